@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <print>
+#include <string_view>
+#include <utility>
+
+namespace bench
+{
+
+// Results are printed as a table for people to read by default
+// With --csv they are printed as name,iterations,ns_per_op,
+// with anything else commented out, so runs can be compared by a script
+enum class OutputFormat
+{
+    Text,
+    Csv,
+};
+
+inline OutputFormat gOutputFormat{OutputFormat::Text};
+
+inline void configure(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string_view{argv[i]} == "--csv")
+        {
+            gOutputFormat = OutputFormat::Csv;
+            std::println("name,iterations,ns_per_op");
+        }
+    }
+}
+
+// Anything printed besides the results themselves
+template <typename... ArgTs>
+void note(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    if (gOutputFormat == OutputFormat::Csv)
+    {
+        std::print("# ");
+    }
+    std::println(format, std::forward<ArgTs>(args)...);
+}
+
+// Stops the compiler from optimising away a result we never otherwise use
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs func iterations times after a short warm up,
+// and prints the average cost of one item, where each call handles itemsPerCall items
+template <typename FuncT>
+double run(std::string_view name, std::size_t iterations, FuncT&& func, std::size_t itemsPerCall = 1)
+{
+    static constexpr std::size_t cWarmupDivisor{10};
+    for (std::size_t i = 0; i < iterations / cWarmupDivisor; i++)
+    {
+        func();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; i++)
+    {
+        func();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double nanosPerItem = std::chrono::duration<double, std::nano>(end - start).count() / (iterations * itemsPerCall);
+    if (gOutputFormat == OutputFormat::Csv)
+    {
+        std::println("{},{},{:.2f}", name, iterations * itemsPerCall, nanosPerItem);
+    }
+    else
+    {
+        std::println("{:<40} {:>10.2f} ns/op", name, nanosPerItem);
+    }
+    return nanosPerItem;
+}
+
+}
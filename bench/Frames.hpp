@@ -0,0 +1,176 @@
+#pragma once
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <IpOptions.hpp>
+#include <Tcp.hpp>
+#include <TcpOptions.hpp>
+#include <Udp.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Well formed frames for the benchmarks and fuzzer to start from
+namespace frames
+{
+
+inline const IpAddress cLocalIp{fromQuartets({10, 3, 3, 3})};
+inline const IpAddress cRemoteIp{fromQuartets({10, 3, 3, 1})};
+inline const MacAddress cLocalMac{fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+inline const MacAddress cRemoteMac{fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0x01})};
+
+inline std::size_t writeEthernet(char* buffer, EtherType etherType)
+{
+    EthernetHeader header{cLocalMac, cRemoteMac, etherType};
+    return toWire(header, buffer);
+}
+
+inline std::size_t writeIp(char* buffer, IPProtocol proto, std::size_t payloadSize)
+{
+    IpV4Header header{};
+    header.mVersionLength.mVersion = 4;
+    header.mVersionLength.mLength = 5;
+    header.mTotalLength = static_cast<std::uint16_t>(sizeof(IpV4Header) + payloadSize);
+    header.mTimeToLive = 64;
+    header.mProto = proto;
+    header.mSourceAddress = cRemoteIp;
+    header.mDestinationAddress = cLocalIp;
+    header.mCheckSum = checksum(header);
+    return toWire(header, buffer);
+}
+
+// Sums an IP header again after its options have been changed
+inline void rewriteIpChecksum(char* ip)
+{
+    auto header = fromWire<IpV4Header>(ip);
+    std::size_t headerLength = header.mVersionLength.mLength * 4;
+    std::memset(ip + offsetof(IpV4Header, mCheckSum), 0, sizeof(header.mCheckSum));
+    std::uint16_t ipChecksum = checksum(0, ip, headerLength);
+    std::memcpy(ip + offsetof(IpV4Header, mCheckSum), &ipChecksum, sizeof(ipChecksum));
+}
+
+// Linux pings with 56 bytes of payload by default
+inline std::vector<char> makeEchoRequest(std::size_t payloadSize = 56)
+{
+    std::size_t icmpSize = sizeof(IcmpV4Header) + sizeof(IcmpV4Echo) + payloadSize;
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(IpV4Header) + icmpSize);
+
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, EtherType::InternetProtocolVersion4);
+    offset += writeIp(frame.data() + offset, IPProtocol::ICMP, icmpSize);
+
+    char* icmp = frame.data() + offset;
+    offset += toWire(IcmpV4Header{IcmpType::EchoRequest, 0, 0}, frame.data() + offset);
+    offset += toWire(IcmpV4Echo{1, 1}, frame.data() + offset);
+    for (std::size_t i = 0; i < payloadSize; i++)
+    {
+        frame[offset + i] = static_cast<char>(i);
+    }
+
+    // Summed in the order it sits in memory, so it is stored the same way
+    std::uint16_t icmpChecksum = checksum(0, icmp, icmpSize);
+    std::memcpy(icmp + offsetof(IcmpV4Header, mCheckSum), &icmpChecksum, sizeof(icmpChecksum));
+    return frame;
+}
+
+// As ping -R sends it, with a Record Route option filling the 40 bytes of IP options
+inline std::vector<char> makeEchoRequestRecordingRoute(std::size_t payloadSize = 56)
+{
+    auto echo = makeEchoRequest(payloadSize);
+    std::array<char, cMaxIpOptionsSize> options{};
+    options[0] = static_cast<char>(IpOptionType::NoOp);
+    options[1] = static_cast<char>(IpOptionType::RecordRoute);
+    options[2] = static_cast<char>(options.size() - 1);
+    options[3] = 4; // Pointing at the first empty slot
+
+    static constexpr auto cIpOffset{sizeof(EthernetHeader)};
+    static constexpr auto cOptionsOffset{cIpOffset + sizeof(IpV4Header)};
+    std::vector<char> frame(echo.begin(), echo.begin() + cOptionsOffset);
+    frame.insert(frame.end(), options.begin(), options.end());
+    frame.insert(frame.end(), echo.begin() + cOptionsOffset, echo.end());
+
+    auto header = fromWire<IpV4Header>(frame.data() + cIpOffset);
+    header.mVersionLength.mLength = static_cast<std::uint8_t>((sizeof(IpV4Header) + options.size()) / 4);
+    header.mTotalLength = static_cast<std::uint16_t>(header.mTotalLength + options.size());
+    toWire(header, frame.data() + cIpOffset);
+    rewriteIpChecksum(frame.data() + cIpOffset);
+    return frame;
+}
+
+// A Syn as Linux sends it, with the usual 20 bytes of options
+inline std::vector<char> makeTcpSyn()
+{
+    std::array<TcpOption, 5> options{
+        TcpOption{TcpOptionType::MaximumSegmentSize, 4, 1460},
+        TcpOption{TcpOptionType::SelectiveAcknowledgementPermitted, 2},
+        TcpOption{TcpOptionType::Timestamps, 10, 12345, 0},
+        TcpOption{TcpOptionType::NoOp},
+        TcpOption{TcpOptionType::WindowScale, 3, 7},
+    };
+    static constexpr std::size_t cOptionsSize{20};
+
+    TcpHeader header{};
+    header.mSourcePort = 40000;
+    header.mDestinationPort = 80;
+    header.mSequenceNumber = 1000;
+    header.setLength((sizeof(TcpHeader) + cOptionsSize) / 4);
+    header.mFlags = TcpFlags{std::to_underlying(TcpFlag::Syn)};
+    header.mWindowSize = 64240;
+
+    std::uint8_t zero{0};
+    TcpPseudoHeader pseudoHeader{cRemoteIp, cLocalIp, zero, IPProtocol::TCP, sizeof(TcpHeader) + cOptionsSize};
+    header.mCheckSum = tcp_checksum({pseudoHeader, header}, options, {});
+
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader) + cOptionsSize);
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, EtherType::InternetProtocolVersion4);
+    offset += writeIp(frame.data() + offset, IPProtocol::TCP, sizeof(TcpHeader) + cOptionsSize);
+    offset += toWire(header, frame.data() + offset);
+    for (const auto& option : options)
+    {
+        offset += toWire(option, frame.data() + offset);
+    }
+    return frame;
+}
+
+// The smallest Ethernet frame holds 18 bytes of UDP payload, and a full size one 1472
+inline std::vector<char> makeUdpDatagram(std::size_t payloadSize = 18, Port port = 9000)
+{
+    std::size_t udpSize = sizeof(UdpHeader) + payloadSize;
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(IpV4Header) + udpSize);
+
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, EtherType::InternetProtocolVersion4);
+    offset += writeIp(frame.data() + offset, IPProtocol::UDP, udpSize);
+
+    char* udp = frame.data() + offset;
+    offset += toWire(UdpHeader{40000, port, static_cast<std::uint16_t>(udpSize), 0}, udp);
+    for (std::size_t i = 0; i < payloadSize; i++)
+    {
+        frame[offset + i] = static_cast<char>(i);
+    }
+
+    std::uint16_t udpSum = udpChecksum(cRemoteIp, cLocalIp, {udp, udpSize});
+    std::memcpy(udp + offsetof(UdpHeader, mCheckSum), &udpSum, sizeof(udpSum));
+    return frame;
+}
+
+inline std::vector<char> makeArpRequest()
+{
+    ArpHeader header{ArpHardwareType::Ethernet, ArpProtoType::InternetProtocolVersion4, sizeof(MacAddress), sizeof(IpAddress), ArpOpCode::Request};
+    ArpIpBody body{cRemoteMac, cRemoteIp, MacAddress{}, cLocalIp};
+
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(ArpHeader) + sizeof(ArpIpBody));
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, EtherType::AddressResolutionProtocol);
+    offset += toWire(header, frame.data() + offset);
+    toWire(body, frame.data() + offset);
+    return frame;
+}
+
+}
@@ -0,0 +1,180 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Async.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <TcpSocket.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <print>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Round trips through an echo server written against the readiness API, and the same server written as coroutines
+// Both stacks run in process, frames passed straight from one to the other as in connect_bench,
+// so most of the cost is the stacks themselves, and the difference between the two is what the coroutines cost.
+namespace
+{
+
+static constexpr std::size_t cConnections{32};
+static constexpr std::size_t cMessageSize{64};
+static constexpr std::size_t cRounds{20000};
+static constexpr Port cEchoPort{7};
+
+void deliver(const FrameBatch& sent, FramePool& pool, Stack& to, FrameBatch& received)
+{
+    received.clear();
+    for (const auto* frame : sent)
+    {
+        if (!frame->mTx.empty())
+        {
+            received.push(&pool.load(received.size(), frame->mTx));
+        }
+    }
+    to.process(received);
+}
+
+// As tilapia's echo does it
+void echoReady(Stack& stack)
+{
+    std::array<Readiness, FrameBatch::cMaxFrames> ready{};
+    std::array<char, 2048> buffer{};
+    while (auto count = stack.readiness(ready))
+    {
+        for (const auto& [key, events] : std::span{ready}.first(count))
+        {
+            if (events.set(SocketEvent::Acceptable))
+            {
+                while (stack.accept(cEchoPort))
+                {
+                }
+                continue;
+            }
+
+            std::size_t received{};
+            do
+            {
+                received = stack.receive(key, std::span{buffer}.first(std::min(buffer.size(), stack.sendSpace(key))));
+                stack.send(key, std::span{buffer}.first(received));
+            } while (received != 0);
+        }
+    }
+}
+
+Task echo(Scheduler& scheduler, ConnectionKey key)
+{
+    std::array<char, 512> buffer{};
+    while (auto received = co_await scheduler.read(key, buffer))
+    {
+        if (co_await scheduler.write(key, std::span{buffer}.first(received)) != received)
+        {
+            break;
+        }
+    }
+    scheduler.close(key);
+}
+
+Task serve(Scheduler& scheduler, Port port)
+{
+    for (;;)
+    {
+        auto key = co_await scheduler.accept(port);
+        echo(scheduler, key);
+    }
+}
+
+class Echoes
+{
+public:
+    Echoes()
+    {
+        mServer.listen(cEchoPort);
+        for (std::size_t i = 0; i < cConnections; i++)
+        {
+            mKeys.push_back(*mClient.open(frames::cLocalIp, cEchoPort));
+        }
+    }
+
+    Stack& server()
+    {
+        return mServer;
+    }
+
+    // A message out on every connection, and whatever has come back read
+    template <typename EchoT>
+    void round(EchoT&& echo)
+    {
+        for (const auto& key : mKeys)
+        {
+            mClient.send(key, mMessage);
+        }
+
+        mRequests.clear();
+        mClient.transmit(*mClientTxPool, mRequests);
+        deliver(mRequests, *mServerRxPool, mServer, mServerAcks);
+        echo();
+
+        mReplies.clear();
+        mServer.transmit(*mServerTxPool, mReplies);
+        deliver(mReplies, *mClientRxPool, mClient, mClientAcks);
+        deliver(mServerAcks, *mClientAckPool, mClient, mIgnored);
+        deliver(mClientAcks, *mServerAckPool, mServer, mIgnored);
+
+        for (const auto& key : mKeys)
+        {
+            while (auto received = mClient.receive(key, mBuffer))
+            {
+                mEchoed += received;
+            }
+        }
+    }
+
+    std::size_t echoed() const
+    {
+        return mEchoed;
+    }
+
+private:
+    Stack mClient{frames::cRemoteIp, frames::cRemoteMac};
+    Stack mServer{frames::cLocalIp, frames::cLocalMac};
+    std::unique_ptr<FramePool> mClientTxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mClientRxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mClientAckPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerTxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerRxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerAckPool{std::make_unique<FramePool>()};
+    FrameBatch mRequests{};
+    FrameBatch mReplies{};
+    FrameBatch mServerAcks{};
+    FrameBatch mClientAcks{};
+    FrameBatch mIgnored{};
+    std::vector<ConnectionKey> mKeys{};
+    std::array<char, cMessageSize> mMessage{};
+    std::array<char, 4096> mBuffer{};
+    std::size_t mEchoed{};
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+
+    {
+        Echoes echoes{};
+        bench::run("echo/readiness", cRounds, [&]() { echoes.round([&]() { echoReady(echoes.server()); }); }, cConnections);
+        bench::note("Echoed {} bytes", echoes.echoed());
+    }
+
+    {
+        Echoes echoes{};
+        Scheduler scheduler{echoes.server()};
+        serve(scheduler, cEchoPort);
+        bench::run("echo/coroutine", cRounds, [&]() { echoes.round([&]() { scheduler.poll(); }); }, cConnections);
+        bench::note("Echoed {} bytes, {} coroutine frames free", echoes.echoed(), scheduler.frames().available());
+    }
+}
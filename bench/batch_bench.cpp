@@ -0,0 +1,43 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+
+#include <cstddef>
+#include <format>
+#include <memory>
+#include <print>
+#include <vector>
+
+// Packets per second through the whole stack against the batch size,
+// for a mix of ICMP, TCP and ARP frames so every handler is in play
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+    static constexpr std::size_t cFramesPerSize{1'000'000};
+
+    Stack stack{frames::cLocalIp, frames::cLocalMac};
+    stack.context().mArpNode.configure(ArpConfig::unlimited());
+    auto framePool = std::make_unique<FramePool>();
+    std::vector<std::vector<char>> mix{frames::makeEchoRequest(), frames::makeTcpSyn(), frames::makeArpRequest()};
+
+    for (std::size_t batchSize = 1; batchSize <= FrameBatch::cMaxFrames; batchSize *= 2)
+    {
+        // Replies are written over the received frames, so each batch is copied in afresh,
+        // much as a read from the device would
+        FrameBatch batch{};
+        auto nanosPerFrame = bench::run(std::format("batch/{}", batchSize), cFramesPerSize / batchSize, [&]() {
+            batch.clear();
+            for (std::size_t i = 0; i < batchSize; i++)
+            {
+                const auto& bytes = mix[i % mix.size()];
+                batch.push(&framePool->load(i, {bytes.data(), bytes.size()}));
+            }
+            stack.process(batch);
+        }, batchSize);
+
+        static constexpr double cNanosPerSecond{1e9};
+        bench::note("{:<40} {:>10.0f} packets/s", std::format("batch/{}", batchSize), cNanosPerSecond / nanosPerFrame);
+    }
+}
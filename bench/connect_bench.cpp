@@ -0,0 +1,73 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Metrics.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <print>
+
+// Connections per second opened by one stack against another in the same process
+// Frames are passed straight from one stack to the other, a batch at a time,
+// so this is the cost of the handshake itself: two Syns, a Syn Ack and an Ack
+namespace
+{
+
+// Hands every frame with something to send to the other stack, which leaves its replies in the pool
+void deliver(const FrameBatch& sent, FramePool& pool, Stack& to, FrameBatch& received)
+{
+    received.clear();
+    for (const auto* frame : sent)
+    {
+        if (!frame->mTx.empty())
+        {
+            received.push(&pool.load(received.size(), frame->mTx));
+        }
+    }
+    to.process(received);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+
+    // Enough rounds for around 100k connections, which the ephemeral ports for four server ports can hold
+    static constexpr std::size_t cRounds{1400};
+    static constexpr std::array<Port, 4> cServerPorts{80, 443, 8080, 8443};
+
+    Stack client{frames::cRemoteIp, frames::cRemoteMac};
+    Stack server{frames::cLocalIp, frames::cLocalMac};
+    auto clientTxPool = std::make_unique<FramePool>();
+    auto clientRxPool = std::make_unique<FramePool>();
+    auto serverRxPool = std::make_unique<FramePool>();
+    FrameBatch syns{};
+    FrameBatch synAcks{};
+    FrameBatch acks{};
+    std::size_t opened{0};
+
+    // Each round opens a batch of connections, and sees their handshakes through
+    auto nanosPerConnection = bench::run("connect/handshake", cRounds, [&]() {
+        for (std::size_t i = 0; i < FrameBatch::cMaxFrames; i++)
+        {
+            client.connect(frames::cLocalIp, cServerPorts[opened++ % cServerPorts.size()]);
+        }
+
+        syns.clear();
+        client.transmit(*clientTxPool, syns);
+        deliver(syns, *serverRxPool, server, synAcks);
+        deliver(synAcks, *clientRxPool, client, acks);
+        deliver(acks, *serverRxPool, server, syns);
+    }, FrameBatch::cMaxFrames);
+
+    static constexpr double cNanosPerSecond{1e9};
+    bench::note("{:<40} {:>10.0f} connections/s", "connect/handshake", cNanosPerSecond / nanosPerConnection);
+
+    const auto& metrics = client.context().metrics();
+    bench::note("Opened {}, established {}, waiting to send {}", metrics.count(Counter::ActiveOpens),
+        metrics.count(Counter::ConnectionsEstablished), client.context().mPendingOpens.size());
+}
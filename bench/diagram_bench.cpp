@@ -0,0 +1,84 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Diagram.hpp>
+#include <Log.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The cost of drawing frames, both to the packet thread and to the logging thread,
+// and what leaving diagrams on costs the packet loop against leaving them off
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+    static constexpr std::size_t cIterations{20'000};
+
+    std::vector<std::vector<char>> mix{frames::makeEchoRequest(), frames::makeTcpSyn(), frames::makeArpRequest()};
+
+    // What the logging thread does for each frame it draws
+    std::string output{};
+    for (const auto& bytes : mix)
+    {
+        ParsedFrame parsed{};
+        bench::run(std::format("render/{}", bytes.size()), cIterations * 10, [&]() {
+            output.clear();
+            parseFrame({bytes.data(), bytes.size()}, parsed);
+            render(describe(parsed, bytes.size()), std::back_inserter(output));
+            bench::doNotOptimize(output.data());
+        });
+    }
+
+    // Stands in for the LogDrainer, without writing anything out
+    std::jthread drainer{[](std::stop_token stopToken) {
+        std::string drained{};
+        while (!stopToken.stop_requested())
+        {
+            drained.clear();
+            logging::gRing.drain(drained);
+        }
+    }};
+
+    Stack stack{frames::cLocalIp, frames::cLocalMac};
+    auto framePool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+
+    // The receive half of the packet loop, as in tilapia.cpp
+    auto runLoop = [&](std::string_view name, std::optional<FrameSampler> sampler) {
+        bench::run(name, cIterations, [&]() {
+            batch.clear();
+            while (!batch.full())
+            {
+                const auto& bytes = mix[batch.size() % mix.size()];
+                auto& frame = framePool->load(batch.size(), {bytes.data(), bytes.size()});
+                if (sampler.has_value() && sampler->sample(frame.mBytes))
+                {
+                    logInfo("{}", FrameDiagram{{frame.mBytes.data(), frame.mBytes.size()}});
+                }
+                batch.push(&frame);
+            }
+            stack.process(batch);
+        }, FrameBatch::cMaxFrames);
+    };
+
+    runLoop("loop/printing_off", std::nullopt);
+    runLoop("loop/every_frame", FrameSampler{});
+
+    FrameSampler oneIn64{};
+    oneIn64.setRate(64);
+    runLoop("loop/one_in_64", oneIn64);
+
+    FrameSampler flow{};
+    flow.setFilter(*FrameFilter::parse("tcp port 80"));
+    runLoop("loop/port_80_flow", flow);
+
+    bench::note("Log records dropped while the ring was full: {}", logging::gRing.dropped());
+}
@@ -0,0 +1,147 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Pipeline.hpp>
+#include <RxArena.hpp>
+#include <Stack.hpp>
+#include <TcpSocket.hpp>
+
+#include <array>
+#include <cstddef>
+#include <format>
+#include <memory>
+#include <optional>
+#include <print>
+#include <span>
+#include <vector>
+
+// Bulk data from one stack to another, read by copying it out of the stream, and by borrowing the frames it arrived in
+// Both stacks run in process, as in async_bench, and the application does nothing with what it reads,
+// so the difference between the two is the copy into the receive buffer and the copy out again.
+namespace
+{
+
+static constexpr std::size_t cSegmentSize{1460};
+static constexpr std::size_t cRoundBytes{32 * cSegmentSize};
+static constexpr std::size_t cRounds{20000};
+static constexpr std::size_t cArenaBuffers{512};
+static constexpr Port cPort{5001};
+
+void deliver(const FrameBatch& sent, FramePool& pool, Stack& to, FrameBatch& received)
+{
+    received.clear();
+    for (const auto* frame : sent)
+    {
+        if (!frame->mTx.empty())
+        {
+            received.push(&pool.load(received.size(), frame->mTx));
+        }
+    }
+    to.process(received);
+}
+
+class Transfer
+{
+public:
+    explicit Transfer(ReceiveMode mode) : mMode{mode}
+    {
+        mServer.context().mTcpSockets.attachArena(mArena);
+        mServer.listen(cPort, {}, mode);
+        mKey = *mClient.open(frames::cLocalIp, cPort, {64 * 1024, 1024 * 1024});
+        for (int i = 0; i < 4 && !mAccepted; i++)
+        {
+            round();
+        }
+    }
+
+    void round()
+    {
+        mClient.send(mKey, mPayload);
+
+        mSegments.clear();
+        mClient.transmit(*mClientTxPool, mSegments);
+        deliver(mSegments, *mServerRxPool, mServer, mAcks);
+        read();
+
+        mUpdates.clear();
+        mServer.transmit(*mServerTxPool, mUpdates);
+        deliver(mAcks, *mClientRxPool, mClient, mIgnored);
+        deliver(mUpdates, *mClientRxPool, mClient, mIgnored);
+    }
+
+    std::size_t received() const
+    {
+        return mReceived;
+    }
+
+    std::size_t arenaAvailable() const
+    {
+        return mArena.available();
+    }
+
+private:
+    void read()
+    {
+        if (!mAccepted)
+        {
+            mAccepted = mServer.accept(cPort);
+            return;
+        }
+
+        if (mMode == ReceiveMode::Copy)
+        {
+            while (auto count = mServer.receive(*mAccepted, mBuffer))
+            {
+                bench::doNotOptimize(mBuffer[0]);
+                mReceived += count;
+            }
+            return;
+        }
+
+        while (auto count = mServer.lend(*mAccepted, mLoans))
+        {
+            auto loans = std::span{mLoans}.first(count);
+            for (const auto& loan : loans)
+            {
+                bench::doNotOptimize(loan.mBytes.data());
+                mReceived += loan.mBytes.size();
+            }
+            mServer.giveBack(*mAccepted, loans);
+        }
+    }
+
+    ReceiveMode mMode;
+    RxBufferArena mArena{cArenaBuffers};
+    Stack mClient{frames::cRemoteIp, frames::cRemoteMac};
+    Stack mServer{frames::cLocalIp, frames::cLocalMac};
+    std::unique_ptr<FramePool> mClientTxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mClientRxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerTxPool{std::make_unique<FramePool>()};
+    // Built on the arena either way, so only what the stream does differs
+    std::unique_ptr<FramePool> mServerRxPool{std::make_unique<FramePool>(mArena)};
+    FrameBatch mSegments{};
+    FrameBatch mAcks{};
+    FrameBatch mUpdates{};
+    FrameBatch mIgnored{};
+    ConnectionKey mKey{};
+    std::optional<ConnectionKey> mAccepted{};
+    std::vector<char> mPayload = std::vector<char>(cRoundBytes);
+    std::array<char, 64 * 1024> mBuffer{};
+    std::array<RxLoan, FrameBatch::cMaxFrames> mLoans{};
+    std::size_t mReceived{};
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+
+    for (auto mode : {ReceiveMode::Copy, ReceiveMode::Lend})
+    {
+        auto transfer = std::make_unique<Transfer>(mode);
+        auto name = std::format("receive/{}", mode);
+        bench::run(name, cRounds, [&]() { transfer->round(); }, cRoundBytes / cSegmentSize);
+        bench::note("Received {} bytes, {} arena buffers free", transfer->received(), transfer->arenaAvailable());
+    }
+}
@@ -0,0 +1,86 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Frame.hpp>
+#include <Parse.hpp>
+
+#include <cstddef>
+#include <print>
+#include <string_view>
+#include <vector>
+
+// Compares the cost of parsing well formed frames against malformed ones
+// Rejecting a bad frame should never cost more than accepting a good one
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+    static constexpr std::size_t cIterations{1'000'000};
+    static constexpr std::size_t cEthernetSize{sizeof(EthernetHeader)};
+    static constexpr std::size_t cIpOffset{sizeof(EthernetHeader)};
+    static constexpr std::size_t cTcpOffset{sizeof(EthernetHeader) + sizeof(IpV4Header)};
+
+    auto echo = frames::makeEchoRequest();
+    auto echoWithOptions = frames::makeEchoRequestRecordingRoute();
+    auto syn = frames::makeTcpSyn();
+    auto arp = frames::makeArpRequest();
+
+    auto unknownEtherType{echo};
+    unknownEtherType[12] = 0x12;
+
+    auto badIpChecksum{echo};
+    badIpChecksum[cIpOffset + 10] ^= 0x1;
+
+    auto badIpLength{echo};
+    badIpLength[cIpOffset + 2] = 0x7f;
+
+    static constexpr std::size_t cIpOptionsOffset{cIpOffset + sizeof(IpV4Header)};
+    auto badIpOption{echoWithOptions};
+    badIpOption[cIpOptionsOffset + 2] = 60; // Record Route claiming to run off the end of the header
+    frames::rewriteIpChecksum(badIpOption.data() + cIpOffset);
+
+    auto badTcpOption{syn};
+    badTcpOption[cTcpOffset + sizeof(TcpHeader) + 1] = 40; // MSS claiming to run off the end of the header
+
+    auto badTcpChecksum{syn};
+    badTcpChecksum[cTcpOffset + 4] ^= 0x1;
+
+    struct Case
+    {
+        std::string_view mName;
+        std::vector<char> mFrame;
+    };
+
+    std::vector<Case> cases{
+        {"good/icmp_echo", echo},
+        {"good/icmp_echo_ip_options", echoWithOptions},
+        {"good/tcp_syn", syn},
+        {"good/arp_request", arp},
+        {"bad/truncated_ethernet", std::vector<char>(echo.begin(), echo.begin() + cEthernetSize - 1)},
+        {"bad/unknown_ethertype", unknownEtherType},
+        {"bad/truncated_ip", std::vector<char>(echo.begin(), echo.begin() + cIpOffset + 10)},
+        {"bad/ip_checksum", badIpChecksum},
+        {"bad/ip_total_length", badIpLength},
+        {"bad/ip_option", badIpOption},
+        {"bad/truncated_tcp", std::vector<char>(syn.begin(), syn.begin() + cTcpOffset + 10)},
+        {"bad/tcp_option", badTcpOption},
+        {"bad/tcp_checksum", badTcpChecksum},
+        {"bad/truncated_arp", std::vector<char>(arp.begin(), arp.end() - 1)},
+    };
+
+    ParsedFrame parsedFrame{};
+    DropCounters dropCounters{};
+    for (const auto& testCase : cases)
+    {
+        LayerBytes frame{testCase.mFrame.data(), testCase.mFrame.size()};
+        bench::run(testCase.mName, cIterations, [&]() {
+            auto result = parseFrame(frame, parsedFrame);
+            if (!result)
+            {
+                dropCounters.record(result.error());
+            }
+            bench::doNotOptimize(result);
+        });
+    }
+
+    bench::note("{}", dropCounters);
+}
@@ -0,0 +1,80 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <print>
+#include <string>
+#include <vector>
+
+// Measures full batches through the pipeline, and then each protocol handler on its own
+// Every figure is the cost of one frame
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+    static constexpr std::size_t cIterations{20'000};
+
+    Stack stack{frames::cLocalIp, frames::cLocalMac};
+    stack.context().mArpNode.configure(ArpConfig::unlimited());
+    auto framePool = std::make_unique<FramePool>();
+
+    auto fillBatch = [&](const std::vector<char>& bytes, FrameBatch& batch) {
+        batch.clear();
+        while (!batch.full())
+        {
+            batch.push(&framePool->load(batch.size(), {bytes.data(), bytes.size()}));
+        }
+    };
+
+    // Replies are written over the received frame, so every run starts by copying it back in,
+    // much as a read from the device would
+    auto restore = [](const std::vector<char>& bytes, const FrameBatch& batch) {
+        for (auto* frame : batch)
+        {
+            std::memcpy(frame->mRxBytes.data(), bytes.data(), bytes.size());
+        }
+    };
+
+    auto& etherTypeDemux = stack.pipeline().next();
+    auto& ipStage = etherTypeDemux.handler<Ipv4Stage<IpDemux>>();
+
+    auto echo = frames::makeEchoRequest();
+    auto syn = frames::makeTcpSyn();
+    auto arp = frames::makeArpRequest();
+    FrameBatch batch{};
+
+    auto runStages = [&](std::string name, const std::vector<char>& bytes, auto& handler) {
+        fillBatch(bytes, batch);
+        bench::run(name + "/pipeline", cIterations, [&]() {
+            restore(bytes, batch);
+            for (auto* frame : batch)
+            {
+                frame->reset(frame->mRxBytes);
+            }
+            stack.process(batch);
+        }, batch.size());
+
+        // The full run above left every frame parsed up to this handler's layer
+        bench::run(name + "/handler", cIterations, [&]() {
+            restore(bytes, batch);
+            handler.process(batch);
+        }, batch.size());
+    };
+
+    runStages("icmp_echo", echo, ipStage.next().handler<IcmpHandler>());
+    runStages("tcp_syn", syn, ipStage.next().handler<TcpHandler>());
+    runStages("arp_request", arp, etherTypeDemux.handler<ArpHandler>());
+
+    fillBatch(echo, batch);
+    stack.process(batch);
+    bench::run("ipv4/stage", cIterations, [&]() {
+        restore(echo, batch);
+        ipStage.process(batch);
+    }, batch.size());
+
+    bench::note("{}", stack.context().mDropCounters);
+}
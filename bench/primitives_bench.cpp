@@ -0,0 +1,184 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Frame.hpp>
+#include <Headers.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <Tcp.hpp>
+#include <TcpOptions.hpp>
+#include <Vnet.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// The building blocks every frame goes through, each timed on its own
+// Run with --csv to compare one build against another
+namespace
+{
+
+constexpr std::size_t cIterations{1'000'000};
+
+// Any bytes will do, as long as they are not all the same
+std::array<char, 64> patternedBytes()
+{
+    std::array<char, 64> bytes{};
+    for (std::size_t i = 0; i < bytes.size(); i++)
+    {
+        bytes[i] = static_cast<char>(i * 37 + 11);
+    }
+    return bytes;
+}
+
+template <typename HeaderT>
+void benchWire(std::string_view name)
+{
+    static_assert(sizeof(HeaderT) <= 64);
+    auto input = patternedBytes();
+    std::array<char, 64> output{};
+
+    HeaderT header{};
+    bench::run(std::format("fromWire/{}", name), cIterations, [&]() {
+        bench::doNotOptimize(input);
+        header = fromWire<HeaderT>(input.data());
+        bench::doNotOptimize(header);
+    });
+
+    bench::run(std::format("toWire/{}", name), cIterations, [&]() {
+        bench::doNotOptimize(header);
+        toWire(header, output.data());
+        bench::doNotOptimize(output);
+    });
+}
+
+void benchChecksums()
+{
+    auto syn = frames::makeTcpSyn();
+    ParsedFrame parsed{};
+    parseFrame({syn.data(), syn.size()}, parsed);
+    auto ipHeader = parsed.mIpHeader;
+
+    bench::run("checksum/IpV4Header", cIterations, [&]() {
+        bench::doNotOptimize(ipHeader);
+        bench::doNotOptimize(checksum(ipHeader));
+    });
+
+    std::uint8_t zero{0};
+    TcpPseudoHeader pseudoHeader{ipHeader.mSourceAddress, ipHeader.mDestinationAddress, zero, IPProtocol::TCP, sizeof(TcpHeader)};
+    TcpPseudoPacket pseudoPacket{pseudoHeader, parsed.mTcpHeader};
+    bench::run("checksum/TcpPseudoPacket", cIterations, [&]() {
+        bench::doNotOptimize(pseudoPacket);
+        bench::doNotOptimize(checksum(pseudoPacket));
+    });
+
+    for (std::size_t size : {20, 64, 576, 1460})
+    {
+        std::vector<char> buffer(size, '\x5a');
+        bench::run(std::format("checksum/buffer/{}", size), cIterations, [&]() {
+            bench::doNotOptimize(buffer.data());
+            bench::doNotOptimize(checksum(0, buffer.data(), buffer.size()));
+        });
+    }
+
+    auto options = frames::makeTcpSyn();
+    std::string_view optionBytes{options.data() + sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader), 20};
+    for (std::size_t payloadSize : {0, 1460})
+    {
+        std::vector<char> payload(payloadSize, '\x5a');
+        bench::run(std::format("tcp_checksum/options/{}", payloadSize), cIterations, [&]() {
+            bench::doNotOptimize(pseudoPacket);
+            bench::doNotOptimize(tcp_checksum(pseudoPacket, optionBytes, {payload.data(), payload.size()}));
+        });
+    }
+
+    auto optionList = parsed.mTcpOptions;
+    bench::run("tcp_checksum/option_list/0", cIterations, [&]() {
+        bench::doNotOptimize(pseudoPacket);
+        bench::doNotOptimize(tcp_checksum(pseudoPacket, optionList.view(), {}));
+    });
+}
+
+void benchTcpOptions()
+{
+    auto syn = frames::makeTcpSyn();
+    std::span<const char> optionBytes{syn.data() + sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader), 20};
+
+    bench::run("parseTcpOption/MaximumSegmentSize", cIterations, [&]() {
+        bench::doNotOptimize(optionBytes);
+        bench::doNotOptimize(parseTcpOption(optionBytes));
+    });
+
+    TcpOptionList options{};
+    bench::run("parseTcpOptions/syn", cIterations, [&]() {
+        bench::doNotOptimize(optionBytes);
+        bench::doNotOptimize(parseTcpOptions(optionBytes, options));
+    });
+
+    std::array<char, 16> output{};
+    TcpOption timestamps{TcpOptionType::Timestamps, 10, 12345, 678};
+    bench::run("toWire/TcpOption/Timestamps", cIterations, [&]() {
+        bench::doNotOptimize(timestamps);
+        toWire(timestamps, output.data());
+        bench::doNotOptimize(output);
+    });
+}
+
+void benchNodes()
+{
+    auto arp = frames::makeArpRequest();
+    ParsedFrame arpFrame{};
+    parseFrame({arp.data(), arp.size()}, arpFrame);
+    ArpNode arpNode{frames::cLocalIp, frames::cLocalMac};
+    arpNode.configure(ArpConfig::unlimited());
+    bench::run("ArpNode::onMessage/request", cIterations, [&]() {
+        bench::doNotOptimize(arpFrame.mArpMessage);
+        bench::doNotOptimize(arpNode.onMessage(arpFrame.mArpMessage, 0));
+    });
+
+    auto syn = frames::makeTcpSyn();
+    ParsedFrame synFrame{};
+    parseFrame({syn.data(), syn.size()}, synFrame);
+    TcpNode tcpNode{synFrame.mTcpHeader.mDestinationPort, synFrame.mTcpHeader.mSourcePort, 8000};
+    bench::run("TcpNode::onMessage/syn", cIterations, [&]() {
+        bench::doNotOptimize(synFrame.mTcpHeader);
+        bench::doNotOptimize(tcpNode.onMessage(synFrame.mTcpHeader, 0));
+    });
+
+    // A stream of data segments, each following on from the last
+    auto segment = synFrame.mTcpHeader;
+    segment.mFlags = TcpFlags{std::to_underlying(TcpFlag::Ack)};
+    static constexpr std::size_t cSegmentSize{1460};
+    bench::run("TcpNode::onMessage/data", cIterations, [&]() {
+        segment.mSequenceNumber += cSegmentSize;
+        bench::doNotOptimize(tcpNode.onMessage(segment, cSegmentSize));
+    });
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+
+    benchWire<EthernetHeader>("EthernetHeader");
+    benchWire<IpV4Header>("IpV4Header");
+    benchWire<IcmpV4Header>("IcmpV4Header");
+    benchWire<IcmpV4Echo>("IcmpV4Echo");
+    benchWire<TcpHeader>("TcpHeader");
+    benchWire<TcpPseudoHeader>("TcpPseudoHeader");
+    benchWire<TcpPseudoPacket>("TcpPseudoPacket");
+    benchWire<ArpHeader>("ArpHeader");
+    benchWire<ArpIpBody>("ArpIpBody");
+    benchWire<VnetHeader>("VnetHeader");
+
+    benchChecksums();
+    benchTcpOptions();
+    benchNodes();
+}
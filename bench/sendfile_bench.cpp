@@ -0,0 +1,136 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <TcpSocket.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <print>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Bulk data from one stack to another, sent by copying it into the stream, and straight from a region of memory
+// as a mapped file would be, each round topping up what is queued and sending what the peer has room for.
+// Both stacks run in process, as in async_bench, so the difference is the copy into the send buffer,
+// and the checksum being summed as the payload is copied into the frame either way.
+namespace
+{
+
+static constexpr std::size_t cSegmentSize{1460};
+static constexpr std::size_t cRegionSize{1024 * 1024};
+static constexpr std::size_t cRounds{20000};
+static constexpr Port cPort{80};
+
+void deliver(const FrameBatch& sent, FramePool& pool, Stack& to, FrameBatch& received)
+{
+    received.clear();
+    for (const auto* frame : sent)
+    {
+        if (!frame->mTx.empty())
+        {
+            received.push(&pool.load(received.size(), frame->mTx));
+        }
+    }
+    to.process(received);
+}
+
+class Transfer
+{
+public:
+    explicit Transfer(bool fromRegion) : mFromRegion{fromRegion}
+    {
+        mServer.listen(cPort);
+        mKey = *mClient.open(frames::cLocalIp, cPort);
+        for (int i = 0; i < 4 && !mAccepted; i++)
+        {
+            round();
+        }
+    }
+
+    void round()
+    {
+        queue();
+
+        mSegments.clear();
+        mServer.transmit(*mServerTxPool, mSegments);
+        deliver(mSegments, *mClientRxPool, mClient, mAcks);
+        while (auto count = mClient.receive(mKey, mBuffer))
+        {
+            mReceived += count;
+        }
+
+        mUpdates.clear();
+        mClient.transmit(*mClientTxPool, mUpdates);
+        deliver(mAcks, *mServerRxPool, mServer, mIgnored);
+        // Only while connecting does anything come back, the Syn Ack, which the client must acknowledge in turn
+        deliver(mUpdates, *mServerRxPool, mServer, mReplies);
+        deliver(mReplies, *mClientRxPool, mClient, mAcks);
+        deliver(mAcks, *mServerRxPool, mServer, mIgnored);
+    }
+
+    std::size_t received() const
+    {
+        return mReceived;
+    }
+
+private:
+    void queue()
+    {
+        if (!mAccepted)
+        {
+            mAccepted = mServer.accept(cPort);
+            return;
+        }
+
+        if (!mFromRegion)
+        {
+            mServer.send(*mAccepted, mRegion);
+            return;
+        }
+
+        // Another copy of the region whenever the last is nearly all acknowledged, so there is always plenty to send
+        if (mServer.unacknowledged(*mAccepted) < cRegionSize / 2)
+        {
+            mServer.sendRegion(*mAccepted, mRegion);
+        }
+    }
+
+    bool mFromRegion;
+    Stack mClient{frames::cRemoteIp, frames::cRemoteMac};
+    Stack mServer{frames::cLocalIp, frames::cLocalMac};
+    std::unique_ptr<FramePool> mClientTxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mClientRxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerTxPool{std::make_unique<FramePool>()};
+    std::unique_ptr<FramePool> mServerRxPool{std::make_unique<FramePool>()};
+    FrameBatch mSegments{};
+    FrameBatch mAcks{};
+    FrameBatch mUpdates{};
+    FrameBatch mReplies{};
+    FrameBatch mIgnored{};
+    ConnectionKey mKey{};
+    std::optional<ConnectionKey> mAccepted{};
+    std::vector<char> mRegion = std::vector<char>(cRegionSize);
+    std::array<char, 64 * 1024> mBuffer{};
+    std::size_t mReceived{};
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+
+    for (bool fromRegion : {false, true})
+    {
+        auto transfer = std::make_unique<Transfer>(fromRegion);
+        std::string_view name = fromRegion ? "transmit/region" : "transmit/copy";
+        // The peer's window lets through about 45 full segments a round
+        bench::run(name, cRounds, [&]() { transfer->round(); }, 0xffff / cSegmentSize);
+        bench::note("Received {} bytes", transfer->received());
+    }
+}
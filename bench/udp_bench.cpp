@@ -0,0 +1,85 @@
+#include <Bench.hpp>
+#include <Frames.hpp>
+
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <Udp.hpp>
+
+#include <array>
+#include <cstddef>
+#include <format>
+#include <memory>
+#include <print>
+#include <vector>
+
+// Datagrams per second received and sent a whole batch at a time,
+// for the smallest datagrams and those which just fill an Ethernet frame
+// Sending is timed both copying each payload in, and with payloads built where they are sent from.
+int main(int argc, char** argv)
+{
+    bench::configure(argc, argv);
+    static constexpr std::size_t cDatagrams{2'000'000};
+    static constexpr std::size_t cBatches{cDatagrams / FrameBatch::cMaxFrames};
+    static constexpr Port cPort{9000};
+    static constexpr std::array<std::size_t, 2> cPayloadSizes{18, 1472};
+    static constexpr double cNanosPerSecond{1e9};
+
+    Stack stack{frames::cLocalIp, frames::cLocalMac};
+    stack.context().mArpNode.configure(ArpConfig::unlimited());
+    stack.bindUdp(cPort);
+    auto framePool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+
+    // So datagrams to the peer go straight out rather than waiting on ARP
+    auto arp = frames::makeArpRequest();
+    batch.push(&framePool->load(0, {arp.data(), arp.size()}));
+    stack.process(batch);
+
+    std::array<UdpDatagram, FrameBatch::cMaxFrames> datagrams{};
+    for (auto payloadSize : cPayloadSizes)
+    {
+        auto bytes = frames::makeUdpDatagram(payloadSize, cPort);
+        auto name = std::format("udp/receive/{}", payloadSize);
+        std::size_t received{0};
+        auto nanos = bench::run(name, cBatches, [&]() {
+            batch.clear();
+            for (std::size_t i = 0; i < FrameBatch::cMaxFrames; i++)
+            {
+                batch.push(&framePool->load(i, {bytes.data(), bytes.size()}));
+            }
+            stack.process(batch);
+            received += stack.receiveUdp(cPort, datagrams);
+        }, FrameBatch::cMaxFrames);
+        bench::doNotOptimize(received);
+        bench::note("{:<40} {:>10.0f} datagrams/s", name, cNanosPerSecond / nanos);
+    }
+
+    auto txPool = std::make_unique<FramePool>();
+    std::vector<char> payload(cPayloadSizes.back());
+    for (auto payloadSize : cPayloadSizes)
+    {
+        for (auto& datagram : datagrams)
+        {
+            datagram = UdpDatagram{frames::cRemoteIp, 40000, {payload.data(), payloadSize}};
+        }
+
+        auto name = std::format("udp/send/{}", payloadSize);
+        auto nanos = bench::run(name, cBatches, [&]() {
+            batch.clear();
+            stack.sendUdp(*txPool, batch, cPort, datagrams);
+        }, FrameBatch::cMaxFrames);
+        bench::note("{:<40} {:>10.0f} datagrams/s", name, cNanosPerSecond / nanos);
+
+        name = std::format("udp/send_in_place/{}", payloadSize);
+        nanos = bench::run(name, cBatches, [&]() {
+            batch.clear();
+            // Whatever the application wrote there last time stands in for a payload it built in place
+            for (std::size_t i = 0; i < datagrams.size(); i++)
+            {
+                datagrams[i].mPayload = stack.udpPayloadBuffer(*txPool, batch, i).first(payloadSize);
+            }
+            stack.sendUdp(*txPool, batch, cPort, datagrams);
+        }, FrameBatch::cMaxFrames);
+        bench::note("{:<40} {:>10.0f} datagrams/s", name, cNanosPerSecond / nanos);
+    }
+}
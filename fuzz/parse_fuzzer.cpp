@@ -0,0 +1,34 @@
+#include <Frame.hpp>
+#include <Parse.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// libFuzzer entry point: every input must either be handled or be dropped with a reason,
+// without throwing or reading outside the buffer.
+// Run with ASan so an out of bounds read is reported as a crash.
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    static ParsedFrame parsedFrame{};
+    static DropCounters dropCounters{};
+
+    LayerBytes bytes{reinterpret_cast<const char*>(data), size};
+    auto result = parseFrame(bytes, parsedFrame);
+    if (!result)
+    {
+        dropCounters.record(result.error());
+    }
+
+    // Then through the whole stack, so the handlers see the same input
+    // Replies are written over the received frame, so it is copied somewhere we can write to
+    static Stack stack{fromQuartets({10, 3, 3, 3}), fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+    static auto framePool = std::make_unique<FramePool>();
+
+    FrameBatch batch{};
+    batch.push(&framePool->load(0, bytes));
+    stack.process(batch);
+    return 0;
+}
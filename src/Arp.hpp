@@ -1,11 +1,15 @@
 #pragma once
 
 #include <Headers.hpp>
+#include <Neighbour.hpp>
+#include <Parse.hpp>
+#include <RateLimit.hpp>
 #include <Types.hpp>
 
 #include <cstddef>
 #include <cstdint>
-#include <unordered_map>
+#include <expected>
+#include <optional>
 
 using ArpProtoType = EtherType; // These are a subset apparently
 static inline constexpr MacAddress ArpBroadcastAddress{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
@@ -26,7 +30,7 @@ template <> struct std::formatter<ArpHardwareType> : SimpleFormatter
         case ArpHardwareType::Ethernet:
             return std::format_to(ctx.out(), "Ethernet");
         default:
-            throw std::runtime_error{std::format("Unexpected ARP Hardware Type: {}", std::to_underlying(hardwareType))};
+            return std::format_to(ctx.out(), "Unknown ARP Hardware Type {}", std::to_underlying(hardwareType));
         }
     }
 };
@@ -50,7 +54,7 @@ template <> struct std::formatter<ArpOpCode> : SimpleFormatter
         case ArpOpCode::Reply:
             return std::format_to(ctx.out(), "Reply");
         default:
-            throw std::runtime_error{std::format("Unexpected ARP OpCode: {}", std::to_underlying(opCode))};
+            return std::format_to(ctx.out(), "Unknown ARP OpCode {}", std::to_underlying(opCode));
         }
     }
 };
@@ -111,56 +115,22 @@ struct ArpMessage
     ArpIpBody mBody;
 };
 
-using ArpKey = std::pair<ArpProtoType, IpAddress>;
-
-namespace detail
-{
-
-inline void hash_combine(std::size_t&)
-{
-}
-
-template <typename T, typename... Rest> inline void hash_combine(std::size_t& seed, const T& v, Rest... rest)
+struct ArpConfig
 {
-    std::hash<T> hasher;
-    seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    hash_combine(seed, rest...);
-}
-} // namespace detail
+    // Messages from any one sender MAC address, beyond which we neither learn from nor answer them
+    std::optional<RateLimit> mPerSourceLimit{RateLimit{100, 200}};
+    // Believe only replies to requests we sent, so nobody can tell us where to send frames unasked
+    bool mLearnOnlyFromReplies{false};
 
-template <typename... Rest> inline std::size_t hash_combine(Rest... rest)
-{
-    std::size_t hash{0};
-    detail::hash_combine(hash, rest...);
-    return hash;
-}
-
-namespace std
-{
-template <> struct hash<ArpProtoType>
-{
-    size_t operator()(const ArpProtoType& value) const
+    // For benchmarks and load tests, which send far more from one sender than any real neighbour would
+    static ArpConfig unlimited()
     {
-        return std::hash<std::uint8_t>{}(std::to_underlying(value));
+        ArpConfig config{};
+        config.mPerSourceLimit = std::nullopt;
+        return config;
     }
 };
 
-template <> struct hash<IpAddress>
-{
-    size_t operator()(const IpAddress& value) const
-    {
-        return std::hash<std::uint32_t>{}(std::bit_cast<std::uint32_t>(value));
-    }
-};
-
-template <> struct hash<ArpKey>
-{
-    size_t operator()(const ArpKey& arpKey) const
-    {
-        return hash_combine(arpKey.first, arpKey.second);
-    }
-};
-}
 // ARP allows us to translate from a protocol specific address like IP
 // to an actual hardware MAC address
 // We will only implement IP
@@ -173,12 +143,43 @@ class ArpNode
 public:
     ArpNode(IpAddress ip, MacAddress mac) : mIp{ip}, mMac{mac} { }
 
-    std::optional<ArpMessage> onMessage(const ArpMessage& message)
+    void configure(const ArpConfig& config)
+    {
+        mConfig = config;
+    }
+
+    // The reply to send, if any, or why the message should be dropped
+    std::expected<std::optional<ArpMessage>, DropReason> onMessage(const ArpMessage& message, std::uint64_t nowNanos)
+    {
+        return onMessage(message, nowNanos, message.mBody.mDestinationIp == mIp);
+    }
+
+    // For when we answer for more addresses than our own, forUs says whether the message asks after one of them
+    std::expected<std::optional<ArpMessage>, DropReason> onMessage(const ArpMessage& message, std::uint64_t nowNanos, bool forUs)
     {
-        auto key = ArpKey{message.mHeader.mProtocolType, message.mBody.mSourceIp};
-        mTranslationTable[key] = message.mBody.mSourceMacAddress;
+        const auto& sender = message.mBody.mSourceMacAddress;
+        if (mConfig.mPerSourceLimit && !mLimiter.allow(*mConfig.mPerSourceLimit, &sender, sizeof(sender), NeighbourCache::millis(nowNanos)))
+        {
+            return std::unexpected{DropReason::ArpRateLimited};
+        }
 
-        if (message.mBody.mDestinationIp != mIp || message.mHeader.mOpCode != ArpOpCode::Request)
+        // As RFC 826 has it, we only learn a new neighbour when it is talking to us,
+        // though anyone we already know may tell us their address has changed
+        bool replyToUs = forUs && message.mHeader.mOpCode == ArpOpCode::Reply;
+        if (!mConfig.mLearnOnlyFromReplies)
+        {
+            mNeighbours.update(message.mBody.mSourceIp, sender, replyToUs, forUs, nowNanos);
+        }
+        else if (message.mHeader.mOpCode == ArpOpCode::Reply)
+        {
+            if (!replyToUs || !mNeighbours.awaiting(message.mBody.mSourceIp))
+            {
+                return std::unexpected{DropReason::UnsolicitedArpReply};
+            }
+            mNeighbours.update(message.mBody.mSourceIp, sender, true, false, nowNanos);
+        }
+
+        if (!forUs || message.mHeader.mOpCode != ArpOpCode::Request)
         {
             return std::nullopt;
         }
@@ -191,15 +192,31 @@ public:
         return result;
     }
 
+    // A request asking who has the given address
+    ArpMessage request(IpAddress target) const
+    {
+        ArpHeader header{ArpHardwareType::Ethernet, ArpProtoType::InternetProtocolVersion4, sizeof(MacAddress), sizeof(IpAddress), ArpOpCode::Request};
+        return {header, ArpIpBody{mMac, mIp, MacAddress{}, target}};
+    }
+
+    NeighbourCache& neighbours()
+    {
+        return mNeighbours;
+    }
+
     IpAddress address() const
     {
         return mIp;
     }
 
 private:
+    static constexpr std::size_t cLimiterBuckets{4096};
+
     IpAddress mIp{};
     MacAddress mMac{};
-    std::unordered_map<ArpKey, MacAddress> mTranslationTable{};
+    ArpConfig mConfig{};
+    NeighbourCache mNeighbours{};
+    SourceRateLimiter<cLimiterBuckets> mLimiter{};
 };
 
 
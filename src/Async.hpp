@@ -0,0 +1,459 @@
+#pragma once
+
+#include <Metrics.hpp>
+#include <Stack.hpp>
+#include <Tcp.hpp>
+#include <TcpSocket.hpp>
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Fixed size slots for coroutine frames, allocated once, so starting a coroutine never touches the heap
+// Each slot starts with a pointer back to its pool, so a frame can be given back knowing nothing else.
+class CoroutineFrames
+{
+public:
+    static constexpr std::size_t cHeaderSize{alignof(std::max_align_t)};
+
+    CoroutineFrames(std::size_t slots, std::size_t slotSize)
+        : mSlotSize{(slotSize + cHeaderSize + cHeaderSize - 1) & ~(cHeaderSize - 1)},
+          mBytes{std::make_unique_for_overwrite<char[]>(slots * mSlotSize)}
+    {
+        mFree.reserve(slots);
+        for (std::size_t i = slots; i > 0; i--)
+        {
+            mFree.push_back(static_cast<std::uint32_t>(i - 1));
+        }
+    }
+
+    CoroutineFrames(const CoroutineFrames&) = delete;
+    CoroutineFrames& operator=(const CoroutineFrames&) = delete;
+
+    // Nullptr when every slot is taken, or the frame is too big for one
+    void* allocate(std::size_t size) noexcept
+    {
+        if (mFree.empty() || size > mSlotSize - cHeaderSize)
+        {
+            return nullptr;
+        }
+
+        char* slot = mBytes.get() + std::size_t{mFree.back()} * mSlotSize;
+        mFree.pop_back();
+        auto* self = this;
+        std::memcpy(slot, &self, sizeof(self));
+        return slot + cHeaderSize;
+    }
+
+    static void release(void* frame) noexcept
+    {
+        char* slot = static_cast<char*>(frame) - cHeaderSize;
+        CoroutineFrames* pool{};
+        std::memcpy(&pool, slot, sizeof(pool));
+        // Never past the capacity reserved up front
+        pool->mFree.push_back(static_cast<std::uint32_t>((slot - pool->mBytes.get()) / pool->mSlotSize));
+    }
+
+    std::size_t available() const
+    {
+        return mFree.size();
+    }
+
+private:
+    std::size_t mSlotSize;
+    std::unique_ptr<char[]> mBytes;
+    std::vector<std::uint32_t> mFree{};
+};
+
+class Scheduler;
+
+// A coroutine run by a Scheduler, which starts straight away and frees itself when it finishes
+// Its first parameter must be the Scheduler, whose pool its frame comes from.
+// When the pool has no room the coroutine never starts, which the Task says.
+class Task
+{
+public:
+    struct promise_type
+    {
+        template <typename... ArgTs>
+        static void* operator new(std::size_t size, Scheduler& scheduler, ArgTs&...) noexcept;
+
+        static void operator delete(void* frame) noexcept
+        {
+            CoroutineFrames::release(frame);
+        }
+
+        static Task get_return_object_on_allocation_failure() noexcept
+        {
+            return Task{false};
+        }
+
+        Task get_return_object() noexcept
+        {
+            return Task{true};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        // Nothing on the packet thread throws, so this is a bug
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+
+    bool started() const
+    {
+        return mStarted;
+    }
+
+private:
+    explicit Task(bool started) : mStarted{started} { }
+
+    bool mStarted;
+};
+
+// Resumes coroutines waiting on connections and timers, straight from the packet loop
+// Call poll after each Stack::process, and before Stack::transmit, so whatever they write goes out with it.
+// Nothing is handed between threads, and waiting allocates nothing: each awaiter lives in its coroutine's frame,
+// and is only pointed to from a table of the connections coroutines have waited on, until they close them.
+class Scheduler
+{
+public:
+    static constexpr std::size_t cDefaultCoroutines{1024};
+    static constexpr std::size_t cDefaultFrameSize{1024};
+
+    explicit Scheduler(Stack& stack, std::size_t maxCoroutines = cDefaultCoroutines, std::size_t frameSize = cDefaultFrameSize)
+        : mStack{stack}, mFrames{maxCoroutines, frameSize}
+    {
+        // Each coroutine sleeps at most once at a time
+        mSleeping.reserve(maxCoroutines);
+        mConnections.reserve(maxCoroutines);
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    Stack& stack()
+    {
+        return mStack;
+    }
+
+    CoroutineFrames& frames()
+    {
+        return mFrames;
+    }
+
+    // Waits for the next connection to port, which must be listened on
+    class AcceptAwaiter
+    {
+    public:
+        bool await_ready()
+        {
+            auto key = mScheduler.mStack.accept(mPort);
+            if (key.has_value())
+            {
+                mResult = *key;
+            }
+            return key.has_value();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            mHandle = handle;
+            auto& acceptors = mScheduler.mAcceptors[mPort];
+            mNext = acceptors;
+            acceptors = this;
+        }
+
+        ConnectionKey await_resume() const
+        {
+            return mResult;
+        }
+
+    private:
+        friend class Scheduler;
+        AcceptAwaiter(Scheduler& scheduler, Port port) : mScheduler{scheduler}, mPort{port} { }
+
+        Scheduler& mScheduler;
+        Port mPort;
+        ConnectionKey mResult{};
+        std::coroutine_handle<> mHandle{};
+        AcceptAwaiter* mNext{};
+    };
+
+    // Waits for something to read, returning how much was, which is 0 once the peer has finished
+    class ReadAwaiter
+    {
+    public:
+        bool await_ready()
+        {
+            return more();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            mHandle = handle;
+            mScheduler.mConnections[mKey].mReader = this;
+        }
+
+        std::size_t await_resume() const
+        {
+            return mResult;
+        }
+
+    private:
+        friend class Scheduler;
+        ReadAwaiter(Scheduler& scheduler, const ConnectionKey& key, std::span<char> out) : mScheduler{scheduler}, mKey{key}, mOut{out} { }
+
+        // Reads what there is, returning whether there is no more to wait for
+        // An event can be out of date by the time we see it, when the coroutine read the data before waiting.
+        bool more()
+        {
+            mResult = mScheduler.mStack.receive(mKey, mOut);
+            return mResult != 0 || mScheduler.mStack.finishedReceiving(mKey);
+        }
+
+        Scheduler& mScheduler;
+        ConnectionKey mKey;
+        std::span<char> mOut;
+        std::size_t mResult{};
+        std::coroutine_handle<> mHandle{};
+    };
+
+    // Waits until all of bytes are queued to send, returning how many were,
+    // which is fewer only if the connection went away first
+    class WriteAwaiter
+    {
+    public:
+        bool await_ready()
+        {
+            return more();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            mHandle = handle;
+            mScheduler.mConnections[mKey].mWriter = this;
+        }
+
+        std::size_t await_resume() const
+        {
+            return mWritten;
+        }
+
+    private:
+        friend class Scheduler;
+        WriteAwaiter(Scheduler& scheduler, const ConnectionKey& key, std::span<const char> bytes) : mScheduler{scheduler}, mKey{key}, mBytes{bytes} { }
+
+        // Queues what there is room for, returning whether there is no more to wait for
+        bool more()
+        {
+            mWritten += mScheduler.mStack.send(mKey, mBytes.subspan(mWritten));
+            return mWritten == mBytes.size() || !mScheduler.mStack.canSend(mKey);
+        }
+
+        Scheduler& mScheduler;
+        ConnectionKey mKey;
+        std::span<const char> mBytes;
+        std::size_t mWritten{};
+        std::coroutine_handle<> mHandle{};
+    };
+
+    class SleepAwaiter
+    {
+    public:
+        bool await_ready() const
+        {
+            return mWakeAt <= nowNanos();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            mHandle = handle;
+            mScheduler.mSleeping.push_back(this);
+            std::push_heap(mScheduler.mSleeping.begin(), mScheduler.mSleeping.end(), wakesLater);
+        }
+
+        void await_resume() const
+        {
+        }
+
+    private:
+        friend class Scheduler;
+        SleepAwaiter(Scheduler& scheduler, std::uint64_t wakeAt) : mScheduler{scheduler}, mWakeAt{wakeAt} { }
+
+        static bool wakesLater(const SleepAwaiter* lhs, const SleepAwaiter* rhs)
+        {
+            return lhs->mWakeAt > rhs->mWakeAt;
+        }
+
+        Scheduler& mScheduler;
+        std::uint64_t mWakeAt;
+        std::coroutine_handle<> mHandle{};
+    };
+
+    AcceptAwaiter accept(Port port)
+    {
+        return AcceptAwaiter{*this, port};
+    }
+
+    ReadAwaiter read(const ConnectionKey& key, std::span<char> out)
+    {
+        return ReadAwaiter{*this, key, out};
+    }
+
+    WriteAwaiter write(const ConnectionKey& key, std::span<const char> bytes)
+    {
+        return WriteAwaiter{*this, key, bytes};
+    }
+
+    SleepAwaiter sleep(std::uint64_t nanos)
+    {
+        return SleepAwaiter{*this, nowNanos() + nanos};
+    }
+
+    // Closes the connection, resuming any coroutine waiting on it, which finds it closed:
+    // a read returns 0, and a write however much it had queued
+    void close(const ConnectionKey& key)
+    {
+        mStack.close(key);
+        auto connection = mConnections.find(key);
+        if (connection == mConnections.end())
+        {
+            return;
+        }
+
+        // Forgotten first, as either may close the connection again, or wait on it once more
+        auto waiters = connection->second;
+        mConnections.erase(connection);
+        if (waiters.mReader != nullptr)
+        {
+            waiters.mReader->mResult = 0;
+            waiters.mReader->mHandle.resume();
+        }
+        if (waiters.mWriter != nullptr)
+        {
+            waiters.mWriter->mHandle.resume();
+        }
+    }
+
+    // Resumes every coroutine whose connection has become ready, then those whose sleep is over,
+    // returning how many were resumed
+    std::size_t poll(std::uint64_t now = nowNanos())
+    {
+        std::size_t resumed{0};
+        std::array<Readiness, FrameBatch::cMaxFrames> ready{};
+        while (auto count = mStack.readiness(ready))
+        {
+            for (const auto& [key, events] : std::span{ready}.first(count))
+            {
+                if (events.set(SocketEvent::Acceptable))
+                {
+                    resumed += resumeAcceptors(key.mLocalPort);
+                    continue;
+                }
+
+                // Each coroutine we resume may wait again, or close the connection, so we look it up afresh each time
+                if (events.set(SocketEvent::Readable) || events.set(SocketEvent::Closed))
+                {
+                    resumed += resumeIfDone(key, &Waiters::mReader);
+                }
+
+                if (events.set(SocketEvent::Writable) || events.set(SocketEvent::Closed))
+                {
+                    resumed += resumeIfDone(key, &Waiters::mWriter);
+                }
+            }
+        }
+
+        while (!mSleeping.empty() && mSleeping.front()->mWakeAt <= now)
+        {
+            std::pop_heap(mSleeping.begin(), mSleeping.end(), SleepAwaiter::wakesLater);
+            auto* sleeper = mSleeping.back();
+            mSleeping.pop_back();
+            sleeper->mHandle.resume();
+            resumed += 1;
+        }
+        return resumed;
+    }
+
+private:
+    struct Waiters
+    {
+        ReadAwaiter* mReader{};
+        WriteAwaiter* mWriter{};
+    };
+
+    template <typename AwaiterT>
+    std::size_t resumeIfDone(const ConnectionKey& key, AwaiterT* Waiters::*waiter)
+    {
+        auto connection = mConnections.find(key);
+        if (connection == mConnections.end() || connection->second.*waiter == nullptr || !(connection->second.*waiter)->more())
+        {
+            return 0;
+        }
+
+        std::exchange(connection->second.*waiter, nullptr)->mHandle.resume();
+        return 1;
+    }
+
+    // As many coroutines as there are connections waiting, most recent first
+    std::size_t resumeAcceptors(Port port)
+    {
+        std::size_t resumed{0};
+        for (;;)
+        {
+            auto acceptors = mAcceptors.find(port);
+            if (acceptors == mAcceptors.end() || acceptors->second == nullptr)
+            {
+                return resumed;
+            }
+
+            auto key = mStack.accept(port);
+            if (!key.has_value())
+            {
+                return resumed;
+            }
+
+            auto* acceptor = acceptors->second;
+            acceptors->second = acceptor->mNext;
+            acceptor->mResult = *key;
+            acceptor->mHandle.resume();
+            resumed += 1;
+        }
+    }
+
+    Stack& mStack;
+    CoroutineFrames mFrames;
+    std::unordered_map<Port, AcceptAwaiter*> mAcceptors{};
+    std::unordered_map<ConnectionKey, Waiters> mConnections{};
+    std::vector<SleepAwaiter*> mSleeping{}; // A heap, soonest first
+};
+
+template <typename... ArgTs>
+void* Task::promise_type::operator new(std::size_t size, Scheduler& scheduler, ArgTs&...) noexcept
+{
+    return scheduler.frames().allocate(size);
+}
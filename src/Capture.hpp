@@ -0,0 +1,126 @@
+#pragma once
+
+#include <Filter.hpp>
+#include <Frame.hpp>
+#include <Pcap.hpp>
+#include <Ring.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+
+// Copies frames as they are received and sent into rotating pcapng files
+// The packet thread only copies the frame, or the first mSnapLength bytes of it, into a ring,
+// and a background thread writes them out. When the writer falls behind,
+// frames are counted as dropped rather than making the packet thread wait.
+enum class CaptureDirection : std::uint8_t
+{
+    Received,
+    Transmitted
+};
+
+struct CaptureConfig
+{
+    std::string mPrefix{};
+    FrameFilter mFilter{};
+    std::uint32_t mSnapLength{65535};
+    std::size_t mMaxFileBytes{64 * 1024 * 1024};
+    std::size_t mMaxFiles{8};
+    std::size_t mRingBytes{16 * 1024 * 1024};
+};
+
+class Capture
+{
+public:
+    explicit Capture(const CaptureConfig& config)
+        : mFilter{config.mFilter}, mSnapLength{config.mSnapLength}, mRing{config.mRingBytes},
+          mWriter{config.mPrefix, config.mMaxFileBytes, config.mMaxFiles, config.mSnapLength},
+          mThread{[this](std::stop_token stopToken) { run(stopToken); }}
+    {
+    }
+
+    ~Capture()
+    {
+        mThread.request_stop();
+        mThread.join();
+        writeOnce();
+        mWriter.flush();
+    }
+
+    Capture(const Capture&) = delete;
+    Capture& operator=(const Capture&) = delete;
+
+    // Called on the packet thread, never blocks
+    void record(CaptureDirection direction, LayerBytes bytes)
+    {
+        if (!mFilter.matches(bytes))
+        {
+            return;
+        }
+
+        auto captured = std::min<std::size_t>(bytes.size(), mSnapLength);
+        auto* out = mRing.reserve(sizeof(RecordHeader) + captured);
+        if (out == nullptr)
+        {
+            mDropped.store(mDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        RecordHeader header{captureTimestamp(), static_cast<std::uint32_t>(bytes.size()), static_cast<std::uint32_t>(captured),
+                            direction};
+        std::memcpy(out, &header, sizeof(header));
+        std::memcpy(out + sizeof(header), bytes.data(), captured);
+        mRing.commit();
+    }
+
+    std::uint64_t dropped() const
+    {
+        return mDropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct RecordHeader
+    {
+        std::uint64_t mTimestamp;
+        std::uint32_t mOriginalLength;
+        std::uint32_t mCapturedLength;
+        CaptureDirection mDirection;
+    };
+
+    void run(std::stop_token stopToken)
+    {
+        static constexpr auto cIdleSleep{std::chrono::milliseconds{1}};
+        while (!stopToken.stop_requested())
+        {
+            if (writeOnce() == 0)
+            {
+                mWriter.flush();
+                std::this_thread::sleep_for(cIdleSleep);
+            }
+        }
+    }
+
+    std::size_t writeOnce()
+    {
+        return mRing.consume([this](const char* record) {
+            RecordHeader header{};
+            std::memcpy(&header, record, sizeof(header));
+            auto direction = header.mDirection == CaptureDirection::Received ? PcapNgWriter::Direction::Inbound
+                                                                             : PcapNgWriter::Direction::Outbound;
+            mWriter.write(header.mTimestamp, direction, {record + sizeof(header), header.mCapturedLength}, header.mOriginalLength);
+        });
+    }
+
+    FrameFilter mFilter;
+    std::uint32_t mSnapLength;
+    ByteRing mRing;
+    PcapNgWriter mWriter;
+    std::atomic<std::uint64_t> mDropped{};
+    std::jthread mThread;
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Filter.hpp>
+#include <Frame.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <Log.hpp>
+#include <Parse.hpp>
+#include <Tcp.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <string_view>
+
+// Draws a frame as a row of boxes, one per layer, each as wide as the layer is long
+// Nothing here allocates: sections are views into the frame,
+// and the diagram is rendered straight into whatever buffer the caller is filling
+struct FrameSection
+{
+    std::size_t mSize{};
+    std::string_view mName{};
+    std::string_view mPayload{};
+};
+
+class FrameSections
+{
+public:
+    // Ethernet, IP, transport header, transport body, and whatever is left over
+    static constexpr std::size_t cMaxSections{6};
+
+    void push(FrameSection section)
+    {
+        if (mCount < cMaxSections)
+        {
+            mSections[mCount++] = section;
+        }
+    }
+
+    std::size_t totalSize() const
+    {
+        std::size_t sum{0};
+        for (const auto& section : *this)
+        {
+            sum += section.mSize;
+        }
+        return sum;
+    }
+
+    const FrameSection* begin() const
+    {
+        return mSections.data();
+    }
+
+    const FrameSection* end() const
+    {
+        return mSections.data() + mCount;
+    }
+
+private:
+    std::array<FrameSection, cMaxSections> mSections{};
+    std::size_t mCount{};
+};
+
+// Lays out the sections of a frame which parsed successfully
+// Each is clamped to what is left of the frame, so no length in a header can make a section bigger than the frame.
+inline FrameSections describe(const ParsedFrame& parsed, std::size_t frameSize)
+{
+    FrameSections sections{};
+    std::size_t remaining{frameSize};
+    auto push = [&](std::size_t size, std::string_view name, std::string_view payload = {}) {
+        size = std::min(size, remaining);
+        remaining -= size;
+        sections.push({size, name, payload});
+    };
+
+    push(sizeof(EthernetHeader), "Ethernet");
+    switch (parsed.mEthernetHeader.mEthertype)
+    {
+        case EtherType::InternetProtocolVersion4:
+        {
+            std::size_t headerLength = parsed.mIpHeader.mVersionLength.mLength * 4;
+            push(headerLength, "IPv4");
+            std::size_t transportSize = std::max<std::size_t>(parsed.mIpHeader.mTotalLength, headerLength) - headerLength;
+            // A fragment's transport header was never parsed, and may not even be in this one
+            if (isFragment(parsed.mIpHeader))
+            {
+                push(transportSize, "Fragment");
+                break;
+            }
+
+            switch (parsed.mIpHeader.mProto)
+            {
+                case IPProtocol::ICMP:
+                    push(sizeof(IcmpV4Header), "ICMP");
+                    push(std::max(transportSize, sizeof(IcmpV4Header)) - sizeof(IcmpV4Header), "Echo");
+                    break;
+                case IPProtocol::TCP:
+                    push(transportSize, "TCP", parsed.mPayload);
+                    break;
+                case IPProtocol::UDP:
+                    push(transportSize, "UDP", parsed.mPayload);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case EtherType::AddressResolutionProtocol:
+            push(sizeof(ArpHeader), "ARP");
+            push(sizeof(ArpIpBody), "ARP IP");
+            break;
+        default:
+            break;
+    }
+
+    if (remaining > 0)
+    {
+        static constexpr std::size_t cMaxIgnoredSectionSize{80};
+        push(std::min(cMaxIgnoredSectionSize, remaining), "Ignored");
+    }
+
+    return sections;
+}
+
+template <typename OutputIt>
+OutputIt renderDashes(std::size_t count, OutputIt out)
+{
+    return std::fill_n(out, count, '-');
+}
+
+// A payload too long for its section is cut off at the edge of the box
+template <typename OutputIt>
+OutputIt render(const FrameSections& sections, OutputIt out)
+{
+    static constexpr std::string_view cPayloadSeparator{": "};
+
+    auto dashes = sections.totalSize() + 1;
+    out = renderDashes(dashes, out);
+    *out++ = '\n';
+    for (const auto& section : sections)
+    {
+        std::size_t remaining = section.mSize;
+        auto append = [&](std::string_view text) {
+            auto count = std::min(remaining, text.size());
+            out = std::copy_n(text.data(), count, out);
+            remaining -= count;
+        };
+
+        append("|");
+        append(section.mName);
+        if (!section.mPayload.empty())
+        {
+            append(cPayloadSeparator);
+            auto payload = section.mPayload.substr(0, remaining);
+            // Replace newlines with carats
+            out = std::replace_copy(payload.begin(), payload.end(), out, '\n', '^');
+            remaining -= payload.size();
+        }
+        out = std::fill_n(out, remaining, ' ');
+    }
+    *out++ = '|';
+    *out++ = '\n';
+    return renderDashes(dashes, out);
+}
+
+// A received frame as it will be logged
+// The packet thread only copies the bytes into the log,
+// and the logging thread parses them again to draw the diagram
+struct FrameDiagram
+{
+    std::string_view mBytes{};
+};
+
+template <>
+struct LogArg<FrameDiagram>
+{
+    using Decoded = FrameDiagram;
+
+    static std::size_t size(const FrameDiagram& diagram)
+    {
+        return LogArg<std::string_view>::size(diagram.mBytes);
+    }
+
+    static char* encode(const FrameDiagram& diagram, char* out)
+    {
+        return LogArg<std::string_view>::encode(diagram.mBytes, out);
+    }
+
+    static const char* decode(const char* in, Decoded& diagram)
+    {
+        return LogArg<std::string_view>::decode(in, diagram.mBytes);
+    }
+};
+
+template <> struct std::formatter<FrameDiagram> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const FrameDiagram& diagram, FormatContext& ctx) const
+    {
+        ParsedFrame parsed{};
+        auto result = parseFrame(diagram.mBytes, parsed);
+        if (!result)
+        {
+            return std::format_to(ctx.out(), "Dropped frame of size {}: {}", diagram.mBytes.size(), result.error());
+        }
+
+        return render(describe(parsed, diagram.mBytes.size()), ctx.out());
+    }
+};
+
+// Decides which received frames are worth drawing
+// Frames can be sampled one in every N, after narrowing them down with a filter
+class FrameSampler
+{
+public:
+    void setRate(std::uint32_t everyN)
+    {
+        mEveryN = std::max<std::uint32_t>(everyN, 1);
+        mCountdown = mEveryN;
+    }
+
+    void setFilter(const FrameFilter& filter)
+    {
+        mFilter = filter;
+    }
+
+    bool sample(LayerBytes bytes)
+    {
+        if (!mFilter.matches(bytes))
+        {
+            return false;
+        }
+
+        if (--mCountdown != 0)
+        {
+            return false;
+        }
+
+        mCountdown = mEveryN;
+        return true;
+    }
+
+private:
+    std::uint32_t mEveryN{1};
+    std::uint32_t mCountdown{1};
+    FrameFilter mFilter{};
+};
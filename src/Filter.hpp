@@ -0,0 +1,203 @@
+#pragma once
+
+#include <Ethernet.hpp>
+#include <Frame.hpp>
+#include <Ip.hpp>
+#include <Tcp.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Picks out frames by protocol, address and port, in the spirit of a BPF expression
+// Every term must match, so "tcp host 10.3.3.1 port 80" is one TCP flow,
+// and the terms understood are arp, ip, icmp, tcp, udp, host a.b.c.d and port n.
+// It runs on raw frames before they are parsed, so it only peeks at fixed offsets,
+// and a frame too short to say is never a match.
+class FrameFilter
+{
+public:
+    static std::optional<FrameFilter> parse(std::string_view expression)
+    {
+        FrameFilter filter{};
+        while (!expression.empty())
+        {
+            auto term = nextWord(expression);
+            if (term.empty())
+            {
+                continue;
+            }
+
+            if (term == "arp")
+            {
+                filter.mEtherType = EtherType::AddressResolutionProtocol;
+            }
+            else if (term == "ip")
+            {
+                filter.mEtherType = EtherType::InternetProtocolVersion4;
+            }
+            else if (term == "icmp" || term == "tcp" || term == "udp")
+            {
+                filter.mEtherType = EtherType::InternetProtocolVersion4;
+                filter.mProtocol = term == "icmp" ? IPProtocol::ICMP : term == "tcp" ? IPProtocol::TCP : IPProtocol::UDP;
+            }
+            else if (term == "host")
+            {
+                std::string address{nextWord(expression)};
+                std::array<int, sizeof(IpAddress)> quartets{};
+                if (std::sscanf(address.c_str(), "%d.%d.%d.%d", &quartets[0], &quartets[1], &quartets[2], &quartets[3]) != 4)
+                {
+                    return std::nullopt;
+                }
+                filter.setAddress(fromQuartets(quartets));
+            }
+            else if (term == "port")
+            {
+                auto portString = nextWord(expression);
+                Port port{};
+                auto [end, error] = std::from_chars(portString.data(), portString.data() + portString.size(), port);
+                if (error != std::errc{} || end != portString.data() + portString.size())
+                {
+                    return std::nullopt;
+                }
+                filter.setPort(port);
+            }
+            else
+            {
+                return std::nullopt;
+            }
+        }
+
+        return filter;
+    }
+
+    void setAddress(std::optional<IpAddress> address)
+    {
+        mAddress = address;
+        if (address.has_value())
+        {
+            mEtherType = EtherType::InternetProtocolVersion4;
+        }
+    }
+
+    // TCP and UDP keep their ports in the same place, and a port alone means TCP
+    void setPort(std::optional<Port> port)
+    {
+        mPort = port;
+        if (port.has_value())
+        {
+            mEtherType = EtherType::InternetProtocolVersion4;
+            if (mProtocol != IPProtocol::UDP)
+            {
+                mProtocol = IPProtocol::TCP;
+            }
+        }
+    }
+
+    bool matchesEverything() const
+    {
+        return !mEtherType && !mProtocol && !mAddress && !mPort;
+    }
+
+    bool matches(LayerBytes bytes) const
+    {
+        if (matchesEverything())
+        {
+            return true;
+        }
+
+        auto etherType = peek<std::uint16_t>(bytes, offsetof(EthernetHeader, mEthertype));
+        if (!etherType || (mEtherType && *etherType != std::to_underlying(*mEtherType)))
+        {
+            return false;
+        }
+
+        if (!mProtocol && !mAddress && !mPort)
+        {
+            return true;
+        }
+
+        static constexpr auto cIpOffset{sizeof(EthernetHeader)};
+        auto protocol = peek<std::uint8_t>(bytes, cIpOffset + offsetof(IpV4Header, mProto));
+        if (!protocol || (mProtocol && *protocol != std::to_underlying(*mProtocol)))
+        {
+            return false;
+        }
+
+        if (mAddress.has_value())
+        {
+            auto address = std::bit_cast<std::uint32_t>(*mAddress);
+            auto source = peek<std::uint32_t>(bytes, cIpOffset + offsetof(IpV4Header, mSourceAddress));
+            auto destination = peek<std::uint32_t>(bytes, cIpOffset + offsetof(IpV4Header, mDestinationAddress));
+            if (source != address && destination != address)
+            {
+                return false;
+            }
+        }
+
+        if (mPort.has_value())
+        {
+            static constexpr std::uint8_t cIhlMask{0x0f};
+            static constexpr std::size_t cIhlUnit{4};
+            auto versionAndIhl = peek<std::uint8_t>(bytes, cIpOffset);
+            if (!versionAndIhl)
+            {
+                return false;
+            }
+
+            auto tcpOffset = cIpOffset + (*versionAndIhl & cIhlMask) * cIhlUnit;
+            auto source = peek<Port>(bytes, tcpOffset + offsetof(TcpHeader, mSourcePort));
+            auto destination = peek<Port>(bytes, tcpOffset + offsetof(TcpHeader, mDestinationPort));
+            if (source != *mPort && destination != *mPort)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static std::string_view nextWord(std::string_view& text)
+    {
+        auto start = text.find_first_not_of(' ');
+        if (start == std::string_view::npos)
+        {
+            text = {};
+            return {};
+        }
+
+        text.remove_prefix(start);
+        auto word = text.substr(0, text.find(' '));
+        text.remove_prefix(word.size());
+        return word;
+    }
+
+    // Reads a big endian field, if the frame is long enough to hold it
+    template <typename T>
+    static std::optional<T> peek(LayerBytes bytes, std::size_t offset)
+    {
+        if (bytes.size() < offset + sizeof(T))
+        {
+            return std::nullopt;
+        }
+
+        T value{};
+        std::memcpy(&value, bytes.data() + offset, sizeof(T));
+        return std::byteswap(value);
+    }
+
+    std::optional<EtherType> mEtherType{};
+    std::optional<IPProtocol> mProtocol{};
+    std::optional<IpAddress> mAddress{};
+    std::optional<Port> mPort{};
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Headers.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <IpOptions.hpp>
+#include <Parse.hpp>
+#include <Tcp.hpp>
+#include <TcpOptions.hpp>
+#include <Udp.hpp>
+#include <Trace.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Everything we managed to parse out of one received frame
+// Only the headers for the protocols actually present are filled in
+struct ParsedFrame
+{
+    EthernetHeader mEthernetHeader{};
+    IpV4Header mIpHeader{};
+    IpOptionList mIpOptions{};
+    IcmpV4Header mIcmpHeader{};
+    IcmpV4Echo mIcmpEcho{};
+    IcmpV4Unreachable mIcmpUnreachable{};
+    IpV4Header mIcmpQuotedHeader{}; // Of the datagram an ICMP error is about
+    TcpHeader mTcpHeader{};
+    TcpOptionList mTcpOptions{};
+    UdpHeader mUdpHeader{};
+    ArpMessage mArpMessage{};
+    std::string_view mPayload{};
+};
+
+// Each parse step takes the bytes belonging to its layer,
+// and on success returns the bytes belonging to the layer above
+using LayerBytes = std::span<const char>;
+
+inline ParseResult<LayerBytes> parseEthernet(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<EthernetHeader>(buffer, DropReason::TruncatedEthernet);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    frame.mEthernetHeader = *header;
+    return buffer.subspan(sizeof(EthernetHeader));
+}
+
+// The checksum covers the options too, so is summed over the header as it is on the wire
+inline ParseResult<void> parseIpV4Options(ParsedFrame& frame, LayerBytes header)
+{
+    if (checksum(0, header.data(), header.size()) != 0)
+    {
+        return std::unexpected{DropReason::BadIpChecksum};
+    }
+
+    return parseIpOptions(header, frame.mIpOptions);
+}
+
+inline ParseResult<LayerBytes> parseIpV4(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<IpV4Header>(buffer, DropReason::TruncatedIp);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    static constexpr auto cIpVersion{4};
+    static constexpr auto cLengthUnits{4};
+    static constexpr auto cMinimumHeaderLength{5};
+    if (header->mVersionLength.mVersion != cIpVersion)
+    {
+        return std::unexpected{DropReason::BadIpVersion};
+    }
+
+    if (header->mVersionLength.mLength < cMinimumHeaderLength)
+    {
+        return std::unexpected{DropReason::BadIpHeaderLength};
+    }
+
+    // Ethernet pads short frames, so the buffer may be longer than the packet,
+    // but it must never be shorter
+    std::size_t headerLength = header->mVersionLength.mLength * cLengthUnits;
+    if (header->mTotalLength < headerLength || header->mTotalLength > buffer.size())
+    {
+        return std::unexpected{DropReason::BadIpTotalLength};
+    }
+
+    // Nearly everything comes without options, so that stays the cheap, predictable case
+    frame.mIpOptions.mCount = 0;
+    if (headerLength != sizeof(IpV4Header)) [[unlikely]]
+    {
+        auto withOptions = parseIpV4Options(frame, buffer.first(headerLength));
+        if (!withOptions)
+        {
+            return std::unexpected{withOptions.error()};
+        }
+    }
+    else if (checksum(*header) != header->checksum())
+    {
+        return std::unexpected{DropReason::BadIpChecksum};
+    }
+
+    frame.mIpHeader = *header;
+    return buffer.subspan(headerLength, header->mTotalLength - headerLength);
+}
+
+// Comes back with the IP header of the datagram which was too big, and at least the next eight bytes of it
+inline ParseResult<LayerBytes> parseFragmentationNeeded(ParsedFrame& frame, LayerBytes buffer, LayerBytes body)
+{
+    auto unreachable = tryFromWire<IcmpV4Unreachable>(body, DropReason::TruncatedIcmp);
+    if (!unreachable)
+    {
+        return std::unexpected{unreachable.error()};
+    }
+
+    auto quoted = body.subspan(sizeof(IcmpV4Unreachable));
+    auto quotedHeader = tryFromWire<IpV4Header>(quoted, DropReason::TruncatedIcmp);
+    if (!quotedHeader)
+    {
+        return std::unexpected{quotedHeader.error()};
+    }
+
+    if (checksum(0, buffer.data(), buffer.size()) != 0)
+    {
+        return std::unexpected{DropReason::BadIcmpChecksum};
+    }
+
+    frame.mIcmpUnreachable = *unreachable;
+    frame.mIcmpQuotedHeader = *quotedHeader;
+    return quoted;
+}
+
+inline ParseResult<LayerBytes> parseIcmp(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<IcmpV4Header>(buffer, DropReason::TruncatedIcmp);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    frame.mIcmpHeader = *header;
+    auto body = buffer.subspan(sizeof(IcmpV4Header));
+    if (header->mType == IcmpType::DestinationUnreachable && header->mCode == cFragmentationNeeded)
+    {
+        return parseFragmentationNeeded(frame, buffer, body);
+    }
+
+    if (header->mType != IcmpType::EchoRequest)
+    {
+        return std::unexpected{DropReason::IgnoredIcmpType};
+    }
+
+    auto echo = tryFromWire<IcmpV4Echo>(body, DropReason::TruncatedIcmp);
+    if (!echo)
+    {
+        return std::unexpected{echo.error()};
+    }
+
+    // The checksum covers the whole message, and summing over it,
+    // checksum included, leaves nothing when the message is intact
+    if (checksum(0, buffer.data(), buffer.size()) != 0)
+    {
+        return std::unexpected{DropReason::BadIcmpChecksum};
+    }
+
+    frame.mIcmpEcho = *echo;
+    auto payload = body.subspan(sizeof(IcmpV4Echo));
+    frame.mPayload = std::string_view{payload.data(), payload.size()};
+    return payload;
+}
+
+inline ParseResult<LayerBytes> parseTcp(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<TcpHeader>(buffer, DropReason::TruncatedTcp);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    static constexpr auto cLengthUnits{4};
+    std::size_t headerLength = header->length() * cLengthUnits;
+    if (headerLength < sizeof(TcpHeader) || headerLength > buffer.size())
+    {
+        return std::unexpected{DropReason::BadTcpHeaderLength};
+    }
+
+    auto optionBytes = buffer.subspan(sizeof(TcpHeader), headerLength - sizeof(TcpHeader));
+    auto options = parseTcpOptions(optionBytes, frame.mTcpOptions);
+    if (!options)
+    {
+        return std::unexpected{options.error()};
+    }
+
+    auto payload = buffer.subspan(headerLength);
+    std::uint8_t zero{0};
+    TcpPseudoHeader pseudoHeader{frame.mIpHeader.mSourceAddress, frame.mIpHeader.mDestinationAddress, zero, IPProtocol::TCP, static_cast<std::uint16_t>(buffer.size())};
+    TcpPseudoPacket pseudoPacket{pseudoHeader, *header};
+    {
+        TraceScope trace{TraceStage::TcpChecksum};
+        auto calculatedChecksum = tcp_checksum(pseudoPacket, std::string_view{optionBytes.data(), optionBytes.size()}, std::string_view{payload.data(), payload.size()});
+        if (calculatedChecksum != header->checksum())
+        {
+            return std::unexpected{DropReason::BadTcpChecksum};
+        }
+    }
+
+    frame.mTcpHeader = *header;
+    frame.mPayload = std::string_view{payload.data(), payload.size()};
+    return payload;
+}
+
+inline ParseResult<LayerBytes> parseUdp(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<UdpHeader>(buffer, DropReason::TruncatedUdp);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    // As with IP, the buffer may run on past the datagram, but never stop short of it
+    if (header->mLength < sizeof(UdpHeader) || header->mLength > buffer.size())
+    {
+        return std::unexpected{DropReason::BadUdpLength};
+    }
+
+    auto datagram = buffer.first(header->mLength);
+    if (header->mCheckSum != 0 && udpChecksum(frame.mIpHeader.mSourceAddress, frame.mIpHeader.mDestinationAddress, datagram) != 0)
+    {
+        return std::unexpected{DropReason::BadUdpChecksum};
+    }
+
+    frame.mUdpHeader = *header;
+    auto payload = datagram.subspan(sizeof(UdpHeader));
+    frame.mPayload = std::string_view{payload.data(), payload.size()};
+    return payload;
+}
+
+inline ParseResult<LayerBytes> parseArp(ParsedFrame& frame, LayerBytes buffer)
+{
+    auto header = tryFromWire<ArpHeader>(buffer, DropReason::TruncatedArp);
+    if (!header)
+    {
+        return std::unexpected{header.error()};
+    }
+
+    if (header->mProtocolType != ArpProtoType::InternetProtocolVersion4)
+    {
+        return std::unexpected{DropReason::UnsupportedArpProtocol};
+    }
+
+    auto body = buffer.subspan(sizeof(ArpHeader));
+    auto ipBody = tryFromWire<ArpIpBody>(body, DropReason::TruncatedArp);
+    if (!ipBody)
+    {
+        return std::unexpected{ipBody.error()};
+    }
+
+    frame.mArpMessage = {*header, *ipBody};
+    return body.subspan(sizeof(ArpIpBody));
+}
+
+// Parses and validates every layer of a frame we know how to handle
+// The frame is reused between calls so we never copy the parsed headers around
+inline ParseResult<void> parseFrame(LayerBytes buffer, ParsedFrame& frame)
+{
+    auto network = parseEthernet(frame, buffer);
+    if (!network)
+    {
+        return std::unexpected{network.error()};
+    }
+
+    ParseResult<LayerBytes> upper{std::unexpected{DropReason::UnsupportedEtherType}};
+    switch (frame.mEthernetHeader.mEthertype)
+    {
+        case EtherType::InternetProtocolVersion4:
+        {
+            auto transport = parseIpV4(frame, *network);
+            if (!transport)
+            {
+                return std::unexpected{transport.error()};
+            }
+
+            // Only the whole datagram has a transport header we can check
+            if (isFragment(frame.mIpHeader))
+            {
+                return {};
+            }
+
+            switch (frame.mIpHeader.mProto)
+            {
+                case IPProtocol::ICMP:
+                    upper = parseIcmp(frame, *transport);
+                    break;
+                case IPProtocol::TCP:
+                    upper = parseTcp(frame, *transport);
+                    break;
+                case IPProtocol::UDP:
+                    upper = parseUdp(frame, *transport);
+                    break;
+                default:
+                    upper = std::unexpected{DropReason::UnsupportedIpProtocol};
+                    break;
+            }
+            break;
+        }
+        case EtherType::AddressResolutionProtocol:
+            upper = parseArp(frame, *network);
+            break;
+        default:
+            break;
+    }
+
+    if (!upper)
+    {
+        return std::unexpected{upper.error()};
+    }
+
+    return {};
+}
@@ -46,10 +46,7 @@ auto fromWire(const char* buffer) -> HeaderT
 {
     using HeaderLayout = LayoutInfo<HeaderT>;
     static_assert(totalSize(HeaderLayout::Sizes) == sizeof(HeaderT) || totalSize(HeaderLayout::Sizes) == 0);
-    if constexpr (HeaderLayout::Sizes.size() == 0)
-    {
-        throw std::runtime_error{"No layout info for requested type"};
-    }
+    static_assert(HeaderLayout::Sizes.size() != 0, "No layout info for requested type");
 
     std::array<std::byte, sizeof(HeaderT)> bytes;
     std::memcpy(&bytes, buffer, sizeof(bytes));
@@ -68,10 +65,7 @@ std::size_t toWire(const HeaderT& header, char* buffer)
 {
     using HeaderLayout = LayoutInfo<HeaderT>;
     static_assert(totalSize(HeaderLayout::Sizes) == sizeof(HeaderT) || totalSize(HeaderLayout::Sizes) == 0);
-    if constexpr (HeaderLayout::Sizes.size() == 0)
-    {
-        throw std::runtime_error{"No layout info for requested type"};
-    }
+    static_assert(HeaderLayout::Sizes.size() != 0, "No layout info for requested type");
 
     std::array<std::byte, sizeof(HeaderT)> bytes;
     std::memcpy(&bytes, &header, sizeof(bytes));
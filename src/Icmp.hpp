@@ -37,41 +37,37 @@ struct LayoutInfo<IcmpV4Header>
     static constexpr std::index_sequence<1, 1, 2> Sizes{};
 };
 
+// The rest of an echo request or reply is payload,
+// which is echoed back untouched whatever its size
 struct IcmpV4Echo
 {
     std::uint16_t mId;
     std::uint16_t mSeq;
-    std::uint64_t mData;
-    std::uint8_t mPayload[48];
-} __attribute__((packed));
-static_assert(sizeof(IcmpV4Echo) == 60, "ICMP Echo must be 60 bytes long");
+};
+static_assert(sizeof(IcmpV4Echo) == 4, "ICMP Echo must be 4 bytes long");
 
 template <>
 struct LayoutInfo<IcmpV4Echo>
 {
-    static constexpr std::index_sequence<2, 2, 8, 48> Sizes{};
+    static constexpr std::index_sequence<2, 2> Sizes{};
 };
 
-struct IcmpV4EchoResponse
-{
-    IcmpV4Header mHeader;
-    IcmpV4Echo mBody;
-
-    void zero_out_checksum()
-    {
-        mHeader.zero_out_checksum();
-    }
+// The code of a Destination Unreachable which asks us to send smaller datagrams
+static constexpr std::uint8_t cFragmentationNeeded{4};
 
-    auto checksum() const
-    {
-        return mHeader.checksum();
-    }
+// Between the header of a Destination Unreachable and the start of the datagram which could not be delivered
+// Only Fragmentation Needed uses the second half, for the MTU of the next hop
+struct IcmpV4Unreachable
+{
+    std::uint16_t mUnused;
+    std::uint16_t mNextHopMtu;
 };
+static_assert(sizeof(IcmpV4Unreachable) == 4, "ICMP Destination Unreachable must be 4 bytes long");
 
 template <>
-struct LayoutInfo<IcmpV4EchoResponse>
+struct LayoutInfo<IcmpV4Unreachable>
 {
-    static constexpr std::index_sequence<1, 1, 2, 2, 2, 8, 48> Sizes{};
+    static constexpr std::index_sequence<2, 2> Sizes{};
 };
 
 template <> struct std::formatter<IcmpType> : SimpleFormatter
@@ -89,7 +85,7 @@ template <> struct std::formatter<IcmpType> : SimpleFormatter
         case IcmpType::DestinationUnreachable:
             return std::format_to(ctx.out(), "Destination Unreachable");
         default:
-            throw std::runtime_error{std::format("Unexpected IP Protocol Type: {}", std::to_underlying(icmpType))};
+            return std::format_to(ctx.out(), "Unknown ICMP Type {}", std::to_underlying(icmpType));
         }
     }
 };
@@ -104,6 +100,15 @@ template <> struct std::formatter<IcmpV4Header> : SimpleFormatter
     }
 };
 
+template <> struct std::formatter<IcmpV4Unreachable> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const IcmpV4Unreachable& unreachable, FormatContext& ctx) const
+    {
+        return std::format_to(ctx.out(), "ICMP Destination Unreachable, next hop MTU {}", unreachable.mNextHopMtu);
+    }
+};
+
 template <> struct std::formatter<IcmpV4Echo> : SimpleFormatter
 {
     template <typename FormatContext>
@@ -5,6 +5,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <bit>
 
 enum class IPProtocol : std::uint8_t
@@ -55,6 +56,15 @@ struct IpV4Header
 };
 static_assert(sizeof(IpV4Header) == 20, "IP header must be 20 bytes long");
 
+// The flags, from least significant up
+static constexpr std::uint16_t cMoreFragments{0b001};
+static constexpr std::uint16_t cDontFragment{0b010};
+
+inline bool isFragment(const IpV4Header& header)
+{
+    return header.mFlagsOffset.mFragOffset != 0 || (header.mFlagsOffset.mFlags & cMoreFragments);
+}
+
 template <>
 struct LayoutInfo<IpV4Header>
 {
@@ -78,7 +88,7 @@ template <> struct std::formatter<IPProtocol> : SimpleFormatter
         case IPProtocol::UDP:
             return std::format_to(ctx.out(), "UDP");
         default:
-            throw std::runtime_error{std::format("Unexpected IP Protocol Type: {}", std::to_underlying(ipProto))};
+            return std::format_to(ctx.out(), "Unknown IP Protocol Type {}", std::to_underlying(ipProto));
         }
     }
 };
@@ -191,3 +201,57 @@ inline std::uint16_t checksum(std::uint16_t starting_sum, const char* buffer, st
     }
     return result;
 }
+
+// Copies count bytes while summing them as checksum does, so a payload is only read once on its way into a frame
+// Returns the sum so far, not negated, for checksum to start from, or to combine with addSums.
+// Eight bytes at a time, as one's complement sums come out the same however wide the words are once folded.
+inline std::uint16_t copyAndSum(char* destination, const char* source, std::size_t count, std::uint16_t startingSum = 0)
+{
+    std::uint64_t sum = startingSum;
+    std::size_t i{0};
+    for (; i + sizeof(std::uint64_t) <= count; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, source + i, sizeof(word));
+        std::memcpy(destination + i, &word, sizeof(word));
+        sum += (word & 0xFFFFFFFF) + (word >> 32);
+    }
+
+    for (; i + sizeof(std::uint16_t) <= count; i += sizeof(std::uint16_t))
+    {
+        std::uint16_t word;
+        std::memcpy(&word, source + i, sizeof(word));
+        std::memcpy(destination + i, &word, sizeof(word));
+        sum += word;
+    }
+
+    if (i < count)
+    {
+        destination[i] = source[i];
+        sum += static_cast<std::uint8_t>(source[i]);
+    }
+
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<std::uint16_t>(sum);
+}
+
+// Combines the sums of two runs of bytes, swapping the second's when it starts an odd number of bytes in (RFC 1071)
+inline std::uint16_t addSums(std::uint16_t lhs, std::uint16_t rhs, bool oddOffset = false)
+{
+    std::uint32_t sum = lhs + (oddOffset ? std::byteswap(rhs) : rhs);
+    return static_cast<std::uint16_t>((sum & 0xFFFF) + (sum >> 16));
+}
+
+// Adjusts a checksum for one 16 bit word changing from oldWord to newWord,
+// without summing the rest of the data again (RFC 1624)
+// The checksum and both words just have to be in the same byte order
+inline std::uint16_t updateChecksum(std::uint16_t checksum, std::uint16_t oldWord, std::uint16_t newWord)
+{
+    std::uint32_t sum = static_cast<std::uint16_t>(~checksum) + static_cast<std::uint16_t>(~oldWord) + newWord;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~static_cast<std::uint16_t>(sum);
+}
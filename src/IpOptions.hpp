@@ -0,0 +1,288 @@
+#pragma once
+
+#include <Types.hpp>
+#include <Ip.hpp>
+#include <Parse.hpp>
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// The top bit of each type says whether the option is copied into every fragment
+enum class IpOptionType : std::uint8_t
+{
+    EndOfOptions = 0,
+    NoOp = 1,
+    RecordRoute = 7,
+    Timestamp = 68,
+    Security = 130,
+    LooseSourceRoute = 131,
+    StreamId = 136,
+    StrictSourceRoute = 137,
+    RouterAlert = 148,
+};
+
+template <> struct std::formatter<IpOptionType> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const IpOptionType& optionType, FormatContext& ctx) const
+    {
+        using enum IpOptionType;
+        switch (optionType)
+        {
+        case IpOptionType::EndOfOptions:
+            return std::format_to(ctx.out(), "EndOfOptions");
+        case IpOptionType::NoOp:
+            return std::format_to(ctx.out(), "NoOp");
+        case IpOptionType::RecordRoute:
+            return std::format_to(ctx.out(), "RecordRoute");
+        case IpOptionType::Timestamp:
+            return std::format_to(ctx.out(), "Timestamp");
+        case IpOptionType::Security:
+            return std::format_to(ctx.out(), "Security");
+        case IpOptionType::LooseSourceRoute:
+            return std::format_to(ctx.out(), "LooseSourceRoute");
+        case IpOptionType::StreamId:
+            return std::format_to(ctx.out(), "StreamId");
+        case IpOptionType::StrictSourceRoute:
+            return std::format_to(ctx.out(), "StrictSourceRoute");
+        case IpOptionType::RouterAlert:
+            return std::format_to(ctx.out(), "RouterAlert");
+        default:
+            return std::format_to(ctx.out(), "Unknown IP Option type {}", std::to_underlying(optionType));
+        }
+    }
+};
+
+inline bool copiedOnFragment(IpOptionType type)
+{
+    return std::to_underlying(type) & 0x80;
+}
+
+// Where an option sits in the header, rather than what it says,
+// as the ones we act on are rewritten in place
+struct IpOption
+{
+    IpOptionType mType;
+    std::uint8_t mOffset{}; // From the start of the IP header
+    std::uint8_t mSize{1};
+    std::uint8_t mPointer{}; // For the route and timestamp options, one based, to the next free slot
+};
+static_assert(sizeof(IpOption) == 4, "IP Options must fit within 4 bytes");
+
+static constexpr std::size_t cMaxIpOptionsSize{40};
+
+// The options area is at most 40 bytes, and each option at least one
+struct IpOptionList
+{
+    static constexpr std::size_t cMaxOptions{cMaxIpOptionsSize};
+
+    std::array<IpOption, cMaxOptions> mOptions{};
+    std::size_t mCount{};
+
+    std::span<const IpOption> view() const
+    {
+        return {mOptions.data(), mCount};
+    }
+};
+
+// Parses one option from offset into header, which must be the whole IP header
+inline ParseResult<IpOption> parseIpOption(std::span<const char> header, std::size_t offset)
+{
+    IpOption result{};
+    result.mType = static_cast<IpOptionType>(header[offset]);
+    result.mOffset = static_cast<std::uint8_t>(offset);
+    switch (result.mType)
+    {
+        case IpOptionType::EndOfOptions:
+        case IpOptionType::NoOp:
+            return result;
+        default:
+            break;
+    }
+
+    auto remaining = header.size() - offset;
+    if (remaining < 2)
+    {
+        return std::unexpected{DropReason::BadIpOption};
+    }
+
+    result.mSize = static_cast<std::uint8_t>(header[offset + 1]);
+    if (result.mSize < 2 || result.mSize > remaining)
+    {
+        return std::unexpected{DropReason::BadIpOption};
+    }
+
+    switch (result.mType)
+    {
+        case IpOptionType::RecordRoute:
+        case IpOptionType::LooseSourceRoute:
+        case IpOptionType::StrictSourceRoute:
+            // A pointer, then a list of addresses
+            if (result.mSize < 3 || (result.mPointer = static_cast<std::uint8_t>(header[offset + 2])) < 4)
+            {
+                return std::unexpected{DropReason::BadIpOption};
+            }
+            return result;
+        case IpOptionType::Timestamp:
+            // A pointer, an overflow count and flags, then the timestamps
+            if (result.mSize < 4 || (result.mPointer = static_cast<std::uint8_t>(header[offset + 2])) < 5)
+            {
+                return std::unexpected{DropReason::BadIpOption};
+            }
+            return result;
+        default:
+            // Well formed but nothing to us, so we just step over them
+            return result;
+    }
+}
+
+inline ParseResult<void> parseIpOptions(std::span<const char> header, IpOptionList& result)
+{
+    result.mCount = 0;
+    std::size_t readOffset{sizeof(IpV4Header)};
+    while (readOffset < header.size())
+    {
+        auto option = parseIpOption(header, readOffset);
+        if (!option)
+        {
+            return std::unexpected{option.error()};
+        }
+
+        readOffset += option->mSize;
+        if (option->mType == IpOptionType::EndOfOptions)
+        {
+            // Anything after this is padding
+            break;
+        }
+
+        if (option->mType == IpOptionType::NoOp)
+        {
+            continue;
+        }
+
+        // We do not forward, so have no business following a route somebody else chose
+        if (option->mType == IpOptionType::LooseSourceRoute || option->mType == IpOptionType::StrictSourceRoute)
+        {
+            return std::unexpected{DropReason::SourceRouted};
+        }
+
+        result.mOptions[result.mCount++] = *option;
+    }
+
+    return {};
+}
+
+// Writes out the options of header which go in every fragment, not just the first (RFC 791),
+// padded to a whole number of words, and returns their size
+// The header is one we built, so anything malformed just ends the options
+inline std::size_t copiedIpOptions(std::span<const char> header, char* buffer)
+{
+    std::size_t writeOffset{0};
+    std::size_t readOffset{sizeof(IpV4Header)};
+    while (readOffset < header.size())
+    {
+        auto type = static_cast<IpOptionType>(header[readOffset]);
+        if (type == IpOptionType::EndOfOptions)
+        {
+            break;
+        }
+        if (type == IpOptionType::NoOp)
+        {
+            readOffset += 1;
+            continue;
+        }
+
+        auto remaining = header.size() - readOffset;
+        std::size_t size = remaining < 2 ? 0 : static_cast<std::uint8_t>(header[readOffset + 1]);
+        if (size < 2 || size > remaining)
+        {
+            break;
+        }
+
+        if (copiedOnFragment(type))
+        {
+            std::memcpy(buffer + writeOffset, header.data() + readOffset, size);
+            writeOffset += size;
+        }
+        readOffset += size;
+    }
+
+    while (writeOffset % 4 != 0)
+    {
+        buffer[writeOffset++] = static_cast<char>(IpOptionType::EndOfOptions);
+    }
+    return writeOffset;
+}
+
+// What the Timestamp option records, milliseconds since midnight UTC
+inline std::uint32_t ipTimestamp()
+{
+    using namespace std::chrono;
+    auto sinceEpoch = system_clock::now().time_since_epoch();
+    return static_cast<std::uint32_t>(duration_cast<milliseconds>(sinceEpoch % days{1}).count());
+}
+
+// Adds ourselves to a Record Route or Timestamp option of a header we are sending back,
+// as RFC 1122 asks of echo replies
+// address is the one we are sending from
+inline void stampIpOption(char* header, const IpOption& option, IpAddress address, std::uint32_t timestamp)
+{
+    char* data = header + option.mOffset;
+    auto addressBytes = std::byteswap(std::bit_cast<std::uint32_t>(address));
+    auto timestampBytes = std::byteswap(timestamp);
+    std::size_t pointer = option.mPointer;
+    if (option.mType == IpOptionType::RecordRoute)
+    {
+        if (pointer + 3 <= option.mSize)
+        {
+            std::memcpy(data + pointer - 1, &addressBytes, sizeof(addressBytes));
+            data[2] = static_cast<char>(pointer + 4);
+        }
+        return;
+    }
+
+    if (option.mType != IpOptionType::Timestamp)
+    {
+        return;
+    }
+
+    static constexpr std::uint8_t cTimestampsOnly{0};
+    static constexpr std::uint8_t cWithAddresses{1};
+    static constexpr std::uint8_t cPrespecified{3};
+    auto overflowFlags = static_cast<std::uint8_t>(data[3]);
+    auto flags = overflowFlags & 0xf;
+    std::size_t entrySize = flags == cTimestampsOnly ? 4 : 8;
+    if (flags != cTimestampsOnly && flags != cWithAddresses && flags != cPrespecified)
+    {
+        return;
+    }
+
+    if (pointer + entrySize - 1 > option.mSize)
+    {
+        // No room, so we can only count ourselves, until the four bit count itself is full
+        if ((overflowFlags >> 4) != 0xf)
+        {
+            data[3] = static_cast<char>(overflowFlags + 0x10);
+        }
+        return;
+    }
+
+    if (flags == cPrespecified && std::memcmp(data + pointer - 1, &addressBytes, sizeof(addressBytes)) != 0)
+    {
+        // Somebody else's turn
+        return;
+    }
+
+    if (flags != cTimestampsOnly)
+    {
+        std::memcpy(data + pointer - 1, &addressBytes, sizeof(addressBytes));
+        pointer += sizeof(addressBytes);
+    }
+    std::memcpy(data + pointer - 1, &timestampBytes, sizeof(timestampBytes));
+    data[2] = static_cast<char>(pointer + sizeof(timestampBytes));
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <Ring.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Logging from the packet thread costs a few stores into a ring:
+// the arguments are copied in as bytes, alongside the format string
+// and a function which knows how to decode them.
+// A background thread drains the ring, does all the formatting,
+// and writes everything it drained to stdout at once.
+//
+// Levels below TILAPIA_LOG_LEVEL compile away to nothing.
+enum class LogLevel : std::uint8_t
+{
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+};
+
+#ifndef TILAPIA_LOG_LEVEL
+#define TILAPIA_LOG_LEVEL 0
+#endif
+
+static constexpr LogLevel cLogLevel{static_cast<LogLevel>(TILAPIA_LOG_LEVEL)};
+
+// How each type of argument is copied into the ring, and read back out
+// Anything trivially copyable is copied as it is
+template <typename T>
+struct LogArg
+{
+    static_assert(std::is_trivially_copyable_v<T>, "Log arguments are copied as bytes, so must be trivially copyable");
+    using Decoded = T;
+
+    static std::size_t size(const T&)
+    {
+        return sizeof(T);
+    }
+
+    static char* encode(const T& value, char* out)
+    {
+        std::memcpy(out, &value, sizeof(T));
+        return out + sizeof(T);
+    }
+
+    static const char* decode(const char* in, Decoded& value)
+    {
+        std::memcpy(&value, in, sizeof(T));
+        return in + sizeof(T);
+    }
+};
+
+// Strings are copied in by value, and read back out as a view into the ring
+template <>
+struct LogArg<std::string_view>
+{
+    using Decoded = std::string_view;
+
+    static std::size_t size(std::string_view value)
+    {
+        return sizeof(std::size_t) + value.size();
+    }
+
+    static char* encode(std::string_view value, char* out)
+    {
+        std::size_t length{value.size()};
+        std::memcpy(out, &length, sizeof(length));
+        std::memcpy(out + sizeof(length), value.data(), length);
+        return out + sizeof(length) + length;
+    }
+
+    static const char* decode(const char* in, Decoded& value)
+    {
+        std::size_t length{};
+        std::memcpy(&length, in, sizeof(length));
+        value = std::string_view{in + sizeof(length), length};
+        return in + sizeof(length) + length;
+    }
+};
+
+// We never want to copy a pointer which might dangle by the time it is formatted
+template <typename T>
+struct LogArgType
+{
+    using Type = T;
+};
+
+template <> struct LogArgType<std::string> { using Type = std::string_view; };
+template <> struct LogArgType<const char*> { using Type = std::string_view; };
+template <> struct LogArgType<char*> { using Type = std::string_view; };
+
+template <typename T>
+using LogArgT = typename LogArgType<std::decay_t<T>>::Type;
+
+using LogFormatFunction = void (*)(std::string_view format, const char* args, std::string& out);
+
+struct LogRecordHeader
+{
+    LogLevel mLevel;
+    LogFormatFunction mFormat;
+    const char* mFormatString;
+    std::size_t mFormatSize;
+};
+
+template <typename... ArgTs>
+void formatLogRecord(std::string_view format, const char* args, std::string& out)
+{
+    std::tuple<typename LogArg<ArgTs>::Decoded...> decoded{};
+    std::apply([&](auto&... values) {
+        ((args = LogArg<ArgTs>::decode(args, values)), ...);
+        std::vformat_to(std::back_inserter(out), format, std::make_format_args(values...));
+    }, decoded);
+    out.push_back('\n');
+}
+
+// Log records in a ring which only the packet thread may write to
+class LogRing
+{
+public:
+    static constexpr std::size_t cCapacity{1 << 22};
+
+    // The format string has already been checked against the arguments,
+    // and must be a literal, as we only keep a pointer to it
+    template <typename... ArgTs>
+    void write(LogLevel level, std::string_view format, const ArgTs&... args)
+    {
+        std::size_t size = sizeof(LogRecordHeader) + (LogArg<ArgTs>::size(args) + ... + 0);
+        char* record = mRing.reserve(size);
+        if (record == nullptr)
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        LogRecordHeader header{level, &formatLogRecord<ArgTs...>, format.data(), format.size()};
+        std::memcpy(record, &header, sizeof(header));
+        char* out = record + sizeof(header);
+        ((out = LogArg<ArgTs>::encode(args, out)), ...);
+        mRing.commit();
+    }
+
+    // Formats every record written so far onto the end of out
+    std::size_t drain(std::string& out)
+    {
+        return mRing.consume([&](const char* record) {
+            LogRecordHeader header{};
+            std::memcpy(&header, record, sizeof(header));
+            header.mFormat({header.mFormatString, header.mFormatSize}, record + sizeof(header), out);
+        });
+    }
+
+    std::uint64_t dropped() const
+    {
+        return mDropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    ByteRing mRing{cCapacity};
+    alignas(64) std::atomic<std::uint64_t> mDropped{};
+};
+
+namespace logging
+{
+inline LogRing gRing{};
+}
+
+template <LogLevel Level, typename... ArgTs>
+inline void log(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    if constexpr (Level >= cLogLevel)
+    {
+        logging::gRing.write<LogArgT<ArgTs>...>(Level, format.get(), LogArgT<ArgTs>{args}...);
+    }
+}
+
+template <typename... ArgTs>
+inline void logDebug(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    log<LogLevel::Debug>(format, std::forward<ArgTs>(args)...);
+}
+
+template <typename... ArgTs>
+inline void logInfo(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    log<LogLevel::Info>(format, std::forward<ArgTs>(args)...);
+}
+
+template <typename... ArgTs>
+inline void logWarning(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    log<LogLevel::Warning>(format, std::forward<ArgTs>(args)...);
+}
+
+template <typename... ArgTs>
+inline void logError(std::format_string<ArgTs...> format, ArgTs&&... args)
+{
+    log<LogLevel::Error>(format, std::forward<ArgTs>(args)...);
+}
+
+// Drains the global ring on a background thread until destroyed,
+// and then once more so nothing logged before then is lost
+class LogDrainer
+{
+public:
+    LogDrainer() : mThread{[this](std::stop_token stopToken) { run(stopToken); }} { }
+
+    ~LogDrainer()
+    {
+        mThread.request_stop();
+        mThread.join();
+        drainOnce();
+    }
+
+    LogDrainer(const LogDrainer&) = delete;
+    LogDrainer& operator=(const LogDrainer&) = delete;
+
+private:
+    void run(std::stop_token stopToken)
+    {
+        static constexpr auto cIdleSleep{std::chrono::milliseconds{1}};
+        while (!stopToken.stop_requested())
+        {
+            if (drainOnce() == 0)
+            {
+                std::this_thread::sleep_for(cIdleSleep);
+            }
+        }
+    }
+
+    std::size_t drainOnce()
+    {
+        mOutput.clear();
+        auto drained = logging::gRing.drain(mOutput);
+
+        auto dropped = logging::gRing.dropped();
+        if (dropped != mReportedDropped)
+        {
+            std::format_to(std::back_inserter(mOutput), "Log ring full, dropped {} records\n", dropped - mReportedDropped);
+            mReportedDropped = dropped;
+        }
+
+        if (!mOutput.empty())
+        {
+            std::fwrite(mOutput.data(), 1, mOutput.size(), stdout);
+            std::fflush(stdout);
+        }
+        return drained;
+    }
+
+    std::string mOutput{};
+    std::uint64_t mReportedDropped{};
+    std::jthread mThread;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <span>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A file mapped read only, to send with Stack::sendRegion
+// Pages are only read in as segments are built from them, so serving a file takes no memory of our own,
+// however big it is, and however many connections are sending it at once.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        mFileDescriptor = open(path.c_str(), O_RDONLY);
+        if (mFileDescriptor < 0)
+        {
+            std::println("Failed to open {}: {}", path, strerror(errno));
+            exit(1);
+        }
+
+        struct stat status{};
+        if (fstat(mFileDescriptor, &status) < 0)
+        {
+            std::println("Failed to size {}: {}", path, strerror(errno));
+            exit(1);
+        }
+
+        // Nothing to map in an empty file
+        mSize = static_cast<std::size_t>(status.st_size);
+        if (mSize == 0)
+        {
+            return;
+        }
+
+        mMapping = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, mFileDescriptor, 0);
+        if (mMapping == MAP_FAILED)
+        {
+            std::println("Failed to map {}: {}", path, strerror(errno));
+            exit(1);
+        }
+        madvise(mMapping, mSize, MADV_SEQUENTIAL);
+    }
+
+    ~MappedFile()
+    {
+        if (mMapping != nullptr)
+        {
+            munmap(mMapping, mSize);
+        }
+        close(mFileDescriptor);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::span<const char> bytes() const
+    {
+        return {static_cast<const char*>(mMapping), mSize};
+    }
+
+private:
+    int mFileDescriptor{-1};
+    std::size_t mSize{};
+    void* mMapping{};
+};
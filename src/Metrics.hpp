@@ -0,0 +1,393 @@
+#pragma once
+
+#include <Parse.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Counters and latency histograms which can be read from outside the process
+// Each worker owns one shard of a memory mapped file and is its only writer,
+// so updates are plain relaxed stores, with no locked instructions and no sharing.
+// A reader maps the same file and adds the shards up, see tools/metrics.cpp.
+enum class Counter : std::uint8_t
+{
+    ReceivedFrames,
+    EthernetFrames,
+    Ipv4Packets,
+    IpFragments,
+    IpReassembled,
+    IpFragmentsSent,
+    PathMtuUpdates,
+    IcmpEchoes,
+    TcpSegments,
+    TcpRetransmits,
+    UdpDatagrams,
+    UdpDatagramsSent,
+    ActiveOpens,
+    ConnectionsEstablished,
+    ConnectionsAccepted,
+    ArpMessages,
+    ArpHits,
+    ArpMisses,
+    TransmittedFrames,
+    TransmitFailures,
+    Count
+};
+
+template <> struct std::formatter<Counter> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const Counter& counter, FormatContext& ctx) const
+    {
+        using enum Counter;
+        switch (counter)
+        {
+        case ReceivedFrames:
+            return std::format_to(ctx.out(), "ReceivedFrames");
+        case EthernetFrames:
+            return std::format_to(ctx.out(), "EthernetFrames");
+        case Ipv4Packets:
+            return std::format_to(ctx.out(), "Ipv4Packets");
+        case IpFragments:
+            return std::format_to(ctx.out(), "IpFragments");
+        case IpReassembled:
+            return std::format_to(ctx.out(), "IpReassembled");
+        case IpFragmentsSent:
+            return std::format_to(ctx.out(), "IpFragmentsSent");
+        case PathMtuUpdates:
+            return std::format_to(ctx.out(), "PathMtuUpdates");
+        case IcmpEchoes:
+            return std::format_to(ctx.out(), "IcmpEchoes");
+        case TcpSegments:
+            return std::format_to(ctx.out(), "TcpSegments");
+        case TcpRetransmits:
+            return std::format_to(ctx.out(), "TcpRetransmits");
+        case UdpDatagrams:
+            return std::format_to(ctx.out(), "UdpDatagrams");
+        case UdpDatagramsSent:
+            return std::format_to(ctx.out(), "UdpDatagramsSent");
+        case ActiveOpens:
+            return std::format_to(ctx.out(), "ActiveOpens");
+        case ConnectionsEstablished:
+            return std::format_to(ctx.out(), "ConnectionsEstablished");
+        case ConnectionsAccepted:
+            return std::format_to(ctx.out(), "ConnectionsAccepted");
+        case ArpMessages:
+            return std::format_to(ctx.out(), "ArpMessages");
+        case ArpHits:
+            return std::format_to(ctx.out(), "ArpHits");
+        case ArpMisses:
+            return std::format_to(ctx.out(), "ArpMisses");
+        case TransmittedFrames:
+            return std::format_to(ctx.out(), "TransmittedFrames");
+        case TransmitFailures:
+            return std::format_to(ctx.out(), "TransmitFailures");
+        default:
+            return std::format_to(ctx.out(), "Unknown counter {}", std::to_underlying(counter));
+        }
+    }
+};
+
+// Buckets in the style of HdrHistogram: each power of two is split into cSubBuckets linear buckets,
+// so every recorded value is within about 6% of its bucket's lower bound,
+// and any 64 bit value can be recorded in under a thousand buckets
+struct LatencyHistogram
+{
+    static constexpr unsigned cSubBucketBits{4};
+    static constexpr std::size_t cSubBuckets{1 << cSubBucketBits};
+    static constexpr std::size_t cBucketCount{(64 - cSubBucketBits + 1) * cSubBuckets};
+
+    using Counts = std::array<std::uint64_t, cBucketCount>;
+
+    static constexpr std::size_t bucketIndex(std::uint64_t value)
+    {
+        if (value < cSubBuckets)
+        {
+            return value;
+        }
+
+        unsigned shift = std::bit_width(value) - 1 - cSubBucketBits;
+        return (shift + 1) * cSubBuckets + ((value >> shift) - cSubBuckets);
+    }
+
+    static constexpr std::uint64_t bucketLowest(std::size_t index)
+    {
+        if (index < cSubBuckets)
+        {
+            return index;
+        }
+
+        unsigned shift = index / cSubBuckets - 1;
+        return (cSubBuckets + index % cSubBuckets) << shift;
+    }
+
+    // The value at or below which the given fraction of recorded values fall
+    static std::uint64_t percentile(const Counts& counts, double fraction)
+    {
+        std::uint64_t total{0};
+        for (auto count : counts)
+        {
+            total += count;
+        }
+
+        auto target = static_cast<std::uint64_t>(fraction * total);
+        std::uint64_t seen{0};
+        for (std::size_t i = 0; i < cBucketCount; i++)
+        {
+            seen += counts[i];
+            if (seen > target || (seen == total && counts[i] != 0))
+            {
+                return bucketLowest(i);
+            }
+        }
+
+        return 0;
+    }
+};
+
+static_assert(LatencyHistogram::bucketIndex(LatencyHistogram::bucketLowest(500)) == 500);
+static_assert(LatencyHistogram::bucketIndex(~std::uint64_t{0}) == LatencyHistogram::cBucketCount - 1);
+
+inline std::uint64_t nowNanos()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Sleeps through long gaps, then spins for the last stretch so we wake on time
+inline void waitUntil(std::uint64_t deadlineNanos)
+{
+    static constexpr std::uint64_t cSpinNanos{200'000};
+    auto now = nowNanos();
+    if (deadlineNanos > now + cSpinNanos)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds{deadlineNanos - now - cSpinNanos});
+    }
+
+    while (nowNanos() < deadlineNanos)
+    {
+    }
+}
+
+// One worker's metrics, laid out directly in the shared file
+struct alignas(64) MetricsShard
+{
+    static constexpr auto cCounterCount{std::to_underlying(Counter::Count)};
+    using Cell = std::atomic<std::uint64_t>;
+    static_assert(Cell::is_always_lock_free, "Metrics are shared between processes, so must be lock free");
+
+    void add(Counter counter, std::uint64_t count = 1)
+    {
+        increment(mCounters[std::to_underlying(counter)], count);
+    }
+
+    void drop(DropReason reason, std::uint64_t count = 1)
+    {
+        increment(mDrops[std::to_underlying(reason)], count);
+    }
+
+    void recordLatency(std::uint64_t nanos)
+    {
+        increment(mLatency[LatencyHistogram::bucketIndex(nanos)], 1);
+    }
+
+    std::uint64_t count(Counter counter) const
+    {
+        return mCounters[std::to_underlying(counter)].load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto& cell : mCounters) cell.store(0, std::memory_order_relaxed);
+        for (auto& cell : mDrops) cell.store(0, std::memory_order_relaxed);
+        for (auto& cell : mLatency) cell.store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<pid_t> mOwner{}; // Zero while no worker has claimed the shard
+    std::array<Cell, cCounterCount> mCounters{};
+    std::array<Cell, DropCounters::cReasonCount> mDrops{};
+    std::array<Cell, LatencyHistogram::cBucketCount> mLatency{};
+
+private:
+    // We are the only writer, so there is no need for an atomic read modify write
+    static void increment(Cell& cell, std::uint64_t count)
+    {
+        cell.store(cell.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+};
+
+struct MetricsFileHeader
+{
+    static constexpr std::uint64_t cMagic{0x7469'6c61'7069'6131}; // "tilapia1"
+    static constexpr std::uint32_t cVersion{1};
+
+    std::uint64_t mMagic;
+    std::uint32_t mVersion;
+    std::uint32_t mShardCount;
+    std::uint64_t mShardSize;
+};
+
+static constexpr auto cDefaultMetricsPath{"/dev/shm/tilapia.metrics"};
+
+inline std::string metricsPath()
+{
+    const char* path = std::getenv("TILAPIA_METRICS_PATH");
+    return path ? path : cDefaultMetricsPath;
+}
+
+// The shared file holding every shard
+// The packet process creates it, and the reader maps it read only
+class MetricsFile
+{
+public:
+    static constexpr std::size_t cDefaultShardCount{8};
+
+    // Creates the file, or reuses one left behind by an earlier run
+    MetricsFile(const std::string& path, std::size_t shardCount) : mWritable{true}
+    {
+        mFileDescriptor = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (mFileDescriptor < 0)
+        {
+            std::println("Failed to open metrics file {}: {}", path, strerror(errno));
+            exit(1);
+        }
+
+        mSize = fileSize(shardCount);
+        if (ftruncate(mFileDescriptor, mSize) < 0)
+        {
+            std::println("Failed to size metrics file {}: {}", path, strerror(errno));
+            exit(1);
+        }
+
+        map(PROT_READ | PROT_WRITE);
+        auto* header = static_cast<MetricsFileHeader*>(mMapping);
+        if (header->mMagic != MetricsFileHeader::cMagic || header->mVersion != MetricsFileHeader::cVersion
+            || header->mShardCount != shardCount || header->mShardSize != sizeof(MetricsShard))
+        {
+            memset(mMapping, 0, mSize);
+            *header = MetricsFileHeader{MetricsFileHeader::cMagic, MetricsFileHeader::cVersion,
+                                        static_cast<std::uint32_t>(shardCount), sizeof(MetricsShard)};
+        }
+    }
+
+    // Opens an existing file to read
+    explicit MetricsFile(const std::string& path) : mWritable{false}
+    {
+        mFileDescriptor = open(path.c_str(), O_RDONLY);
+        if (mFileDescriptor < 0)
+        {
+            std::println("Failed to open metrics file {}: {}", path, strerror(errno));
+            exit(1);
+        }
+
+        MetricsFileHeader header{};
+        if (pread(mFileDescriptor, &header, sizeof(header), 0) != sizeof(header) || header.mMagic != MetricsFileHeader::cMagic
+            || header.mVersion != MetricsFileHeader::cVersion || header.mShardSize != sizeof(MetricsShard))
+        {
+            std::println("{} is not a metrics file this version of tilapia understands", path);
+            exit(1);
+        }
+
+        mSize = fileSize(header.mShardCount);
+        map(PROT_READ);
+    }
+
+    ~MetricsFile()
+    {
+        if (mWritable)
+        {
+            for (std::size_t i = 0; i < shardCount(); i++)
+            {
+                pid_t self = getpid();
+                shard(i).mOwner.compare_exchange_strong(self, 0);
+            }
+        }
+        munmap(mMapping, mSize);
+        close(mFileDescriptor);
+    }
+
+    MetricsFile(const MetricsFile&) = delete;
+    MetricsFile& operator=(const MetricsFile&) = delete;
+
+    std::size_t shardCount() const
+    {
+        return static_cast<const MetricsFileHeader*>(mMapping)->mShardCount;
+    }
+
+    MetricsShard& shard(std::size_t index)
+    {
+        return shards()[index];
+    }
+
+    const MetricsShard& shard(std::size_t index) const
+    {
+        return shards()[index];
+    }
+
+    // Each worker claims a shard of its own, taking over any whose owner has died
+    MetricsShard* claimShard()
+    {
+        pid_t self = getpid();
+        for (std::size_t i = 0; i < shardCount(); i++)
+        {
+            auto& candidate = shard(i);
+            pid_t owner = candidate.mOwner.load();
+            bool ownerDead = owner != 0 && kill(owner, 0) < 0 && errno == ESRCH;
+            if ((owner == 0 || ownerDead) && candidate.mOwner.compare_exchange_strong(owner, self))
+            {
+                candidate.reset();
+                return &candidate;
+            }
+        }
+
+        return nullptr;
+    }
+
+private:
+    // Shards start on their own cache line, after the header
+    static constexpr std::size_t cShardsOffset{alignof(MetricsShard)};
+    static_assert(sizeof(MetricsFileHeader) <= cShardsOffset);
+
+    static std::size_t fileSize(std::size_t shardCount)
+    {
+        return cShardsOffset + shardCount * sizeof(MetricsShard);
+    }
+
+    void map(int protection)
+    {
+        mMapping = mmap(nullptr, mSize, protection, MAP_SHARED, mFileDescriptor, 0);
+        if (mMapping == MAP_FAILED)
+        {
+            std::println("Failed to map metrics file: {}", strerror(errno));
+            exit(1);
+        }
+    }
+
+    MetricsShard* shards() const
+    {
+        return reinterpret_cast<MetricsShard*>(static_cast<char*>(mMapping) + cShardsOffset);
+    }
+
+    bool mWritable{};
+    int mFileDescriptor{-1};
+    std::size_t mSize{};
+    void* mMapping{};
+};
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <Types.hpp>
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+
+// Where we send frames for each address on our link, learned through ARP
+// Entries age much as they do in Linux:
+//   Incomplete - we have asked, and frames wait in the pending queue for an answer
+//   Reachable  - confirmed by a reply to us recently, so used as is
+//   Stale      - learned from someone else's message, or confirmed too long ago,
+//                still used, but using it starts a probe
+//   Probe      - asking the address directly, a few times, before giving up on it
+enum class NeighbourState : std::uint8_t
+{
+    Free,
+    Incomplete,
+    Reachable,
+    Stale,
+    Probe,
+};
+
+template <> struct std::formatter<NeighbourState> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const NeighbourState& state, FormatContext& ctx) const
+    {
+        using enum NeighbourState;
+        switch (state)
+        {
+        case Free:
+            return std::format_to(ctx.out(), "Free");
+        case Incomplete:
+            return std::format_to(ctx.out(), "Incomplete");
+        case Reachable:
+            return std::format_to(ctx.out(), "Reachable");
+        case Stale:
+            return std::format_to(ctx.out(), "Stale");
+        case Probe:
+            return std::format_to(ctx.out(), "Probe");
+        default:
+            return std::format_to(ctx.out(), "Unknown neighbour state {}", std::to_underlying(state));
+        }
+    }
+};
+
+enum class Resolution : std::uint8_t
+{
+    Requested, // Nobody had asked, so a request should go out now
+    Waiting, // A request is already out
+    NoRoom, // Every entry the address could use is busy resolving something else
+};
+
+struct NeighbourEntry
+{
+    IpAddress mIp;
+    MacAddress mMac;
+    NeighbourState mState;
+    std::uint8_t mRequests; // Sent since we last heard from them
+    std::uint32_t mUpdatedAt; // Milliseconds, when the state last changed or a request went out
+};
+static_assert(sizeof(NeighbourEntry) == 16, "Four neighbour entries must fit in a cache line");
+
+// A fixed size, four way set associative table
+// An address can only live in one set, so a lookup reads a single cache line,
+// and when a set is full the least recently updated entry which is not waiting on a reply makes way.
+class NeighbourCache
+{
+public:
+    static constexpr std::size_t cWays{4};
+    static constexpr std::size_t cSets{1024};
+    static constexpr std::uint32_t cReachableMillis{30'000};
+    static constexpr std::uint32_t cStaleMillis{60'000}; // Unused for this long after going stale, an entry is forgotten
+    static constexpr std::uint32_t cRetransmitMillis{1'000};
+    static constexpr std::uint8_t cMaxRequests{3};
+
+    NeighbourCache() : mSets{std::make_unique<Set[]>(cSets)} { }
+
+    static std::uint32_t millis(std::uint64_t nanos)
+    {
+        static constexpr std::uint64_t cNanosPerMilli{1'000'000};
+        return static_cast<std::uint32_t>(nanos / cNanosPerMilli);
+    }
+
+    // Where to send a frame for ip, if we know
+    // Using an entry which has gone stale starts probing it, while we carry on using it
+    std::optional<MacAddress> lookup(IpAddress ip, std::uint64_t nowNanos)
+    {
+        auto* entry = find(ip);
+        if (entry == nullptr || entry->mState == NeighbourState::Incomplete)
+        {
+            return std::nullopt;
+        }
+
+        auto now = millis(nowNanos);
+        if (entry->mState == NeighbourState::Reachable && now - entry->mUpdatedAt >= cReachableMillis)
+        {
+            entry->mState = NeighbourState::Stale;
+            entry->mUpdatedAt = now;
+        }
+
+        if (entry->mState == NeighbourState::Stale)
+        {
+            // The probe's first request goes out on the next call to age
+            entry->mState = NeighbourState::Probe;
+            entry->mRequests = 0;
+            entry->mUpdatedAt = now - cRetransmitMillis;
+        }
+        return entry->mMac;
+    }
+
+    // Whether frames for ip can go now, without changing anything
+    bool resolved(IpAddress ip) const
+    {
+        const auto* entry = find(ip);
+        return entry != nullptr && entry->mState != NeighbourState::Incomplete;
+    }
+
+    // Whether we have asked ip for its address, and are yet to hear back
+    bool awaiting(IpAddress ip) const
+    {
+        const auto* entry = find(ip);
+        return entry != nullptr && (entry->mState == NeighbourState::Incomplete || entry->mState == NeighbourState::Probe);
+    }
+
+    // Starts resolving an address lookup could not find
+    Resolution resolve(IpAddress ip, std::uint64_t nowNanos)
+    {
+        if (find(ip) != nullptr)
+        {
+            return Resolution::Waiting;
+        }
+
+        auto now = millis(nowNanos);
+        auto* entry = allocate(ip, now);
+        if (entry == nullptr)
+        {
+            return Resolution::NoRoom;
+        }
+
+        *entry = NeighbourEntry{ip, MacAddress{}, NeighbourState::Incomplete, 1, now};
+        return Resolution::Requested;
+    }
+
+    // Records what an ARP message told us
+    // A reply to our own request confirms the entry, anything else only leaves it stale.
+    // New entries are only made when create is set, so a sender cannot fill the table by talking to others.
+    void update(IpAddress ip, MacAddress mac, bool confirmed, bool create, std::uint64_t nowNanos)
+    {
+        auto* entry = find(ip);
+        if (entry == nullptr)
+        {
+            if (!create || (entry = allocate(ip, millis(nowNanos))) == nullptr)
+            {
+                return;
+            }
+            *entry = NeighbourEntry{ip, mac, NeighbourState::Stale, 0, millis(nowNanos)};
+        }
+
+        bool changed = entry->mMac != mac;
+        if (confirmed)
+        {
+            entry->mState = NeighbourState::Reachable;
+        }
+        else if (changed || entry->mState == NeighbourState::Incomplete)
+        {
+            entry->mState = NeighbourState::Stale;
+        }
+        else
+        {
+            // Hearing from them again tells us nothing new
+            return;
+        }
+
+        entry->mMac = mac;
+        entry->mRequests = 0;
+        entry->mUpdatedAt = millis(nowNanos);
+    }
+
+    // The timer which moves entries along
+    // request(ip, mac) is called for every request due, with the MAC to send it to while probing,
+    // and failed(ip) for every address which never answered, whose entry is then freed
+    template <typename RequestT, typename FailedT>
+    void age(std::uint64_t nowNanos, RequestT&& request, FailedT&& failed)
+    {
+        static constexpr std::uint32_t cSweepMillis{100};
+        auto now = millis(nowNanos);
+        if (now - mLastSweep < cSweepMillis)
+        {
+            return;
+        }
+        mLastSweep = now;
+
+        for (std::size_t set = 0; set < cSets; set++)
+        {
+            for (auto& entry : mSets[set].mEntries)
+            {
+                auto elapsed = now - entry.mUpdatedAt;
+                switch (entry.mState)
+                {
+                case NeighbourState::Incomplete:
+                case NeighbourState::Probe:
+                    if (elapsed < cRetransmitMillis)
+                    {
+                        break;
+                    }
+                    if (entry.mRequests >= cMaxRequests)
+                    {
+                        failed(entry.mIp);
+                        entry.mState = NeighbourState::Free;
+                        break;
+                    }
+                    entry.mRequests += 1;
+                    entry.mUpdatedAt = now;
+                    request(entry.mIp, entry.mState == NeighbourState::Probe ? std::optional{entry.mMac} : std::nullopt);
+                    break;
+                case NeighbourState::Reachable:
+                    if (elapsed >= cReachableMillis)
+                    {
+                        entry.mState = NeighbourState::Stale;
+                        entry.mUpdatedAt = now;
+                    }
+                    break;
+                case NeighbourState::Stale:
+                    if (elapsed >= cStaleMillis)
+                    {
+                        entry.mState = NeighbourState::Free;
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    const NeighbourEntry* entry(IpAddress ip) const
+    {
+        return find(ip);
+    }
+
+private:
+    struct alignas(64) Set
+    {
+        std::array<NeighbourEntry, cWays> mEntries{};
+    };
+
+    static std::size_t setIndex(IpAddress ip)
+    {
+        static constexpr std::uint32_t cGoldenRatio{0x9e3779b1};
+        static constexpr auto cSetBits{std::countr_zero(cSets)};
+        return (std::bit_cast<std::uint32_t>(ip) * cGoldenRatio) >> (32 - cSetBits);
+    }
+
+    const NeighbourEntry* find(IpAddress ip) const
+    {
+        for (const auto& entry : mSets[setIndex(ip)].mEntries)
+        {
+            if (entry.mState != NeighbourState::Free && entry.mIp == ip)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    NeighbourEntry* find(IpAddress ip)
+    {
+        return const_cast<NeighbourEntry*>(std::as_const(*this).find(ip));
+    }
+
+    // A free way in ip's set, or else the least recently updated one we are not waiting to hear back from
+    NeighbourEntry* allocate(IpAddress ip, std::uint32_t now)
+    {
+        NeighbourEntry* oldest{nullptr};
+        for (auto& entry : mSets[setIndex(ip)].mEntries)
+        {
+            if (entry.mState == NeighbourState::Free)
+            {
+                return &entry;
+            }
+
+            bool waiting = entry.mState == NeighbourState::Incomplete;
+            if (!waiting && (oldest == nullptr || now - entry.mUpdatedAt > now - oldest->mUpdatedAt))
+            {
+                oldest = &entry;
+            }
+        }
+        return oldest;
+    }
+
+    std::unique_ptr<Set[]> mSets;
+    std::uint32_t mLastSweep{};
+};
+
+// Frames we have built but cannot send until their next hop is resolved
+// A fixed ring of slots, so frames go out in the order they were queued.
+// A frame for a neighbour which is still resolving holds its place,
+// and the ring only moves on past it once it is sent or given up on.
+class PendingFrames
+{
+public:
+    static constexpr std::size_t cSlots{256};
+    static constexpr std::size_t cMaxPerNeighbour{64};
+    static constexpr std::size_t cMaxFrameSize{1536}; // A full size Ethernet frame
+
+    PendingFrames() : mSlots{std::make_unique<Slot[]>(cSlots)} { }
+
+    // False if there is no room, in which case the frame is dropped
+    bool push(IpAddress nextHop, std::span<const char> frame)
+    {
+        if (frame.size() > cMaxFrameSize || mTail - mHead == cSlots)
+        {
+            return false;
+        }
+
+        std::size_t forNeighbour{0};
+        for (auto i = mHead; i < mTail; i++)
+        {
+            const auto& slot = mSlots[i % cSlots];
+            if (slot.mSize != 0 && slot.mNextHop == nextHop && ++forNeighbour == cMaxPerNeighbour)
+            {
+                return false;
+            }
+        }
+
+        auto& slot = mSlots[mTail++ % cSlots];
+        slot.mNextHop = nextHop;
+        slot.mSize = static_cast<std::uint16_t>(frame.size());
+        std::memcpy(slot.mBytes.data(), frame.data(), frame.size());
+        return true;
+    }
+
+    bool empty() const
+    {
+        return mHead == mTail;
+    }
+
+    // Hands over, oldest first, every frame for which ready(nextHop) is true,
+    // calling send(nextHop, bytes) until it returns false for want of room
+    template <typename ReadyT, typename SendT>
+    void release(ReadyT&& ready, SendT&& send)
+    {
+        for (auto i = mHead; i < mTail; i++)
+        {
+            auto& slot = mSlots[i % cSlots];
+            if (slot.mSize == 0 || !ready(slot.mNextHop))
+            {
+                continue;
+            }
+
+            if (!send(slot.mNextHop, std::span<const char>{slot.mBytes.data(), slot.mSize}))
+            {
+                break;
+            }
+            slot.mSize = 0;
+        }
+        skipSent();
+    }
+
+    // Throws away every frame waiting on nextHop, returning how many there were
+    std::size_t discard(IpAddress nextHop)
+    {
+        std::size_t discarded{0};
+        for (auto i = mHead; i < mTail; i++)
+        {
+            auto& slot = mSlots[i % cSlots];
+            if (slot.mSize != 0 && slot.mNextHop == nextHop)
+            {
+                slot.mSize = 0;
+                discarded += 1;
+            }
+        }
+        skipSent();
+        return discarded;
+    }
+
+private:
+    struct Slot
+    {
+        IpAddress mNextHop{};
+        std::uint16_t mSize{}; // Zero once the frame is sent or discarded
+        std::array<char, cMaxFrameSize> mBytes{};
+    };
+
+    void skipSent()
+    {
+        while (mHead != mTail && mSlots[mHead % cSlots].mSize == 0)
+        {
+            mHead += 1;
+        }
+    }
+
+    std::unique_ptr<Slot[]> mSlots;
+    std::size_t mHead{};
+    std::size_t mTail{};
+};
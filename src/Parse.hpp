@@ -0,0 +1,229 @@
+#pragma once
+
+#include <Headers.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <numeric>
+#include <span>
+#include <utility>
+
+// Every reason we might drop a frame, whether received or one of our own
+// Parsing a frame never throws: each step returns a ParseResult,
+// and whoever is driving the parse counts why the frame was dropped.
+// A malformed frame should cost us no more than a well formed one.
+enum class DropReason : std::uint8_t
+{
+    ReadFailure,
+    TruncatedVnet,
+    TruncatedEthernet,
+    UnsupportedEtherType,
+    TruncatedIp,
+    BadIpVersion,
+    BadIpHeaderLength,
+    BadIpOption,
+    SourceRouted,
+    BadIpTotalLength,
+    BadIpChecksum,
+    UnsupportedIpProtocol,
+    TruncatedIcmp,
+    BadIcmpChecksum,
+    IgnoredIcmpType,
+    TruncatedTcp,
+    BadTcpHeaderLength,
+    BadTcpOption,
+    BadTcpChecksum,
+    TcpBacklogFull,
+    TcpHalfOpenFull,
+    TruncatedUdp,
+    BadUdpLength,
+    BadUdpChecksum,
+    UdpPortUnreachable,
+    UdpReceiveFull,
+    UdpUnread,
+    DatagramTooLarge,
+    TruncatedArp,
+    UnsupportedArpProtocol,
+    NeighbourTableFull,
+    PendingQueueFull,
+    NeighbourUnreachable,
+    ArpRateLimited,
+    UnsolicitedArpReply,
+    NotLocalAddress,
+    NoRoute,
+    BadFragment,
+    DuplicateFragment,
+    FragmentOverlap,
+    ReassemblyFull,
+    ReassemblyEvicted,
+    ReassemblyTimeout,
+    FragmentationNeeded,
+    UnexpectedIcmpError,
+    Count
+};
+
+template <> struct std::formatter<DropReason> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const DropReason& reason, FormatContext& ctx) const
+    {
+        using enum DropReason;
+        switch (reason)
+        {
+        case ReadFailure:
+            return std::format_to(ctx.out(), "ReadFailure");
+        case TruncatedVnet:
+            return std::format_to(ctx.out(), "TruncatedVnet");
+        case TruncatedEthernet:
+            return std::format_to(ctx.out(), "TruncatedEthernet");
+        case UnsupportedEtherType:
+            return std::format_to(ctx.out(), "UnsupportedEtherType");
+        case TruncatedIp:
+            return std::format_to(ctx.out(), "TruncatedIp");
+        case BadIpVersion:
+            return std::format_to(ctx.out(), "BadIpVersion");
+        case BadIpHeaderLength:
+            return std::format_to(ctx.out(), "BadIpHeaderLength");
+        case BadIpOption:
+            return std::format_to(ctx.out(), "BadIpOption");
+        case SourceRouted:
+            return std::format_to(ctx.out(), "SourceRouted");
+        case BadIpTotalLength:
+            return std::format_to(ctx.out(), "BadIpTotalLength");
+        case BadIpChecksum:
+            return std::format_to(ctx.out(), "BadIpChecksum");
+        case UnsupportedIpProtocol:
+            return std::format_to(ctx.out(), "UnsupportedIpProtocol");
+        case TruncatedIcmp:
+            return std::format_to(ctx.out(), "TruncatedIcmp");
+        case BadIcmpChecksum:
+            return std::format_to(ctx.out(), "BadIcmpChecksum");
+        case IgnoredIcmpType:
+            return std::format_to(ctx.out(), "IgnoredIcmpType");
+        case TruncatedTcp:
+            return std::format_to(ctx.out(), "TruncatedTcp");
+        case BadTcpHeaderLength:
+            return std::format_to(ctx.out(), "BadTcpHeaderLength");
+        case BadTcpOption:
+            return std::format_to(ctx.out(), "BadTcpOption");
+        case BadTcpChecksum:
+            return std::format_to(ctx.out(), "BadTcpChecksum");
+        case TcpBacklogFull:
+            return std::format_to(ctx.out(), "TcpBacklogFull");
+        case TcpHalfOpenFull:
+            return std::format_to(ctx.out(), "TcpHalfOpenFull");
+        case TruncatedUdp:
+            return std::format_to(ctx.out(), "TruncatedUdp");
+        case BadUdpLength:
+            return std::format_to(ctx.out(), "BadUdpLength");
+        case BadUdpChecksum:
+            return std::format_to(ctx.out(), "BadUdpChecksum");
+        case UdpPortUnreachable:
+            return std::format_to(ctx.out(), "UdpPortUnreachable");
+        case UdpReceiveFull:
+            return std::format_to(ctx.out(), "UdpReceiveFull");
+        case UdpUnread:
+            return std::format_to(ctx.out(), "UdpUnread");
+        case DatagramTooLarge:
+            return std::format_to(ctx.out(), "DatagramTooLarge");
+        case TruncatedArp:
+            return std::format_to(ctx.out(), "TruncatedArp");
+        case UnsupportedArpProtocol:
+            return std::format_to(ctx.out(), "UnsupportedArpProtocol");
+        case NeighbourTableFull:
+            return std::format_to(ctx.out(), "NeighbourTableFull");
+        case PendingQueueFull:
+            return std::format_to(ctx.out(), "PendingQueueFull");
+        case NeighbourUnreachable:
+            return std::format_to(ctx.out(), "NeighbourUnreachable");
+        case ArpRateLimited:
+            return std::format_to(ctx.out(), "ArpRateLimited");
+        case UnsolicitedArpReply:
+            return std::format_to(ctx.out(), "UnsolicitedArpReply");
+        case NotLocalAddress:
+            return std::format_to(ctx.out(), "NotLocalAddress");
+        case NoRoute:
+            return std::format_to(ctx.out(), "NoRoute");
+        case BadFragment:
+            return std::format_to(ctx.out(), "BadFragment");
+        case DuplicateFragment:
+            return std::format_to(ctx.out(), "DuplicateFragment");
+        case FragmentOverlap:
+            return std::format_to(ctx.out(), "FragmentOverlap");
+        case ReassemblyFull:
+            return std::format_to(ctx.out(), "ReassemblyFull");
+        case ReassemblyEvicted:
+            return std::format_to(ctx.out(), "ReassemblyEvicted");
+        case ReassemblyTimeout:
+            return std::format_to(ctx.out(), "ReassemblyTimeout");
+        case FragmentationNeeded:
+            return std::format_to(ctx.out(), "FragmentationNeeded");
+        case UnexpectedIcmpError:
+            return std::format_to(ctx.out(), "UnexpectedIcmpError");
+        default:
+            return std::format_to(ctx.out(), "Unknown drop reason {}", std::to_underlying(reason));
+        }
+    }
+};
+
+template <typename T>
+using ParseResult = std::expected<T, DropReason>;
+
+// Only copies the header out of the buffer once we know it is all there
+template <typename HeaderT>
+ParseResult<HeaderT> tryFromWire(std::span<const char> buffer, DropReason truncatedReason)
+{
+    if (buffer.size() < sizeof(HeaderT))
+    {
+        return std::unexpected{truncatedReason};
+    }
+
+    return fromWire<HeaderT>(buffer.data());
+}
+
+class DropCounters
+{
+public:
+    static constexpr auto cReasonCount{std::to_underlying(DropReason::Count)};
+
+    void record(DropReason reason, std::uint64_t count = 1)
+    {
+        mCounts[std::to_underlying(reason)] += count;
+    }
+
+    std::uint64_t count(DropReason reason) const
+    {
+        return mCounts[std::to_underlying(reason)];
+    }
+
+    std::uint64_t total() const
+    {
+        return std::accumulate(mCounts.begin(), mCounts.end(), std::uint64_t{0});
+    }
+
+private:
+    std::array<std::uint64_t, cReasonCount> mCounts{};
+};
+
+template <> struct std::formatter<DropCounters> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const DropCounters& counters, FormatContext& ctx) const
+    {
+        std::format_to(ctx.out(), "Dropped {} frames", counters.total());
+        for (std::size_t i = 0; i < DropCounters::cReasonCount; i++)
+        {
+            auto reason = static_cast<DropReason>(i);
+            if (counters.count(reason) != 0)
+            {
+                std::format_to(ctx.out(), ", {}: {}", reason, counters.count(reason));
+            }
+        }
+
+        return ctx.out();
+    }
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// The largest datagram which gets through to each destination, as RFC 1191 has us learn it
+// Routers tell us with a Fragmentation Needed message when a datagram was too big for the next hop.
+// What we learn is only ever lowered by those messages, and forgotten after ten minutes,
+// when we go back to trying the link MTU.
+// A fixed table, indexed by a hash of the destination, so a new destination may push out another.
+class PathMtuCache
+{
+public:
+    static constexpr std::size_t cEntries{1024};
+    static constexpr std::uint16_t cMinimumMtu{552}; // As Linux, so a forged message cannot have us send tiny fragments
+    static constexpr std::uint64_t cExpiryNanos{600'000'000'000};
+
+    explicit PathMtuCache(std::uint16_t linkMtu = 1500) : mLinkMtu{linkMtu}, mEntries{std::make_unique<Entry[]>(cEntries)} { }
+
+    std::uint16_t linkMtu() const
+    {
+        return mLinkMtu;
+    }
+
+    std::uint16_t mtu(IpAddress destination, std::uint64_t nowNanos) const
+    {
+        const auto& entry = mEntries[index(destination)];
+        if (entry.mMtu == 0 || entry.mDestination != destination || nowNanos - entry.mLearnedAt >= cExpiryNanos)
+        {
+            return mLinkMtu;
+        }
+        return std::min(entry.mMtu, mLinkMtu);
+    }
+
+    // From a Fragmentation Needed message about a datagram of originalLength bytes to destination
+    // Returns whether we now send anything smaller
+    bool update(IpAddress destination, std::uint16_t nextHopMtu, std::uint16_t originalLength, std::uint64_t nowNanos)
+    {
+        // Routers from before RFC 1191 leave the MTU out, so we guess at the next plateau down
+        auto learned = nextHopMtu != 0 ? nextHopMtu : plateauBelow(originalLength);
+        learned = std::max(learned, cMinimumMtu);
+        if (learned >= mtu(destination, nowNanos))
+        {
+            return false;
+        }
+
+        mEntries[index(destination)] = Entry{destination, learned, nowNanos};
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        IpAddress mDestination{};
+        std::uint16_t mMtu{}; // Zero when unused
+        std::uint64_t mLearnedAt{};
+    };
+
+    static std::size_t index(IpAddress destination)
+    {
+        static constexpr std::uint32_t cGoldenRatio{0x9e3779b1};
+        static constexpr auto cIndexBits{std::countr_zero(cEntries)};
+        return (std::bit_cast<std::uint32_t>(destination) * cGoldenRatio) >> (32 - cIndexBits);
+    }
+
+    // The common MTUs RFC 1191 suggests
+    static std::uint16_t plateauBelow(std::uint16_t length)
+    {
+        static constexpr std::array<std::uint16_t, 11> cPlateaus{65535, 32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68};
+        for (auto plateau : cPlateaus)
+        {
+            if (plateau < length)
+            {
+                return plateau;
+            }
+        }
+        return cPlateaus.back();
+    }
+
+    std::uint16_t mLinkMtu;
+    std::unique_ptr<Entry[]> mEntries;
+};
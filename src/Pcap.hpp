@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Reading and writing captures in the pcap and pcapng formats, Ethernet frames only
+// A capture is read into memory up front, so replaying it never touches the disk.
+
+// One captured frame, pointing into the file's bytes
+struct PcapRecord
+{
+    std::uint64_t mTimestampNanos{};
+    std::span<const char> mBytes{};
+    std::uint32_t mOriginalLength{}; // Longer than mBytes when the capture was snapped
+};
+
+namespace pcap
+{
+
+static constexpr std::uint32_t cLinkTypeEthernet{1};
+
+// Classic pcap
+static constexpr std::uint32_t cMicrosecondMagic{0xa1b2c3d4};
+static constexpr std::uint32_t cNanosecondMagic{0xa1b23c4d};
+
+struct FileHeader
+{
+    std::uint32_t mMagic;
+    std::uint16_t mVersionMajor;
+    std::uint16_t mVersionMinor;
+    std::int32_t mThisZone;
+    std::uint32_t mSigFigs;
+    std::uint32_t mSnapLength;
+    std::uint32_t mLinkType;
+};
+static_assert(sizeof(FileHeader) == 24);
+
+struct RecordHeader
+{
+    std::uint32_t mSeconds;
+    std::uint32_t mFraction;
+    std::uint32_t mCapturedLength;
+    std::uint32_t mOriginalLength;
+};
+static_assert(sizeof(RecordHeader) == 16);
+
+// pcapng
+static constexpr std::uint32_t cSectionHeaderBlock{0x0a0d0d0a};
+static constexpr std::uint32_t cInterfaceDescriptionBlock{1};
+static constexpr std::uint32_t cSimplePacketBlock{3};
+static constexpr std::uint32_t cEnhancedPacketBlock{6};
+static constexpr std::uint32_t cByteOrderMagic{0x1a2b3c4d};
+static constexpr std::uint16_t cOptionEnd{0};
+static constexpr std::uint16_t cOptionTimestampResolution{9};
+
+// Structures are read as they are, and their fields swapped by the caller
+template <typename T>
+std::optional<T> read(std::span<const char> bytes, std::size_t offset, bool swapped)
+{
+    if (offset > bytes.size() || bytes.size() - offset < sizeof(T))
+    {
+        return std::nullopt;
+    }
+
+    T value{};
+    std::memcpy(&value, bytes.data() + offset, sizeof(T));
+    if constexpr (std::is_integral_v<T>)
+    {
+        return swapped ? std::byteswap(value) : value;
+    }
+    return value;
+}
+
+inline std::size_t padded(std::size_t length)
+{
+    static constexpr std::size_t cAlignment{4};
+    return (length + cAlignment - 1) & ~(cAlignment - 1);
+}
+
+}
+
+// A capture file held in memory
+// Anything we cannot make sense of ends the records early rather than failing the whole file,
+// so a capture cut off part way through still replays
+class PcapFile
+{
+public:
+    explicit PcapFile(const std::string& path)
+    {
+        std::ifstream file{path, std::ios::binary};
+        if (!file)
+        {
+            std::println("Failed to open capture file {}", path);
+            exit(1);
+        }
+        mBytes.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+
+        auto magic = pcap::read<std::uint32_t>(mBytes, 0, false);
+        if (magic == pcap::cSectionHeaderBlock)
+        {
+            parseNextGeneration();
+        }
+        else if (magic.has_value())
+        {
+            parseClassic(*magic);
+        }
+
+        if (!mError.empty())
+        {
+            std::println("Failed to read capture file {}: {}", path, mError);
+            exit(1);
+        }
+    }
+
+    PcapFile(const PcapFile&) = delete;
+    PcapFile& operator=(const PcapFile&) = delete;
+
+    const std::vector<PcapRecord>& records() const
+    {
+        return mRecords;
+    }
+
+private:
+    void parseClassic(std::uint32_t magic)
+    {
+        bool swapped = magic == std::byteswap(pcap::cMicrosecondMagic) || magic == std::byteswap(pcap::cNanosecondMagic);
+        if (swapped)
+        {
+            magic = std::byteswap(magic);
+        }
+
+        if (magic != pcap::cMicrosecondMagic && magic != pcap::cNanosecondMagic)
+        {
+            mError = "not a pcap or pcapng file";
+            return;
+        }
+
+        auto linkType = pcap::read<std::uint32_t>(mBytes, offsetof(pcap::FileHeader, mLinkType), swapped);
+        if (linkType != pcap::cLinkTypeEthernet)
+        {
+            mError = "only Ethernet captures are supported";
+            return;
+        }
+
+        static constexpr std::uint64_t cNanosPerMicro{1000};
+        std::uint64_t fractionNanos = magic == pcap::cNanosecondMagic ? 1 : cNanosPerMicro;
+        std::size_t offset{sizeof(pcap::FileHeader)};
+        while (auto header = pcap::read<pcap::RecordHeader>(mBytes, offset, false))
+        {
+            if (swapped)
+            {
+                header->mSeconds = std::byteswap(header->mSeconds);
+                header->mFraction = std::byteswap(header->mFraction);
+                header->mCapturedLength = std::byteswap(header->mCapturedLength);
+                header->mOriginalLength = std::byteswap(header->mOriginalLength);
+            }
+
+            offset += sizeof(pcap::RecordHeader);
+            if (header->mCapturedLength > mBytes.size() - offset)
+            {
+                break;
+            }
+
+            static constexpr std::uint64_t cNanosPerSecond{1'000'000'000};
+            auto timestamp = header->mSeconds * cNanosPerSecond + header->mFraction * fractionNanos;
+            mRecords.push_back({timestamp, std::span<const char>{mBytes}.subspan(offset, header->mCapturedLength), header->mOriginalLength});
+            offset += header->mCapturedLength;
+        }
+    }
+
+    struct Interface
+    {
+        std::uint32_t mLinkType{};
+        std::uint64_t mTicksPerSecond{1'000'000};
+    };
+
+    void parseNextGeneration()
+    {
+        std::span<const char> bytes{mBytes};
+        std::vector<Interface> interfaces{};
+        bool swapped{false};
+        std::size_t offset{0};
+        while (offset < bytes.size())
+        {
+            auto type = pcap::read<std::uint32_t>(bytes, offset, swapped);
+            if (type == pcap::cSectionHeaderBlock)
+            {
+                // Each section says which way round its own numbers are
+                auto byteOrder = pcap::read<std::uint32_t>(bytes, offset + 8, false);
+                if (byteOrder != pcap::cByteOrderMagic && byteOrder != std::byteswap(pcap::cByteOrderMagic))
+                {
+                    mError = "bad byte order magic";
+                    return;
+                }
+                swapped = byteOrder != pcap::cByteOrderMagic;
+                interfaces.clear();
+            }
+
+            auto length = pcap::read<std::uint32_t>(bytes, offset + 4, swapped);
+            if (!type || !length || *length < 12 || *length % 4 != 0 || *length > bytes.size() - offset)
+            {
+                break;
+            }
+
+            auto block = bytes.subspan(offset, *length);
+            switch (*type)
+            {
+                case pcap::cInterfaceDescriptionBlock:
+                    interfaces.push_back(parseInterface(block, swapped));
+                    break;
+                case pcap::cEnhancedPacketBlock:
+                    parseEnhancedPacket(block, swapped, interfaces);
+                    break;
+                case pcap::cSimplePacketBlock:
+                    parseSimplePacket(block, swapped, interfaces);
+                    break;
+                default:
+                    break;
+            }
+            offset += *length;
+        }
+    }
+
+    static Interface parseInterface(std::span<const char> block, bool swapped)
+    {
+        static constexpr std::size_t cOptionsOffset{16};
+        Interface interface{pcap::read<std::uint16_t>(block, 8, swapped).value_or(0)};
+
+        // Options run up to the trailing copy of the block length
+        std::size_t offset{cOptionsOffset};
+        while (offset + 4 <= block.size() - 4)
+        {
+            auto code = *pcap::read<std::uint16_t>(block, offset, swapped);
+            auto length = *pcap::read<std::uint16_t>(block, offset + 2, swapped);
+            if (code == pcap::cOptionEnd)
+            {
+                break;
+            }
+
+            if (code == pcap::cOptionTimestampResolution && length >= 1 && offset + 4 < block.size())
+            {
+                // The top bit picks a power of two rather than a power of ten
+                auto resolution = static_cast<std::uint8_t>(block[offset + 4]);
+                static constexpr std::uint8_t cPowerOfTwo{0x80};
+                static constexpr std::uint8_t cExponentMask{0x7f};
+                std::uint8_t exponent = resolution & cExponentMask;
+                interface.mTicksPerSecond = 1;
+                for (std::uint8_t i = 0; i < exponent && interface.mTicksPerSecond < (std::uint64_t{1} << 60); i++)
+                {
+                    interface.mTicksPerSecond *= (resolution & cPowerOfTwo) ? 2 : 10;
+                }
+            }
+            offset += 4 + pcap::padded(length);
+        }
+        return interface;
+    }
+
+    void parseEnhancedPacket(std::span<const char> block, bool swapped, const std::vector<Interface>& interfaces)
+    {
+        static constexpr std::size_t cDataOffset{28};
+        auto interfaceId = pcap::read<std::uint32_t>(block, 8, swapped);
+        auto high = pcap::read<std::uint32_t>(block, 12, swapped);
+        auto low = pcap::read<std::uint32_t>(block, 16, swapped);
+        auto captured = pcap::read<std::uint32_t>(block, 20, swapped);
+        auto original = pcap::read<std::uint32_t>(block, 24, swapped);
+        if (!interfaceId || !high || !low || !captured || !original || *interfaceId >= interfaces.size()
+            || interfaces[*interfaceId].mLinkType != pcap::cLinkTypeEthernet || *captured > block.size() - cDataOffset)
+        {
+            return;
+        }
+
+        std::uint64_t ticks = (std::uint64_t{*high} << 32) | *low;
+        mRecords.push_back({toNanos(ticks, interfaces[*interfaceId].mTicksPerSecond), block.subspan(cDataOffset, *captured), *original});
+    }
+
+    // Simple packets have no timestamp, and no captured length, so take up the whole block
+    void parseSimplePacket(std::span<const char> block, bool swapped, const std::vector<Interface>& interfaces)
+    {
+        static constexpr std::size_t cDataOffset{12};
+        auto original = pcap::read<std::uint32_t>(block, 8, swapped);
+        if (!original || block.size() < cDataOffset + 4 || interfaces.empty() || interfaces.front().mLinkType != pcap::cLinkTypeEthernet)
+        {
+            return;
+        }
+
+        auto captured = std::min<std::size_t>(*original, block.size() - cDataOffset - 4);
+        mRecords.push_back({0, block.subspan(cDataOffset, captured), *original});
+    }
+
+    static std::uint64_t toNanos(std::uint64_t ticks, std::uint64_t ticksPerSecond)
+    {
+        static constexpr std::uint64_t cNanosPerSecond{1'000'000'000};
+        auto seconds = ticks / ticksPerSecond;
+        auto remainder = ticks % ticksPerSecond;
+        return seconds * cNanosPerSecond + static_cast<std::uint64_t>(static_cast<double>(remainder) * cNanosPerSecond / ticksPerSecond);
+    }
+
+    std::vector<char> mBytes{};
+    std::vector<PcapRecord> mRecords{};
+    std::string mError{};
+};
+
+// Captures are stamped with the wall clock, so they line up with captures taken elsewhere
+inline std::uint64_t captureTimestamp()
+{
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Writes a classic pcap file with nanosecond timestamps
+class PcapWriter
+{
+public:
+    static constexpr std::uint32_t cSnapLength{65535};
+
+    explicit PcapWriter(const std::string& path)
+    {
+        mFile = std::fopen(path.c_str(), "wb");
+        if (mFile == nullptr)
+        {
+            std::println("Failed to open capture file {} for writing", path);
+            exit(1);
+        }
+
+        static constexpr std::uint16_t cVersionMajor{2};
+        static constexpr std::uint16_t cVersionMinor{4};
+        pcap::FileHeader header{pcap::cNanosecondMagic, cVersionMajor, cVersionMinor, 0, 0, cSnapLength, pcap::cLinkTypeEthernet};
+        std::fwrite(&header, sizeof(header), 1, mFile);
+    }
+
+    ~PcapWriter()
+    {
+        std::fclose(mFile);
+    }
+
+    PcapWriter(const PcapWriter&) = delete;
+    PcapWriter& operator=(const PcapWriter&) = delete;
+
+    void write(std::uint64_t timestampNanos, std::span<const char> bytes)
+    {
+        static constexpr std::uint64_t cNanosPerSecond{1'000'000'000};
+        auto captured = static_cast<std::uint32_t>(std::min<std::size_t>(bytes.size(), cSnapLength));
+        pcap::RecordHeader header{static_cast<std::uint32_t>(timestampNanos / cNanosPerSecond),
+                                  static_cast<std::uint32_t>(timestampNanos % cNanosPerSecond), captured, static_cast<std::uint32_t>(bytes.size())};
+        std::fwrite(&header, sizeof(header), 1, mFile);
+        std::fwrite(bytes.data(), 1, captured, mFile);
+    }
+
+private:
+    std::FILE* mFile{};
+};
+
+// Writes pcapng, starting a new file once the current one passes maxFileBytes,
+// and deleting the oldest so at most maxFiles are kept
+// Files are named <prefix>.<n>.pcapng, counting up from zero
+class PcapNgWriter
+{
+public:
+    enum class Direction : std::uint8_t
+    {
+        Inbound = 1,
+        Outbound = 2,
+    };
+
+    PcapNgWriter(std::string prefix, std::size_t maxFileBytes, std::size_t maxFiles, std::uint32_t snapLength)
+        : mPrefix{std::move(prefix)}, mMaxFileBytes{maxFileBytes}, mMaxFiles{std::max<std::size_t>(maxFiles, 1)}, mSnapLength{snapLength}
+    {
+        openNext();
+    }
+
+    ~PcapNgWriter()
+    {
+        if (mFile != nullptr)
+        {
+            std::fclose(mFile);
+        }
+    }
+
+    PcapNgWriter(const PcapNgWriter&) = delete;
+    PcapNgWriter& operator=(const PcapNgWriter&) = delete;
+
+    void write(std::uint64_t timestampNanos, Direction direction, std::span<const char> bytes, std::uint32_t originalLength)
+    {
+        if (mFileBytes >= mMaxFileBytes)
+        {
+            openNext();
+        }
+
+        static constexpr std::uint16_t cOptionFlags{2};
+        static constexpr std::size_t cFixedSize{28 + 8 + 4 + 4};
+        auto captured = static_cast<std::uint32_t>(bytes.size());
+        auto length = static_cast<std::uint32_t>(cFixedSize + pcap::padded(captured));
+
+        writeWords(pcap::cEnhancedPacketBlock, length, 0, static_cast<std::uint32_t>(timestampNanos >> 32),
+                   static_cast<std::uint32_t>(timestampNanos), captured, originalLength);
+        writePadded(bytes);
+        writeOption(cOptionFlags, static_cast<std::uint32_t>(std::to_underlying(direction)));
+        writeWords(std::uint32_t{pcap::cOptionEnd}, length);
+        mFileBytes += length;
+    }
+
+    void flush()
+    {
+        std::fflush(mFile);
+    }
+
+private:
+    template <typename... WordTs>
+    void writeWords(WordTs... words)
+    {
+        std::array<std::uint32_t, sizeof...(WordTs)> values{static_cast<std::uint32_t>(words)...};
+        std::fwrite(values.data(), sizeof(std::uint32_t), values.size(), mFile);
+    }
+
+    void writePadded(std::span<const char> bytes)
+    {
+        static constexpr std::array<char, 4> cZeroes{};
+        std::fwrite(bytes.data(), 1, bytes.size(), mFile);
+        std::fwrite(cZeroes.data(), 1, pcap::padded(bytes.size()) - bytes.size(), mFile);
+    }
+
+    // An option whose value is a single 32 bit word
+    void writeOption(std::uint16_t code, std::uint32_t value)
+    {
+        std::array<std::uint16_t, 2> header{code, sizeof(value)};
+        std::fwrite(header.data(), sizeof(std::uint16_t), header.size(), mFile);
+        std::fwrite(&value, sizeof(value), 1, mFile);
+    }
+
+    void openNext()
+    {
+        if (mFile != nullptr)
+        {
+            std::fclose(mFile);
+        }
+
+        if (mIndex >= mMaxFiles)
+        {
+            std::remove(path(mIndex - mMaxFiles).c_str());
+        }
+
+        auto nextPath = path(mIndex++);
+        mFile = std::fopen(nextPath.c_str(), "wb");
+        if (mFile == nullptr)
+        {
+            std::println("Failed to open capture file {} for writing", nextPath);
+            exit(1);
+        }
+
+        // A section header, then a single Ethernet interface with nanosecond timestamps
+        static constexpr std::uint32_t cSectionLength{28};
+        static constexpr std::uint16_t cMajorVersion{1};
+        static constexpr std::uint16_t cMinorVersion{0};
+        static constexpr std::uint32_t cUnknownSectionSize{0xffffffff};
+        writeWords(pcap::cSectionHeaderBlock, cSectionLength, pcap::cByteOrderMagic,
+                   (std::uint32_t{cMinorVersion} << 16) | cMajorVersion, cUnknownSectionSize, cUnknownSectionSize, cSectionLength);
+
+        static constexpr std::uint32_t cInterfaceLength{32};
+        static constexpr std::uint32_t cNanosecondResolution{9};
+        writeWords(pcap::cInterfaceDescriptionBlock, cInterfaceLength, pcap::cLinkTypeEthernet, mSnapLength);
+        std::array<std::uint16_t, 2> resolutionHeader{pcap::cOptionTimestampResolution, 1};
+        std::fwrite(resolutionHeader.data(), sizeof(std::uint16_t), resolutionHeader.size(), mFile);
+        writeWords(cNanosecondResolution, std::uint32_t{pcap::cOptionEnd}, cInterfaceLength);
+        mFileBytes = cSectionLength + cInterfaceLength;
+    }
+
+    std::string path(std::size_t index) const
+    {
+        return std::format("{}.{}.pcapng", mPrefix, index);
+    }
+
+    std::string mPrefix;
+    std::size_t mMaxFileBytes;
+    std::size_t mMaxFiles;
+    std::uint32_t mSnapLength;
+    std::FILE* mFile{};
+    std::size_t mIndex{};
+    std::size_t mFileBytes{};
+};
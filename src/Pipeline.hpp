@@ -0,0 +1,278 @@
+#pragma once
+
+#include <Frame.hpp>
+#include <Parse.hpp>
+#include <RxArena.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// One frame on its way through the stack
+// Each stage leaves the bytes for the next layer up in the frame,
+// so any stage can be rerun or measured on its own
+struct Frame
+{
+    std::span<char> mRxBytes{}; // Everything we received, after any virtual network header
+    LayerBytes mBytes{}; // A read only view of the same bytes
+    LayerBytes mNetwork{}; // Set by the Ethernet stage
+    LayerBytes mTransport{}; // Set by the IP stage
+    ParsedFrame mParsed{};
+    std::optional<DropReason> mDropReason{};
+    std::uint64_t mReceivedAt{}; // Nanoseconds, for measuring how long we took to reply
+
+    std::span<char> mTxBuffer{}; // Where any new reply is built
+    LayerBytes mTx{}; // What to send, non empty once a stage has replied
+
+    // The bytes are in a buffer we own, so stages may rewrite them into a reply
+    void reset(std::span<char> bytes)
+    {
+        mRxBytes = bytes;
+        mBytes = bytes;
+        mNetwork = {};
+        mTransport = {};
+        mDropReason = std::nullopt;
+        mTx = {};
+    }
+
+    // Where one of our layers lives in the receive buffer, for rewriting it in place
+    char* writable(LayerBytes layer)
+    {
+        return mRxBytes.data() + (layer.data() - mBytes.data());
+    }
+};
+
+// Stages are handed frames a batch at a time,
+// so each stage's code stays hot while it runs over the whole batch
+class FrameBatch
+{
+public:
+    static constexpr std::size_t cMaxFrames{64};
+
+    void push(Frame* frame)
+    {
+        mFrames[mCount++] = frame;
+    }
+
+    void clear()
+    {
+        mCount = 0;
+    }
+
+    std::size_t size() const
+    {
+        return mCount;
+    }
+
+    bool empty() const
+    {
+        return mCount == 0;
+    }
+
+    bool full() const
+    {
+        return mCount == cMaxFrames;
+    }
+
+    Frame* operator[](std::size_t index) const
+    {
+        return mFrames[index];
+    }
+
+    // Starts pulling a later frame's layer into cache while we work on an earlier one
+    void prefetch(std::size_t index, LayerBytes Frame::* layer) const
+    {
+        if (index < mCount)
+        {
+            __builtin_prefetch((mFrames[index]->*layer).data());
+            __builtin_prefetch(&mFrames[index]->mParsed);
+        }
+    }
+
+    Frame* const* begin() const
+    {
+        return mFrames.data();
+    }
+
+    Frame* const* end() const
+    {
+        return mFrames.data() + mCount;
+    }
+
+private:
+    std::array<Frame*, cMaxFrames> mFrames{};
+    std::size_t mCount{};
+};
+
+// How many frames ahead of the one being processed a stage prefetches
+static constexpr std::size_t cPrefetchDistance{4};
+
+// Receive and transmit buffers for a full batch of frames, allocated once up front
+// Too big for the stack, so allocate it on the heap
+// Built on an RxBufferArena it receives into the arena's buffers instead, so streams can lend payloads out,
+// swapping in a fresh buffer whenever the last one read into a slot is still lent.
+class FramePool
+{
+public:
+    // Large enough for a jumbo frame
+    static constexpr std::size_t cBufferSize{RxBufferArena::cBufferSize};
+
+    FramePool()
+    {
+        for (std::size_t i = 0; i < FrameBatch::cMaxFrames; i++)
+        {
+            mFrames[i].mTxBuffer = mTxBuffers[i];
+        }
+    }
+
+    explicit FramePool(RxBufferArena& arena) : FramePool()
+    {
+        mArena = &arena;
+        mArena->reserve(FrameBatch::cMaxFrames);
+        for (auto& buffer : mArenaBuffers)
+        {
+            buffer = *arena.allocate();
+        }
+    }
+
+    ~FramePool()
+    {
+        if (mArena != nullptr)
+        {
+            for (auto buffer : mArenaBuffers)
+            {
+                mArena->release(buffer);
+            }
+            mArena->unreserve(FrameBatch::cMaxFrames);
+        }
+    }
+
+    // Our frames point into our own buffers
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    std::span<char> rxBuffer(std::size_t index)
+    {
+        if (mArena == nullptr)
+        {
+            return mRxBuffers[index];
+        }
+
+        // What we reserved means there is always a buffer to swap in
+        auto& buffer = mArenaBuffers[index];
+        if (mArena->lent(buffer))
+        {
+            mArena->release(buffer);
+            buffer = *mArena->allocate();
+        }
+        return mArena->bytes(buffer);
+    }
+
+    Frame& frame(std::size_t index)
+    {
+        return mFrames[index];
+    }
+
+    // Copies in a frame from somewhere other than a device, as if we had just received it
+    Frame& load(std::size_t index, LayerBytes bytes)
+    {
+        auto destination = rxBuffer(index).first(std::min(bytes.size(), cBufferSize));
+        std::memcpy(destination.data(), bytes.data(), destination.size());
+        mFrames[index].reset(destination);
+        return mFrames[index];
+    }
+
+private:
+    std::array<std::array<char, cBufferSize>, FrameBatch::cMaxFrames> mRxBuffers{};
+    std::array<std::array<char, cBufferSize>, FrameBatch::cMaxFrames> mTxBuffers{};
+    std::array<Frame, FrameBatch::cMaxFrames> mFrames{};
+    RxBufferArena* mArena{};
+    std::array<std::uint32_t, FrameBatch::cMaxFrames> mArenaBuffers{};
+};
+
+// Tells a Demux where to find its key in a frame,
+// and why a frame is dropped when no handler is registered for its key
+template <typename KeyT>
+struct DemuxKey;
+
+template <>
+struct DemuxKey<EtherType>
+{
+    static constexpr auto cUnmatched{DropReason::UnsupportedEtherType};
+
+    static EtherType of(const Frame& frame)
+    {
+        return frame.mParsed.mEthernetHeader.mEthertype;
+    }
+};
+
+template <>
+struct DemuxKey<IPProtocol>
+{
+    static constexpr auto cUnmatched{DropReason::UnsupportedIpProtocol};
+
+    static IPProtocol of(const Frame& frame)
+    {
+        return frame.mParsed.mIpHeader.mProto;
+    }
+};
+
+// Splits a batch between handlers by key, then runs each handler over its share
+// Handlers are registered by listing them as template arguments,
+// each declaring the key it handles as a static constexpr cKey.
+// The routing is a fold over the handler list, so there is no indirection
+// and the handlers can be inlined into the stage below them.
+// Adding a protocol means writing a handler and adding it to a list.
+template <typename ContextT, typename KeyT, typename... HandlerTs>
+class Demux
+{
+    static_assert((std::is_same_v<std::remove_cv_t<decltype(HandlerTs::cKey)>, KeyT> && ...), "Handler key type does not match demux key type");
+
+    using Routed = std::array<FrameBatch, sizeof...(HandlerTs)>;
+
+public:
+    explicit Demux(ContextT& context) : mContext{context}, mHandlers{HandlerTs{context}...} { }
+
+    void process(const FrameBatch& batch)
+    {
+        Routed routed{};
+        for (auto* frame : batch)
+        {
+            if (!route(DemuxKey<KeyT>::of(*frame), frame, routed, std::index_sequence_for<HandlerTs...>{}))
+            {
+                mContext.drop(*frame, DemuxKey<KeyT>::cUnmatched);
+            }
+        }
+
+        dispatch(routed, std::index_sequence_for<HandlerTs...>{});
+    }
+
+    template <typename HandlerT>
+    HandlerT& handler()
+    {
+        return std::get<HandlerT>(mHandlers);
+    }
+
+private:
+    template <std::size_t... Indices>
+    static bool route(KeyT key, Frame* frame, Routed& routed, std::index_sequence<Indices...>)
+    {
+        return ((key == HandlerTs::cKey && (routed[Indices].push(frame), true)) || ...);
+    }
+
+    template <std::size_t... Indices>
+    void dispatch(Routed& routed, std::index_sequence<Indices...>)
+    {
+        ((routed[Indices].empty() || (std::get<Indices>(mHandlers).process(routed[Indices]), true)), ...);
+    }
+
+    ContextT& mContext;
+    std::tuple<HandlerTs...> mHandlers;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <SipHash.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// So many a second, with up to a burst of them at once
+struct RateLimit
+{
+    std::uint32_t mRate{};
+    std::uint32_t mBurst{};
+};
+
+class TokenBucket
+{
+public:
+    bool take(const RateLimit& limit, std::uint32_t nowMillis)
+    {
+        // A rate a second is the same number of thousandths of a token a millisecond
+        std::uint64_t refill = std::uint64_t{nowMillis - mRefilledAt} * limit.mRate;
+        mTokens = static_cast<std::uint32_t>(std::min<std::uint64_t>(mTokens + refill, std::uint64_t{limit.mBurst} * cScale));
+        mRefilledAt = nowMillis;
+        if (mTokens < cScale)
+        {
+            return false;
+        }
+
+        mTokens -= cScale;
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t cScale{1000}; // Counted in thousandths, so every millisecond refills something
+
+    std::uint32_t mTokens{};
+    std::uint32_t mRefilledAt{};
+};
+
+// A token bucket for every source, in fixed memory
+// Sources are hashed into a fixed number of buckets, so a few may end up sharing,
+// but the hash is keyed at random so nobody can choose to share with someone else.
+template <std::size_t BucketsT>
+class SourceRateLimiter
+{
+public:
+    static_assert(std::has_single_bit(BucketsT), "Bucket count must be a power of two");
+
+    bool allow(const RateLimit& limit, const void* source, std::size_t size, std::uint32_t nowMillis)
+    {
+        auto index = sipHash(mKey, source, size) & (BucketsT - 1);
+        return mBuckets[index].take(limit, nowMillis);
+    }
+
+private:
+    SipKey mKey{randomSipKey()};
+    std::array<TokenBucket, BucketsT> mBuckets{};
+};
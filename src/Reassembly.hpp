@@ -0,0 +1,275 @@
+#pragma once
+
+#include <Ethernet.hpp>
+#include <Frame.hpp>
+#include <Headers.hpp>
+#include <Ip.hpp>
+#include <Parse.hpp>
+#include <Types.hpp>
+#include <Vnet.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+
+// Which fragments belong to the same datagram, as RFC 791 has it
+struct FragmentKey
+{
+    IpAddress mSource;
+    IpAddress mDestination;
+    std::uint16_t mId;
+    IPProtocol mProto;
+
+    bool operator==(const FragmentKey&) const = default;
+};
+
+// Puts fragmented datagrams back together
+// There are a fixed number of slots, each with a buffer big enough for the largest datagram,
+// allocated once up front, so however many fragments arrive we never use more memory.
+// Each fragment is copied once, straight to where it belongs in its datagram,
+// and which eight byte units have arrived is kept in a bitmap, so holes cost nothing to track.
+// When the last hole is filled, the slot holds the datagram laid out as a received frame would be,
+// Ethernet and IP headers included, so the rest of the stack can treat it as one.
+// A flood of first fragments cannot shut reassembly off: no source may hold more than a few slots,
+// and once they are all busy a new datagram pushes out whichever has the least data.
+class Reassembler
+{
+public:
+    static constexpr std::size_t cSlots{32};
+    static constexpr std::size_t cSlotsPerSource{4};
+    static constexpr std::size_t cMaxPayload{0xffff - sizeof(IpV4Header)};
+    static constexpr std::size_t cHeadroom{sizeof(VnetHeader) + sizeof(EthernetHeader) + sizeof(IpV4Header)};
+    static constexpr std::size_t cSlotBytes{cHeadroom + cMaxPayload};
+    static constexpr std::uint64_t cTimeoutNanos{30'000'000'000}; // As long as Linux waits
+
+    Reassembler() : mBuffers{std::make_unique_for_overwrite<char[]>(cSlots * cSlotBytes)}, mSlots{std::make_unique<Slot[]>(cSlots)} { }
+
+    // Adds a fragment, returning the whole datagram if this was the last piece missing
+    // The datagram stays where it is until the next call to expire, so must be finished with by then
+    std::expected<std::optional<std::span<char>>, DropReason> add(
+        const EthernetHeader& ethernetHeader, const IpV4Header& header, LayerBytes payload, std::uint64_t nowNanos)
+    {
+        std::size_t offset = header.mFlagsOffset.mFragOffset * cUnit;
+        bool last = !(header.mFlagsOffset.mFlags & cMoreFragments);
+        if (offset + payload.size() > cMaxPayload || (!last && (payload.empty() || payload.size() % cUnit != 0)))
+        {
+            return std::unexpected{DropReason::BadFragment};
+        }
+
+        FragmentKey key{header.mSourceAddress, header.mDestinationAddress, header.mId, header.mProto};
+        auto* slot = find(key);
+        if (slot == nullptr)
+        {
+            slot = allocate(header.mSourceAddress);
+            if (slot == nullptr)
+            {
+                return std::unexpected{DropReason::ReassemblyFull};
+            }
+            *slot = Slot{key, SlotState::Assembling, nowNanos};
+            slot->mEthernetHeader = ethernetHeader;
+        }
+
+        // Overlapping fragments are how reassembly is usually attacked, so we do not try to merge them
+        auto first = offset / cUnit;
+        auto end = (offset + payload.size() + cUnit - 1) / cUnit;
+        auto seen = slot->countSeen(first, end);
+        if (seen == end - first && seen != 0)
+        {
+            return std::unexpected{DropReason::DuplicateFragment};
+        }
+        bool pastEnd = slot->mLength != 0 && offset + payload.size() > slot->mLength;
+        bool endMoved = last && (slot->mLength != 0 || slot->mEndSeen > end);
+        if (seen != 0 || pastEnd || endMoved)
+        {
+            release(*slot);
+            return std::unexpected{DropReason::FragmentOverlap};
+        }
+
+        std::memcpy(payloadOf(*slot) + offset, payload.data(), payload.size());
+        slot->markSeen(first, end);
+        slot->mUnitsSeen += end - first;
+        slot->mEndSeen = std::max(slot->mEndSeen, end);
+        if (last)
+        {
+            slot->mLength = offset + payload.size();
+        }
+        if (offset == 0)
+        {
+            slot->mHeader = header;
+            slot->mHaveHeader = true;
+        }
+
+        if (slot->mLength == 0 || !slot->mHaveHeader || slot->mUnitsSeen != (slot->mLength + cUnit - 1) / cUnit)
+        {
+            return std::nullopt;
+        }
+
+        // Complete, so it is given the headers it would have had unfragmented, less any options
+        auto ipHeader = slot->mHeader;
+        ipHeader.mVersionLength.mLength = sizeof(IpV4Header) / 4;
+        ipHeader.mTotalLength = static_cast<std::uint16_t>(sizeof(IpV4Header) + slot->mLength);
+        ipHeader.mFlagsOffset = {};
+        ipHeader.mCheckSum = checksum(ipHeader);
+
+        char* ip = payloadOf(*slot) - sizeof(IpV4Header);
+        char* ethernet = ip - sizeof(EthernetHeader);
+        toWire(ipHeader, ip);
+        toWire(slot->mEthernetHeader, ethernet);
+        slot->mState = SlotState::Delivered;
+        return std::span<char>{ethernet, sizeof(EthernetHeader) + sizeof(IpV4Header) + slot->mLength};
+    }
+
+    // Frees delivered datagrams, and gives up on those which have waited too long,
+    // returning how many were given up on
+    std::size_t expire(std::uint64_t nowNanos)
+    {
+        std::size_t expired{0};
+        for (std::size_t i = 0; i < cSlots && mInUse != 0; i++)
+        {
+            auto& slot = mSlots[i];
+            if (slot.mState == SlotState::Delivered)
+            {
+                release(slot);
+            }
+            else if (slot.mState == SlotState::Assembling && nowNanos - slot.mStartedAt >= cTimeoutNanos)
+            {
+                release(slot);
+                expired += 1;
+            }
+        }
+        return expired;
+    }
+
+    // How many datagrams were pushed out for new ones since last asked
+    std::size_t takeEvicted()
+    {
+        return std::exchange(mEvicted, 0);
+    }
+
+private:
+    static constexpr std::size_t cUnit{8}; // Fragment offsets count eight byte units
+    static constexpr std::size_t cMaxUnits{(cMaxPayload + cUnit - 1) / cUnit};
+
+    enum class SlotState : std::uint8_t
+    {
+        Free,
+        Assembling,
+        Delivered, // Complete, but the stack may still be using it
+    };
+
+    struct Slot
+    {
+        FragmentKey mKey{};
+        SlotState mState{SlotState::Free};
+        std::uint64_t mStartedAt{};
+        std::size_t mLength{}; // Of the payload, known once the last fragment arrives
+        std::size_t mUnitsSeen{};
+        std::size_t mEndSeen{}; // One past the last unit seen
+        bool mHaveHeader{};
+        IpV4Header mHeader{}; // From the first fragment
+        EthernetHeader mEthernetHeader{};
+        std::array<std::uint64_t, (cMaxUnits + 63) / 64> mSeen{};
+
+        std::size_t countSeen(std::size_t first, std::size_t end) const
+        {
+            std::size_t count{0};
+            for (auto unit = first; unit < end; unit++)
+            {
+                count += (mSeen[unit / 64] >> (unit % 64)) & 1;
+            }
+            return count;
+        }
+
+        void markSeen(std::size_t first, std::size_t end)
+        {
+            for (auto unit = first; unit < end; unit++)
+            {
+                mSeen[unit / 64] |= std::uint64_t{1} << (unit % 64);
+            }
+        }
+    };
+
+    char* payloadOf(const Slot& slot)
+    {
+        return mBuffers.get() + (&slot - mSlots.get()) * cSlotBytes + cHeadroom;
+    }
+
+    Slot* find(const FragmentKey& key)
+    {
+        for (std::size_t i = 0; i < cSlots; i++)
+        {
+            if (mSlots[i].mState == SlotState::Assembling && mSlots[i].mKey == key)
+            {
+                return &mSlots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // A source at its limit gives up its own oldest datagram, and otherwise, with every slot busy,
+    // the one with the least data goes, the oldest of those first, so those nearly done are kept
+    // Only while every slot holds a datagram still being delivered is a new one turned away.
+    Slot* allocate(IpAddress source)
+    {
+        Slot* free{nullptr};
+        Slot* sourceOldest{nullptr};
+        Slot* smallest{nullptr};
+        std::size_t fromSource{0};
+        for (std::size_t i = 0; i < cSlots; i++)
+        {
+            auto& slot = mSlots[i];
+            if (slot.mState == SlotState::Free)
+            {
+                free = free == nullptr ? &slot : free;
+                continue;
+            }
+            if (slot.mState != SlotState::Assembling)
+            {
+                continue;
+            }
+
+            if (slot.mKey.mSource == source)
+            {
+                fromSource += 1;
+                sourceOldest = sourceOldest == nullptr || slot.mStartedAt < sourceOldest->mStartedAt ? &slot : sourceOldest;
+            }
+            if (smallest == nullptr || slot.mUnitsSeen < smallest->mUnitsSeen
+                || (slot.mUnitsSeen == smallest->mUnitsSeen && slot.mStartedAt < smallest->mStartedAt))
+            {
+                smallest = &slot;
+            }
+        }
+
+        auto* evicted = fromSource >= cSlotsPerSource ? sourceOldest : (free == nullptr ? smallest : nullptr);
+        if (evicted != nullptr)
+        {
+            release(*evicted);
+            mEvicted += 1;
+            free = evicted;
+        }
+        if (free != nullptr)
+        {
+            mInUse += 1;
+        }
+        return free;
+    }
+
+    void release(Slot& slot)
+    {
+        slot.mState = SlotState::Free;
+        mInUse -= 1;
+    }
+
+    std::unique_ptr<char[]> mBuffers;
+    std::unique_ptr<Slot[]> mSlots;
+    std::size_t mInUse{};
+    std::size_t mEvicted{};
+};
@@ -0,0 +1,979 @@
+#pragma once
+
+#include <Log.hpp>
+#include <SharedRing.hpp>
+#include <Stack.hpp>
+#include <Tcp.hpp>
+#include <TcpSocket.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <memory>
+#include <new>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Applications in other processes use the stack in tilapia_daemon through memory they share with it
+// Each client maps a region holding a ring of commands to the daemon, a ring of completions back,
+// and an arena of buffers, the first half of which it sends from, and the second half of which the daemon receives into.
+// Buffers only change hands through the rings, so neither side ever allocates from the other's half.
+// What an application sends is copied once, into a send buffer, which its stream sends straight from,
+// and what arrives is copied once, from the frame it arrived in to a receive buffer.
+// The region and two eventfds, one to wake each side, are handed to the daemon over a unix socket,
+// which closing tells the daemon the client has gone.
+
+enum class CommandType : std::uint8_t
+{
+    Listen,
+    Open,
+    Send, // A send buffer, to be sent and handed back once acknowledged
+    Close,
+    Release, // A receive buffer, handed back once the application is done with it
+};
+
+template <> struct std::formatter<CommandType> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const CommandType& type, FormatContext& ctx) const
+    {
+        switch (type)
+        {
+            case CommandType::Listen:
+                return std::format_to(ctx.out(), "Listen");
+            case CommandType::Open:
+                return std::format_to(ctx.out(), "Open");
+            case CommandType::Send:
+                return std::format_to(ctx.out(), "Send");
+            case CommandType::Close:
+                return std::format_to(ctx.out(), "Close");
+            case CommandType::Release:
+                return std::format_to(ctx.out(), "Release");
+            default:
+                return std::format_to(ctx.out(), "Unknown CommandType {}", std::to_underlying(type));
+        }
+    }
+};
+
+struct Command
+{
+    CommandType mType{};
+    Port mPort{}; // Listen and Open
+    IpAddress mIp{}; // Open
+    ConnectionKey mKey{}; // Send and Close
+    std::uint32_t mBuffer{}; // Send and Release
+    std::uint32_t mSize{}; // Send
+    std::uint32_t mTag{}; // Open, handed back with its completion
+};
+
+enum class CompletionType : std::uint8_t
+{
+    Listening,
+    Accepted,
+    Opened,
+    Received, // Bytes in a receive buffer, which must be released
+    Sent, // A send buffer back, which RemoteStack takes care of itself
+    Closed, // Nothing more will be received, as the peer has finished, or the connection is gone
+};
+
+template <> struct std::formatter<CompletionType> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const CompletionType& type, FormatContext& ctx) const
+    {
+        switch (type)
+        {
+            case CompletionType::Listening:
+                return std::format_to(ctx.out(), "Listening");
+            case CompletionType::Accepted:
+                return std::format_to(ctx.out(), "Accepted");
+            case CompletionType::Opened:
+                return std::format_to(ctx.out(), "Opened");
+            case CompletionType::Received:
+                return std::format_to(ctx.out(), "Received");
+            case CompletionType::Sent:
+                return std::format_to(ctx.out(), "Sent");
+            case CompletionType::Closed:
+                return std::format_to(ctx.out(), "Closed");
+            default:
+                return std::format_to(ctx.out(), "Unknown CompletionType {}", std::to_underlying(type));
+        }
+    }
+};
+
+struct Completion
+{
+    CompletionType mType{};
+    bool mSucceeded{}; // Listening and Opened
+    Port mPort{}; // Listening and Accepted
+    ConnectionKey mKey{};
+    std::uint32_t mBuffer{}; // Received and Sent
+    std::uint32_t mSize{}; // Received
+    std::uint32_t mTag{}; // Opened
+};
+
+// What a client and the daemon share, laid out the same in both, wherever each maps it
+struct SharedRegion
+{
+    static constexpr std::uint64_t cMagic{0x7469'6c61'7069'6173}; // "tilapias"
+    static constexpr std::uint32_t cVersion{1};
+    static constexpr std::size_t cBufferSize{2048}; // A full segment, and then some
+    static constexpr std::uint32_t cBufferCount{2048};
+    static constexpr std::uint32_t cSendBuffers{cBufferCount / 2}; // The client's, those after are the daemon's
+    static constexpr std::size_t cRingCapacity{4096};
+
+    std::uint64_t mMagic{cMagic};
+    std::uint32_t mVersion{cVersion};
+    Doorbell mDaemonDoorbell{}; // Rung when a command is pushed while the daemon sleeps
+    Doorbell mClientDoorbell{}; // Rung when a completion is pushed while the client sleeps
+    SharedRing<Command, cRingCapacity> mCommands{};
+    SharedRing<Completion, cRingCapacity> mCompletions{};
+    alignas(64) std::array<std::array<char, cBufferSize>, cBufferCount> mBuffers{};
+};
+
+static constexpr auto cDefaultDaemonSocketPath{"/tmp/tilapia.sock"};
+
+inline std::string daemonSocketPath()
+{
+    const char* path = std::getenv("TILAPIA_DAEMON_SOCKET");
+    return path ? path : cDefaultDaemonSocketPath;
+}
+
+// The region, then the daemon's eventfd, then the client's
+static constexpr std::size_t cClientDescriptors{3};
+
+inline sockaddr_un daemonAddress(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// The application's end: a stack in tilapia_daemon, used much as a Stack is,
+// except that everything it does is reported later, through completions from poll
+// Only one thread should use it at a time, as it is one end of each ring.
+class RemoteStack
+{
+public:
+    explicit RemoteStack(const std::string& socketPath = daemonSocketPath())
+    {
+        // Sealed at its size, as the daemon will not map a region which could shrink under it
+        mRegionDescriptor = memfd_create("tilapia", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (mRegionDescriptor < 0 || ftruncate(mRegionDescriptor, sizeof(SharedRegion)) < 0
+            || fcntl(mRegionDescriptor, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        {
+            std::println("Failed to create shared region: {}", strerror(errno));
+            exit(1);
+        }
+
+        void* mapping = mmap(nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, mRegionDescriptor, 0);
+        if (mapping == MAP_FAILED)
+        {
+            std::println("Failed to map shared region: {}", strerror(errno));
+            exit(1);
+        }
+        mRegion = new (mapping) SharedRegion{};
+
+        mDaemonEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        mClientEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        mSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        auto address = daemonAddress(socketPath);
+        if (mDaemonEvent < 0 || mClientEvent < 0 || mSocket < 0
+            || connect(mSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+        {
+            std::println("Failed to connect to tilapia_daemon at {}: {}", socketPath, strerror(errno));
+            exit(1);
+        }
+
+        char marker{'t'};
+        iovec payload{&marker, sizeof(marker)};
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(cClientDescriptors * sizeof(int))> control{};
+        msghdr message{};
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        auto* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(cClientDescriptors * sizeof(int));
+        std::array<int, cClientDescriptors> descriptors{mRegionDescriptor, mDaemonEvent, mClientEvent};
+        std::memcpy(CMSG_DATA(header), descriptors.data(), sizeof(descriptors));
+        if (sendmsg(mSocket, &message, 0) < 0)
+        {
+            std::println("Failed to attach to tilapia_daemon: {}", strerror(errno));
+            exit(1);
+        }
+
+        mFreeBuffers.reserve(SharedRegion::cSendBuffers);
+        for (std::uint32_t buffer = SharedRegion::cSendBuffers; buffer > 0; buffer--)
+        {
+            mFreeBuffers.push_back(buffer - 1);
+        }
+    }
+
+    // Closing the socket tells the daemon we have gone, and it closes our connections
+    ~RemoteStack()
+    {
+        ::close(mSocket);
+        munmap(mRegion, sizeof(SharedRegion));
+        ::close(mRegionDescriptor);
+        ::close(mDaemonEvent);
+        ::close(mClientEvent);
+    }
+
+    RemoteStack(const RemoteStack&) = delete;
+    RemoteStack& operator=(const RemoteStack&) = delete;
+
+    // Each of these returns false when the command ring is full, so nothing was asked
+
+    bool listen(Port port)
+    {
+        Command command{CommandType::Listen};
+        command.mPort = port;
+        return push(command);
+    }
+
+    // Answered with an Opened completion carrying tag, and the connection's key
+    bool open(IpAddress remoteIp, Port remotePort, std::uint32_t tag = 0)
+    {
+        Command command{CommandType::Open};
+        command.mIp = remoteIp;
+        command.mPort = remotePort;
+        command.mTag = tag;
+        return push(command);
+    }
+
+    bool close(const ConnectionKey& key)
+    {
+        Command command{CommandType::Close};
+        command.mKey = key;
+        return push(command);
+    }
+
+    // Copies as much of bytes as there are send buffers for, returning how much that was
+    // Buffers come back as the peer acknowledges what was in them, which poll takes care of.
+    std::size_t send(const ConnectionKey& key, std::span<const char> bytes)
+    {
+        std::size_t sent{0};
+        while (sent < bytes.size() && !mFreeBuffers.empty())
+        {
+            auto buffer = mFreeBuffers.back();
+            auto size = std::min(bytes.size() - sent, SharedRegion::cBufferSize);
+            std::memcpy(mRegion->mBuffers[buffer].data(), bytes.data() + sent, size);
+
+            Command command{CommandType::Send};
+            command.mKey = key;
+            command.mBuffer = buffer;
+            command.mSize = static_cast<std::uint32_t>(size);
+            if (!push(command))
+            {
+                break;
+            }
+            mFreeBuffers.pop_back();
+            sent += size;
+        }
+        return sent;
+    }
+
+    // How much send would take now
+    std::size_t sendSpace() const
+    {
+        return mFreeBuffers.size() * SharedRegion::cBufferSize;
+    }
+
+    // The bytes a Received completion brought, which stay put until released
+    std::span<const char> received(const Completion& completion) const
+    {
+        return {mRegion->mBuffers[completion.mBuffer].data(), completion.mSize};
+    }
+
+    // Hands a Received completion's buffer back, which is never lost, even when the ring is full
+    void release(const Completion& completion)
+    {
+        Command command{CommandType::Release};
+        command.mBuffer = completion.mBuffer;
+        if (!push(command))
+        {
+            mUnreleased.push_back(command);
+        }
+    }
+
+    // Copies out up to out.size() completions, returning how many
+    std::size_t poll(std::span<Completion> out)
+    {
+        flushReleases();
+        std::size_t count{0};
+        while (count < out.size())
+        {
+            auto completion = mRegion->mCompletions.pop();
+            if (!completion.has_value())
+            {
+                break;
+            }
+
+            if (completion->mType == CompletionType::Sent)
+            {
+                mFreeBuffers.push_back(completion->mBuffer);
+                continue;
+            }
+            out[count++] = *completion;
+        }
+        return count;
+    }
+
+    // Sleeps until the daemon has something for us, or timeoutMillis pass
+    void wait(int timeoutMillis)
+    {
+        mRegion->mClientDoorbell.sleep();
+        if (mRegion->mCompletions.empty())
+        {
+            pollfd event{mClientEvent, POLLIN, 0};
+            ::poll(&event, 1, timeoutMillis);
+        }
+        mRegion->mClientDoorbell.wake(mClientEvent);
+    }
+
+private:
+    bool push(const Command& command)
+    {
+        if (!mRegion->mCommands.push(command))
+        {
+            return false;
+        }
+        mRegion->mDaemonDoorbell.ring(mDaemonEvent);
+        return true;
+    }
+
+    void flushReleases()
+    {
+        while (!mUnreleased.empty() && push(mUnreleased.front()))
+        {
+            mUnreleased.pop_front();
+        }
+    }
+
+    int mSocket{-1};
+    int mRegionDescriptor{-1};
+    int mDaemonEvent{-1};
+    int mClientEvent{-1};
+    SharedRegion* mRegion{};
+    std::vector<std::uint32_t> mFreeBuffers{}; // Send buffers
+    std::deque<Command> mUnreleased{};
+};
+
+// The daemon's end: attaches clients as they connect to its socket, carries out their commands on the stack,
+// and tells them what happens on their connections
+// Its streams lend what they receive, so the stack's frame pool must be built on the arena attached to it,
+// and each received byte is copied once, straight from its frame to the client.
+class AttachedClients
+{
+public:
+    explicit AttachedClients(Stack& stack, const std::string& socketPath = daemonSocketPath()) : mStack{stack}, mPath{socketPath}
+    {
+        unlink(mPath.c_str());
+        mSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        auto address = daemonAddress(mPath);
+        if (mSocket < 0 || bind(mSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(mSocket, cPendingClients) < 0)
+        {
+            std::println("Failed to listen for clients at {}: {}", mPath, strerror(errno));
+            exit(1);
+        }
+    }
+
+    ~AttachedClients()
+    {
+        for (auto& client : mClients)
+        {
+            detach(*client);
+        }
+        for (auto descriptor : mAttaching)
+        {
+            close(descriptor);
+        }
+        close(mSocket);
+        unlink(mPath.c_str());
+    }
+
+    AttachedClients(const AttachedClients&) = delete;
+    AttachedClients& operator=(const AttachedClients&) = delete;
+
+    std::size_t clients() const
+    {
+        return mClients.size();
+    }
+
+    // What to wake for besides the device: new clients, each client's doorbell, and its socket closing
+    void descriptors(std::vector<pollfd>& out) const
+    {
+        out.push_back(pollfd{mSocket, POLLIN, 0});
+        for (auto descriptor : mAttaching)
+        {
+            out.push_back(pollfd{descriptor, POLLIN, 0});
+        }
+        for (const auto& client : mClients)
+        {
+            out.push_back(pollfd{client->mDaemonEvent, POLLIN, 0});
+            out.push_back(pollfd{client->mSocket, POLLIN, 0});
+        }
+    }
+
+    // Tells clients we are about to sleep, returning false if one has already asked for something, when we should not
+    bool sleep()
+    {
+        bool idle{true};
+        for (auto& client : mClients)
+        {
+            client->mRegion->mDaemonDoorbell.sleep();
+            idle = idle && client->mRegion->mCommands.empty();
+        }
+        return idle;
+    }
+
+    void wake()
+    {
+        for (auto& client : mClients)
+        {
+            client->mRegion->mDaemonDoorbell.wake(client->mDaemonEvent);
+        }
+    }
+
+    // Attaches new clients, carries out their commands, then hands out whatever the last batch brought
+    // Call between Stack::process and Stack::transmit, so what clients send goes straight out.
+    void service()
+    {
+        attach();
+        // What a client asked for before it went is still carried out
+        for (auto& client : mClients)
+        {
+            if (!client->mGone)
+            {
+                carryOut(*client);
+            }
+            if (!client->mGone && (client->mMisbehaved || hungUp(*client)))
+            {
+                leave(*client);
+            }
+        }
+
+        std::array<Readiness, FrameBatch::cMaxFrames> ready{};
+        while (auto count = mStack.readiness(ready))
+        {
+            for (const auto& [key, events] : std::span{ready}.first(count))
+            {
+                onEvents(key, events);
+            }
+        }
+
+        // Those which ran out of receive buffers, now clients may have released some
+        auto starved = std::exchange(mStarved, {});
+        for (const auto& key : starved)
+        {
+            if (auto connection = mConnections.find(key); connection != mConnections.end())
+            {
+                deliver(key, connection->second);
+            }
+        }
+
+        completeSends();
+
+        // Those whose completions have backed up too far are not keeping up, or not reading at all
+        for (auto& client : mClients)
+        {
+            if (!client->mGone && client->mMisbehaved)
+            {
+                leave(*client);
+            }
+        }
+        reap();
+    }
+
+private:
+    static constexpr int cPendingClients{16};
+    // So one busy client cannot keep the others, and the device, waiting
+    static constexpr std::size_t cCommandsPerService{1024};
+    // Completions waiting for a client beyond what its ring holds, before we give up on it
+    static constexpr std::size_t cMaxOverflow{SharedRegion::cRingCapacity};
+    static constexpr std::uint32_t cReceiveBuffers{SharedRegion::cBufferCount - SharedRegion::cSendBuffers};
+
+    struct Client
+    {
+        int mSocket;
+        int mRegionDescriptor;
+        int mDaemonEvent;
+        int mClientEvent;
+        SharedRegion* mRegion;
+        std::vector<std::uint32_t> mFreeBuffers{}; // Receive buffers
+        std::bitset<cReceiveBuffers> mLent{}; // Receive buffers the client has, by their index past the send buffers
+        std::deque<Completion> mOverflow{}; // Waiting for room in the completion ring
+        std::vector<Port> mPorts{};
+        std::size_t mConnections{};
+        bool mGone{};
+        bool mMisbehaved{}; // To be dropped as though it had gone
+    };
+
+    struct PendingSend
+    {
+        std::uint32_t mBuffer;
+        std::uint64_t mEnd; // How much had been queued on the connection once it was
+    };
+
+    struct Connection
+    {
+        Client* mClient;
+        std::uint32_t mTag{};
+        bool mOpening{};
+        bool mClosed{}; // Reported as such
+        bool mStarved{};
+        std::uint64_t mQueued{};
+        std::deque<PendingSend> mSending{};
+    };
+
+    // New connections to our socket, and those which have not sent their descriptors yet
+    void attach()
+    {
+        for (;;)
+        {
+            int descriptor = accept4(mSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (descriptor < 0)
+            {
+                break;
+            }
+            mAttaching.push_back(descriptor);
+        }
+
+        std::erase_if(mAttaching, [&](int descriptor) {
+            char marker{};
+            iovec payload{&marker, sizeof(marker)};
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(cClientDescriptors * sizeof(int))> control{};
+            msghdr message{};
+            message.msg_iov = &payload;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+            auto received = recvmsg(descriptor, &message, MSG_CMSG_CLOEXEC);
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return false;
+            }
+
+            auto* header = CMSG_FIRSTHDR(&message);
+            if (received <= 0 || header == nullptr || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(cClientDescriptors * sizeof(int)))
+            {
+                logWarning("Client on descriptor {} did not attach properly", descriptor);
+                close(descriptor);
+                return true;
+            }
+
+            std::array<int, cClientDescriptors> descriptors{};
+            std::memcpy(descriptors.data(), CMSG_DATA(header), sizeof(descriptors));
+            map(descriptor, descriptors);
+            return true;
+        });
+    }
+
+    void map(int socket, const std::array<int, cClientDescriptors>& descriptors)
+    {
+        auto [regionDescriptor, daemonEvent, clientEvent] = descriptors;
+        // A region which could still shrink would raise SIGBUS here the moment its client truncated it
+        struct stat status{};
+        void* mapping = MAP_FAILED;
+        auto seals = fcntl(regionDescriptor, F_GET_SEALS);
+        if (seals >= 0 && (seals & F_SEAL_SHRINK) != 0 && fstat(regionDescriptor, &status) == 0
+            && static_cast<std::size_t>(status.st_size) == sizeof(SharedRegion))
+        {
+            mapping = mmap(nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, regionDescriptor, 0);
+        }
+
+        auto* region = static_cast<SharedRegion*>(mapping);
+        if (mapping == MAP_FAILED || region->mMagic != SharedRegion::cMagic || region->mVersion != SharedRegion::cVersion)
+        {
+            logWarning("Client on descriptor {} shared a region which is unsealed, or which this version of tilapia does not understand", socket);
+            if (mapping != MAP_FAILED)
+            {
+                munmap(mapping, sizeof(SharedRegion));
+            }
+            for (auto descriptor : {socket, regionDescriptor, daemonEvent, clientEvent})
+            {
+                close(descriptor);
+            }
+            return;
+        }
+
+        auto& client = *mClients.emplace_back(std::make_unique<Client>(socket, regionDescriptor, daemonEvent, clientEvent, region));
+        client.mFreeBuffers.reserve(SharedRegion::cBufferCount - SharedRegion::cSendBuffers);
+        for (auto buffer = SharedRegion::cBufferCount; buffer > SharedRegion::cSendBuffers; buffer--)
+        {
+            client.mFreeBuffers.push_back(buffer - 1);
+        }
+        logInfo("Client attached on descriptor {}", socket);
+    }
+
+    bool hungUp(const Client& client) const
+    {
+        char byte{};
+        auto received = recv(client.mSocket, &byte, sizeof(byte), MSG_DONTWAIT | MSG_PEEK);
+        return received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+
+    // Its connections are closed, and its region kept until they are gone, as their streams may still be sending from it
+    // One we drop has its socket shut down, which it sees just as it would the daemon going.
+    void leave(Client& client)
+    {
+        logInfo("Client on descriptor {} has gone", client.mSocket);
+        if (client.mMisbehaved)
+        {
+            shutdown(client.mSocket, SHUT_RDWR);
+        }
+        client.mGone = true;
+        client.mOverflow.clear();
+        for (auto port : client.mPorts)
+        {
+            mStack.unlisten(port);
+            mListeners.erase(port);
+        }
+        for (auto& [key, connection] : mConnections)
+        {
+            if (connection.mClient == &client)
+            {
+                mStack.close(key);
+            }
+        }
+    }
+
+    void detach(Client& client)
+    {
+        munmap(client.mRegion, sizeof(SharedRegion));
+        for (auto descriptor : {client.mSocket, client.mRegionDescriptor, client.mDaemonEvent, client.mClientEvent})
+        {
+            close(descriptor);
+        }
+    }
+
+    // Nothing in the ring is trusted: another process writes it, and may be broken or hostile
+    void carryOut(Client& client)
+    {
+        auto& commands = client.mRegion->mCommands;
+        if (!commands.consistent())
+        {
+            logWarning("Client on descriptor {} corrupted its command ring", client.mSocket);
+            client.mMisbehaved = true;
+            return;
+        }
+
+        for (std::size_t i = 0; i < cCommandsPerService; i++)
+        {
+            auto command = commands.pop();
+            if (!command.has_value())
+            {
+                break;
+            }
+
+            switch (command->mType)
+            {
+                case CommandType::Listen:
+                {
+                    Completion completion{CompletionType::Listening};
+                    completion.mPort = command->mPort;
+                    completion.mSucceeded = !mListeners.contains(command->mPort) && mStack.listen(command->mPort, {}, ReceiveMode::Lend);
+                    if (completion.mSucceeded)
+                    {
+                        mListeners[command->mPort] = &client;
+                        client.mPorts.push_back(command->mPort);
+                    }
+                    complete(client, completion);
+                    break;
+                }
+                case CommandType::Open:
+                {
+                    auto key = mStack.open(command->mIp, command->mPort, {}, ReceiveMode::Lend);
+                    if (!key.has_value())
+                    {
+                        Completion completion{CompletionType::Opened};
+                        completion.mTag = command->mTag;
+                        complete(client, completion);
+                        break;
+                    }
+                    add(*key, client).mOpening = true;
+                    mConnections.at(*key).mTag = command->mTag;
+                    break;
+                }
+                case CommandType::Send:
+                    send(client, *command);
+                    break;
+                case CommandType::Close:
+                    if (owned(client, command->mKey) != nullptr)
+                    {
+                        mStack.close(command->mKey);
+                    }
+                    break;
+                case CommandType::Release:
+                    release(client, command->mBuffer);
+                    break;
+                default:
+                    logWarning("Unknown command {} from client on descriptor {}", std::to_underlying(command->mType), client.mSocket);
+                    break;
+            }
+        }
+    }
+
+    // Only a buffer we lent the client can come back, and only once, or two receives could share it
+    void release(Client& client, std::uint32_t buffer)
+    {
+        auto index = buffer - SharedRegion::cSendBuffers;
+        if (buffer < SharedRegion::cSendBuffers || buffer >= SharedRegion::cBufferCount || !client.mLent.test(index))
+        {
+            logWarning("Client on descriptor {} released buffer {} which it did not have", client.mSocket, buffer);
+            return;
+        }
+
+        client.mLent.reset(index);
+        client.mFreeBuffers.push_back(buffer);
+    }
+
+    // Queued to go straight from the client's buffer, which is handed back once the peer has it all
+    void send(Client& client, const Command& command)
+    {
+        if (command.mBuffer >= SharedRegion::cSendBuffers || command.mSize > SharedRegion::cBufferSize)
+        {
+            logWarning("Client on descriptor {} sent from buffer {} which is not its own", client.mSocket, command.mBuffer);
+            return;
+        }
+
+        auto* connection = owned(client, command.mKey);
+        std::span<const char> region{client.mRegion->mBuffers[command.mBuffer].data(), command.mSize};
+        if (connection == nullptr || !mStack.sendRegion(command.mKey, region))
+        {
+            Completion completion{CompletionType::Sent};
+            completion.mKey = command.mKey;
+            completion.mBuffer = command.mBuffer;
+            complete(client, completion);
+            return;
+        }
+
+        connection->mQueued += command.mSize;
+        connection->mSending.push_back(PendingSend{command.mBuffer, connection->mQueued});
+    }
+
+    Connection* owned(const Client& client, const ConnectionKey& key)
+    {
+        auto connection = mConnections.find(key);
+        return connection == mConnections.end() || connection->second.mClient != &client ? nullptr : &connection->second;
+    }
+
+    Connection& add(const ConnectionKey& key, Client& client)
+    {
+        client.mConnections += 1;
+        return mConnections.try_emplace(key, Connection{&client}).first->second;
+    }
+
+    void onEvents(const ConnectionKey& key, SocketEvents events)
+    {
+        if (events.set(SocketEvent::Acceptable))
+        {
+            auto listener = mListeners.find(key.mLocalPort);
+            while (listener != mListeners.end())
+            {
+                auto accepted = mStack.accept(key.mLocalPort);
+                if (!accepted.has_value())
+                {
+                    break;
+                }
+
+                add(*accepted, *listener->second);
+                Completion completion{CompletionType::Accepted};
+                completion.mPort = key.mLocalPort;
+                completion.mKey = *accepted;
+                complete(*listener->second, completion);
+            }
+            return;
+        }
+
+        auto found = mConnections.find(key);
+        if (found == mConnections.end())
+        {
+            return;
+        }
+
+        auto& connection = found->second;
+        if (connection.mOpening)
+        {
+            // Writable once established, Closed if it never was
+            if (!events.set(SocketEvent::Writable) && !events.set(SocketEvent::Closed))
+            {
+                return;
+            }
+
+            connection.mOpening = false;
+            Completion completion{CompletionType::Opened};
+            completion.mKey = key;
+            completion.mTag = connection.mTag;
+            completion.mSucceeded = events.set(SocketEvent::Writable);
+            complete(*connection.mClient, completion);
+            if (!completion.mSucceeded)
+            {
+                connection.mClosed = true;
+                return;
+            }
+        }
+
+        if (events.set(SocketEvent::Readable) || events.set(SocketEvent::Closed))
+        {
+            deliver(key, connection);
+        }
+    }
+
+    // The one copy of what was received, from the frames it arrived in to the client's receive buffers
+    void deliver(const ConnectionKey& key, Connection& connection)
+    {
+        auto& client = *connection.mClient;
+        if (client.mGone || connection.mClosed)
+        {
+            // Whatever is still coming is thrown away
+            std::array<char, SharedRegion::cBufferSize> discard{};
+            while (mStack.receive(key, discard) != 0)
+            {
+            }
+            return;
+        }
+
+        for (;;)
+        {
+            if (client.mFreeBuffers.empty())
+            {
+                if (!connection.mStarved)
+                {
+                    connection.mStarved = true;
+                    mStarved.push_back(key);
+                }
+                return;
+            }
+
+            auto buffer = client.mFreeBuffers.back();
+            auto size = mStack.receive(key, client.mRegion->mBuffers[buffer]);
+            if (size == 0)
+            {
+                break;
+            }
+
+            client.mFreeBuffers.pop_back();
+            client.mLent.set(buffer - SharedRegion::cSendBuffers);
+            Completion completion{CompletionType::Received};
+            completion.mKey = key;
+            completion.mBuffer = buffer;
+            completion.mSize = static_cast<std::uint32_t>(size);
+            complete(client, completion);
+        }
+
+        connection.mStarved = false;
+        if (mStack.finishedReceiving(key))
+        {
+            connection.mClosed = true;
+            Completion completion{CompletionType::Closed};
+            completion.mKey = key;
+            complete(client, completion);
+        }
+    }
+
+    // Send buffers go back once everything up to their end has been acknowledged, or the connection has gone
+    void completeSends()
+    {
+        for (auto& [key, connection] : mConnections)
+        {
+            if (connection.mSending.empty())
+            {
+                continue;
+            }
+
+            auto acknowledged = connection.mQueued - mStack.unacknowledged(key);
+            while (!connection.mSending.empty() && connection.mSending.front().mEnd <= acknowledged)
+            {
+                Completion completion{CompletionType::Sent};
+                completion.mKey = key;
+                completion.mBuffer = connection.mSending.front().mBuffer;
+                complete(*connection.mClient, completion);
+                connection.mSending.pop_front();
+            }
+        }
+    }
+
+    // Forgets connections whose streams have gone, then clients which have gone, once nothing sends from their regions
+    void reap()
+    {
+        std::erase_if(mConnections, [&](const auto& entry) {
+            const auto& [key, connection] = entry;
+            bool gone = mStack.context().mTcpSockets.find(key) == nullptr && connection.mSending.empty()
+                        && (connection.mClosed || connection.mClient->mGone);
+            if (gone)
+            {
+                connection.mClient->mConnections -= 1;
+            }
+            return gone;
+        });
+
+        std::erase_if(mClients, [&](const auto& client) {
+            bool gone = client->mGone && client->mConnections == 0;
+            if (gone)
+            {
+                detach(*client);
+            }
+            return gone;
+        });
+    }
+
+    // Completions wait in order for room in the ring, rather than being lost,
+    // but a client which lets too many back up is dropped at the end of service, as though it had gone
+    void complete(Client& client, const Completion& completion)
+    {
+        if (client.mGone || client.mMisbehaved)
+        {
+            return;
+        }
+
+        while (!client.mOverflow.empty() && client.mRegion->mCompletions.push(client.mOverflow.front()))
+        {
+            client.mOverflow.pop_front();
+        }
+        if (!client.mOverflow.empty() || !client.mRegion->mCompletions.push(completion))
+        {
+            client.mOverflow.push_back(completion);
+            if (client.mOverflow.size() > cMaxOverflow)
+            {
+                logWarning("Client on descriptor {} is not taking its completions", client.mSocket);
+                client.mMisbehaved = true;
+            }
+        }
+        client.mRegion->mClientDoorbell.ring(client.mClientEvent);
+    }
+
+    Stack& mStack;
+    std::string mPath;
+    int mSocket{-1};
+    std::vector<int> mAttaching{}; // Connected, but yet to send their descriptors
+    std::vector<std::unique_ptr<Client>> mClients{};
+    std::unordered_map<Port, Client*> mListeners{};
+    std::unordered_map<ConnectionKey, Connection> mConnections{};
+    std::vector<ConnectionKey> mStarved{};
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// A single producer, single consumer ring of variable length records
+// The producer reserves room for a record, fills it in place, then commits it.
+// A record is never split across the end of the ring: if it does not fit in what is left,
+// the rest is marked as padding and the record starts again at the beginning.
+// When the consumer falls behind, reserve fails rather than waiting.
+class ByteRing
+{
+public:
+    static constexpr std::size_t cAlignment{8};
+
+    // The capacity should be a multiple of cAlignment, so every record stays aligned
+    explicit ByteRing(std::size_t capacity) : mCapacity{capacity}, mBuffer{std::make_unique<char[]>(capacity)} { }
+
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    // Room for size bytes, or nullptr if the ring is too full
+    char* reserve(std::size_t size)
+    {
+        auto total = align(sizeof(RecordHeader) + size);
+        if (total > mCapacity / 2)
+        {
+            return nullptr;
+        }
+
+        auto head = mHead.load(std::memory_order_relaxed);
+        auto tail = mTail.load(std::memory_order_acquire);
+        auto offset = head % mCapacity;
+        auto contiguous = mCapacity - offset;
+        if (total > contiguous)
+        {
+            if (head + contiguous + total - tail > mCapacity)
+            {
+                return nullptr;
+            }
+
+            if (contiguous >= sizeof(RecordHeader))
+            {
+                RecordHeader padding{0};
+                std::memcpy(mBuffer.get() + offset, &padding, sizeof(padding));
+            }
+            head += contiguous;
+            offset = 0;
+        }
+        else if (head + total - tail > mCapacity)
+        {
+            return nullptr;
+        }
+
+        RecordHeader header{static_cast<std::uint32_t>(total)};
+        std::memcpy(mBuffer.get() + offset, &header, sizeof(header));
+        mReservedHead = head + total;
+        return mBuffer.get() + offset + sizeof(RecordHeader);
+    }
+
+    // Makes the last reserved record visible to the consumer
+    void commit()
+    {
+        mHead.store(mReservedHead, std::memory_order_release);
+    }
+
+    // Calls visit(const char* record) on every committed record, oldest first,
+    // then frees their space, returning how many there were
+    template <typename VisitorT>
+    std::size_t consume(VisitorT&& visit)
+    {
+        std::size_t consumed{0};
+        auto tail = mTail.load(std::memory_order_relaxed);
+        auto head = mHead.load(std::memory_order_acquire);
+        while (tail != head)
+        {
+            auto offset = tail % mCapacity;
+            RecordHeader header{0};
+            if (mCapacity - offset >= sizeof(RecordHeader))
+            {
+                std::memcpy(&header, mBuffer.get() + offset, sizeof(header));
+            }
+
+            if (header.mSize == 0)
+            {
+                tail += mCapacity - offset;
+                continue;
+            }
+
+            visit(static_cast<const char*>(mBuffer.get() + offset + sizeof(RecordHeader)));
+            tail += header.mSize;
+            consumed += 1;
+        }
+
+        mTail.store(tail, std::memory_order_release);
+        return consumed;
+    }
+
+private:
+    struct alignas(cAlignment) RecordHeader
+    {
+        std::uint32_t mSize; // Including this header, zero marks padding to the end of the ring
+    };
+
+    static constexpr std::size_t align(std::size_t size)
+    {
+        return (size + cAlignment - 1) & ~(cAlignment - 1);
+    }
+
+    std::size_t mCapacity;
+    std::unique_ptr<char[]> mBuffer;
+    std::size_t mReservedHead{};
+    alignas(64) std::atomic<std::size_t> mHead{};
+    alignas(64) std::atomic<std::size_t> mTail{};
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <Types.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class RouteKind : std::uint8_t
+{
+    Local, // One of our own addresses
+    Connected, // On our link, so we send straight to the destination
+    Gateway, // Somewhere else, so we send to the gateway
+};
+
+template <> struct std::formatter<RouteKind> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const RouteKind& kind, FormatContext& ctx) const
+    {
+        using enum RouteKind;
+        switch (kind)
+        {
+        case Local:
+            return std::format_to(ctx.out(), "Local");
+        case Connected:
+            return std::format_to(ctx.out(), "Connected");
+        case Gateway:
+            return std::format_to(ctx.out(), "Gateway");
+        default:
+            return std::format_to(ctx.out(), "Unknown route kind {}", std::to_underlying(kind));
+        }
+    }
+};
+
+struct Route
+{
+    IpAddress mPrefix{};
+    std::uint8_t mLength{};
+    RouteKind mKind{};
+    IpAddress mGateway{};
+
+    bool operator==(const Route&) const = default;
+
+    bool sameDestination(const Route& other) const
+    {
+        return mPrefix == other.mPrefix && mLength == other.mLength;
+    }
+
+    // Where a frame for destination should be sent on our link
+    IpAddress nextHop(IpAddress destination) const
+    {
+        return mKind == RouteKind::Gateway ? mGateway : destination;
+    }
+};
+
+template <> struct std::formatter<Route> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const Route& route, FormatContext& ctx) const
+    {
+        if (route.mKind == RouteKind::Gateway)
+        {
+            return std::format_to(ctx.out(), "{}/{} via {}", route.mPrefix, route.mLength, route.mGateway);
+        }
+        return std::format_to(ctx.out(), "{}/{} {}", route.mPrefix, route.mLength, route.mKind);
+    }
+};
+
+// An immutable longest prefix match table, laid out as DIR-16-8-8:
+// the first sixteen bits of an address index a table of 65536 entries,
+// each either the route for every address under it, or a chunk of 256 entries for the next eight bits,
+// whose entries may in turn point at a chunk for the last eight.
+// So a lookup is one to three reads, and each route is expanded over every entry it covers when built.
+class Fib
+{
+public:
+    explicit Fib(std::vector<Route> routes) : mRoutes{std::move(routes)}, mTop(cTopSize, cNoRoute)
+    {
+        // Painting shorter prefixes first leaves each entry holding its longest match
+        std::stable_sort(mRoutes.begin(), mRoutes.end(), [](const Route& lhs, const Route& rhs) { return lhs.mLength < rhs.mLength; });
+        for (std::size_t i = 0; i < mRoutes.size(); i++)
+        {
+            paint(mRoutes[i], static_cast<std::uint32_t>(i + 1));
+        }
+    }
+
+    const Route* lookup(IpAddress ip) const
+    {
+        auto address = std::bit_cast<std::uint32_t>(ip);
+        auto entry = mTop[address >> 16];
+        if (entry & cChunkFlag)
+        {
+            entry = mChunks[chunkBase(entry) + ((address >> 8) & 0xff)];
+            if (entry & cChunkFlag)
+            {
+                entry = mChunks[chunkBase(entry) + (address & 0xff)];
+            }
+        }
+        return entry == cNoRoute ? nullptr : &mRoutes[entry - 1];
+    }
+
+    bool local(IpAddress ip) const
+    {
+        const auto* route = lookup(ip);
+        return route != nullptr && route->mKind == RouteKind::Local;
+    }
+
+    const std::vector<Route>& routes() const
+    {
+        return mRoutes;
+    }
+
+private:
+    static constexpr std::size_t cTopSize{1 << 16};
+    static constexpr std::size_t cChunkSize{1 << 8};
+    static constexpr std::uint32_t cNoRoute{0}; // Otherwise entries hold a route's index plus one
+    static constexpr std::uint32_t cChunkFlag{1u << 31};
+
+    static std::size_t chunkBase(std::uint32_t entry)
+    {
+        return (entry & ~cChunkFlag) * cChunkSize;
+    }
+
+    // A new chunk, every entry of which starts out as the entry it replaces
+    std::uint32_t split(std::uint32_t entry)
+    {
+        auto index = static_cast<std::uint32_t>(mChunks.size() / cChunkSize);
+        mChunks.resize(mChunks.size() + cChunkSize, entry);
+        return index | cChunkFlag;
+    }
+
+    // Sets an entry, or every entry under it if it has been split by a longer prefix
+    std::uint32_t fill(std::uint32_t entry, std::uint32_t value)
+    {
+        if (!(entry & cChunkFlag))
+        {
+            return value;
+        }
+
+        auto base = chunkBase(entry);
+        for (std::size_t i = 0; i < cChunkSize; i++)
+        {
+            mChunks[base + i] = fill(mChunks[base + i], value);
+        }
+        return entry;
+    }
+
+    void paint(const Route& route, std::uint32_t value)
+    {
+        auto length = std::min<std::uint32_t>(route.mLength, 32);
+        auto mask = length == 0 ? 0u : ~0u << (32 - length);
+        auto address = std::bit_cast<std::uint32_t>(route.mPrefix) & mask;
+
+        if (length <= 16)
+        {
+            auto first = address >> 16;
+            for (std::size_t i = first; i < first + (std::size_t{1} << (16 - length)); i++)
+            {
+                mTop[i] = fill(mTop[i], value);
+            }
+            return;
+        }
+
+        auto& top = mTop[address >> 16];
+        if (!(top & cChunkFlag))
+        {
+            top = split(top);
+        }
+        auto middleBase = chunkBase(top);
+
+        if (length <= 24)
+        {
+            auto first = (address >> 8) & 0xff;
+            for (std::size_t i = first; i < first + (std::size_t{1} << (24 - length)); i++)
+            {
+                mChunks[middleBase + i] = fill(mChunks[middleBase + i], value);
+            }
+            return;
+        }
+
+        auto middle = middleBase + ((address >> 8) & 0xff);
+        if (!(mChunks[middle] & cChunkFlag))
+        {
+            auto chunk = split(mChunks[middle]);
+            mChunks[middle] = chunk;
+        }
+        auto bottomBase = chunkBase(mChunks[middle]);
+
+        auto first = address & 0xff;
+        for (std::size_t i = first; i < first + (std::size_t{1} << (32 - length)); i++)
+        {
+            mChunks[bottomBase + i] = value;
+        }
+    }
+
+    std::vector<Route> mRoutes;
+    std::vector<std::uint32_t> mTop;
+    std::vector<std::uint32_t> mChunks{};
+};
+
+// The routes we know, and the table built from them
+// Changes rebuild the whole table off to the side and swap it in,
+// so the stack only ever sees a complete table, and can hold on to one for a batch without locking.
+class Routes
+{
+public:
+    Routes() : mFib{std::make_shared<const Fib>(std::vector<Route>{})} { }
+
+    std::shared_ptr<const Fib> fib() const
+    {
+        return mFib.load(std::memory_order_acquire);
+    }
+
+    // Replaces any route to the same prefix
+    void add(const Route& route)
+    {
+        std::lock_guard lock{mMutex};
+        std::erase_if(mRoutes, [&](const Route& existing) { return existing.sameDestination(route); });
+        mRoutes.push_back(route);
+        publish();
+    }
+
+    bool remove(IpAddress prefix, std::uint8_t length)
+    {
+        std::lock_guard lock{mMutex};
+        auto removed = std::erase_if(mRoutes, [&](const Route& existing) { return existing.sameDestination(Route{prefix, length}); });
+        publish();
+        return removed != 0;
+    }
+
+    void replace(std::vector<Route> routes)
+    {
+        std::lock_guard lock{mMutex};
+        mRoutes = std::move(routes);
+        publish();
+    }
+
+private:
+    void publish()
+    {
+        mFib.store(std::make_shared<const Fib>(mRoutes), std::memory_order_release);
+    }
+
+    std::mutex mMutex{};
+    std::vector<Route> mRoutes{};
+    std::atomic<std::shared_ptr<const Fib>> mFib;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Receive buffers which can outlive the batch they were read in, for lending payloads to applications
+// A frame pool built on an arena holds one reference to each buffer it reads into,
+// and a stream lending out a payload takes another, so the pool reads into a fresh buffer next time,
+// and the old one comes back once the application returns everything it lent.
+// Only used from the packet thread, so the counts are plain integers.
+// Each pool built on an arena takes two buffers for each of its slots, one to read into and one kept back,
+// and whatever is left over is what can be lent.
+class RxBufferArena
+{
+public:
+    static constexpr std::size_t cBufferSize{9216}; // Large enough for a jumbo frame
+
+    explicit RxBufferArena(std::size_t buffers)
+        : mBuffers{std::make_unique_for_overwrite<char[]>(buffers * cBufferSize)}, mReferences{std::make_unique<std::uint32_t[]>(buffers)},
+          mCount{buffers}
+    {
+        mFree.reserve(buffers);
+        for (std::size_t i = buffers; i > 0; i--)
+        {
+            mFree.push_back(static_cast<std::uint32_t>(i - 1));
+        }
+    }
+
+    RxBufferArena(const RxBufferArena&) = delete;
+    RxBufferArena& operator=(const RxBufferArena&) = delete;
+
+    // A buffer with one reference, for whoever asked
+    std::optional<std::uint32_t> allocate()
+    {
+        if (mFree.empty())
+        {
+            return std::nullopt;
+        }
+
+        auto buffer = mFree.back();
+        mFree.pop_back();
+        mReferences[buffer] = 1;
+        return buffer;
+    }
+
+    void retain(std::uint32_t buffer)
+    {
+        mReferences[buffer] += 1;
+    }
+
+    void release(std::uint32_t buffer)
+    {
+        if (--mReferences[buffer] == 0)
+        {
+            mFree.push_back(buffer);
+        }
+    }
+
+    // Whether anyone but its first holder still has a reference
+    bool lent(std::uint32_t buffer) const
+    {
+        return mReferences[buffer] > 1;
+    }
+
+    std::span<char> bytes(std::uint32_t buffer)
+    {
+        return {mBuffers.get() + std::size_t{buffer} * cBufferSize, cBufferSize};
+    }
+
+    // Which buffer bytes lie in, if they are ours at all
+    std::optional<std::uint32_t> find(const char* bytes) const
+    {
+        if (bytes < mBuffers.get() || bytes >= mBuffers.get() + mCount * cBufferSize)
+        {
+            return std::nullopt;
+        }
+        return static_cast<std::uint32_t>((bytes - mBuffers.get()) / cBufferSize);
+    }
+
+    // Each frame pool keeps back a buffer for each of its slots, so it can always swap in a fresh one
+    void reserve(std::size_t buffers)
+    {
+        mReserved += buffers;
+    }
+
+    void unreserve(std::size_t buffers)
+    {
+        mReserved -= buffers;
+    }
+
+    // Whether more can be lent, and wanted buffers more taken, leaving the reserve untouched
+    bool spare(std::size_t wanted = 0) const
+    {
+        return mFree.size() > mReserved + wanted;
+    }
+
+    std::size_t available() const
+    {
+        return mFree.size();
+    }
+
+private:
+    std::unique_ptr<char[]> mBuffers;
+    std::unique_ptr<std::uint32_t[]> mReferences;
+    std::size_t mCount;
+    std::size_t mReserved{};
+    std::vector<std::uint32_t> mFree{};
+};
+
+// Received bytes lent to the application, which stay where they are until given back
+struct RxLoan
+{
+    std::span<const char> mBytes{};
+    std::uint32_t mBuffer{};
+};
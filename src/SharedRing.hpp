@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// A single producer, single consumer ring of fixed size records, which can live in memory shared between processes
+// Unlike ByteRing it holds no pointers, only counts, and its atomics are lock free,
+// so each process can map it wherever it likes, and neither ever waits on the other.
+template <typename T, std::size_t Capacity>
+class SharedRing
+{
+public:
+    static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "Records are copied between processes byte for byte");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "A lock would not be shared between processes");
+
+    // Only called by the producer, returning false when the ring is full
+    bool push(const T& value)
+    {
+        auto head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        mSlots[head & (Capacity - 1)] = value;
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the consumer
+    std::optional<T> pop()
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire))
+        {
+            return std::nullopt;
+        }
+
+        T value = mSlots[tail & (Capacity - 1)];
+        mTail.store(tail + 1, std::memory_order_release);
+        return value;
+    }
+
+    // Whether the producer's count is one it could have reached, as another process may have scribbled on it
+    // A consumer which finds it is not should stop trusting the producer.
+    bool consistent() const
+    {
+        return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_relaxed) <= Capacity;
+    }
+
+    bool empty() const
+    {
+        return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<std::uint64_t> mHead{};
+    alignas(64) std::atomic<std::uint64_t> mTail{};
+    alignas(64) std::array<T, Capacity> mSlots{};
+};
+
+// Wakes a process sleeping on an eventfd, but only when it says it is asleep, so a busy consumer costs no system calls
+// The sleeper says so before checking its ring one last time, and the producer checks after pushing,
+// with a full fence between each side's store and load, so one of them always sees the other.
+// Without the fences the producer's load could be ordered before its push, and both would miss.
+struct Doorbell
+{
+    std::atomic<std::uint32_t> mSleeping{};
+
+    // Call after pushing
+    void ring(int eventDescriptor)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mSleeping.load(std::memory_order_relaxed) != 0)
+        {
+            std::uint64_t one{1};
+            [[maybe_unused]] auto written = write(eventDescriptor, &one, sizeof(one));
+        }
+    }
+
+    // Call before the last check for work, and waking after, whether or not anything was waited for
+    void sleep()
+    {
+        mSleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Also drains the eventfd, which must be non blocking
+    void wake(int eventDescriptor)
+    {
+        mSleeping.store(0, std::memory_order_relaxed);
+        std::uint64_t count{};
+        [[maybe_unused]] auto read = ::read(eventDescriptor, &count, sizeof(count));
+    }
+};
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+// SipHash-2-4, a keyed hash which is fast on short inputs like connection tuples,
+// and whose output cannot be predicted without the key
+// See https://cr.yp.to/siphash/siphash-20120918.pdf
+using SipKey = std::array<std::uint64_t, 2>;
+
+inline SipKey randomSipKey()
+{
+    std::random_device device{};
+    auto word = [&device]() { return (std::uint64_t{device()} << 32) | device(); };
+    return {word(), word()};
+}
+
+inline std::uint64_t sipHash(const SipKey& key, const void* data, std::size_t size)
+{
+    std::uint64_t v0 = key[0] ^ 0x736f6d6570736575;
+    std::uint64_t v1 = key[1] ^ 0x646f72616e646f6d;
+    std::uint64_t v2 = key[0] ^ 0x6c7967656e657261;
+    std::uint64_t v3 = key[1] ^ 0x7465646279746573;
+
+    auto round = [&]() {
+        v0 += v1;
+        v1 = std::rotl(v1, 13);
+        v1 ^= v0;
+        v0 = std::rotl(v0, 32);
+        v2 += v3;
+        v3 = std::rotl(v3, 16);
+        v3 ^= v2;
+        v0 += v3;
+        v3 = std::rotl(v3, 21);
+        v3 ^= v0;
+        v2 += v1;
+        v1 = std::rotl(v1, 17);
+        v1 ^= v2;
+        v2 = std::rotl(v2, 32);
+    };
+
+    auto compress = [&](std::uint64_t word) {
+        v3 ^= word;
+        round();
+        round();
+        v0 ^= word;
+    };
+
+    const auto* bytes = static_cast<const char*>(data);
+    std::size_t whole = size - size % sizeof(std::uint64_t);
+    for (std::size_t offset = 0; offset < whole; offset += sizeof(std::uint64_t))
+    {
+        std::uint64_t word{};
+        std::memcpy(&word, bytes + offset, sizeof(word));
+        compress(word);
+    }
+
+    // The last word holds what is left over, with the length in the top byte
+    std::uint64_t last{};
+    std::memcpy(&last, bytes + whole, size - whole);
+    last |= std::uint64_t{size} << 56;
+    compress(last);
+
+    v2 ^= 0xff;
+    round();
+    round();
+    round();
+    round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,1369 @@
+#pragma once
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Frame.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <IpOptions.hpp>
+#include <Log.hpp>
+#include <Metrics.hpp>
+#include <Parse.hpp>
+#include <PathMtu.hpp>
+#include <Pipeline.hpp>
+#include <Reassembly.hpp>
+#include <Route.hpp>
+#include <Tcp.hpp>
+#include <TcpSocket.hpp>
+#include <Trace.hpp>
+#include <Types.hpp>
+#include <Udp.hpp>
+#include <Vnet.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static constexpr bool cEnableVnetHeader = false;
+
+// Everything the stages share: our addresses, protocol state and counters
+struct StackContext
+{
+    // Until told otherwise, everything is on our link
+    StackContext(IpAddress ip, MacAddress mac) : mIp{ip}, mMac{mac}, mArpNode{ip, mac}
+    {
+        mRoutes.replace({Route{ip, 32, RouteKind::Local}, Route{IpAddress{}, 0, RouteKind::Connected}});
+    }
+
+    void drop(Frame& frame, DropReason reason)
+    {
+        frame.mDropReason = reason;
+        mDropCounters.record(reason);
+        mMetrics->drop(reason);
+    }
+
+    // For frames of our own, which never made it into a batch
+    void drop(DropReason reason, std::uint64_t count = 1)
+    {
+        mDropCounters.record(reason, count);
+        mMetrics->drop(reason, count);
+    }
+
+    // Metrics go to a private shard unless a shared one is attached
+    void attachMetrics(MetricsShard& shard)
+    {
+        mMetrics = &shard;
+    }
+
+    MetricsShard& metrics()
+    {
+        return *mMetrics;
+    }
+
+    // The initial sequence number for a new connection
+    SequenceNumber initialSequence(const ConnectionKey& key) const
+    {
+        return mIsnGenerator.next(key, nowNanos());
+    }
+
+    IpAddress mIp{}; // Our first address, which connections we open come from
+    MacAddress mMac{};
+    Routes mRoutes{};
+    ArpNode mArpNode;
+    std::unordered_map<ConnectionKey, TcpNode> mTcpNodes{};
+    HalfOpenConnections mHalfOpen{};
+    OpeningConnections mOpening{}; // Active opens whose Syn has gone
+    IsnGenerator mIsnGenerator{};
+    EphemeralPorts mEphemeralPorts{};
+    std::vector<ConnectionKey> mPendingOpens{}; // Active opens whose Syn is yet to be sent
+    PendingFrames mPendingFrames{}; // Frames waiting on ARP
+    Reassembler mReassembler{};
+    PathMtuCache mPathMtu{};
+    UdpSockets mUdpSockets{};
+    TcpSockets mTcpSockets{};
+    std::uint16_t mNextIpId{}; // So fragments of different datagrams we send are never mixed up
+    DropCounters mDropCounters{};
+
+private:
+    MetricsShard mLocalMetrics{};
+    MetricsShard* mMetrics{&mLocalMetrics};
+};
+
+inline std::size_t writeVnetHeader(char* buffer)
+{
+    if constexpr (!cEnableVnetHeader)
+    {
+        return 0;
+    }
+
+    VnetHeader vnetWriteHeader{ VnetFlag::ChecksumValid, GenericSegmentOffloadType::None, 0, 0, 0, 0, 1};
+    return toWire(vnetWriteHeader, buffer);
+}
+
+// Asks the kernel to sum everything from checksumStart bytes into the Ethernet frame, and store it checksumOffset bytes on
+inline std::size_t writeVnetHeader(char* buffer, std::size_t checksumStart, std::size_t checksumOffset)
+{
+    if constexpr (!cEnableVnetHeader)
+    {
+        return 0;
+    }
+
+    VnetHeader vnetWriteHeader{VnetFlag::NeedsChecksum, GenericSegmentOffloadType::None, 0, 0,
+                               static_cast<std::uint16_t>(checksumStart), static_cast<std::uint16_t>(checksumOffset), 1};
+    return toWire(vnetWriteHeader, buffer);
+}
+
+inline EthernetHeader replyEthernetHeader(const EthernetHeader& header)
+{
+    auto result{header};
+    std::swap(result.mSourceMacAddress, result.mDestinationMacAddress);
+    return result;
+}
+
+// Sends the first size bytes of the received frame back out,
+// once a handler has rewritten them into a reply
+inline void transmitInPlace(Frame& frame, std::size_t size)
+{
+    char* start = frame.mRxBytes.data();
+    if constexpr (cEnableVnetHeader)
+    {
+        // The virtual network header we received sits just before the frame,
+        // so we write ours over it
+        start -= sizeof(VnetHeader);
+        writeVnetHeader(start);
+    }
+
+    frame.mTx = {start, static_cast<std::size_t>(frame.mRxBytes.data() - start) + size};
+}
+
+inline void swapInPlace(char* buffer, std::size_t firstOffset, std::size_t secondOffset, std::size_t size)
+{
+    std::swap_ranges(buffer + firstOffset, buffer + firstOffset + size, buffer + secondOffset);
+}
+
+// Where the payload of a segment we send starts, as those carrying data have no options
+static constexpr std::size_t cTcpPayloadOffset{(cEnableVnetHeader ? sizeof(VnetHeader) : 0) + sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader)};
+
+// Writes a segment we originate, rather than one rewritten from a segment we received
+// A payload is only copied if it was not built at cTcpPayloadOffset already, and cannot go with options.
+// One copied there with copyAndSum comes with its sum, so is never read again, and with the virtual network header
+// on is not summed by us at all, as the kernel checksums the segment from the pseudo header's sum we leave in it.
+inline std::size_t writeTcpFrame(char* buffer, const StackContext& context, MacAddress nextHop, IpAddress source, IpAddress destination,
+                                 TcpHeader header, std::span<TcpOption> options = {}, std::span<const char> payload = {},
+                                 std::optional<std::uint16_t> payloadSum = std::nullopt)
+{
+    std::size_t optionsSize{0};
+    for (const auto& option : options)
+    {
+        optionsSize += option.mSize;
+    }
+    auto tcpSize = static_cast<std::uint16_t>(sizeof(TcpHeader) + optionsSize);
+    header.setLength(tcpSize / 4);
+    auto segmentSize = static_cast<std::uint16_t>(tcpSize + payload.size());
+
+    IpV4Header ipHeader{};
+    ipHeader.mVersionLength.mVersion = 4;
+    ipHeader.mVersionLength.mLength = 5;
+    ipHeader.mTotalLength = sizeof(IpV4Header) + segmentSize;
+    ipHeader.mTimeToLive = 64;
+    ipHeader.mProto = IPProtocol::TCP;
+    ipHeader.mSourceAddress = source;
+    ipHeader.mDestinationAddress = destination;
+    ipHeader.mCheckSum = checksum(ipHeader);
+
+    std::uint8_t zero{0};
+    TcpPseudoHeader pseudoHeader{source, destination, zero, IPProtocol::TCP, segmentSize};
+    std::size_t offset{0};
+    if (cEnableVnetHeader && payloadSum.has_value())
+    {
+        header.mCheckSum = static_cast<std::uint16_t>(~checksum(pseudoHeader));
+        offset = writeVnetHeader(buffer, sizeof(EthernetHeader) + sizeof(IpV4Header), offsetof(TcpHeader, mCheckSum));
+    }
+    else if (payloadSum.has_value())
+    {
+        header.mCheckSum = tcp_checksum(TcpPseudoPacket{pseudoHeader, header}, options, *payloadSum);
+        offset = writeVnetHeader(buffer);
+    }
+    else
+    {
+        header.mCheckSum = tcp_checksum(TcpPseudoPacket{pseudoHeader, header}, options, std::string_view{payload.data(), payload.size()});
+        offset = writeVnetHeader(buffer);
+    }
+
+    if (!payload.empty() && buffer + cTcpPayloadOffset != payload.data())
+    {
+        std::memmove(buffer + cTcpPayloadOffset, payload.data(), payload.size());
+    }
+
+    offset += toWire(EthernetHeader{nextHop, context.mMac, EtherType::InternetProtocolVersion4}, buffer + offset);
+    offset += toWire(ipHeader, buffer + offset);
+    offset += toWire(header, buffer + offset);
+    for (const auto& option : options)
+    {
+        offset += toWire(option, buffer + offset);
+    }
+    return offset + payload.size();
+}
+
+// Where the payload of a datagram we send starts, so it can be built there in the first place
+static constexpr std::size_t cUdpPayloadOffset{(cEnableVnetHeader ? sizeof(VnetHeader) : 0) + sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(UdpHeader)};
+
+// Writes the headers around a datagram's payload, only copying the payload if it was not built in place
+inline std::size_t writeUdpFrame(char* buffer, StackContext& context, MacAddress nextHop, IpAddress source, Port sourcePort, const UdpDatagram& datagram)
+{
+    auto udpSize = static_cast<std::uint16_t>(sizeof(UdpHeader) + datagram.mPayload.size());
+    IpV4Header ipHeader{};
+    ipHeader.mVersionLength.mVersion = 4;
+    ipHeader.mVersionLength.mLength = 5;
+    ipHeader.mTotalLength = sizeof(IpV4Header) + udpSize;
+    ipHeader.mId = context.mNextIpId++;
+    ipHeader.mTimeToLive = 64;
+    ipHeader.mProto = IPProtocol::UDP;
+    ipHeader.mSourceAddress = source;
+    ipHeader.mDestinationAddress = datagram.mRemoteIp;
+    ipHeader.mCheckSum = checksum(ipHeader);
+
+    char* payload = buffer + cUdpPayloadOffset;
+    if (payload != datagram.mPayload.data())
+    {
+        std::memmove(payload, datagram.mPayload.data(), datagram.mPayload.size());
+    }
+
+    std::size_t offset = writeVnetHeader(buffer);
+    offset += toWire(EthernetHeader{nextHop, context.mMac, EtherType::InternetProtocolVersion4}, buffer + offset);
+    offset += toWire(ipHeader, buffer + offset);
+    char* udp = buffer + offset;
+    offset += toWire(UdpHeader{sourcePort, datagram.mRemotePort, udpSize, 0}, udp);
+
+    // A checksum which comes to zero is sent as all ones, as zero means there is none
+    auto udpSum = udpChecksum(source, datagram.mRemoteIp, {udp, udpSize});
+    udpSum = udpSum == 0 ? 0xffff : udpSum;
+    std::memcpy(udp + offsetof(UdpHeader, mCheckSum), &udpSum, sizeof(udpSum));
+    return offset + datagram.mPayload.size();
+}
+
+// Broadcast, unless we are probing a neighbour whose MAC address we already have
+inline std::size_t writeArpRequest(char* buffer, const StackContext& context, IpAddress target, std::optional<MacAddress> targetMac = std::nullopt)
+{
+    auto request = context.mArpNode.request(target);
+    std::size_t offset = writeVnetHeader(buffer);
+    offset += toWire(EthernetHeader{targetMac.value_or(ArpBroadcastAddress), context.mMac, EtherType::AddressResolutionProtocol}, buffer + offset);
+    offset += toWire(request.mHeader, buffer + offset);
+    offset += toWire(request.mBody, buffer + offset);
+    return offset;
+}
+
+// Answers an echo request by turning it around in the buffer it arrived in,
+// so the payload is never copied, whatever its size
+class IcmpHandler
+{
+public:
+    static constexpr IPProtocol cKey{IPProtocol::ICMP};
+
+    explicit IcmpHandler(StackContext& context) : mContext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        std::shared_ptr<const Fib> fib{};
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mTransport);
+            TraceScope trace{TraceStage::IcmpReply};
+            auto* frame = batch[i];
+            auto& parsed = frame->mParsed;
+            auto result = parseIcmp(parsed, frame->mTransport);
+            if (!result)
+            {
+                mContext.drop(*frame, result.error());
+                continue;
+            }
+
+            if (parsed.mIcmpHeader.mType == IcmpType::DestinationUnreachable)
+            {
+                if (!fib)
+                {
+                    fib = mContext.mRoutes.fib();
+                }
+                onFragmentationNeeded(*frame, *fib);
+                continue;
+            }
+
+            char* ethernet = frame->writable(frame->mBytes);
+            swapInPlace(ethernet, offsetof(EthernetHeader, mSourceMacAddress), offsetof(EthernetHeader, mDestinationMacAddress), sizeof(MacAddress));
+
+            // Swapping the addresses leaves the IP checksum as it was
+            char* ip = frame->writable(frame->mNetwork);
+            swapInPlace(ip, offsetof(IpV4Header, mSourceAddress), offsetof(IpV4Header, mDestinationAddress), sizeof(IpAddress));
+            if (parsed.mIpOptions.mCount != 0) [[unlikely]]
+            {
+                stampOptions(ip, parsed);
+            }
+
+            // The type shares a 16 bit word with the code, which stays the same
+            char* icmp = frame->writable(frame->mTransport);
+            auto oldTypeWord = static_cast<std::uint16_t>(std::to_underlying(IcmpType::EchoRequest) << 8 | parsed.mIcmpHeader.mCode);
+            auto newTypeWord = static_cast<std::uint16_t>(std::to_underlying(IcmpType::EchoReply) << 8 | parsed.mIcmpHeader.mCode);
+            icmp[offsetof(IcmpV4Header, mType)] = static_cast<char>(IcmpType::EchoReply);
+            auto replyChecksum = updateChecksum(parsed.mIcmpHeader.mCheckSum, oldTypeWord, newTypeWord);
+            replyChecksum = std::byteswap(replyChecksum);
+            std::memcpy(icmp + offsetof(IcmpV4Header, mCheckSum), &replyChecksum, sizeof(replyChecksum));
+
+            // Leave behind any Ethernet padding
+            transmitInPlace(*frame, sizeof(EthernetHeader) + parsed.mIpHeader.mTotalLength);
+            mContext.metrics().add(Counter::IcmpEchoes);
+        }
+    }
+
+private:
+    // Options are sent back as they came, with us added to any route or timestamps they record,
+    // which changes the header, so it is summed again
+    static void stampOptions(char* ip, const ParsedFrame& parsed)
+    {
+        auto timestamp = ipTimestamp();
+        for (const auto& option : parsed.mIpOptions.view())
+        {
+            stampIpOption(ip, option, parsed.mIpHeader.mDestinationAddress, timestamp);
+        }
+
+        std::size_t headerLength = parsed.mIpHeader.mVersionLength.mLength * 4;
+        std::memset(ip + offsetof(IpV4Header, mCheckSum), 0, sizeof(std::uint16_t));
+        auto sum = checksum(0, ip, headerLength);
+        std::memcpy(ip + offsetof(IpV4Header, mCheckSum), &sum, sizeof(sum));
+    }
+
+    // Only believed when it is about a datagram from one of our own addresses,
+    // and even then it can only make what we send smaller, down to a floor
+    void onFragmentationNeeded(Frame& frame, const Fib& fib)
+    {
+        const auto& quoted = frame.mParsed.mIcmpQuotedHeader;
+        if (!fib.local(quoted.mSourceAddress))
+        {
+            mContext.drop(frame, DropReason::UnexpectedIcmpError);
+            return;
+        }
+
+        if (mContext.mPathMtu.update(quoted.mDestinationAddress, frame.mParsed.mIcmpUnreachable.mNextHopMtu, quoted.mTotalLength, nowNanos()))
+        {
+            mContext.metrics().add(Counter::PathMtuUpdates);
+            logInfo("Path MTU to {} is now {}", quoted.mDestinationAddress, mContext.mPathMtu.mtu(quoted.mDestinationAddress, nowNanos()));
+        }
+    }
+
+    StackContext& mContext;
+};
+
+class TcpHandler
+{
+public:
+    static constexpr IPProtocol cKey{IPProtocol::TCP};
+
+    explicit TcpHandler(StackContext& context) : mContext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mTransport);
+            auto* frame = batch[i];
+            auto& parsed = frame->mParsed;
+            ParseResult<LayerBytes> result{};
+            {
+                TraceScope trace{TraceStage::TcpParse};
+                result = parseTcp(parsed, frame->mTransport);
+            }
+            if (!result)
+            {
+                mContext.drop(*frame, result.error());
+                continue;
+            }
+
+            const auto& tcpHeader = parsed.mTcpHeader;
+            auto payload = parsed.mPayload;
+            TcpResponse response{};
+            {
+                TraceScope trace{TraceStage::TcpNode};
+                ConnectionKey key{parsed.mIpHeader.mDestinationAddress, parsed.mIpHeader.mSourceAddress, tcpHeader.mDestinationPort, tcpHeader.mSourcePort};
+                auto nodeIt = mContext.mTcpNodes.find(key);
+                if (nodeIt == mContext.mTcpNodes.end())
+                {
+                    // Only a Syn to a port we listen on gets a node, as only our own opens have one already
+                    bool syn = tcpHeader.mFlags.set(TcpFlag::Syn) && !tcpHeader.mFlags.set(TcpFlag::Ack) && !tcpHeader.mFlags.set(TcpFlag::Reset);
+                    if (!syn || !mContext.mTcpSockets.listening(key.mLocalPort))
+                    {
+                        reset(*frame, key, payload.size());
+                        continue;
+                    }
+                    if (mContext.mTcpSockets.backlogFull(key.mLocalPort))
+                    {
+                        mContext.drop(*frame, DropReason::TcpBacklogFull);
+                        continue;
+                    }
+                    if (mContext.mHalfOpen.full())
+                    {
+                        mContext.drop(*frame, DropReason::TcpHalfOpenFull);
+                        continue;
+                    }
+
+                    nodeIt = mContext.mTcpNodes.try_emplace(key, key.mLocalPort, key.mRemotePort, mContext.initialSequence(key)).first;
+                    mContext.mHalfOpen.add(key, nowNanos());
+                }
+
+                auto& node = nodeIt->second;
+                auto* stream = mContext.mTcpSockets.find(key);
+                // A port with a full backlog turns away Syns, and leaves handshakes unfinished until there is room
+                bool listened = stream == nullptr && mContext.mTcpSockets.listening(key.mLocalPort);
+                if (listened && mContext.mTcpSockets.backlogFull(key.mLocalPort))
+                {
+                    mContext.drop(*frame, DropReason::TcpBacklogFull);
+                    continue;
+                }
+
+                // A Reset throws away a handshake we have not finished, or refuses one we started, unless it is blind
+                bool handshaking = node.state() == TcpState::SynReceived || node.state() == TcpState::SynSent;
+                if (handshaking && tcpHeader.mFlags.set(TcpFlag::Reset))
+                {
+                    if (node.acceptsReset(tcpHeader))
+                    {
+                        mContext.mHalfOpen.remove(key);
+                        mContext.mOpening.remove(key);
+                        mContext.mTcpNodes.erase(nodeIt);
+                        mContext.mTcpSockets.release(key);
+                    }
+                    mContext.metrics().add(Counter::TcpSegments);
+                    continue;
+                }
+
+                if (listened && node.completesPassiveOpen(tcpHeader))
+                {
+                    mContext.mHalfOpen.remove(key);
+                    stream = &mContext.mTcpSockets.onPassiveOpen(key);
+                    stream->establish(node.sendNext(), node.receiveNext(), tcpHeader.mWindowSize);
+                    mContext.metrics().add(Counter::ConnectionsAccepted);
+                }
+
+                // Once a stream has taken over, its segments carry data for the application
+                if (stream != nullptr && stream->established())
+                {
+                    mContext.metrics().add(Counter::TcpSegments);
+                    onStreamSegment(*frame, key, *stream, payload);
+                    continue;
+                }
+
+                if (tcpHeader.mFlags.set(TcpFlag::Syn))
+                {
+                    node.onSynOptions(parsed.mTcpOptions.view());
+                }
+                bool opening = node.state() == TcpState::SynSent;
+                response = node.onMessage(tcpHeader, payload.size());
+                if (opening && node.state() == TcpState::Established)
+                {
+                    mContext.mOpening.remove(key);
+                    mContext.metrics().add(Counter::ConnectionsEstablished);
+                    if (stream != nullptr)
+                    {
+                        stream->establish(node.sendNext(), node.receiveNext(), tcpHeader.mWindowSize);
+                        mContext.mTcpSockets.notify(key, SocketEvents{std::to_underlying(SocketEvent::Writable)});
+                    }
+                }
+            }
+            mContext.metrics().add(Counter::TcpSegments);
+            if (response.mPrintPayload)
+            {
+                if (payload.size())
+                {
+                    logInfo("{}", payload);
+                }
+            }
+            else if (payload.size())
+            {
+                // We have seen this sequence number before
+                mContext.metrics().add(Counter::TcpRetransmits);
+            }
+
+            if (!response.mSendAck)
+            {
+                continue;
+            }
+
+            // Our Syn Ack says how big a segment fits the path back to us
+            std::array<TcpOption, 1> synOptions{maximumSegmentSize(mContext.mPathMtu.mtu(parsed.mIpHeader.mSourceAddress, nowNanos()))};
+            std::span<TcpOption> options{};
+            if (response.mHeader.mFlags.set(TcpFlag::Syn))
+            {
+                options = synOptions;
+            }
+            auto tcpSize = static_cast<std::uint16_t>(sizeof(TcpHeader) + (options.empty() ? 0 : synOptions[0].mSize));
+            response.mHeader.setLength(tcpSize / 4);
+
+            // Whatever options the segment had are not ours to send back
+            auto ipResponseHeader{parsed.mIpHeader};
+            ipResponseHeader.mVersionLength.mLength = sizeof(IpV4Header) / 4;
+            ipResponseHeader.mTotalLength = sizeof(ipResponseHeader) + tcpSize;
+            std::swap(ipResponseHeader.mSourceAddress, ipResponseHeader.mDestinationAddress);
+            ipResponseHeader.mCheckSum = checksum(ipResponseHeader);
+
+            char* writeBuffer = frame->mTxBuffer.data();
+            std::size_t writeOffset{0};
+            std::uint8_t zero{0};
+            TcpPseudoHeader pseudoHeader{ipResponseHeader.mSourceAddress, ipResponseHeader.mDestinationAddress, zero, IPProtocol::TCP, tcpSize};
+            static constexpr auto cHardwareChecksums = false;
+            if constexpr (cHardwareChecksums)
+            {
+                static_assert(cHardwareChecksums == cEnableVnetHeader, "Cannot enable hardeware checksum without virtual network header");
+                constexpr auto cHeaderLength{sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader)};
+                constexpr auto cGsoSize{1440};
+                constexpr auto cChecksumStart{sizeof(EthernetHeader) + sizeof(IpV4Header)};
+                constexpr auto cChecksumOffset{16};
+                constexpr auto cNumBuffers{1};
+                VnetHeader vnetTcpHeader{VnetFlag::NeedsChecksum, GenericSegmentOffloadType::TcpIp4, cHeaderLength, cGsoSize,
+                                         cChecksumStart, cChecksumOffset, cNumBuffers};
+                writeOffset += toWire(vnetTcpHeader, writeBuffer + writeOffset);
+            }
+            else
+            {
+                TraceScope trace{TraceStage::TcpChecksum};
+                TcpPseudoPacket pseudoPacket{pseudoHeader, response.mHeader};
+                response.mHeader.mCheckSum = tcp_checksum(pseudoPacket, options, std::string_view{});
+                writeOffset += writeVnetHeader(writeBuffer + writeOffset);
+            }
+
+            TraceScope trace{TraceStage::TcpSerialise};
+            writeOffset += toWire(replyEthernetHeader(parsed.mEthernetHeader), writeBuffer + writeOffset);
+            writeOffset += toWire(ipResponseHeader, writeBuffer + writeOffset);
+            writeOffset += toWire(response.mHeader, writeBuffer + writeOffset);
+            for (const auto& option : options)
+            {
+                writeOffset += toWire(option, writeBuffer + writeOffset);
+            }
+            frame->mTx = {writeBuffer, writeOffset};
+        }
+    }
+
+private:
+    // Answers a segment for a connection we have no node for with a Reset, unless it is one
+    void reset(Frame& frame, const ConnectionKey& key, std::size_t payloadSize)
+    {
+        const auto& parsed = frame.mParsed;
+        mContext.metrics().add(Counter::TcpSegments);
+        if (parsed.mTcpHeader.mFlags.set(TcpFlag::Reset))
+        {
+            return;
+        }
+
+        auto size = writeTcpFrame(frame.mTxBuffer.data(), mContext, parsed.mEthernetHeader.mSourceMacAddress, key.mLocalIp, key.mRemoteIp,
+                                  resetFor(parsed.mTcpHeader, payloadSize));
+        frame.mTx = {frame.mTxBuffer.data(), size};
+    }
+
+    // Hands the payload to the stream, acknowledging it from the frame it arrived in
+    void onStreamSegment(Frame& frame, const ConnectionKey& key, TcpStream& stream, LayerBytes payload)
+    {
+        const auto& parsed = frame.mParsed;
+        auto update = stream.onSegment(parsed.mTcpHeader, payload, nowNanos());
+        mContext.mTcpSockets.notify(key, update.mEvents);
+        if (update.mSendAck && !stream.failed())
+        {
+            auto ack = stream.ackHeader();
+            auto size = writeTcpFrame(frame.mTxBuffer.data(), mContext, parsed.mEthernetHeader.mSourceMacAddress, key.mLocalIp, key.mRemoteIp, ack);
+            frame.mTx = {frame.mTxBuffer.data(), size};
+        }
+
+        if (stream.finished())
+        {
+            mContext.mTcpSockets.release(key);
+            mContext.mTcpNodes.erase(key);
+        }
+    }
+
+    StackContext& mContext;
+};
+
+// Hands each datagram to the socket bound to its port,
+// where it waits, still in the frame it arrived in, for the application to receive it
+class UdpHandler
+{
+public:
+    static constexpr IPProtocol cKey{IPProtocol::UDP};
+
+    explicit UdpHandler(StackContext& context) : mContext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mTransport);
+            auto* frame = batch[i];
+            auto& parsed = frame->mParsed;
+            auto payload = parseUdp(parsed, frame->mTransport);
+            if (!payload)
+            {
+                mContext.drop(*frame, payload.error());
+                continue;
+            }
+
+            // We do not send Port Unreachable, much as a firewalled host would not
+            auto port = parsed.mUdpHeader.mDestinationPort;
+            if (!mContext.mUdpSockets.bound(port))
+            {
+                mContext.drop(*frame, DropReason::UdpPortUnreachable);
+                continue;
+            }
+
+            if (!mContext.mUdpSockets.deliver(port, UdpDatagram{parsed.mIpHeader.mSourceAddress, parsed.mUdpHeader.mSourcePort, *payload}))
+            {
+                mContext.drop(*frame, DropReason::UdpReceiveFull);
+                continue;
+            }
+            mContext.metrics().add(Counter::UdpDatagrams);
+        }
+    }
+
+private:
+    StackContext& mContext;
+};
+
+class ArpHandler
+{
+public:
+    static constexpr EtherType cKey{EtherType::AddressResolutionProtocol};
+
+    explicit ArpHandler(StackContext& context) : mContext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        auto now = nowNanos();
+        auto fib = mContext.mRoutes.fib();
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mNetwork);
+            TraceScope trace{TraceStage::ArpReply};
+            auto* frame = batch[i];
+            auto& parsed = frame->mParsed;
+            auto result = parseArp(parsed, frame->mNetwork);
+            if (!result)
+            {
+                mContext.drop(*frame, result.error());
+                continue;
+            }
+
+            bool forUs = fib->local(parsed.mArpMessage.mBody.mDestinationIp);
+            auto arpResponse = mContext.mArpNode.onMessage(parsed.mArpMessage, now, forUs);
+            mContext.metrics().add(Counter::ArpMessages);
+            if (!arpResponse)
+            {
+                mContext.drop(*frame, arpResponse.error());
+                continue;
+            }
+
+            if (!arpResponse->has_value())
+            {
+                mContext.metrics().add(Counter::ArpMisses);
+                continue;
+            }
+
+            mContext.metrics().add(Counter::ArpHits);
+
+            // The reply is the same size as the request, so we write it over the top
+            // A request is usually broadcast, so we reply straight to the sender from our own address
+            EthernetHeader ethernetResponseHeader{parsed.mArpMessage.mBody.mSourceMacAddress, mContext.mMac, EtherType::AddressResolutionProtocol};
+            toWire(ethernetResponseHeader, frame->writable(frame->mBytes));
+
+            char* arp = frame->writable(frame->mNetwork);
+            toWire((*arpResponse)->mHeader, arp);
+            toWire((*arpResponse)->mBody, arp + sizeof(ArpHeader));
+            transmitInPlace(*frame, sizeof(EthernetHeader) + sizeof(ArpHeader) + sizeof(ArpIpBody));
+        }
+    }
+
+private:
+    StackContext& mContext;
+};
+
+// Validates the IP header of every frame in the batch,
+// then hands the survivors up to the handler for their protocol
+template <typename NextT>
+class Ipv4Stage
+{
+public:
+    static constexpr EtherType cKey{EtherType::InternetProtocolVersion4};
+
+    explicit Ipv4Stage(StackContext& context) : mContext{context}, mNext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        FrameBatch valid{};
+        TraceScope trace{TraceStage::Ipv4Parse, static_cast<std::uint32_t>(batch.size())};
+        auto fib = mContext.mRoutes.fib();
+        auto now = nowNanos();
+        if (auto expired = mContext.mReassembler.expire(now))
+        {
+            mContext.drop(DropReason::ReassemblyTimeout, expired);
+        }
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mNetwork);
+            auto* frame = batch[i];
+            auto transport = parseIpV4(frame->mParsed, frame->mNetwork);
+            if (!transport)
+            {
+                mContext.drop(*frame, transport.error());
+                continue;
+            }
+
+            // We do not forward
+            if (!fib->local(frame->mParsed.mIpHeader.mDestinationAddress))
+            {
+                mContext.drop(*frame, DropReason::NotLocalAddress);
+                continue;
+            }
+
+            if (isFragment(frame->mParsed.mIpHeader))
+            {
+                mContext.metrics().add(Counter::IpFragments);
+                auto datagram = mContext.mReassembler.add(frame->mParsed.mEthernetHeader, frame->mParsed.mIpHeader, *transport, now);
+                if (auto evicted = mContext.mReassembler.takeEvicted())
+                {
+                    mContext.drop(DropReason::ReassemblyEvicted, evicted);
+                }
+                if (!datagram)
+                {
+                    mContext.drop(*frame, datagram.error());
+                    continue;
+                }
+
+                // The rest are still on their way
+                if (!datagram->has_value())
+                {
+                    continue;
+                }
+
+                // From here on the frame is the whole datagram, which lives in the reassembler until the next batch
+                frame->mRxBytes = **datagram;
+                frame->mBytes = **datagram;
+                frame->mNetwork = frame->mBytes.subspan(sizeof(EthernetHeader));
+                transport = parseIpV4(frame->mParsed, frame->mNetwork);
+                mContext.metrics().add(Counter::IpReassembled);
+            }
+
+            frame->mTransport = *transport;
+            valid.push(frame);
+        }
+
+        mContext.metrics().add(Counter::Ipv4Packets, valid.size());
+        mNext.process(valid);
+    }
+
+    NextT& next()
+    {
+        return mNext;
+    }
+
+private:
+    StackContext& mContext;
+    NextT mNext;
+};
+
+template <typename NextT>
+class EthernetStage
+{
+public:
+    explicit EthernetStage(StackContext& context) : mContext{context}, mNext{context} { }
+
+    void process(const FrameBatch& batch)
+    {
+        FrameBatch valid{};
+        TraceScope trace{TraceStage::EthernetParse, static_cast<std::uint32_t>(batch.size())};
+        for (std::size_t i = 0; i < batch.size(); i++)
+        {
+            batch.prefetch(i + cPrefetchDistance, &Frame::mBytes);
+            auto* frame = batch[i];
+            auto network = parseEthernet(frame->mParsed, frame->mBytes);
+            if (!network)
+            {
+                mContext.drop(*frame, network.error());
+                continue;
+            }
+
+            frame->mNetwork = *network;
+            valid.push(frame);
+        }
+
+        mContext.metrics().add(Counter::EthernetFrames, valid.size());
+        mNext.process(valid);
+    }
+
+    NextT& next()
+    {
+        return mNext;
+    }
+
+private:
+    StackContext& mContext;
+    NextT mNext;
+};
+
+// The protocols we handle, from the bottom up
+using IpDemux = Demux<StackContext, IPProtocol, IcmpHandler, TcpHandler, UdpHandler>;
+using EtherTypeDemux = Demux<StackContext, EtherType, Ipv4Stage<IpDemux>, ArpHandler>;
+using Pipeline = EthernetStage<EtherTypeDemux>;
+
+// Owns the protocol state, and runs batches of received frames through the pipeline
+// Any replies are left in each frame's transmit buffer
+class Stack
+{
+public:
+    Stack(IpAddress ip, MacAddress mac) : mContext{ip, mac}, mPipeline{mContext} { }
+
+    // The pipeline holds a reference to our context
+    Stack(const Stack&) = delete;
+    Stack& operator=(const Stack&) = delete;
+
+    void process(const FrameBatch& batch)
+    {
+        // Datagrams from the last batch pointed into frames which have now been reused
+        if (auto unread = mContext.mUdpSockets.discardUnread())
+        {
+            mContext.drop(DropReason::UdpUnread, unread);
+        }
+        mPipeline.process(batch);
+    }
+
+    bool bindUdp(Port port)
+    {
+        return mContext.mUdpSockets.bind(port);
+    }
+
+    // Takes up to out.size() of the datagrams the last batch brought for port, without copying their payloads,
+    // which are only good until the next batch is read
+    std::size_t receiveUdp(Port port, std::span<UdpDatagram> out)
+    {
+        return mContext.mUdpSockets.receive(port, out);
+    }
+
+    // Where the payload of the index'th next datagram sent would go,
+    // so it can be built in place and sent without a copy, by the very next sendUdp
+    std::span<char> udpPayloadBuffer(FramePool& pool, const FrameBatch& batch, std::size_t index = 0)
+    {
+        return pool.frame(batch.size() + index).mTxBuffer.subspan(cUdpPayloadOffset);
+    }
+
+    // Builds datagrams from localPort into frames from the pool, as transmit does,
+    // returning how many were taken, which is fewer than given when the batch fills up
+    // A datagram whose next hop is still being resolved waits in the pending queue, like any other frame.
+    std::size_t sendUdp(FramePool& pool, FrameBatch& batch, Port localPort, std::span<const UdpDatagram> datagrams)
+    {
+        static constexpr std::size_t cMaxPayload{std::min(FramePool::cBufferSize, std::size_t{0xffff}) - cUdpPayloadOffset};
+        auto now = nowNanos();
+        auto fib = mContext.mRoutes.fib();
+        auto& neighbours = mContext.mArpNode.neighbours();
+        std::size_t taken{0};
+        for (const auto& datagram : datagrams)
+        {
+            if (batch.full())
+            {
+                break;
+            }
+            taken += 1;
+
+            if (datagram.mPayload.size() > cMaxPayload)
+            {
+                mContext.drop(DropReason::DatagramTooLarge);
+                continue;
+            }
+
+            const auto* route = fib->lookup(datagram.mRemoteIp);
+            if (route == nullptr || route->mKind == RouteKind::Local)
+            {
+                mContext.drop(DropReason::NoRoute);
+                continue;
+            }
+
+            // Each datagram takes at most one frame, so is never written over one built in place after it
+            auto nextHop = route->nextHop(datagram.mRemoteIp);
+            auto mac = neighbours.lookup(nextHop, now);
+            auto& frame = nextFrame(pool, batch);
+            auto size = writeUdpFrame(frame.mTxBuffer.data(), mContext, mac.value_or(MacAddress{}), mContext.mIp, localPort, datagram);
+            mContext.metrics().add(Counter::UdpDatagramsSent);
+            if (mac.has_value())
+            {
+                frame.mTx = {frame.mTxBuffer.data(), size};
+                batch.push(&frame);
+            }
+            else
+            {
+                hold(pool, batch, nextHop, {frame.mTxBuffer.data(), size}, now);
+            }
+        }
+        return taken;
+    }
+
+    // Starts opening a connection, whose Syn goes out with a later transmit, and again while it goes unanswered
+    // Fails if we have no route there, or have run out of ports for it, and readiness reports Closed
+    // if it fails later, as when the peer refuses it, or never answers.
+    std::optional<ConnectionKey> connect(IpAddress remoteIp, Port remotePort)
+    {
+        const auto* route = mContext.mRoutes.fib()->lookup(remoteIp);
+        if (route == nullptr || route->mKind == RouteKind::Local)
+        {
+            return std::nullopt;
+        }
+
+        auto localIp = mContext.mIp;
+        auto localPort = mContext.mEphemeralPorts.allocate(remoteIp, remotePort, [&](Port port) {
+            return mContext.mTcpNodes.contains(ConnectionKey{localIp, remoteIp, port, remotePort});
+        });
+        if (!localPort.has_value())
+        {
+            return std::nullopt;
+        }
+
+        ConnectionKey key{localIp, remoteIp, *localPort, remotePort};
+        mContext.mTcpNodes.try_emplace(key, key.mLocalPort, key.mRemotePort, mContext.initialSequence(key));
+        mContext.mPendingOpens.push_back(key);
+        mContext.metrics().add(Counter::ActiveOpens);
+        return key;
+    }
+
+    // Accepts connections to port, each with buffers of the given sizes, rounded up to a power of two
+    // Syns to ports nobody listens on are answered with a Reset.
+    // Lending what they receive needs an arena attached first, which frames must be received into.
+    bool listen(Port port, TcpBufferSizes sizes = {}, ReceiveMode mode = ReceiveMode::Copy)
+    {
+        return mContext.mTcpSockets.listen(port, sizes, mode);
+    }
+
+    // Stops accepting connections to port, closing any which were waiting to be accepted
+    void unlisten(Port port)
+    {
+        for (const auto& key : mContext.mTcpSockets.unlisten(port))
+        {
+            close(key);
+        }
+    }
+
+    // The oldest connection to port waiting to be accepted, which readiness reports as Acceptable
+    std::optional<ConnectionKey> accept(Port port)
+    {
+        return mContext.mTcpSockets.accept(port);
+    }
+
+    // As connect, but the connection carries data once open, which readiness reports as Writable
+    std::optional<ConnectionKey> open(IpAddress remoteIp, Port remotePort, TcpBufferSizes sizes = {}, ReceiveMode mode = ReceiveMode::Copy)
+    {
+        if (mode == ReceiveMode::Lend && mContext.mTcpSockets.arena() == nullptr)
+        {
+            return std::nullopt;
+        }
+
+        auto key = connect(remoteIp, remotePort);
+        if (key.has_value())
+        {
+            mContext.mTcpSockets.open(*key, sizes, mode);
+        }
+        return key;
+    }
+
+    // Queues as much of bytes as there is room for, to go with the next transmit, returning how much that was
+    // When that is not everything, readiness reports the connection Writable once there is room again.
+    std::size_t send(const ConnectionKey& key, std::span<const char> bytes)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr ? 0 : stream->send(bytes);
+    }
+
+    // Queues region to be sent straight from where it is, like sendfile with a mapped file,
+    // returning whether it was, as it is not once we have closed, or the connection is gone
+    // Nothing is copied but into each frame, retransmits included, so the region must stay mapped
+    // until unacknowledged says the peer has it all, or the connection is gone.
+    bool sendRegion(const ConnectionKey& key, std::span<const char> region)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream != nullptr && stream->sendRegion(region);
+    }
+
+    // How many bytes sent or queued the peer is yet to acknowledge
+    std::size_t unacknowledged(const ConnectionKey& key)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr ? 0 : stream->unacknowledged();
+    }
+
+    // How much send would take now
+    std::size_t sendSpace(const ConnectionKey& key)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr ? 0 : stream->sendSpace();
+    }
+
+    // Whether send could ever take more, as we have not closed, and the connection is not gone
+    bool canSend(const ConnectionKey& key)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream != nullptr && !stream->failed() && !stream->closing();
+    }
+
+    // Whether nothing more will arrive, as the peer has sent its Fin, or the connection is gone
+    bool finishedReceiving(const ConnectionKey& key)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr || stream->failed() || stream->peerFinished();
+    }
+
+    // Copies out up to out.size() bytes received in order, returning how many
+    // Nothing more will come once readiness has reported the connection Closed and this returns 0.
+    std::size_t receive(const ConnectionKey& key, std::span<char> out)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr ? 0 : stream->receive(out);
+    }
+
+    // Lends out up to out.size() payloads received in order, returning how many, without copying them
+    // Each points into the buffer it arrived in, which is ours again only once given back.
+    // A lending stream can still be read with receive, which copies, and gives back as it goes.
+    std::size_t lend(const ConnectionKey& key, std::span<RxLoan> out)
+    {
+        auto* stream = mContext.mTcpSockets.find(key);
+        return stream == nullptr ? 0 : stream->lend(out);
+    }
+
+    // Gives back loans from lend, even once the connection is gone, so the window can open again
+    // Loans which were never lent for the connection, or were given back already, are ignored.
+    void giveBack(const ConnectionKey& key, std::span<const RxLoan> loans)
+    {
+        mContext.mTcpSockets.giveBack(key, loans);
+    }
+
+    // Sends a Fin once everything queued has gone, and forgets the connection once the peer has closed too
+    void close(const ConnectionKey& key)
+    {
+        if (auto* stream = mContext.mTcpSockets.find(key))
+        {
+            stream->close();
+        }
+    }
+
+    // Copies out up to out.size() connections and listening ports with something new since last asked, returning how many
+    std::size_t readiness(std::span<Readiness> out)
+    {
+        return mContext.mTcpSockets.readiness(out);
+    }
+
+    // Builds the frames we originate, rather than reply with, into frames from the pool.
+    // This is also our timer, so should be called regularly even when there is nothing new to send.
+    // First come ARP retransmits and probes, then frames which were waiting on ARP, then the Syn for each pending open,
+    // or each sent too long ago to still be waiting for an answer, then data queued on streams.
+    // Anything which does not fit in the batch waits for the next call.
+    void transmit(FramePool& pool, FrameBatch& batch)
+    {
+        auto now = nowNanos();
+        auto fib = mContext.mRoutes.fib();
+        auto& neighbours = mContext.mArpNode.neighbours();
+        neighbours.age(now, [&](IpAddress ip, std::optional<MacAddress> mac) {
+            if (!batch.full())
+            {
+                auto& frame = nextFrame(pool, batch);
+                frame.mTx = {frame.mTxBuffer.data(), writeArpRequest(frame.mTxBuffer.data(), mContext, ip, mac)};
+                batch.push(&frame);
+            }
+        }, [&](IpAddress ip) {
+            mContext.drop(DropReason::NeighbourUnreachable, mContext.mPendingFrames.discard(ip));
+            for (const auto& key : mContext.mOpening.unreachable(ip))
+            {
+                abandonOpen(key);
+            }
+        });
+
+        mContext.mPendingFrames.release([&](IpAddress ip) { return neighbours.resolved(ip); }, [&](IpAddress ip, LayerBytes bytes) {
+            if (batch.full())
+            {
+                return false;
+            }
+
+            // Now we know where it is going
+            auto& frame = nextFrame(pool, batch);
+            char* buffer = frame.mTxBuffer.data();
+            std::memcpy(buffer, bytes.data(), bytes.size());
+            char* ethernet = buffer + (cEnableVnetHeader ? sizeof(VnetHeader) : 0);
+            auto ethernetHeader = fromWire<EthernetHeader>(ethernet);
+            ethernetHeader.mDestinationMacAddress = *neighbours.lookup(ip, now);
+            toWire(ethernetHeader, ethernet);
+            frame.mTx = {buffer, bytes.size()};
+            batch.push(&frame);
+            return true;
+        });
+
+        mContext.mHalfOpen.expire(now, [&](const ConnectionKey& key) { mContext.mTcpNodes.erase(key); });
+        mContext.mOpening.expire(now, [&](const ConnectionKey& key) {
+            mContext.mPendingOpens.push_back(key);
+            mContext.metrics().add(Counter::TcpRetransmits);
+        }, [&](const ConnectionKey& key) { abandonOpen(key); });
+
+        auto& pending = mContext.mPendingOpens;
+        std::size_t kept{0};
+        for (const auto& key : pending)
+        {
+            if (batch.full())
+            {
+                pending[kept++] = key;
+                continue;
+            }
+
+            // Given up on, or answered, while it waited
+            auto node = mContext.mTcpNodes.find(key);
+            if (node == mContext.mTcpNodes.end() || node->second.state() == TcpState::Established)
+            {
+                continue;
+            }
+
+            // The route may have gone since the connection was opened
+            const auto* route = fib->lookup(key.mRemoteIp);
+            if (route == nullptr || route->mKind == RouteKind::Local)
+            {
+                mContext.drop(DropReason::NoRoute);
+                abandonOpen(key);
+                continue;
+            }
+
+            auto nextHop = route->nextHop(key.mRemoteIp);
+            auto mac = neighbours.lookup(nextHop, now);
+            auto& frame = nextFrame(pool, batch);
+            auto syn = node->second.open();
+            std::array<TcpOption, 1> options{maximumSegmentSize(mContext.mPathMtu.mtu(key.mRemoteIp, now))};
+            auto size = writeTcpFrame(frame.mTxBuffer.data(), mContext, mac.value_or(MacAddress{}), key.mLocalIp, key.mRemoteIp, syn, options);
+            if (mac.has_value())
+            {
+                frame.mTx = {frame.mTxBuffer.data(), size};
+                batch.push(&frame);
+            }
+            else if (!hold(pool, batch, nextHop, {frame.mTxBuffer.data(), size}, now))
+            {
+                abandonOpen(key);
+                continue;
+            }
+            mContext.mOpening.sent(key, nextHop, now);
+        }
+        pending.resize(kept);
+
+        mContext.mTcpSockets.forEachStream([&](const ConnectionKey& key, TcpStream& stream) {
+            transmitStream(pool, batch, *fib, key, stream, now);
+        });
+        for (const auto& key : mReleased)
+        {
+            mContext.mTcpSockets.release(key);
+            mContext.mTcpNodes.erase(key);
+            mContext.mOpening.remove(key);
+        }
+        mReleased.clear();
+    }
+
+    // Hands send each piece of a frame we are about to write, as it should go on the wire
+    // Everything we send is built whole, so an IPv4 datagram bigger than the path MTU to its destination
+    // is only cut into fragments here, each built in turn in the same buffer.
+    // A datagram which asks not to be fragmented is dropped instead.
+    template <typename SendT>
+    void forEachFragment(LayerBytes tx, SendT&& send)
+    {
+        static constexpr std::size_t cLinkOffset{cEnableVnetHeader ? sizeof(VnetHeader) : 0};
+        static constexpr std::size_t cIpOffset{cLinkOffset + sizeof(EthernetHeader)};
+        if (tx.size() < cIpOffset + sizeof(IpV4Header) || fromWire<EthernetHeader>(tx.data() + cLinkOffset).mEthertype != EtherType::InternetProtocolVersion4)
+        {
+            send(tx);
+            return;
+        }
+
+        auto header = fromWire<IpV4Header>(tx.data() + cIpOffset);
+        std::size_t headerLength = header.mVersionLength.mLength * 4;
+        std::size_t mtu = mContext.mPathMtu.mtu(header.mDestinationAddress, nowNanos());
+        if (header.mTotalLength <= mtu || header.mTotalLength > tx.size() - cIpOffset || headerLength < sizeof(IpV4Header))
+        {
+            send(tx);
+            return;
+        }
+
+        if (header.mFlagsOffset.mFlags & cDontFragment)
+        {
+            mContext.drop(DropReason::FragmentationNeeded);
+            return;
+        }
+
+        // The first fragment has every option, the rest only those marked as copied
+        auto payload = tx.subspan(cIpOffset + headerLength, header.mTotalLength - headerLength);
+        std::array<char, cMaxIpOptionsSize> laterOptions{};
+        auto laterOptionsSize = copiedIpOptions(tx.subspan(cIpOffset, headerLength), laterOptions.data());
+        bool moreAfter = header.mFlagsOffset.mFlags & cMoreFragments;
+        std::memcpy(mFragment.data(), tx.data(), cIpOffset + headerLength);
+        std::size_t pieceSize{};
+        for (std::size_t offset = 0; offset < payload.size(); offset += pieceSize)
+        {
+            if (offset != 0 && headerLength != sizeof(IpV4Header) + laterOptionsSize)
+            {
+                headerLength = sizeof(IpV4Header) + laterOptionsSize;
+                std::memcpy(mFragment.data() + cIpOffset + sizeof(IpV4Header), laterOptions.data(), laterOptionsSize);
+            }
+
+            // Every fragment but the last must carry a multiple of eight bytes
+            pieceSize = (std::min(mtu, mFragment.size() - cIpOffset) - headerLength) & ~std::size_t{7};
+            auto piece = payload.subspan(offset, std::min(pieceSize, payload.size() - offset));
+            bool last = offset + piece.size() == payload.size();
+
+            auto fragmentHeader{header};
+            fragmentHeader.mVersionLength.mLength = static_cast<std::uint8_t>(headerLength / 4);
+            fragmentHeader.mTotalLength = static_cast<std::uint16_t>(headerLength + piece.size());
+            fragmentHeader.mFlagsOffset.mFragOffset = static_cast<std::uint16_t>(header.mFlagsOffset.mFragOffset + offset / 8);
+            fragmentHeader.mFlagsOffset.mFlags = (header.mFlagsOffset.mFlags & ~cMoreFragments) | (last && !moreAfter ? 0 : cMoreFragments);
+            fragmentHeader.mCheckSum = 0;
+            char* ip = mFragment.data() + cIpOffset;
+            toWire(fragmentHeader, ip);
+            // Summed over the bytes as they are on the wire, so it covers any options too, and is stored as is
+            auto sum = checksum(0, ip, headerLength);
+            std::memcpy(ip + offsetof(IpV4Header, mCheckSum), &sum, sizeof(sum));
+
+            std::memcpy(mFragment.data() + cIpOffset + headerLength, piece.data(), piece.size());
+            send(LayerBytes{mFragment.data(), cIpOffset + headerLength + piece.size()});
+            mContext.metrics().add(Counter::IpFragmentsSent);
+        }
+    }
+
+    StackContext& context()
+    {
+        return mContext;
+    }
+
+    Pipeline& pipeline()
+    {
+        return mPipeline;
+    }
+
+private:
+    static Frame& nextFrame(FramePool& pool, const FrameBatch& batch)
+    {
+        auto& frame = pool.frame(batch.size());
+        frame.reset({});
+        return frame;
+    }
+
+    // Sends whatever the stream has queued that the peer has room for, going back first if an Ack is overdue,
+    // and says so when the application has made room for more
+    void transmitStream(FramePool& pool, FrameBatch& batch, const Fib& fib, const ConnectionKey& key, TcpStream& stream, std::uint64_t now)
+    {
+        if (!stream.established())
+        {
+            return;
+        }
+
+        if (stream.retransmitDue(now))
+        {
+            mContext.metrics().add(Counter::TcpRetransmits);
+        }
+        if (stream.failed())
+        {
+            mReleased.push_back(key);
+            return;
+        }
+
+        // Without a route or the peer's address, what is queued waits for the retransmit timer to try again
+        const auto* route = fib.lookup(key.mRemoteIp);
+        if (route == nullptr || route->mKind == RouteKind::Local)
+        {
+            return;
+        }
+
+        auto nextHop = route->nextHop(key.mRemoteIp);
+        auto mac = mContext.mArpNode.neighbours().lookup(nextHop, now);
+        if (!mac.has_value())
+        {
+            auto resolution = mContext.mArpNode.neighbours().resolve(nextHop, now);
+            if (resolution == Resolution::Requested && !batch.full())
+            {
+                auto& frame = nextFrame(pool, batch);
+                frame.mTx = {frame.mTxBuffer.data(), writeArpRequest(frame.mTxBuffer.data(), mContext, nextHop)};
+                batch.push(&frame);
+            }
+            return;
+        }
+
+        auto node = mContext.mTcpNodes.find(key);
+        auto pathMtu = mContext.mPathMtu.mtu(key.mRemoteIp, now);
+        auto segmentSize = node == mContext.mTcpNodes.end() ? TcpNode::cDefaultSegmentSize : node->second.segmentSize(pathMtu);
+        bool sent{false};
+        while (!batch.full())
+        {
+            auto segment = stream.nextSegment(segmentSize, now);
+            if (!segment.has_value())
+            {
+                break;
+            }
+
+            // The payload is copied straight to where it goes in the frame, and summed on the way
+            auto& frame = nextFrame(pool, batch);
+            auto payload = frame.mTxBuffer.subspan(cTcpPayloadOffset, segment->mSize);
+            auto payloadSum = stream.copyPayload(*segment, payload);
+            auto size = writeTcpFrame(frame.mTxBuffer.data(), mContext, *mac, key.mLocalIp, key.mRemoteIp, segment->mHeader, {}, payload, payloadSum);
+            frame.mTx = {frame.mTxBuffer.data(), size};
+            batch.push(&frame);
+            sent = true;
+        }
+
+        if (!sent && !batch.full() && stream.windowUpdateDue())
+        {
+            auto& frame = nextFrame(pool, batch);
+            auto size = writeTcpFrame(frame.mTxBuffer.data(), mContext, *mac, key.mLocalIp, key.mRemoteIp, stream.ackHeader());
+            frame.mTx = {frame.mTxBuffer.data(), size};
+            batch.push(&frame);
+        }
+    }
+
+    // Queues a frame until ARP finds its next hop, asking if nobody has yet, returning false if it was dropped instead
+    bool hold(FramePool& pool, FrameBatch& batch, IpAddress nextHop, LayerBytes bytes, std::uint64_t now)
+    {
+        auto resolution = mContext.mArpNode.neighbours().resolve(nextHop, now);
+        if (resolution == Resolution::NoRoom)
+        {
+            mContext.drop(DropReason::NeighbourTableFull);
+            return false;
+        }
+
+        if (!mContext.mPendingFrames.push(nextHop, bytes))
+        {
+            mContext.drop(DropReason::PendingQueueFull);
+            return false;
+        }
+
+        // Otherwise the request goes out when it is next retransmitted
+        if (resolution == Resolution::Requested && !batch.full())
+        {
+            auto& frame = nextFrame(pool, batch);
+            frame.mTx = {frame.mTxBuffer.data(), writeArpRequest(frame.mTxBuffer.data(), mContext, nextHop)};
+            batch.push(&frame);
+        }
+        return true;
+    }
+
+    // Gives up on an active open, freeing its port, and tells the application, even when it opened with connect
+    void abandonOpen(const ConnectionKey& key)
+    {
+        mContext.mTcpNodes.erase(key);
+        mContext.mOpening.remove(key);
+        if (mContext.mTcpSockets.find(key) != nullptr)
+        {
+            mContext.mTcpSockets.release(key);
+        }
+        else
+        {
+            mContext.mTcpSockets.notify(key, SocketEvents{std::to_underlying(SocketEvent::Closed)});
+        }
+    }
+
+    StackContext mContext;
+    Pipeline mPipeline;
+    std::array<char, FramePool::cBufferSize> mFragment{};
+    std::vector<ConnectionKey> mReleased{}; // Streams given up on during transmit
+};
@@ -3,13 +3,21 @@
 #include <Headers.hpp>
 #include <Types.hpp>
 #include <Ip.hpp>
+#include <SipHash.hpp>
 #include <TcpOptions.hpp>
 
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <optional>
 #include <span>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 enum class TcpFlag : std::uint8_t
 {
@@ -132,12 +140,23 @@ struct LayoutInfo<TcpPseudoPacket>
     static constexpr std::index_sequence<4, 4, 1, 1, 2, 2, 2, 4, 4, 1, 1, 2, 2, 2> Sizes{};
 };
 
-inline std::uint16_t tcp_checksum(const TcpPseudoPacket& header, std::span<TcpOption> options, std::string_view payload)
+// Checksums the options as they appeared on the wire,
+// so we never have to understand an option to validate a segment
+inline std::uint16_t tcp_checksum(const TcpPseudoPacket& header, std::string_view options, std::string_view payload)
 {
     std::uint16_t header_checksum_negated = checksum(header);
     std::uint16_t header_checksum = ~header_checksum_negated;
     std::uint16_t header_checksum_network_byte_order = std::byteswap(header_checksum);
 
+    std::uint16_t options_checksum_negated_nbo = checksum(header_checksum_network_byte_order, options.data(), options.size());
+    std::uint16_t options_checksum_nbo = ~options_checksum_negated_nbo;
+
+    std::uint16_t payload_checksum_nbo = checksum(options_checksum_nbo, payload.data(), payload.size());
+    return std::byteswap(payload_checksum_nbo);
+}
+
+inline std::uint16_t tcp_checksum(const TcpPseudoPacket& header, std::span<TcpOption> options, std::string_view payload)
+{
     static constexpr auto cOptionBufferSize{60};
     char optionBuffer[cOptionBufferSize];
     auto optionWriteIndex = 0;
@@ -146,11 +165,14 @@ inline std::uint16_t tcp_checksum(const TcpPseudoPacket& header, std::span<TcpOp
         optionWriteIndex += toWire(option, optionBuffer + optionWriteIndex);
     }
 
-    std::uint16_t options_checksum_negated_nbo = checksum(header_checksum_network_byte_order, optionBuffer, optionWriteIndex);
-    std::uint16_t options_checksum_nbo = ~options_checksum_negated_nbo;
+    return tcp_checksum(header, std::string_view{optionBuffer, static_cast<std::size_t>(optionWriteIndex)}, payload);
+}
 
-    std::uint16_t payload_checksum_nbo = checksum(options_checksum_nbo, payload.data(), payload.size());
-    return std::byteswap(payload_checksum_nbo);
+// As above, for a payload already summed on its way into the frame with copyAndSum
+inline std::uint16_t tcp_checksum(const TcpPseudoPacket& header, std::span<TcpOption> options, std::uint16_t payloadSum)
+{
+    std::uint16_t headerSum = ~std::byteswap(tcp_checksum(header, options, std::string_view{}));
+    return std::byteswap(static_cast<std::uint16_t>(~addSums(headerSum, payloadSum)));
 }
 
 template <> struct std::formatter<TcpFlags> : SimpleFormatter
@@ -214,21 +236,125 @@ struct TcpResponse
     bool mPrintPayload{};
 };
 
+// The IP and TCP headers without options, which a segment size leaves out
+static constexpr std::uint16_t cTcpIpHeaderSize{sizeof(IpV4Header) + sizeof(TcpHeader)};
+
+// What to advertise in our Syn or Syn Ack, so the peer's segments fit the path back to us unfragmented
+inline TcpOption maximumSegmentSize(std::uint16_t pathMtu)
+{
+    return TcpOption{TcpOptionType::MaximumSegmentSize, 4, static_cast<std::uint32_t>(pathMtu - cTcpIpHeaderSize)};
+}
+
+// Passive nodes answer whatever arrives, while an active open waits in SynSent for the Syn Ack
+// A passive node which has answered a Syn is in SynReceived until the Ack of its Syn Ack arrives.
+enum class TcpState : std::uint8_t
+{
+    Listen,
+    SynSent,
+    SynReceived,
+    Established,
+};
+
 class TcpNode
 {
     struct ControlBlock
     {
-        SequenceNumber mLastSendSeqNum{8000};
+        SequenceNumber mLastSendSeqNum{};
         SequenceNumber mLastRecvSeqNum{};
         SequenceNumber mLastSendAckNum{};
         SequenceNumber mLastRecvAckNum{};
     };
 
 public:
-    TcpNode(Port port, Port remotePort) : mPort{port}, mRemotePort{remotePort} { }
+    static constexpr std::uint16_t cWindowSize{64240};
+    static constexpr std::uint16_t cDefaultSegmentSize{536}; // Assumed when the peer's Syn does not say, as RFC 879 has it
+
+    TcpNode(Port port, Port remotePort, SequenceNumber initialSequence) : mPort{port}, mRemotePort{remotePort}
+    {
+        mControlBlock.mLastSendSeqNum = initialSequence;
+    }
+
+    // Starts an active open, returning the Syn to send
+    TcpHeader open()
+    {
+        mState = TcpState::SynSent;
+        TcpHeader syn{};
+        syn.mSourcePort = mPort;
+        syn.mDestinationPort = mRemotePort;
+        syn.mSequenceNumber = mControlBlock.mLastSendSeqNum;
+        syn.setLength(5);
+        syn.mFlags.mValue = std::to_underlying(TcpFlag::Syn);
+        syn.mWindowSize = cWindowSize;
+        return syn;
+    }
+
+    TcpState state() const
+    {
+        return mState;
+    }
+
+    // Remembers the largest segment the peer will take, from the options on its Syn
+    void onSynOptions(std::span<const TcpOption> options)
+    {
+        for (const auto& option : options)
+        {
+            if (option.mType == TcpOptionType::MaximumSegmentSize)
+            {
+                mPeerSegmentSize = static_cast<std::uint16_t>(option.mData);
+            }
+        }
+    }
+
+    // Whether this acknowledges our Syn Ack, which finishes a passive open
+    bool completesPassiveOpen(const TcpHeader& header)
+    {
+        bool ack = header.mFlags.set(TcpFlag::Ack) && !header.mFlags.set(TcpFlag::Syn);
+        if (mState != TcpState::SynReceived || !ack || header.mAcknowledgementNumber != mControlBlock.mLastSendSeqNum + 1)
+        {
+            return false;
+        }
+
+        mState = TcpState::Established;
+        mControlBlock.mLastSendSeqNum = header.mAcknowledgementNumber;
+        return true;
+    }
+
+    // Whether a Reset is meant for this handshake rather than blind:
+    // acknowledging our Syn for an active open, in sequence for a passive one
+    bool acceptsReset(const TcpHeader& header) const
+    {
+        if (mState == TcpState::SynSent)
+        {
+            return header.mFlags.set(TcpFlag::Ack) && header.mAcknowledgementNumber == mControlBlock.mLastSendSeqNum + 1;
+        }
+        return mState == TcpState::SynReceived && header.mSequenceNumber == mControlBlock.mLastSendAckNum;
+    }
+
+    // Where each side's data starts, once the handshake is done
+    SequenceNumber sendNext() const
+    {
+        return mControlBlock.mLastSendSeqNum;
+    }
+
+    SequenceNumber receiveNext() const
+    {
+        return mControlBlock.mLastSendAckNum;
+    }
+
+    // The largest segment we should send, which both the peer and the path to it can take
+    // Asked each time rather than kept, so it follows the path MTU as we learn it
+    std::uint16_t segmentSize(std::uint16_t pathMtu) const
+    {
+        return std::min<std::uint16_t>(mPeerSegmentSize, pathMtu - cTcpIpHeaderSize);
+    }
 
     TcpResponse onMessage(const TcpHeader& header, std::size_t payload_size)
     {
+        if (mState == TcpState::SynSent)
+        {
+            return onSynSentMessage(header);
+        }
+
         TcpHeader result{header};
         std::swap(result.mSourcePort, result.mDestinationPort);
         result.mCheckSum = 0;
@@ -245,9 +371,14 @@ public:
 
         if (header.mFlags.set(TcpFlag::Syn))
         {
-            assert(payload_size == 0);
+            // We do not support data on a Syn (as in TCP Fast Open),
+            // so any payload is left unacknowledged for the peer to resend
             result.mFlags = result.mFlags | TcpFlag::Syn;
             result.mSequenceNumber = mControlBlock.mLastSendSeqNum++;
+            if (mState == TcpState::Listen)
+            {
+                mState = TcpState::SynReceived;
+            }
             result.mAcknowledgementNumber = header.mSequenceNumber + 1;
         }
 
@@ -261,6 +392,33 @@ public:
     }
 
 private:
+    // Completes the handshake with an Ack, if this acknowledges our Syn
+    // Anything else is ignored, leaving the peer to retransmit
+    TcpResponse onSynSentMessage(const TcpHeader& header)
+    {
+        bool synAck = header.mFlags.set(TcpFlag::Syn) && header.mFlags.set(TcpFlag::Ack);
+        if (!synAck || header.mAcknowledgementNumber != mControlBlock.mLastSendSeqNum + 1)
+        {
+            return {};
+        }
+
+        mState = TcpState::Established;
+        TcpHeader result{};
+        result.mSourcePort = mPort;
+        result.mDestinationPort = mRemotePort;
+        result.mSequenceNumber = header.mAcknowledgementNumber;
+        result.mAcknowledgementNumber = header.mSequenceNumber + 1;
+        result.setLength(5);
+        result.mFlags.mValue = std::to_underlying(TcpFlag::Ack);
+        result.mWindowSize = cWindowSize;
+
+        mControlBlock.mLastRecvSeqNum = header.mSequenceNumber;
+        mControlBlock.mLastRecvAckNum = header.mAcknowledgementNumber;
+        mControlBlock.mLastSendSeqNum = result.mSequenceNumber;
+        mControlBlock.mLastSendAckNum = result.mAcknowledgementNumber;
+        return {result, true, false};
+    }
+
     bool shouldAck(const TcpHeader& header, std::size_t payload_size)
     {
         if (header.mFlags.set(TcpFlag::Syn))
@@ -297,6 +455,252 @@ private:
 
     Port mPort;
     Port mRemotePort;
+    TcpState mState{TcpState::Listen};
+    std::uint16_t mPeerSegmentSize{cDefaultSegmentSize};
     ControlBlock mControlBlock{};
 };
 
+// The answer to a segment for a connection we know nothing of, as in RFC 793, which remembers nothing
+// A Reset is never answered, so two stacks cannot reset each other forever.
+inline TcpHeader resetFor(const TcpHeader& header, std::size_t payloadSize)
+{
+    TcpHeader reset{};
+    reset.mSourcePort = header.mDestinationPort;
+    reset.mDestinationPort = header.mSourcePort;
+    reset.setLength(5);
+    if (header.mFlags.set(TcpFlag::Ack))
+    {
+        reset.mSequenceNumber = header.mAcknowledgementNumber;
+        reset.mFlags.mValue = std::to_underlying(TcpFlag::Reset);
+        return reset;
+    }
+
+    auto length = payloadSize + (header.mFlags.set(TcpFlag::Syn) ? 1 : 0) + (header.mFlags.set(TcpFlag::Fin) ? 1 : 0);
+    reset.mAcknowledgementNumber = header.mSequenceNumber + static_cast<SequenceNumber>(length);
+    reset.mFlags = TcpFlags{std::to_underlying(TcpFlag::Reset)} | TcpFlag::Ack;
+    return reset;
+}
+
+// Connections are told apart by both addresses and both ports,
+// as we may have more than one address of our own
+struct ConnectionKey
+{
+    IpAddress mLocalIp;
+    IpAddress mRemoteIp;
+    Port mLocalPort;
+    Port mRemotePort;
+
+    bool operator==(const ConnectionKey&) const = default;
+};
+
+template <> struct std::hash<ConnectionKey>
+{
+    std::size_t operator()(const ConnectionKey& key) const
+    {
+        static constexpr std::uint64_t cGoldenRatio{0x9e3779b97f4a7c15};
+        auto packed = std::uint64_t{std::bit_cast<std::uint32_t>(key.mRemoteIp)} << 32 | std::uint32_t{key.mLocalPort} << 16 | key.mRemotePort;
+        return std::hash<std::uint64_t>{}(packed ^ std::bit_cast<std::uint32_t>(key.mLocalIp) * cGoldenRatio);
+    }
+};
+
+// Passive opens still shaking hands, each holding a node until it finishes, is reset, or takes too long
+// There are only so many at once, so Syns from addresses which never answer cannot grow the node table without bound.
+class HalfOpenConnections
+{
+public:
+    static constexpr std::size_t cMaxConnections{1024};
+    static constexpr std::uint64_t cTimeoutNanos{10'000'000'000};
+
+    bool full() const
+    {
+        return mDeadlines.size() >= cMaxConnections;
+    }
+
+    std::size_t size() const
+    {
+        return mDeadlines.size();
+    }
+
+    void add(const ConnectionKey& key, std::uint64_t nowNanos)
+    {
+        auto deadline = nowNanos + cTimeoutNanos;
+        mDeadlines[key] = deadline;
+        mExpiries.emplace_back(key, deadline);
+    }
+
+    // Once the handshake has finished, or been reset
+    void remove(const ConnectionKey& key)
+    {
+        mDeadlines.erase(key);
+    }
+
+    // Calls onExpired with each handshake which has taken too long, and forgets it
+    template <typename OnExpiredT>
+    void expire(std::uint64_t nowNanos, OnExpiredT&& onExpired)
+    {
+        while (!mExpiries.empty() && mExpiries.front().second <= nowNanos)
+        {
+            auto [key, deadline] = mExpiries.front();
+            mExpiries.pop_front();
+            // Those which finished, or were reset and began again, are skipped
+            auto entry = mDeadlines.find(key);
+            if (entry != mDeadlines.end() && entry->second == deadline)
+            {
+                mDeadlines.erase(entry);
+                onExpired(key);
+            }
+        }
+    }
+
+private:
+    std::unordered_map<ConnectionKey, std::uint64_t> mDeadlines{};
+    std::deque<std::pair<ConnectionKey, std::uint64_t>> mExpiries{}; // In the order they were added, so deadlines are too
+};
+
+// Active opens whose Syn has gone, each sent again when it goes unanswered, backing off as streams do,
+// until it has been sent too often and the open fails, so a lost Syn never holds a node and its port for good
+class OpeningConnections
+{
+public:
+    static constexpr std::uint64_t cInitialTimeoutNanos{1'000'000'000}; // As RFC 6298 has it
+    static constexpr std::uint32_t cMaxRetransmits{6}; // As tcp_syn_retries
+
+    std::size_t size() const
+    {
+        return mOpening.size();
+    }
+
+    // Once its Syn has gone through nextHop, the first time or again
+    void sent(const ConnectionKey& key, IpAddress nextHop, std::uint64_t nowNanos)
+    {
+        auto& opening = mOpening[key];
+        opening.mDeadline = nowNanos + (cInitialTimeoutNanos << opening.mRetransmits);
+        opening.mNextHop = nextHop;
+        mTimers[opening.mRetransmits].emplace_back(key, opening.mDeadline);
+    }
+
+    // Once the handshake has finished, or been reset or given up on
+    void remove(const ConnectionKey& key)
+    {
+        mOpening.erase(key);
+    }
+
+    // Calls onRetransmit with each open whose Syn has gone unanswered too long, to send it again,
+    // and onFailed with each which has been sent too often, and forgets it
+    template <typename OnRetransmitT, typename OnFailedT>
+    void expire(std::uint64_t nowNanos, OnRetransmitT&& onRetransmit, OnFailedT&& onFailed)
+    {
+        for (auto& timers : mTimers)
+        {
+            while (!timers.empty() && timers.front().second <= nowNanos)
+            {
+                auto [key, deadline] = timers.front();
+                timers.pop_front();
+                // Those which finished, or were sent again since, are skipped
+                auto opening = mOpening.find(key);
+                if (opening == mOpening.end() || opening->second.mDeadline != deadline)
+                {
+                    continue;
+                }
+
+                if (++opening->second.mRetransmits > cMaxRetransmits)
+                {
+                    mOpening.erase(opening);
+                    onFailed(key);
+                    continue;
+                }
+                opening->second.mDeadline = 0;
+                onRetransmit(key);
+            }
+        }
+    }
+
+    // Forgets the opens whose Syns go through nextHop, once it stops answering ARP, returning them
+    std::vector<ConnectionKey> unreachable(IpAddress nextHop)
+    {
+        std::vector<ConnectionKey> keys{};
+        for (auto opening = mOpening.begin(); opening != mOpening.end();)
+        {
+            if (opening->second.mNextHop == nextHop)
+            {
+                keys.push_back(opening->first);
+                opening = mOpening.erase(opening);
+            }
+            else
+            {
+                ++opening;
+            }
+        }
+        return keys;
+    }
+
+private:
+    struct Opening
+    {
+        std::uint64_t mDeadline{}; // Zero while waiting to be sent again
+        IpAddress mNextHop{};
+        std::uint32_t mRetransmits{};
+    };
+
+    std::unordered_map<ConnectionKey, Opening> mOpening{};
+    // One queue for each backoff, so each keeps its deadlines in order, as those added later expire later
+    std::array<std::deque<std::pair<ConnectionKey, std::uint64_t>>, cMaxRetransmits + 1> mTimers{};
+};
+
+// Initial sequence numbers as in RFC 6528: a clock ticking every four microseconds,
+// plus a keyed hash of the connection, so they cannot be guessed from outside
+// but a reused connection still starts past where the last one left off
+class IsnGenerator
+{
+public:
+    explicit IsnGenerator(SipKey key = randomSipKey()) : mKey{key} { }
+
+    SequenceNumber next(const ConnectionKey& key, std::uint64_t nowNanos) const
+    {
+        static constexpr std::uint64_t cNanosPerTick{4000};
+        std::array<std::uint32_t, 3> tuple{std::bit_cast<std::uint32_t>(key.mLocalIp), std::bit_cast<std::uint32_t>(key.mRemoteIp),
+                                           std::uint32_t{key.mLocalPort} << 16 | key.mRemotePort};
+        return static_cast<SequenceNumber>(nowNanos / cNanosPerTick + sipHash(mKey, tuple.data(), sizeof(tuple)));
+    }
+
+private:
+    SipKey mKey;
+};
+
+// Picks local ports for active opens as in RFC 6056's third algorithm:
+// each destination starts searching from its own keyed hash offset,
+// so ports are hard to predict, and a shared counter moves every search on
+class EphemeralPorts
+{
+public:
+    // The same range as Linux
+    static constexpr Port cFirst{32768};
+    static constexpr Port cLast{60999};
+
+    explicit EphemeralPorts(SipKey key = randomSipKey()) : mKey{key} { }
+
+    // A port inUse(port) says is free for this destination, if there is one
+    template <typename InUseT>
+    std::optional<Port> allocate(IpAddress remoteIp, Port remotePort, InUseT&& inUse)
+    {
+        static constexpr std::uint32_t cCount{cLast - cFirst + 1};
+        std::array<std::uint32_t, 2> destination{std::bit_cast<std::uint32_t>(remoteIp), remotePort};
+        auto offset = sipHash(mKey, destination.data(), sizeof(destination));
+        for (std::uint32_t i = 0; i < cCount; i++)
+        {
+            auto port = static_cast<Port>(cFirst + (offset + mNext + i) % cCount);
+            if (!inUse(port))
+            {
+                mNext += i + 1;
+                return port;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    SipKey mKey;
+    std::uint64_t mNext{};
+};
+
@@ -2,12 +2,15 @@
 
 #include <Types.hpp>
 #include <Ip.hpp>
+#include <Parse.hpp>
 
 #include <array>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <bit>
+#include <cstring>
+#include <span>
 
 enum class TcpOptionType : std::uint8_t
 {
@@ -56,7 +59,7 @@ template <> struct std::formatter<TcpOptionType> : SimpleFormatter
         case TcpOptionType::FastOpen:
             return std::format_to(ctx.out(), "FastOpen");
         default:
-            throw std::runtime_error{std::format("Unexpected TCP Option type: {}", std::to_underlying(optionType))};
+            return std::format_to(ctx.out(), "Unknown TCP Option type {}", std::to_underlying(optionType));
         }
     }
 };
@@ -71,58 +74,130 @@ struct TcpOption
 };
 static_assert(sizeof(TcpOption) == 12, "TCP Options must fit within 12 bytes");
 
-template <>
-auto fromWire<TcpOption>(const char* buffer) -> TcpOption
+// Parses one option from the start of the options area,
+// checking its length against both the bytes remaining
+// and the length the option type requires
+// Options we do not understand are skipped over using their length
+inline ParseResult<TcpOption> parseTcpOption(std::span<const char> buffer)
 {
-    TcpOption result{};
+    if (buffer.empty())
+    {
+        return std::unexpected{DropReason::BadTcpOption};
+    }
 
-    result.mType = *reinterpret_cast<const TcpOptionType*>(buffer);
+    TcpOption result{};
+    result.mType = static_cast<TcpOptionType>(buffer[0]);
     switch (result.mType)
     {
         case TcpOptionType::EndOfOptions:
         case TcpOptionType::NoOp:
             return result;
+        default:
+            break;
     }
 
-    auto asSizedInt = [buffer]<typename SizeT>(std::int64_t offset = 2) {
-        SizeT myNetworkByteOrderNum = *reinterpret_cast<const SizeT*>(buffer + offset);
+    if (buffer.size() < 2)
+    {
+        return std::unexpected{DropReason::BadTcpOption};
+    }
+
+    result.mSize = static_cast<std::uint8_t>(buffer[1]);
+    if (result.mSize < 2 || result.mSize > buffer.size())
+    {
+        return std::unexpected{DropReason::BadTcpOption};
+    }
+
+    auto asSizedInt = [&buffer]<typename SizeT>(std::size_t offset = 2) {
+        SizeT myNetworkByteOrderNum{};
+        std::memcpy(&myNetworkByteOrderNum, buffer.data() + offset, sizeof(myNetworkByteOrderNum));
         return std::byteswap(myNetworkByteOrderNum);
     };
 
-    result.mSize = asSizedInt.template operator()<std::uint8_t>(1);
-
+    auto expectSize = [&result](std::uint8_t size) { return result.mSize == size; };
     switch (result.mType)
     {
         case TcpOptionType::SelectiveAcknowledgementPermitted:
-        case TcpOptionType::FastOpen:
-            assert(result.mSize == 2);
+            if (!expectSize(2))
+            {
+                return std::unexpected{DropReason::BadTcpOption};
+            }
             return result;
         case TcpOptionType::WindowScale:
-            assert(result.mSize == 3);
+            if (!expectSize(3))
+            {
+                return std::unexpected{DropReason::BadTcpOption};
+            }
             // Ridiculous syntax necessary to call a non deducible template lambda
             result.mData = asSizedInt.template operator()<std::uint8_t>();
             return result;
         case TcpOptionType::MaximumSegmentSize:
-            assert(result.mSize == 4);
+            if (!expectSize(4))
+            {
+                return std::unexpected{DropReason::BadTcpOption};
+            }
             result.mData = asSizedInt.template operator()<std::uint16_t>();
             return result;
         case TcpOptionType::Timestamps:
-            assert(result.mSize == 10);
+            if (!expectSize(10))
+            {
+                return std::unexpected{DropReason::BadTcpOption};
+            }
             result.mData = asSizedInt.template operator()<std::uint32_t>();
             result.mSecondData = asSizedInt.template operator()<std::uint32_t>(6);
             return result;
-        case TcpOptionType::SelectiveAcknowledgemnt:
-        case TcpOptionType::UserTimeout:
-        case TcpOptionType::Authentication:
-        case TcpOptionType::Multipath:
-            std::println("Error: Received unsupported TCP Option: {}", std::to_underlying(result.mType));
+        default:
+            // Fast Open cookies, Selective Acknowledgements and so on
+            // are well formed but unsupported, so we just step over them
+            return result;
     }
+}
 
-    return result;
+// Options fill at most 40 bytes of a TCP header, and each is at least one byte,
+// so we can keep every option of a segment without allocating
+struct TcpOptionList
+{
+    static constexpr std::size_t cMaxOptions{40};
+
+    std::array<TcpOption, cMaxOptions> mOptions{};
+    std::size_t mCount{};
+
+    std::span<TcpOption> view()
+    {
+        return {mOptions.data(), mCount};
+    }
+};
+
+inline ParseResult<void> parseTcpOptions(std::span<const char> buffer, TcpOptionList& result)
+{
+    result.mCount = 0;
+    std::size_t readOffset{0};
+    while (readOffset < buffer.size())
+    {
+        auto option = parseTcpOption(buffer.subspan(readOffset));
+        if (!option)
+        {
+            return std::unexpected{option.error()};
+        }
+
+        readOffset += option->mSize;
+        if (option->mType == TcpOptionType::EndOfOptions)
+        {
+            // Anything after this is padding
+            break;
+        }
+
+        if (result.mCount == TcpOptionList::cMaxOptions)
+        {
+            return std::unexpected{DropReason::BadTcpOption};
+        }
+        result.mOptions[result.mCount++] = *option;
+    }
+
+    return {};
 }
 
 template <>
-std::size_t toWire(const TcpOption& option, char* buffer)
+inline std::size_t toWire(const TcpOption& option, char* buffer)
 {
     char* writePointer{buffer};
     std::memcpy(writePointer, &option.mType, sizeof(option.mType));
@@ -199,7 +274,7 @@ template <> struct std::formatter<TcpOption> : SimpleFormatter
         case TcpOptionType::Timestamps:
             return std::format_to(ctx.out(), ", data: {}, secondary data: {}", option.mData, option.mSecondData);
         default:
-            throw std::runtime_error{std::format("Unexpected TCP Option type: {}", std::to_underlying(option.mType))};
+            return ctx.out();
         }
     }
 };
@@ -0,0 +1,1047 @@
+#pragma once
+
+#include <RxArena.hpp>
+#include <Tcp.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+
+// Sequence numbers wrap, so are compared by how far apart they are
+inline bool sequenceBefore(SequenceNumber lhs, SequenceNumber rhs)
+{
+    return static_cast<std::int32_t>(lhs - rhs) < 0;
+}
+
+// Bytes queued in order, in a buffer allocated once, whose size is rounded up to a power of two
+class StreamBuffer
+{
+public:
+    explicit StreamBuffer(std::size_t capacity)
+        : mCapacity{std::bit_ceil(std::max<std::size_t>(capacity, 1))}, mBytes{std::make_unique_for_overwrite<char[]>(mCapacity)} { }
+
+    std::size_t capacity() const
+    {
+        return mCapacity;
+    }
+
+    std::size_t size() const
+    {
+        return mWrite - mRead;
+    }
+
+    std::size_t space() const
+    {
+        return mCapacity - size();
+    }
+
+    // Queues as much of bytes as fits, returning how much that was
+    std::size_t write(std::span<const char> bytes)
+    {
+        auto count = std::min(bytes.size(), space());
+        auto start = mWrite & (mCapacity - 1);
+        auto first = std::min(count, mCapacity - start);
+        std::memcpy(mBytes.get() + start, bytes.data(), first);
+        std::memcpy(mBytes.get(), bytes.data() + first, count - first);
+        mWrite += count;
+        return count;
+    }
+
+    // Copies out up to out.size() bytes from offset past the oldest, leaving them queued
+    std::size_t peek(std::size_t offset, std::span<char> out) const
+    {
+        if (offset >= size())
+        {
+            return 0;
+        }
+
+        auto count = std::min(out.size(), size() - offset);
+        auto start = (mRead + offset) & (mCapacity - 1);
+        auto first = std::min(count, mCapacity - start);
+        std::memcpy(out.data(), mBytes.get() + start, first);
+        std::memcpy(out.data() + first, mBytes.get(), count - first);
+        return count;
+    }
+
+    // As peek, summing the bytes as they are copied, see copyAndSum
+    std::uint16_t peekAndSum(std::size_t offset, std::span<char> out) const
+    {
+        auto count = std::min(out.size(), size() - std::min(offset, size()));
+        auto start = (mRead + offset) & (mCapacity - 1);
+        auto first = std::min(count, mCapacity - start);
+        auto sum = copyAndSum(out.data(), mBytes.get() + start, first);
+        return addSums(sum, copyAndSum(out.data() + first, mBytes.get(), count - first), first % 2);
+    }
+
+    std::size_t read(std::span<char> out)
+    {
+        auto count = peek(0, out);
+        consume(count);
+        return count;
+    }
+
+    void consume(std::size_t count)
+    {
+        mRead += std::min(count, size());
+    }
+
+private:
+    std::size_t mCapacity;
+    std::unique_ptr<char[]> mBytes;
+    std::size_t mRead{}; // Both only ever count up, and are masked on use
+    std::size_t mWrite{};
+};
+
+// What a stream has to send, from the oldest unacknowledged byte
+// Bytes the application sends are copied into a StreamBuffer, but it can also queue regions of its own memory,
+// a mapped file say, which are read again for every segment, retransmits included, and never copied anywhere but the frame.
+class SendQueue
+{
+public:
+    explicit SendQueue(std::size_t capacity) : mBuffered{capacity} { }
+
+    std::size_t size() const
+    {
+        return mSize;
+    }
+
+    // For bytes to be copied in, as regions take no room
+    std::size_t space() const
+    {
+        return mBuffered.space();
+    }
+
+    std::size_t write(std::span<const char> bytes)
+    {
+        auto count = mBuffered.write(bytes);
+        if (count != 0 && !mPieces.empty() && mPieces.back().mRegion.empty())
+        {
+            mPieces.back().mSize += count;
+        }
+        else if (count != 0)
+        {
+            mPieces.push_back(Piece{count, {}});
+        }
+        mSize += count;
+        return count;
+    }
+
+    // The region must stay where it is until it has all been consumed
+    void writeRegion(std::span<const char> region)
+    {
+        if (!region.empty())
+        {
+            mPieces.push_back(Piece{region.size(), region});
+            mSize += region.size();
+        }
+    }
+
+    // Copies out up to out.size() bytes from offset past the oldest, returning their sum, see copyAndSum
+    std::uint16_t copy(std::size_t offset, std::span<char> out) const
+    {
+        std::uint16_t sum{0};
+        std::size_t copied{0};
+        std::size_t bufferedOffset{0};
+        for (const auto& piece : mPieces)
+        {
+            if (copied == out.size())
+            {
+                break;
+            }
+
+            if (offset >= piece.mSize)
+            {
+                offset -= piece.mSize;
+                bufferedOffset += piece.mRegion.empty() ? piece.mSize : 0;
+                continue;
+            }
+
+            auto count = std::min(piece.mSize - offset, out.size() - copied);
+            auto part = piece.mRegion.empty() ? mBuffered.peekAndSum(bufferedOffset + offset, out.subspan(copied, count))
+                                              : copyAndSum(out.data() + copied, piece.mRegion.data() + offset, count);
+            sum = addSums(sum, part, copied % 2);
+            copied += count;
+            bufferedOffset += piece.mRegion.empty() ? piece.mSize : 0;
+            offset = 0;
+        }
+        return sum;
+    }
+
+    void consume(std::size_t count)
+    {
+        count = std::min(count, mSize);
+        mSize -= count;
+        while (count != 0)
+        {
+            auto& piece = mPieces.front();
+            auto taken = std::min(count, piece.mSize);
+            if (piece.mRegion.empty())
+            {
+                mBuffered.consume(taken);
+            }
+            else
+            {
+                piece.mRegion = piece.mRegion.subspan(taken);
+            }
+
+            piece.mSize -= taken;
+            count -= taken;
+            if (piece.mSize == 0)
+            {
+                mPieces.pop_front();
+            }
+        }
+    }
+
+private:
+    struct Piece
+    {
+        std::size_t mSize;
+        std::span<const char> mRegion; // Empty when the bytes are in the buffer
+    };
+
+    StreamBuffer mBuffered;
+    std::deque<Piece> mPieces{};
+    std::size_t mSize{};
+};
+
+enum class SocketEvent : std::uint8_t
+{
+    Acceptable = 1 << 0, // A listening port has a connection waiting to be accepted
+    Readable = 1 << 1,
+    Writable = 1 << 2, // Only after a send which did not fit
+    Closed = 1 << 3, // The peer has finished sending, or the connection is gone
+};
+
+struct SocketEvents
+{
+    std::uint8_t mValue;
+
+    bool set(SocketEvent event) const
+    {
+        return mValue & std::to_underlying(event);
+    }
+
+    SocketEvents operator|(SocketEvent event) const
+    {
+        return SocketEvents(mValue | std::to_underlying(event));
+    }
+
+    SocketEvents operator|(SocketEvents events) const
+    {
+        return SocketEvents(mValue | events.mValue);
+    }
+};
+
+template <> struct std::formatter<SocketEvents> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const SocketEvents& events, FormatContext& ctx) const
+    {
+        std::format_to(ctx.out(), "Events: |");
+        if (events.set(SocketEvent::Acceptable))
+        {
+            std::format_to(ctx.out(), "Acceptable|");
+        }
+        if (events.set(SocketEvent::Readable))
+        {
+            std::format_to(ctx.out(), "Readable|");
+        }
+        if (events.set(SocketEvent::Writable))
+        {
+            std::format_to(ctx.out(), "Writable|");
+        }
+        if (events.set(SocketEvent::Closed))
+        {
+            std::format_to(ctx.out(), "Closed|");
+        }
+
+        return ctx.out();
+    }
+};
+
+// What changed on a connection, or on a listening port, in which case only the local address and port are set
+struct Readiness
+{
+    ConnectionKey mKey;
+    SocketEvents mEvents;
+};
+
+struct TcpBufferSizes
+{
+    std::size_t mReceive{64 * 1024};
+    std::size_t mSend{64 * 1024};
+};
+
+enum class ReceiveMode : std::uint8_t
+{
+    Copy, // Received bytes are copied into the stream's buffer, and out again by receive
+    Lend, // Received bytes stay in the frame buffers they arrived in, which are lent to the application
+};
+
+template <> struct std::formatter<ReceiveMode> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const ReceiveMode& mode, FormatContext& ctx) const
+    {
+        switch (mode)
+        {
+            case ReceiveMode::Copy:
+                return std::format_to(ctx.out(), "Copy");
+            case ReceiveMode::Lend:
+                return std::format_to(ctx.out(), "Lend");
+            default:
+                return std::format_to(ctx.out(), "Unknown ReceiveMode {}", std::to_underlying(mode));
+        }
+    }
+};
+
+// Payloads received in order, waiting to be lent to the application, in a ring allocated once,
+// and the buffers of those already lent, so only what was really lent can be given back
+class LoanQueue
+{
+public:
+    struct Lent
+    {
+        std::size_t mBytes;
+        std::uint32_t mCount; // Only ever one, as each payload arrives in a buffer of its own, but counted to be sure
+    };
+    using Outstanding = std::unordered_map<std::uint32_t, Lent>; // By buffer
+
+    // Forgets one loan from its buffer, returning how many bytes it counted for, or nothing if it was never lent
+    static std::optional<std::size_t> takeBack(Outstanding& outstanding, const RxLoan& loan)
+    {
+        auto lent = outstanding.find(loan.mBuffer);
+        if (lent == outstanding.end())
+        {
+            return std::nullopt;
+        }
+
+        // Trusting the size given back only so far, as the last loan from a buffer takes whatever is left
+        auto bytes = --lent->second.mCount == 0 ? lent->second.mBytes : std::min(lent->second.mBytes, loan.mBytes.size());
+        lent->second.mBytes -= bytes;
+        if (lent->second.mCount == 0)
+        {
+            outstanding.erase(lent);
+        }
+        return bytes;
+    }
+
+    static constexpr std::size_t cCapacity{256}; // Enough for a 64KB window of small segments
+
+    LoanQueue() : mLoans{std::make_unique<RxLoan[]>(cCapacity)} { }
+
+    bool empty() const
+    {
+        return mRead == mWrite;
+    }
+
+    bool full() const
+    {
+        return mWrite - mRead == cCapacity;
+    }
+
+    void push(const RxLoan& loan)
+    {
+        mLoans[mWrite++ % cCapacity] = loan;
+    }
+
+    RxLoan& front()
+    {
+        return mLoans[mRead % cCapacity];
+    }
+
+    void pop()
+    {
+        mRead += 1;
+    }
+
+    // Lends out the front payload, which pops it
+    RxLoan lend()
+    {
+        auto loan = front();
+        auto& lent = mOutstanding[loan.mBuffer];
+        lent.mBytes += loan.mBytes.size();
+        lent.mCount += 1;
+        pop();
+        return loan;
+    }
+
+    std::optional<std::size_t> takeBack(const RxLoan& loan)
+    {
+        return takeBack(mOutstanding, loan);
+    }
+
+    Outstanding& outstanding()
+    {
+        return mOutstanding;
+    }
+
+private:
+    std::unique_ptr<RxLoan[]> mLoans;
+    Outstanding mOutstanding{};
+    std::size_t mRead{}; // Both only ever count up
+    std::size_t mWrite{};
+};
+
+// The data carrying half of a connection somebody listened for or opened,
+// taking over from the TcpNode once its handshake is done
+// Received bytes are only taken in order, and anything else acknowledged again, so the peer resends what we missed.
+// Sent bytes stay in the send queue until acknowledged, and if that takes too long
+// we go back to the oldest and send them all again.
+// A stream which lends what it receives holds a reference to each buffer its payloads are in,
+// and counts them against its receive buffer size until they are given back, so the window shuts
+// when the application holds on to too much, as well as when the arena is running out.
+class TcpStream
+{
+public:
+    static constexpr std::uint64_t cInitialRetransmitNanos{200'000'000}; // The least Linux waits
+    static constexpr std::uint64_t cMaxRetransmitNanos{60'000'000'000};
+    static constexpr std::uint32_t cMaxRetransmits{15}; // As tcp_retries2
+
+    struct Segment
+    {
+        TcpHeader mHeader;
+        std::size_t mOffset; // Of the payload, past the oldest unacknowledged byte
+        std::size_t mSize;
+    };
+
+    struct Update
+    {
+        SocketEvents mEvents{};
+        bool mSendAck{};
+    };
+
+    // Lends what it receives when given an arena to lend from
+    TcpStream(const ConnectionKey& key, TcpBufferSizes sizes, RxBufferArena* lender = nullptr)
+        : mPort{key.mLocalPort}, mRemotePort{key.mRemotePort}, mReceived{lender == nullptr ? sizes.mReceive : 1}, mToSend{sizes.mSend},
+          mLender{lender}, mLendable{std::bit_ceil(std::max<std::size_t>(sizes.mReceive, 1))}
+    {
+        if (mLender != nullptr)
+        {
+            mLoans = std::make_unique<LoanQueue>();
+        }
+    }
+
+    TcpStream(const TcpStream&) = delete;
+    TcpStream& operator=(const TcpStream&) = delete;
+
+    // Gives back whatever was never lent
+    ~TcpStream()
+    {
+        if (mLoans != nullptr)
+        {
+            for (; !mLoans->empty(); mLoans->pop())
+            {
+                mLender->release(mLoans->front().mBuffer);
+            }
+        }
+    }
+
+    void establish(SequenceNumber sendNext, SequenceNumber receiveNext, std::uint16_t peerWindow)
+    {
+        mEstablished = true;
+        mSendUnacknowledged = sendNext;
+        mSendNext = sendNext;
+        mReceiveNext = receiveNext;
+        mPeerWindow = peerWindow;
+    }
+
+    bool established() const
+    {
+        return mEstablished;
+    }
+
+    // Both ways are done with, or the connection is gone, so it can be forgotten
+    bool finished() const
+    {
+        return mFailed || (mPeerFinished && mFinAcknowledged);
+    }
+
+    // Reset by the peer, or given up on
+    bool failed() const
+    {
+        return mFailed;
+    }
+
+    bool closing() const
+    {
+        return mClosing;
+    }
+
+    bool peerFinished() const
+    {
+        return mPeerFinished;
+    }
+
+    // Queues as much of bytes as there is room for, returning how much that was
+    std::size_t send(std::span<const char> bytes)
+    {
+        if (mClosing || mFailed)
+        {
+            return 0;
+        }
+
+        auto queued = mToSend.write(bytes);
+        mWantWritable = queued < bytes.size();
+        return queued;
+    }
+
+    // Queues a region of the application's memory to be sent straight from where it is
+    bool sendRegion(std::span<const char> region)
+    {
+        if (mClosing || mFailed)
+        {
+            return false;
+        }
+
+        mToSend.writeRegion(region);
+        return true;
+    }
+
+    std::size_t sendSpace() const
+    {
+        return mClosing || mFailed ? 0 : mToSend.space();
+    }
+
+    // Everything sent or queued which the peer is yet to acknowledge
+    std::size_t unacknowledged() const
+    {
+        return mToSend.size();
+    }
+
+    std::size_t receive(std::span<char> out)
+    {
+        if (mLoans == nullptr)
+        {
+            return mReceived.read(out);
+        }
+
+        // Copying out of a lending stream gives back each loan as soon as it is all copied
+        std::size_t copied{0};
+        while (copied < out.size() && !mLoans->empty())
+        {
+            auto& loan = mLoans->front();
+            auto count = std::min(out.size() - copied, loan.mBytes.size());
+            std::memcpy(out.data() + copied, loan.mBytes.data(), count);
+            copied += count;
+            loan.mBytes = loan.mBytes.subspan(count);
+            if (loan.mBytes.empty())
+            {
+                mLender->release(loan.mBuffer);
+                mLoans->pop();
+            }
+        }
+        mLent -= copied;
+        return copied;
+    }
+
+    // Lends out up to out.size() payloads received in order, returning how many
+    // Each must be given back to the Stack once the application is done with it.
+    std::size_t lend(std::span<RxLoan> out)
+    {
+        std::size_t count{0};
+        if (mLoans != nullptr)
+        {
+            while (count < out.size() && !mLoans->empty())
+            {
+                out[count++] = mLoans->lend();
+            }
+        }
+        return count;
+    }
+
+    // Releases the buffer of a loan this stream lent and has yet to have back, returning false for any other
+    bool givenBack(const RxLoan& loan)
+    {
+        if (mLoans == nullptr)
+        {
+            return false;
+        }
+
+        auto bytes = mLoans->takeBack(loan);
+        if (!bytes.has_value())
+        {
+            return false;
+        }
+
+        mLender->release(loan.mBuffer);
+        mLent -= std::min(mLent, *bytes);
+        return true;
+    }
+
+    // The loans still out once we are gone, which are given back to the arena without us
+    LoanQueue::Outstanding takeOutstanding()
+    {
+        return mLoans == nullptr ? LoanQueue::Outstanding{} : std::exchange(mLoans->outstanding(), {});
+    }
+
+    // No more will be sent, so a Fin follows whatever is still queued
+    void close()
+    {
+        mClosing = true;
+    }
+
+    Update onSegment(const TcpHeader& header, std::span<const char> payload, std::uint64_t nowNanos)
+    {
+        Update update{};
+        if (header.mFlags.set(TcpFlag::Reset))
+        {
+            // Only believed from within the window, so it cannot be guessed blind (RFC 5961 would be stricter still)
+            auto offset = header.mSequenceNumber - mReceiveNext;
+            if (offset <= window())
+            {
+                mFailed = true;
+                update.mEvents = update.mEvents | SocketEvent::Closed;
+            }
+            return update;
+        }
+
+        if (header.mFlags.set(TcpFlag::Ack))
+        {
+            onAck(header, update, nowNanos);
+        }
+
+        if (!payload.empty())
+        {
+            update.mSendAck = true;
+            if (header.mSequenceNumber == mReceiveNext && !mPeerFinished)
+            {
+                // Anything past our window is dropped, and sent again once there is room
+                auto taken = mLoans == nullptr ? mReceived.write(payload) : borrow(payload);
+                mReceiveNext += static_cast<SequenceNumber>(taken);
+                if (taken != 0)
+                {
+                    update.mEvents = update.mEvents | SocketEvent::Readable;
+                }
+            }
+        }
+
+        if (header.mFlags.set(TcpFlag::Fin))
+        {
+            update.mSendAck = true;
+            if (!mPeerFinished && header.mSequenceNumber + payload.size() == mReceiveNext)
+            {
+                mPeerFinished = true;
+                mReceiveNext += 1;
+                update.mEvents = update.mEvents | SocketEvent::Readable | SocketEvent::Closed;
+            }
+        }
+        return update;
+    }
+
+    // Acknowledges everything received so far, and says how much more room there is
+    TcpHeader ackHeader()
+    {
+        TcpHeader header{};
+        header.mSourcePort = mPort;
+        header.mDestinationPort = mRemotePort;
+        header.mSequenceNumber = mSendNext;
+        header.mAcknowledgementNumber = mReceiveNext;
+        header.setLength(5);
+        header.mFlags.mValue = std::to_underlying(TcpFlag::Ack);
+        mAdvertisedWindow = window();
+        header.mWindowSize = mAdvertisedWindow;
+        return header;
+    }
+
+    // The next segment to send, if the peer has room for it, or our Fin once everything queued has gone
+    // Its payload is then copied out of the send queue with copyPayload.
+    std::optional<Segment> nextSegment(std::uint16_t segmentSize, std::uint64_t nowNanos)
+    {
+        if (!mEstablished || mFailed || mFinSent)
+        {
+            return std::nullopt;
+        }
+
+        std::size_t inFlight = mSendNext - mSendUnacknowledged;
+        auto unsent = mToSend.size() - inFlight;
+        std::size_t usable = mPeerWindow > inFlight ? mPeerWindow - inFlight : 0;
+        if (mProbeWindow)
+        {
+            // The peer's window has been shut for a while, so we try one byte to see if it has opened
+            usable = std::max<std::size_t>(usable, 1);
+            mProbeWindow = false;
+        }
+
+        auto size = std::min({unsent, std::size_t{segmentSize}, usable});
+        if (size == 0 && (!mClosing || unsent != 0))
+        {
+            if (unsent != 0 && inFlight == 0)
+            {
+                armRetransmit(nowNanos);
+            }
+            return std::nullopt;
+        }
+
+        auto header = ackHeader();
+        if (size == 0)
+        {
+            header.mFlags = header.mFlags | TcpFlag::Fin;
+            mFinSent = true;
+            mSendNext += 1;
+        }
+        else
+        {
+            header.mFlags = header.mFlags | TcpFlag::Push;
+            mSendNext += static_cast<SequenceNumber>(size);
+        }
+        armRetransmit(nowNanos);
+        return Segment{header, inFlight, size};
+    }
+
+    // Returns the payload's sum, so it need not be read again to checksum the segment
+    std::uint16_t copyPayload(const Segment& segment, std::span<char> out) const
+    {
+        return mToSend.copy(segment.mOffset, out.first(std::min(out.size(), segment.mSize)));
+    }
+
+    // Whether the application has read enough since we last said how much room we had to be worth saying again
+    bool windowUpdateDue() const
+    {
+        auto threshold = std::min(mLoans == nullptr ? mReceived.capacity() : mLendable, std::size_t{0xffff}) / 2;
+        return mEstablished && !mFailed && window() >= mAdvertisedWindow + threshold;
+    }
+
+    // When nothing has been acknowledged for too long, goes back to the oldest unacknowledged byte,
+    // or probes a shut window, returning whether it did
+    bool retransmitDue(std::uint64_t nowNanos)
+    {
+        if (mRetransmitAt == 0 || nowNanos < mRetransmitAt)
+        {
+            return false;
+        }
+
+        mRetransmitAt = 0;
+        if (++mRetransmits > cMaxRetransmits)
+        {
+            mFailed = true;
+            return false;
+        }
+
+        mRetransmitNanos = std::min(mRetransmitNanos * 2, cMaxRetransmitNanos);
+        if (mSendNext == mSendUnacknowledged)
+        {
+            mProbeWindow = true;
+            return false;
+        }
+
+        mSendNext = mSendUnacknowledged;
+        mFinSent = false;
+        return true;
+    }
+
+    // Cleared once reported, so each short send is followed by one Writable event
+    bool takeWritable()
+    {
+        if (!mWantWritable || mToSend.space() == 0 || mClosing)
+        {
+            return false;
+        }
+        mWantWritable = false;
+        return true;
+    }
+
+private:
+    std::uint16_t window() const
+    {
+        if (mLoans == nullptr)
+        {
+            return static_cast<std::uint16_t>(std::min(mReceived.space(), std::size_t{0xffff}));
+        }
+        return mLender->spare() ? static_cast<std::uint16_t>(std::min(mLendable - mLent, std::size_t{0xffff})) : 0;
+    }
+
+    // Takes a reference to the buffer payload is in, or copies it into one of its own
+    // when it arrived somewhere else, as a reassembled datagram does, returning how much was taken
+    std::size_t borrow(std::span<const char> payload)
+    {
+        auto size = std::min(payload.size(), mLendable - mLent);
+        if (size == 0 || mLoans->full() || !mLender->spare())
+        {
+            return 0;
+        }
+
+        auto buffer = mLender->find(payload.data());
+        if (buffer.has_value())
+        {
+            mLender->retain(*buffer);
+        }
+        else
+        {
+            if (!mLender->spare(1))
+            {
+                return 0;
+            }
+            buffer = mLender->allocate();
+            size = std::min(size, RxBufferArena::cBufferSize);
+            auto copy = mLender->bytes(*buffer).first(size);
+            std::memcpy(copy.data(), payload.data(), size);
+            payload = copy;
+        }
+
+        mLoans->push(RxLoan{payload.first(size), *buffer});
+        mLent += size;
+        return size;
+    }
+
+    void armRetransmit(std::uint64_t nowNanos)
+    {
+        if (mRetransmitAt == 0)
+        {
+            mRetransmitAt = nowNanos + mRetransmitNanos;
+        }
+    }
+
+    void onAck(const TcpHeader& header, Update& update, std::uint64_t nowNanos)
+    {
+        auto ack = header.mAcknowledgementNumber;
+        if (sequenceBefore(mSendNext, ack))
+        {
+            // For something we have not sent, so ignored
+            update.mSendAck = true;
+            return;
+        }
+
+        mPeerWindow = header.mWindowSize;
+        if (!sequenceBefore(mSendUnacknowledged, ack))
+        {
+            return;
+        }
+
+        std::size_t acknowledged = ack - mSendUnacknowledged;
+        if (mFinSent && ack == mSendNext)
+        {
+            mFinAcknowledged = true;
+            acknowledged -= 1;
+        }
+        mToSend.consume(acknowledged);
+        mSendUnacknowledged = ack;
+        mRetransmits = 0;
+        mRetransmitNanos = cInitialRetransmitNanos;
+        mRetransmitAt = 0;
+        if (mSendNext != mSendUnacknowledged)
+        {
+            armRetransmit(nowNanos);
+        }
+
+        if (takeWritable())
+        {
+            update.mEvents = update.mEvents | SocketEvent::Writable;
+        }
+    }
+
+    Port mPort;
+    Port mRemotePort;
+    StreamBuffer mReceived;
+    SendQueue mToSend;
+    RxBufferArena* mLender;
+    std::unique_ptr<LoanQueue> mLoans{}; // Only when lending
+    std::size_t mLendable; // How many received bytes may be queued or lent at once
+    std::size_t mLent{};
+    SequenceNumber mSendUnacknowledged{};
+    SequenceNumber mSendNext{};
+    SequenceNumber mReceiveNext{};
+    std::uint16_t mPeerWindow{};
+    std::uint16_t mAdvertisedWindow{};
+    std::uint64_t mRetransmitAt{}; // Zero when nothing is waiting on an Ack
+    std::uint64_t mRetransmitNanos{cInitialRetransmitNanos};
+    std::uint32_t mRetransmits{};
+    bool mEstablished{};
+    bool mWantWritable{};
+    bool mClosing{};
+    bool mFinSent{};
+    bool mFinAcknowledged{};
+    bool mPeerFinished{};
+    bool mProbeWindow{};
+    bool mFailed{};
+};
+
+// The ports applications listen on, and the streams of the connections they accept or open
+// Segments to ports nobody listens on are answered with a Reset, and leave nothing behind.
+// What changes is kept as a set of events per connection, which the application collects
+// with readiness, much as epoll_wait works.
+class TcpSockets
+{
+public:
+    static constexpr std::size_t cBacklog{128}; // Connections waiting to be accepted on each port
+
+    // Lending streams need an arena to lend from
+    bool listen(Port port, TcpBufferSizes sizes, ReceiveMode mode)
+    {
+        if (mode == ReceiveMode::Lend && mArena == nullptr)
+        {
+            return false;
+        }
+        return mListeners.try_emplace(port, Listener{sizes, mode}).second;
+    }
+
+    // Stops accepting connections to port, returning those which were waiting to be accepted
+    std::deque<ConnectionKey> unlisten(Port port)
+    {
+        auto listener = mListeners.find(port);
+        if (listener == mListeners.end())
+        {
+            return {};
+        }
+
+        auto accepting = std::move(listener->second.mAccepting);
+        mListeners.erase(listener);
+        return accepting;
+    }
+
+    bool listening(Port port) const
+    {
+        return mListeners.contains(port);
+    }
+
+    bool backlogFull(Port port) const
+    {
+        auto listener = mListeners.find(port);
+        return listener != mListeners.end() && listener->second.mAccepting.size() >= cBacklog;
+    }
+
+    // A connection to a listening port has finished its handshake, and waits to be accepted
+    TcpStream& onPassiveOpen(const ConnectionKey& key)
+    {
+        auto& listener = mListeners.at(key.mLocalPort);
+        listener.mAccepting.push_back(key);
+        notify(ConnectionKey{key.mLocalIp, IpAddress{}, key.mLocalPort, 0}, SocketEvents{std::to_underlying(SocketEvent::Acceptable)});
+        return open(key, listener.mSizes, listener.mMode);
+    }
+
+    std::optional<ConnectionKey> accept(Port port)
+    {
+        auto listener = mListeners.find(port);
+        if (listener == mListeners.end() || listener->second.mAccepting.empty())
+        {
+            return std::nullopt;
+        }
+
+        auto key = listener->second.mAccepting.front();
+        listener->second.mAccepting.pop_front();
+        return key;
+    }
+
+    TcpStream& open(const ConnectionKey& key, TcpBufferSizes sizes, ReceiveMode mode)
+    {
+        return mStreams.try_emplace(key, key, sizes, mode == ReceiveMode::Lend ? mArena : nullptr).first->second;
+    }
+
+    // Where the frames we receive are read into, which must outlive every stream lending from it
+    void attachArena(RxBufferArena& arena)
+    {
+        mArena = &arena;
+    }
+
+    RxBufferArena* arena()
+    {
+        return mArena;
+    }
+
+    TcpStream* find(const ConnectionKey& key)
+    {
+        auto stream = mStreams.find(key);
+        return stream == mStreams.end() ? nullptr : &stream->second;
+    }
+
+    // Forgets a connection, telling the application it has gone
+    // Whatever it had lent out stays lent, until the application gives it back.
+    void release(const ConnectionKey& key)
+    {
+        auto stream = mStreams.find(key);
+        if (stream == mStreams.end())
+        {
+            return;
+        }
+
+        for (const auto& [buffer, lent] : stream->second.takeOutstanding())
+        {
+            auto& orphan = mOrphanedLoans[key][buffer];
+            orphan.mBytes += lent.mBytes;
+            orphan.mCount += lent.mCount;
+        }
+        mStreams.erase(stream);
+        notify(key, SocketEvents{std::to_underlying(SocketEvent::Closed)});
+    }
+
+    // Releases the buffers of loans lent out for the connection, and not yet given back, ignoring any others
+    void giveBack(const ConnectionKey& key, std::span<const RxLoan> loans)
+    {
+        if (mArena == nullptr)
+        {
+            return;
+        }
+
+        auto* stream = find(key);
+        auto orphans = mOrphanedLoans.find(key);
+        for (const auto& loan : loans)
+        {
+            if (stream != nullptr && stream->givenBack(loan))
+            {
+                continue;
+            }
+            if (orphans != mOrphanedLoans.end() && LoanQueue::takeBack(orphans->second, loan).has_value())
+            {
+                mArena->release(loan.mBuffer);
+            }
+        }
+
+        if (orphans != mOrphanedLoans.end() && orphans->second.empty())
+        {
+            mOrphanedLoans.erase(orphans);
+        }
+    }
+
+    template <typename FunctionT>
+    void forEachStream(FunctionT&& function)
+    {
+        for (auto& [key, stream] : mStreams)
+        {
+            function(key, stream);
+        }
+    }
+
+    void notify(const ConnectionKey& key, SocketEvents events)
+    {
+        if (events.mValue != 0)
+        {
+            auto& pending = mReady[key];
+            pending = pending | events;
+        }
+    }
+
+    // Copies out up to out.size() connections and ports with something new, returning how many
+    std::size_t readiness(std::span<Readiness> out)
+    {
+        std::size_t count{0};
+        for (auto ready = mReady.begin(); ready != mReady.end() && count < out.size(); ready = mReady.erase(ready))
+        {
+            out[count++] = Readiness{ready->first, ready->second};
+        }
+        return count;
+    }
+
+private:
+    struct Listener
+    {
+        TcpBufferSizes mSizes;
+        ReceiveMode mMode;
+        std::deque<ConnectionKey> mAccepting{};
+    };
+
+    RxBufferArena* mArena{};
+    std::unordered_map<Port, Listener> mListeners{};
+    std::unordered_map<ConnectionKey, TcpStream> mStreams{};
+    std::unordered_map<ConnectionKey, LoanQueue::Outstanding> mOrphanedLoans{}; // Lent by streams which have since gone
+    std::unordered_map<ConnectionKey, SocketEvents> mReady{};
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <Types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Timestamps each stage a frame passes through, into a ring per thread
+// Built with -DTILAPIA_TRACE=1 (the CMake option TILAPIA_TRACE) the rings are written out on exit,
+// and tools/trace.cpp turns them into a Chrome trace and a table of percentiles.
+// Otherwise a TraceScope is an empty object and compiles away entirely.
+#ifndef TILAPIA_TRACE
+#define TILAPIA_TRACE 0
+#endif
+
+static constexpr bool cTraceEnabled{TILAPIA_TRACE != 0};
+
+enum class TraceStage : std::uint8_t
+{
+    TapRead,
+    EthernetParse,
+    Ipv4Parse,
+    IcmpReply,
+    TcpParse,
+    TcpChecksum,
+    TcpNode,
+    TcpSerialise,
+    ArpReply,
+    TapWrite,
+    Count
+};
+
+template <> struct std::formatter<TraceStage> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const TraceStage& stage, FormatContext& ctx) const
+    {
+        using enum TraceStage;
+        switch (stage)
+        {
+        case TapRead:
+            return std::format_to(ctx.out(), "TapRead");
+        case EthernetParse:
+            return std::format_to(ctx.out(), "EthernetParse");
+        case Ipv4Parse:
+            return std::format_to(ctx.out(), "Ipv4Parse");
+        case IcmpReply:
+            return std::format_to(ctx.out(), "IcmpReply");
+        case TcpParse:
+            return std::format_to(ctx.out(), "TcpParse");
+        case TcpChecksum:
+            return std::format_to(ctx.out(), "TcpChecksum");
+        case TcpNode:
+            return std::format_to(ctx.out(), "TcpNode");
+        case TcpSerialise:
+            return std::format_to(ctx.out(), "TcpSerialise");
+        case ArpReply:
+            return std::format_to(ctx.out(), "ArpReply");
+        case TapWrite:
+            return std::format_to(ctx.out(), "TapWrite");
+        default:
+            return std::format_to(ctx.out(), "Unknown trace stage {}", std::to_underlying(stage));
+        }
+    }
+};
+
+// The time stamp counter where we have one, otherwise the steady clock in nanoseconds
+inline std::uint64_t readTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// How many ticks of readTsc pass each nanosecond, measured against the steady clock
+inline double calibrateTicksPerNano()
+{
+    static constexpr auto cCalibrationTime{std::chrono::milliseconds{20}};
+    auto clockStart = std::chrono::steady_clock::now();
+    auto ticksStart = readTsc();
+    std::this_thread::sleep_for(cCalibrationTime);
+    auto ticksEnd = readTsc();
+    auto clockEnd = std::chrono::steady_clock::now();
+    return (ticksEnd - ticksStart) / std::chrono::duration<double, std::nano>(clockEnd - clockStart).count();
+}
+
+struct TraceEvent
+{
+    std::uint64_t mStart;
+    std::uint64_t mEnd;
+    TraceStage mStage;
+    std::uint32_t mFrames; // How many frames the stage handled between start and end
+};
+
+// Keeps the most recent cCapacity events, overwriting the oldest
+class TraceRing
+{
+public:
+    static constexpr std::size_t cCapacity{1 << 16};
+    static_assert(std::has_single_bit(cCapacity));
+
+    TraceRing() : mEvents{std::make_unique<TraceEvent[]>(cCapacity)} { }
+
+    void record(const TraceEvent& event)
+    {
+        mEvents[mWritten++ & (cCapacity - 1)] = event;
+    }
+
+    std::size_t size() const
+    {
+        return std::min(mWritten, cCapacity);
+    }
+
+    // Oldest first
+    const TraceEvent& operator[](std::size_t index) const
+    {
+        return mEvents[(mWritten - size() + index) & (cCapacity - 1)];
+    }
+
+private:
+    std::unique_ptr<TraceEvent[]> mEvents;
+    std::size_t mWritten{};
+};
+
+namespace tracing
+{
+
+struct ThreadRing
+{
+    std::uint64_t mThreadId;
+    TraceRing mRing{};
+};
+
+// Every thread's ring, kept alive until the process exits so they can be written out
+inline std::mutex gRingsMutex{};
+inline std::vector<std::unique_ptr<ThreadRing>> gRings{};
+
+inline TraceRing& threadRing()
+{
+    thread_local TraceRing* tRing = [] {
+        std::scoped_lock lock{gRingsMutex};
+        auto threadId = static_cast<std::uint64_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        gRings.push_back(std::make_unique<ThreadRing>(ThreadRing{threadId}));
+        return &gRings.back()->mRing;
+    }();
+    return *tRing;
+}
+
+struct TraceFileHeader
+{
+    static constexpr std::uint64_t cMagic{0x7469'6c61'7472'6331}; // "tilatrc1"
+
+    std::uint64_t mMagic;
+    double mTicksPerNano;
+    std::uint64_t mThreadCount;
+};
+
+struct TraceThreadHeader
+{
+    std::uint64_t mThreadId;
+    std::uint64_t mEventCount;
+};
+
+// Writes out every thread's ring, once those threads have stopped recording
+inline bool writeTrace(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::scoped_lock lock{gRingsMutex};
+    TraceFileHeader header{TraceFileHeader::cMagic, calibrateTicksPerNano(), gRings.size()};
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const auto& threadRing : gRings)
+    {
+        const auto& ring = threadRing->mRing;
+        TraceThreadHeader threadHeader{threadRing->mThreadId, ring.size()};
+        written = written && std::fwrite(&threadHeader, sizeof(threadHeader), 1, file) == 1;
+        for (std::size_t i = 0; i < ring.size(); i++)
+        {
+            written = written && std::fwrite(&ring[i], sizeof(TraceEvent), 1, file) == 1;
+        }
+    }
+
+    return std::fclose(file) == 0 && written;
+}
+
+}
+
+// Records the time between construction and destruction against a stage
+template <bool Enabled>
+class BasicTraceScope;
+
+template <>
+class BasicTraceScope<true>
+{
+public:
+    explicit BasicTraceScope(TraceStage stage, std::uint32_t frames = 1) : mStage{stage}, mFrames{frames}, mStart{readTsc()} { }
+
+    ~BasicTraceScope()
+    {
+        tracing::threadRing().record({mStart, readTsc(), mStage, mFrames});
+    }
+
+    BasicTraceScope(const BasicTraceScope&) = delete;
+    BasicTraceScope& operator=(const BasicTraceScope&) = delete;
+
+private:
+    TraceStage mStage;
+    std::uint32_t mFrames;
+    std::uint64_t mStart;
+};
+
+template <>
+class BasicTraceScope<false>
+{
+public:
+    explicit BasicTraceScope(TraceStage, std::uint32_t = 1) { }
+};
+
+using TraceScope = BasicTraceScope<cTraceEnabled>;
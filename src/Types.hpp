@@ -36,7 +36,7 @@ template <> struct std::formatter<EtherType> : SimpleFormatter
         case InternetProtocolVersion6:
             return std::format_to(ctx.out(), "IPv6");
         default:
-            throw std::runtime_error{std::format("Unexpected ethertype: {}", std::to_underlying(etherType))};
+            return std::format_to(ctx.out(), "Unknown ethertype 0x{:x}", std::to_underlying(etherType));
         }
     }
 };
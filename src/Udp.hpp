@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Headers.hpp>
+#include <Ip.hpp>
+#include <Tcp.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <unordered_map>
+
+struct UdpHeader
+{
+    Port mSourcePort;
+    Port mDestinationPort;
+    std::uint16_t mLength; // Includes the header
+    std::uint16_t mCheckSum; // Zero when the sender did not compute one
+
+    void zero_out_checksum()
+    {
+        mCheckSum = 0;
+    }
+
+    auto checksum() const
+    {
+        return mCheckSum;
+    }
+};
+static_assert(sizeof(UdpHeader) == 8, "UDP header must be 8 bytes long");
+
+template <>
+struct LayoutInfo<UdpHeader>
+{
+    static constexpr std::index_sequence<2, 2, 2, 2> Sizes{};
+};
+
+template <> struct std::formatter<UdpHeader> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const UdpHeader& header, FormatContext& ctx) const
+    {
+        return std::format_to(ctx.out(), "UDP Header {} -> {}, size {}", header.mSourcePort, header.mDestinationPort, header.mLength);
+    }
+};
+
+// Sums the pseudo header and then the datagram as it is on the wire, header included,
+// so the result is stored as is, and a datagram with a correct checksum sums to zero
+inline std::uint16_t udpChecksum(IpAddress source, IpAddress destination, std::span<const char> datagram)
+{
+    std::array<char, 12> pseudoHeader{};
+    auto sourceBytes = std::byteswap(std::bit_cast<std::uint32_t>(source));
+    auto destinationBytes = std::byteswap(std::bit_cast<std::uint32_t>(destination));
+    auto length = std::byteswap(static_cast<std::uint16_t>(datagram.size()));
+    std::memcpy(pseudoHeader.data(), &sourceBytes, sizeof(sourceBytes));
+    std::memcpy(pseudoHeader.data() + 4, &destinationBytes, sizeof(destinationBytes));
+    pseudoHeader[9] = static_cast<char>(IPProtocol::UDP);
+    std::memcpy(pseudoHeader.data() + 10, &length, sizeof(length));
+
+    auto pseudoSum = static_cast<std::uint16_t>(~checksum(0, pseudoHeader.data(), pseudoHeader.size()));
+    return checksum(pseudoSum, datagram.data(), datagram.size());
+}
+
+// One datagram, received or to send
+// Received payloads point into the frame they arrived in, so are only good until the next batch is read
+struct UdpDatagram
+{
+    IpAddress mRemoteIp{};
+    Port mRemotePort{};
+    std::span<const char> mPayload{};
+};
+
+// The ports we accept datagrams on, and what each has received from the current batch
+// Nothing is copied: each socket just keeps the datagrams' places in the received frames,
+// so whatever is not received before the next batch is read is lost.
+class UdpSockets
+{
+public:
+    static constexpr std::size_t cMaxQueued{64}; // A whole batch of frames
+
+    bool bind(Port port)
+    {
+        return mSockets.try_emplace(port).second;
+    }
+
+    bool unbind(Port port)
+    {
+        return mSockets.erase(port) != 0;
+    }
+
+    bool bound(Port port) const
+    {
+        return mSockets.contains(port);
+    }
+
+    // False if nobody is listening, or they have a full batch already
+    bool deliver(Port port, const UdpDatagram& datagram)
+    {
+        auto socket = mSockets.find(port);
+        if (socket == mSockets.end() || socket->second.mCount == cMaxQueued)
+        {
+            return false;
+        }
+
+        socket->second.mQueued[socket->second.mCount++] = datagram;
+        return true;
+    }
+
+    // Copies out up to out.size() datagrams received on port, oldest first, returning how many
+    std::size_t receive(Port port, std::span<UdpDatagram> out)
+    {
+        auto socket = mSockets.find(port);
+        if (socket == mSockets.end())
+        {
+            return 0;
+        }
+
+        auto& queue = socket->second;
+        auto count = std::min(out.size(), queue.mCount - queue.mRead);
+        std::copy_n(queue.mQueued.begin() + queue.mRead, count, out.begin());
+        queue.mRead += count;
+        return count;
+    }
+
+    // Called before each batch, as the frames the last one pointed into are about to be reused
+    // Returns how many datagrams were never received
+    std::size_t discardUnread()
+    {
+        std::size_t unread{0};
+        for (auto& [port, queue] : mSockets)
+        {
+            unread += queue.mCount - queue.mRead;
+            queue.mCount = 0;
+            queue.mRead = 0;
+        }
+        return unread;
+    }
+
+private:
+    struct Queue
+    {
+        std::array<UdpDatagram, cMaxQueued> mQueued{};
+        std::size_t mCount{};
+        std::size_t mRead{};
+    };
+
+    std::unordered_map<Port, Queue> mSockets{};
+};
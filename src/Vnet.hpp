@@ -66,7 +66,7 @@ template <> struct std::formatter<VnetFlag> : SimpleFormatter
         case VnetFlag::NeedsChecksum:
             return std::format_to(ctx.out(), "NeedsChecksum");
         default:
-            throw std::runtime_error{std::format("Unexpected VNET Flag: {}", std::to_underlying(vnetFlag))};
+            return std::format_to(ctx.out(), "Unknown VNET Flag {}", std::to_underlying(vnetFlag));
         }
     }
 };
@@ -91,7 +91,7 @@ template <> struct std::formatter<GenericSegmentOffloadType> : SimpleFormatter
         case GenericSegmentOffloadType::UdpL4:
             return std::format_to(ctx.out(), "UdpL4");
         default:
-            throw std::runtime_error{std::format("Unexpected GSO type: {}", std::to_underlying(gsoType))};
+            return std::format_to(ctx.out(), "Unknown GSO type {}", std::to_underlying(gsoType));
         }
     }
 };
@@ -74,6 +74,19 @@ struct TapDevice
         mName = std::string{interfaceConfig.ifr_name};
     }
 
+    // Lets us drain every frame that is waiting without blocking,
+    // we then wait for more with poll
+    void setNonBlocking()
+    {
+        int flags = fcntl(mFileDescriptor, F_GETFL);
+        if (flags < 0 || fcntl(mFileDescriptor, F_SETFL, flags | O_NONBLOCK) < 0)
+        {
+            std::println("Failed to make tap device non blocking: {}", strerror(errno));
+            close(mFileDescriptor);
+            exit(1);
+        }
+    }
+
     int descriptor() const
     {
         return mFileDescriptor;
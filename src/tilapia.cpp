@@ -1,67 +1,167 @@
 #include <tap.hpp>
 #include <Arp.hpp>
+#include <Capture.hpp>
+#include <Diagram.hpp>
 #include <Ethernet.hpp>
 #include <Icmp.hpp>
 #include <Ip.hpp>
+#include <Log.hpp>
+#include <Metrics.hpp>
+#include <Parse.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
 #include <Tcp.hpp>
+#include <TcpSocket.hpp>
+#include <Trace.hpp>
+#include <Udp.hpp>
 #include <Vnet.hpp>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <bit>
 #include <csignal>
-#include <iostream>
-#include <iomanip>
-#include <numeric>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
 #include <print>
+#include <span>
 #include <string_view>
-#include <vector>
 
-struct FrameSection
-{
-    std::size_t size{};
-    std::string name{};
-    std::string payload{};
+#include <poll.h>
 
-};
+// The diagrams printed with SIGUSR1 can be thinned out by setting, for example,
+// TILAPIA_SAMPLE_EVERY=100 to draw one frame in every hundred, or
+// TILAPIA_SAMPLE_FILTER="tcp host 10.3.3.1 port 80" to only draw one flow
+FrameSampler samplerFromEnvironment()
+{
+    FrameSampler sampler{};
+    if (const char* everyN = std::getenv("TILAPIA_SAMPLE_EVERY"))
+    {
+        sampler.setRate(static_cast<std::uint32_t>(std::strtoul(everyN, nullptr, 10)));
+    }
 
-using FrameSections = std::vector<FrameSection>;
+    if (const char* expression = std::getenv("TILAPIA_SAMPLE_FILTER"))
+    {
+        auto filter = FrameFilter::parse(expression);
+        if (!filter.has_value())
+        {
+            std::println("Could not understand sample filter \"{}\"", expression);
+            exit(1);
+        }
+        sampler.setFilter(*filter);
+    }
 
-std::size_t totalSize(const FrameSections& sections)
-{
-    return std::accumulate(sections.begin(), sections.end(), 0, [](std::size_t sum, const FrameSection& it) { return sum + it.size; });
+    return sampler;
 }
 
-std::string print(const FrameSections& sections)
+// Frames are copied to rotating pcapng files by setting, for example,
+// TILAPIA_CAPTURE=/tmp/tilapia to write /tmp/tilapia.0.pcapng onwards,
+// optionally with TILAPIA_CAPTURE_FILTER, in the same language as the sample filter,
+// and TILAPIA_CAPTURE_SNAP to only keep the first bytes of each frame
+std::optional<CaptureConfig> captureFromEnvironment()
 {
-    auto size = totalSize(sections);
-    std::string dashes(size + 1, '-');
-    std::string line{};
-    for (const auto& section : sections)
+    const char* prefix = std::getenv("TILAPIA_CAPTURE");
+    if (prefix == nullptr)
     {
-        std::string segment{};
-        segment.append("|");
-        segment.append(section.name);
+        return std::nullopt;
+    }
 
-        if (section.payload.size())
+    CaptureConfig config{};
+    config.mPrefix = prefix;
+    if (const char* expression = std::getenv("TILAPIA_CAPTURE_FILTER"))
+    {
+        auto filter = FrameFilter::parse(expression);
+        if (!filter.has_value())
         {
-            segment.append(": ");
-            segment.append(section.payload);
-            // Replace newlines with carats
-            std::replace(segment.begin(), segment.end(), '\n', '^');
+            std::println("Could not understand capture filter \"{}\"", expression);
+            exit(1);
         }
+        config.mFilter = *filter;
+    }
 
-        int fill_count = section.size - segment.size();
-        if (fill_count < 0)
-        {
-            std::println("Cannot print section {}, size {}", section.name, section.size);
-            continue;
-        }
+    if (const char* snapLength = std::getenv("TILAPIA_CAPTURE_SNAP"))
+    {
+        config.mSnapLength = static_cast<std::uint32_t>(std::strtoul(snapLength, nullptr, 10));
+    }
+
+    return config;
+}
 
-        segment.append(std::string(fill_count, ' '));
-        line.append(segment);
+// TILAPIA_ARP_RATE to answer at most so many ARP messages a second from any one sender, or 0 for no limit,
+// and TILAPIA_ARP_STRICT=1 to only learn addresses from replies to our own requests
+ArpConfig arpFromEnvironment()
+{
+    ArpConfig config{};
+    if (const char* rate = std::getenv("TILAPIA_ARP_RATE"))
+    {
+        auto perSecond = static_cast<std::uint32_t>(std::strtoul(rate, nullptr, 10));
+        config.mPerSourceLimit = perSecond == 0 ? std::nullopt : std::optional{RateLimit{perSecond, 2 * perSecond}};
     }
 
-    return std::format("{}\n{}|\n{}", dashes, line, dashes);
+    if (const char* strict = std::getenv("TILAPIA_ARP_STRICT"))
+    {
+        config.mLearnOnlyFromReplies = std::string_view{strict} == "1";
+    }
+    return config;
+}
+
+// Answers every datagram to TILAPIA_UDP_ECHO_PORT with the same payload, if it is set
+std::optional<Port> udpEchoPortFromEnvironment()
+{
+    const char* port = std::getenv("TILAPIA_UDP_ECHO_PORT");
+    if (port == nullptr)
+    {
+        return std::nullopt;
+    }
+    return static_cast<Port>(std::strtoul(port, nullptr, 10));
+}
+
+// TILAPIA_TCP_ECHO_PORT to listen on a port, and send back whatever each connection to it sends us
+std::optional<Port> tcpEchoPortFromEnvironment()
+{
+    const char* port = std::getenv("TILAPIA_TCP_ECHO_PORT");
+    if (port == nullptr)
+    {
+        return std::nullopt;
+    }
+    return static_cast<Port>(std::strtoul(port, nullptr, 10));
+}
+
+// Accepts whatever is waiting, and echoes as much as there is room to send,
+// leaving the rest to be read again when the connection is next Writable
+void echoTcp(Stack& stack, Port port)
+{
+    std::array<Readiness, FrameBatch::cMaxFrames> ready{};
+    std::array<char, 16 * 1024> buffer{};
+    while (auto count = stack.readiness(ready))
+    {
+        for (const auto& [key, events] : std::span{ready}.first(count))
+        {
+            if (events.set(SocketEvent::Acceptable))
+            {
+                while (stack.accept(port))
+                {
+                }
+                continue;
+            }
+
+            std::size_t received{};
+            do
+            {
+                auto room = std::min(buffer.size(), stack.sendSpace(key));
+                received = stack.receive(key, std::span{buffer}.first(room));
+                stack.send(key, std::span{buffer}.first(received));
+            } while (received != 0);
+
+            if (events.set(SocketEvent::Closed))
+            {
+                stack.close(key);
+            }
+        }
+    }
 }
 
 namespace sig
@@ -100,7 +200,6 @@ int main()
     std::signal(SIGUSR1, signal_handler);
     std::signal(SIGUSR2, signal_handler);
 
-    static constexpr bool cEnableVnetHeader = false;
     TapDevice tap{cEnableVnetHeader};
     std::println("Created tap device {} : descriptor {}", tap.name(), tap.descriptor());
 
@@ -108,248 +207,206 @@ int main()
     // TODO: Bring interface up, set mac address
     IpAddress ip{fromQuartets({10, 3, 3, 3})};
     MacAddress mac{fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
-    ArpNode arpNode{ip, mac};
-    std::unordered_map<Port, TcpNode> tcpNodes{};
-    std::println("Created Arp Node, IP: {}", arpNode.address());
-
-    int messagesRemaining{100};
+    Stack stack{ip, mac};
+    stack.context().mArpNode.configure(arpFromEnvironment());
+    auto udpEchoPort = udpEchoPortFromEnvironment();
+    if (udpEchoPort)
+    {
+        stack.bindUdp(*udpEchoPort);
+    }
+    auto tcpEchoPort = tcpEchoPortFromEnvironment();
+    if (tcpEchoPort)
+    {
+        stack.listen(*tcpEchoPort);
+    }
+    std::println("Created Arp Node, IP: {}", stack.context().mArpNode.address());
 
-    char readBuffer[2000];
-    char writeBuffer[2000];
+    // From here on everything is logged through the ring, and written out by the drainer
+    LogDrainer logDrainer{};
 
-    while (messagesRemaining)
+    // Watch these with tilapia_metrics while we run
+    MetricsFile metricsFile{metricsPath(), MetricsFile::cDefaultShardCount};
+    if (auto* shard = metricsFile.claimShard())
     {
-        int bytesRead = read(tap.descriptor(), readBuffer, sizeof(readBuffer));
-        messagesRemaining -= 1;
-        if (bytesRead < 0)
-        {
-            std::println("Failed to read from Tap Device");
-        }
+        stack.context().attachMetrics(*shard);
+    }
+    else
+    {
+        logWarning("Every metrics shard is in use, metrics will not be shared");
+    }
+    auto& metrics = stack.context().metrics();
+    auto sampler = samplerFromEnvironment();
 
-        if (bytesRead < sizeof(EthernetHeader))
-        {
-            std::println("Received dodgy message of size {}", bytesRead);
-        }
+    std::optional<Capture> capture{};
+    if (auto captureConfig = captureFromEnvironment())
+    {
+        capture.emplace(*captureConfig);
+    }
 
-        std::size_t readOffset{0};
-        std::size_t writeOffset{0};
+    int messagesRemaining{100};
 
-        auto writeVnetHeader = [&writeBuffer, &writeOffset]() -> std::size_t
+    // Up to a batch of frames is read before any are processed,
+    // then each layer of the stack runs over the whole batch,
+    // and finally all the replies are written out together
+    tap.setNonBlocking();
+    pollfd tapPoll{tap.descriptor(), POLLIN, 0};
+    auto framePool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    auto txPool = std::make_unique<FramePool>();
+    FrameBatch txBatch{};
+
+    // Replies are timed from when the frame they answer arrived
+    auto writeFrames = [&](const FrameBatch& frames, bool replies) {
+        for (const auto* frame : frames)
         {
-            if constexpr (!cEnableVnetHeader)
+            if (frame->mTx.empty())
             {
-                return 0;
+                continue;
             }
 
-            VnetFlag mFlag;
-            GenericSegmentOffloadType mGsoType;
-            VnetHeader vnetWriteHeader{ VnetFlag::ChecksumValid, GenericSegmentOffloadType::None, 0, 0, 0, 0, 1};
-            return toWire(vnetWriteHeader, writeBuffer + writeOffset);
-        };
+            // Anything too big for the path goes out in fragments
+            stack.forEachFragment(frame->mTx, [&](LayerBytes tx) {
+                int bytesWritten{};
+                {
+                    TraceScope trace{TraceStage::TapWrite};
+                    bytesWritten = write(tap.descriptor(), tx.data(), tx.size());
+                }
+                if (bytesWritten != tx.size())
+                {
+                    logError("Write failure! Only wrote {} out of {} bytes", bytesWritten, tx.size());
+                    metrics.add(Counter::TransmitFailures);
+                    return;
+                }
 
-        if constexpr (cEnableVnetHeader)
-        {
-            auto vnetHeader = fromWire<VnetHeader>(readBuffer);
-            readOffset += sizeof(vnetHeader);
-            std::println("Received a virtual network header, size {}, {}", bytesRead, vnetHeader);
+                metrics.add(Counter::TransmittedFrames);
+                if (capture)
+                {
+                    auto sent = tx;
+                    if constexpr (cEnableVnetHeader)
+                    {
+                        sent = sent.subspan(sizeof(VnetHeader));
+                    }
+                    capture->record(CaptureDirection::Transmitted, sent);
+                }
+            });
+            if (replies)
+            {
+                metrics.recordLatency(nowNanos() - frame->mReceivedAt);
+            }
         }
+    };
 
-        FrameSections sections{};
-        auto ethernetHeader = fromWire<EthernetHeader>(readBuffer + readOffset);
-        readOffset += sizeof(ethernetHeader);
-        sections.emplace_back(FrameSection{sizeof(ethernetHeader), "Ethernet", {}});
-
-        switch(ethernetHeader.mEthertype)
+    // Wake up now and then even when nothing arrives, as transmitting also ages the neighbour cache
+    static constexpr int cPollTimeoutMillis{100};
+    while (messagesRemaining > 0)
+    {
+        if (poll(&tapPoll, 1, cPollTimeoutMillis) < 0)
         {
-            case EtherType::InternetProtocolVersion4:
+            // Our signals interrupt the poll, which is fine
+            if (errno != EINTR)
             {
-                auto ipHeader = fromWire<IpV4Header>(readBuffer + readOffset);
-                auto packetEndOffset = readOffset + ipHeader.mTotalLength;
-                readOffset += sizeof(ipHeader);
-                sections.emplace_back(FrameSection{sizeof(ipHeader), "IPv4", {}});
-                std::size_t myHeaderLen{ipHeader.mVersionLength.mLength};
-                if (myHeaderLen != 5)
-                {
-                    break;
-                }
+                logError("Failed to poll Tap Device: {}", strerror(errno));
+            }
+            continue;
+        }
 
-                switch(ipHeader.mProto)
+        batch.clear();
+        while (!batch.full() && messagesRemaining > 0)
+        {
+            auto rxBuffer = framePool->rxBuffer(batch.size());
+            int bytesRead{};
+            {
+                TraceScope trace{TraceStage::TapRead};
+                bytesRead = read(tap.descriptor(), rxBuffer.data(), rxBuffer.size());
+            }
+            if (bytesRead < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
                 {
-                    case IPProtocol::ICMP:
-                    {
-                        auto icmpHeader = fromWire<IcmpV4Header>(readBuffer + readOffset);
-                        readOffset += sizeof(icmpHeader);
-                        sections.emplace_back(FrameSection{sizeof(icmpHeader), "ICMP", {}});
-                        if (icmpHeader.mType != IcmpType::EchoRequest)
-                        {
-                            break;
-                        }
-
-                        auto icmpEcho = fromWire<IcmpV4Echo>(readBuffer + readOffset);
-                        readOffset += sizeof(icmpEcho);
-                        sections.emplace_back(FrameSection{sizeof(icmpEcho), "Echo", {}});
-
-                        IcmpV4EchoResponse response{icmpHeader, icmpEcho};
-                        response.mHeader.mType = IcmpType::EchoReply;
-                        response.mHeader.mCheckSum = checksum(response);
-
-                        auto ipResponseHeader{ipHeader};
-                        std::swap(ipResponseHeader.mSourceAddress, ipResponseHeader.mDestinationAddress);
-                        ipResponseHeader.mCheckSum = checksum(ipResponseHeader);
-
-                        auto ethernetResponseHeader{ethernetHeader};
-                        std::swap(ethernetResponseHeader.mSourceMacAddress, ethernetResponseHeader.mDestinationMacAddress);
-
-                        writeOffset += writeVnetHeader();
-                        writeOffset += toWire(ethernetResponseHeader, writeBuffer + writeOffset);
-                        writeOffset += toWire(ipResponseHeader, writeBuffer + writeOffset);
-                        writeOffset += toWire(response, writeBuffer + writeOffset);
-                        break;
-                    }
-                    case IPProtocol::TCP:
-                    {
-                        auto segmentStartOffset = readOffset;
-                        auto tcpHeader = fromWire<TcpHeader>(readBuffer + readOffset);
-                        readOffset += sizeof(tcpHeader);
-                        std::vector<TcpOption> options{};
-                        static constexpr auto cLengthUnits{4};
-                        auto endOfOptions = readOffset + ((tcpHeader.length() * cLengthUnits) - sizeof(TcpHeader));
-                        while (readOffset < endOfOptions)
-                        {
-                            auto tcpOption = fromWire<TcpOption>(readBuffer + readOffset);
-                            options.push_back(tcpOption);
-                            readOffset += tcpOption.mSize;
-                        }
-
-                        if (readOffset != endOfOptions)
-                        {
-                            std::println("Read to {}, past options end {}", readOffset, endOfOptions);
-                            std::cout << std::flush;
-                            throw std::runtime_error{"Read too many TCP options"};
-                        }
-
-                        if (readOffset > packetEndOffset)
-                        {
-                            std::println("Read offset {} past packet end offset", readOffset, packetEndOffset);
-                            std::cout << std::flush;
-                            throw std::runtime_error{"Read past end of packet"};
-                        }
-
-                        auto payload = std::string_view{readBuffer + readOffset, packetEndOffset - readOffset};
-                        sections.emplace_back(FrameSection{packetEndOffset - segmentStartOffset, "TCP", std::string(payload)});
-
-                        std::uint8_t zero{0};
-                        TcpPseudoHeader pseudoReadHeader{ipHeader.mSourceAddress, ipHeader.mDestinationAddress, zero, IPProtocol::TCP, static_cast<std::uint16_t>(tcpHeader.length() * cLengthUnits + payload.size())};
-                        TcpPseudoPacket pseudoReadPacket{pseudoReadHeader, tcpHeader};
-                        auto read_checksum = tcp_checksum(pseudoReadPacket, options, payload);
-                        if (read_checksum != tcpHeader.checksum())
-                        {
-                            std::println("TCP calculated checksum 0x{:x} does not match received 0x{:x}, will not Ack", tcpHeader.checksum(), read_checksum);
-                            continue;
-                        }
-
-                        auto [nodeIt, inserted] = tcpNodes.try_emplace(tcpHeader.mDestinationPort, tcpHeader.mDestinationPort, tcpHeader.mSourcePort);
-                        auto response = nodeIt->second.onMessage(tcpHeader, payload.size());
-                        if (response.mPrintPayload)
-                        {
-                            if (payload.size())
-                            {
-                                std::print("{}", payload);
-                            }
-                        }
-
-                        if (response.mSendAck)
-                        {
-                            auto ethernetResponseHeader{ethernetHeader};
-                            std::swap(ethernetResponseHeader.mSourceMacAddress, ethernetResponseHeader.mDestinationMacAddress);
-
-                            auto ipResponseHeader{ipHeader};
-                            ipResponseHeader.mTotalLength = sizeof(ipResponseHeader) + sizeof(response.mHeader);
-                            std::swap(ipResponseHeader.mSourceAddress, ipResponseHeader.mDestinationAddress);
-                            ipResponseHeader.mCheckSum = checksum(ipResponseHeader);
-
-                            TcpPseudoHeader pseudoHeader{ipResponseHeader.mSourceAddress, ipResponseHeader.mDestinationAddress, zero, IPProtocol::TCP, sizeof(TcpHeader)};
-                            static constexpr auto cHardwareChecksums = false;
-                            if constexpr (cHardwareChecksums)
-                            {
-                                static_assert(cHardwareChecksums == cEnableVnetHeader, "Cannot enable hardeware checksum without virtual network header");
-                                constexpr auto cHeaderLength{sizeof(EthernetHeader) + sizeof(IpV4Header) + sizeof(TcpHeader)};
-                                constexpr auto cGsoSize{1440};
-                                constexpr auto cChecksumStart{sizeof(EthernetHeader) + sizeof(IpV4Header)};
-                                constexpr auto cChecksumOffset{16};
-                                constexpr auto cNumBuffers{1};
-                                VnetHeader vnetTcpHeader{VnetFlag::NeedsChecksum, GenericSegmentOffloadType::TcpIp4, cHeaderLength, cGsoSize,
-                                                         cChecksumStart, cChecksumOffset, cNumBuffers};
-                                writeOffset += toWire(vnetTcpHeader, writeBuffer + writeOffset);
-                            }
-                            else
-                            {
-                                TcpPseudoPacket pseudoPacket{pseudoHeader, response.mHeader};
-                                response.mHeader.mCheckSum = checksum(pseudoPacket);
-                                writeOffset += writeVnetHeader();
-                            }
-
-                            writeOffset += toWire(ethernetResponseHeader, writeBuffer + writeOffset);
-                            writeOffset += toWire(ipResponseHeader, writeBuffer + writeOffset);
-                            writeOffset += toWire(response.mHeader, writeBuffer + writeOffset);
-                        }
-                    }
-                    default:
-                        break;
+                    logError("Failed to read from Tap Device: {}", strerror(errno));
+                    stack.context().mDropCounters.record(DropReason::ReadFailure);
+                    metrics.drop(DropReason::ReadFailure);
                 }
                 break;
             }
-            case EtherType::AddressResolutionProtocol:
+
+            auto receivedAt = nowNanos();
+            metrics.add(Counter::ReceivedFrames);
+            messagesRemaining -= 1;
+            auto bytes = rxBuffer.first(bytesRead);
+            if constexpr (cEnableVnetHeader)
             {
-                auto arpHeader = fromWire<ArpHeader>(readBuffer + readOffset);
-                readOffset += sizeof(arpHeader);
-                sections.emplace_back(FrameSection{sizeof(arpHeader), "ARP", {}});
-                if (arpHeader.mProtocolType != ArpProtoType::InternetProtocolVersion4)
+                auto vnetHeader = tryFromWire<VnetHeader>(bytes, DropReason::TruncatedVnet);
+                if (!vnetHeader)
                 {
+                    stack.context().mDropCounters.record(vnetHeader.error());
+                    metrics.drop(vnetHeader.error());
                     continue;
                 }
+                bytes = bytes.subspan(sizeof(VnetHeader));
+                logDebug("Received a virtual network header, size {}, {}", bytesRead, *vnetHeader);
+            }
 
-                auto arpIpBody = fromWire<ArpIpBody>(readBuffer + readOffset);
-                readOffset += sizeof(arpIpBody);
-                sections.emplace_back(FrameSection{sizeof(arpIpBody), "ARP IP", {}});
-
-                auto arpResponse = arpNode.onMessage({arpHeader, arpIpBody});
-                if (arpResponse.has_value())
-                {
-                    auto ethernetResponseHeader{ethernetHeader};
-                    std::swap(ethernetResponseHeader.mSourceMacAddress, ethernetResponseHeader.mDestinationMacAddress);
+            if (capture)
+            {
+                capture->record(CaptureDirection::Received, bytes);
+            }
 
-                    writeOffset += writeVnetHeader();
-                    writeOffset += toWire(ethernetResponseHeader, writeBuffer + writeOffset);
-                    writeOffset += toWire(arpResponse->mHeader, writeBuffer + writeOffset);
-                    writeOffset += toWire(arpResponse->mBody, writeBuffer + writeOffset);
-                }
+            // Handlers may rewrite the frame into a reply, so we log it as it arrived
+            if (sig::gPrintPackets && sampler.sample(bytes))
+            {
+                logInfo("{}", FrameDiagram{{bytes.data(), bytes.size()}});
             }
-            default:
-                break;
+
+            auto& frame = framePool->frame(batch.size());
+            frame.reset(bytes);
+            frame.mReceivedAt = receivedAt;
+            batch.push(&frame);
         }
 
-        if (sig::gPrintPackets)
+        stack.process(batch);
+
+        if (sig::gWritePackets)
         {
-            auto sectionsSize = totalSize(sections);
-            if (bytesRead > sectionsSize)
-            {
-                static constexpr auto cMaxIgnoredSectionSize{80};
-                auto size = std::min<std::size_t>(cMaxIgnoredSectionSize, bytesRead - sectionsSize);
-                sections.emplace_back(FrameSection{size, "Ignored", {}});
-            }
-            std::println("{}", print(sections));
+            writeFrames(batch, true);
         }
 
-        if (sig::gWritePackets && writeOffset != 0)
+        // What we echo is queued before transmit, so goes out with it
+        if (tcpEchoPort)
         {
-            int bytesWritten= write(tap.descriptor(), writeBuffer, writeOffset);
-            if (bytesWritten != writeOffset)
-            {
-                std::println("Write failure! Only wrote {} out of {} bytes", bytesWritten, writeOffset);
-            }
+            echoTcp(stack, *tcpEchoPort);
+        }
+
+        // Then whatever the stack has to say for itself, ARP requests, frames which were waiting on them, Syns and stream data
+        txBatch.clear();
+        stack.transmit(*txPool, txBatch);
+
+        // The payloads are still in the frames we just read, so go straight back out from there
+        if (udpEchoPort)
+        {
+            std::array<UdpDatagram, FrameBatch::cMaxFrames> datagrams{};
+            auto received = stack.receiveUdp(*udpEchoPort, datagrams);
+            stack.sendUdp(*txPool, txBatch, *udpEchoPort, std::span{datagrams}.first(received));
         }
 
-        std::cout << std::flush;
+        if (sig::gWritePackets)
+        {
+            writeFrames(txBatch, false);
+        }
+    }
+
+    logInfo("{}", stack.context().mDropCounters);
+    if (capture && capture->dropped() != 0)
+    {
+        logWarning("Capture ring full, dropped {} frames", capture->dropped());
+    }
+
+    if constexpr (cTraceEnabled)
+    {
+        const char* tracePath = std::getenv("TILAPIA_TRACE_PATH");
+        if (!tracing::writeTrace(tracePath ? tracePath : "tilapia.trace"))
+        {
+            logError("Failed to write trace file");
+        }
     }
 }
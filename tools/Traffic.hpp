@@ -0,0 +1,293 @@
+#pragma once
+
+#include <Arp.hpp>
+#include <Ethernet.hpp>
+#include <Icmp.hpp>
+#include <Ip.hpp>
+#include <Tcp.hpp>
+#include <Types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Synthetic traffic for load testing the stack
+// Every frame a flow can send is built once up front, with its checksums,
+// so generating a frame is a copy plus patching a sequence number,
+// with the checksum adjusted for just the words that changed.
+enum class TrafficKind : std::uint8_t
+{
+    Icmp,
+    Arp,
+    TcpSyn,
+    TcpData,
+    Count
+};
+
+template <> struct std::formatter<TrafficKind> : SimpleFormatter
+{
+    template <typename FormatContext>
+    auto format(const TrafficKind& kind, FormatContext& ctx) const
+    {
+        using enum TrafficKind;
+        switch (kind)
+        {
+        case Icmp:
+            return std::format_to(ctx.out(), "icmp");
+        case Arp:
+            return std::format_to(ctx.out(), "arp");
+        case TcpSyn:
+            return std::format_to(ctx.out(), "syn");
+        case TcpData:
+            return std::format_to(ctx.out(), "data");
+        default:
+            return std::format_to(ctx.out(), "Unknown traffic kind {}", std::to_underlying(kind));
+        }
+    }
+};
+
+namespace traffic
+{
+
+// Echo requests carry this id, and a sequence number we can match their reply to
+static constexpr std::uint16_t cProbeId{0x7467};
+
+struct Endpoint
+{
+    MacAddress mMac{};
+    IpAddress mIp{};
+    Port mPort{};
+};
+
+inline std::optional<TrafficKind> parseKind(std::string_view name)
+{
+    for (std::uint8_t i = 0; i < std::to_underlying(TrafficKind::Count); i++)
+    {
+        auto kind = static_cast<TrafficKind>(i);
+        if (std::format("{}", kind) == name)
+        {
+            return kind;
+        }
+    }
+    return std::nullopt;
+}
+
+inline std::size_t writeEthernet(char* buffer, const Endpoint& from, const Endpoint& to, EtherType etherType)
+{
+    return toWire(EthernetHeader{to.mMac, from.mMac, etherType}, buffer);
+}
+
+inline std::size_t writeIp(char* buffer, const Endpoint& from, const Endpoint& to, IPProtocol proto, std::size_t payloadSize)
+{
+    IpV4Header header{};
+    header.mVersionLength.mVersion = 4;
+    header.mVersionLength.mLength = 5;
+    header.mTotalLength = static_cast<std::uint16_t>(sizeof(IpV4Header) + payloadSize);
+    header.mTimeToLive = 64;
+    header.mProto = proto;
+    header.mSourceAddress = from.mIp;
+    header.mDestinationAddress = to.mIp;
+    header.mCheckSum = checksum(header);
+    return toWire(header, buffer);
+}
+
+inline std::vector<char> makeEchoRequest(const Endpoint& from, const Endpoint& to, std::size_t payloadSize)
+{
+    std::size_t icmpSize = sizeof(IcmpV4Header) + sizeof(IcmpV4Echo) + payloadSize;
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(IpV4Header) + icmpSize);
+
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, from, to, EtherType::InternetProtocolVersion4);
+    offset += writeIp(frame.data() + offset, from, to, IPProtocol::ICMP, icmpSize);
+
+    char* icmp = frame.data() + offset;
+    offset += toWire(IcmpV4Header{IcmpType::EchoRequest, 0, 0}, frame.data() + offset);
+    offset += toWire(IcmpV4Echo{cProbeId, 0}, frame.data() + offset);
+    for (std::size_t i = 0; i < payloadSize; i++)
+    {
+        frame[offset + i] = static_cast<char>(i);
+    }
+
+    // Summed in the order it sits in memory, so it is stored the same way
+    std::uint16_t icmpChecksum = checksum(0, icmp, icmpSize);
+    std::memcpy(icmp + offsetof(IcmpV4Header, mCheckSum), &icmpChecksum, sizeof(icmpChecksum));
+    return frame;
+}
+
+inline std::vector<char> makeArpRequest(const Endpoint& from, const Endpoint& to)
+{
+    ArpHeader header{ArpHardwareType::Ethernet, ArpProtoType::InternetProtocolVersion4, sizeof(MacAddress), sizeof(IpAddress), ArpOpCode::Request};
+    ArpIpBody body{from.mMac, from.mIp, MacAddress{}, to.mIp};
+
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(ArpHeader) + sizeof(ArpIpBody));
+    std::size_t offset{0};
+    offset += toWire(EthernetHeader{ArpBroadcastAddress, from.mMac, EtherType::AddressResolutionProtocol}, frame.data() + offset);
+    offset += toWire(header, frame.data() + offset);
+    toWire(body, frame.data() + offset);
+    return frame;
+}
+
+inline std::vector<char> makeTcpSegment(const Endpoint& from, const Endpoint& to, TcpFlags flags, SequenceNumber sequence, std::size_t payloadSize)
+{
+    std::vector<char> payload(payloadSize);
+    for (std::size_t i = 0; i < payloadSize; i++)
+    {
+        payload[i] = static_cast<char>('a' + i % 26);
+    }
+
+    TcpHeader header{};
+    header.mSourcePort = from.mPort;
+    header.mDestinationPort = to.mPort;
+    header.mSequenceNumber = sequence;
+    header.setLength(sizeof(TcpHeader) / 4);
+    header.mFlags = flags;
+    header.mWindowSize = 64240;
+
+    std::uint8_t zero{0};
+    auto tcpSize = static_cast<std::uint16_t>(sizeof(TcpHeader) + payloadSize);
+    TcpPseudoHeader pseudoHeader{from.mIp, to.mIp, zero, IPProtocol::TCP, tcpSize};
+    header.mCheckSum = tcp_checksum({pseudoHeader, header}, std::string_view{}, {payload.data(), payload.size()});
+
+    std::vector<char> frame(sizeof(EthernetHeader) + sizeof(IpV4Header) + tcpSize);
+    std::size_t offset{0};
+    offset += writeEthernet(frame.data() + offset, from, to, EtherType::InternetProtocolVersion4);
+    offset += writeIp(frame.data() + offset, from, to, IPProtocol::TCP, tcpSize);
+    offset += toWire(header, frame.data() + offset);
+    std::copy(payload.begin(), payload.end(), frame.data() + offset);
+    return frame;
+}
+
+// Rewrites a big endian 16 bit field of a frame, fixing up the checksum which covers it
+// The checksum is adjusted as it sits in memory, which works whichever order it was stored in
+inline void patchWord(char* frame, std::size_t offset, std::uint16_t value, std::size_t checksumOffset)
+{
+    std::uint16_t oldWord{};
+    std::uint16_t storedChecksum{};
+    std::memcpy(&oldWord, frame + offset, sizeof(oldWord));
+    std::memcpy(&storedChecksum, frame + checksumOffset, sizeof(storedChecksum));
+
+    std::uint16_t newWord = std::byteswap(value);
+    storedChecksum = updateChecksum(storedChecksum, oldWord, newWord);
+    std::memcpy(frame + offset, &newWord, sizeof(newWord));
+    std::memcpy(frame + checksumOffset, &storedChecksum, sizeof(storedChecksum));
+}
+
+}
+
+struct TrafficConfig
+{
+    std::vector<TrafficKind> mKinds{TrafficKind::Icmp, TrafficKind::Arp, TrafficKind::TcpSyn, TrafficKind::TcpData};
+    std::size_t mFlows{1};
+    std::size_t mPayloadSize{64}; // Of echo requests and TCP data segments
+    traffic::Endpoint mTarget{};
+};
+
+struct GeneratedFrame
+{
+    std::size_t mSize{};
+    TrafficKind mKind{};
+    std::uint16_t mProbe{}; // The echo sequence number, for matching a reply
+};
+
+// Cycles through the kinds of traffic, then through the flows
+// Each flow comes from its own MAC, IP address and port, and talks to a port of its own
+class TrafficGenerator
+{
+public:
+    static constexpr std::size_t cMaxFlows{60000};
+    static constexpr Port cFirstSourcePort{1024};
+    static constexpr Port cFirstTargetPort{2048};
+
+    explicit TrafficGenerator(const TrafficConfig& config) : mKinds{config.mKinds}, mPayloadSize{config.mPayloadSize}
+    {
+        auto flowCount = std::min(config.mFlows, cMaxFlows);
+        mFlows.reserve(flowCount);
+        for (std::size_t i = 0; i < flowCount; i++)
+        {
+            auto high = static_cast<std::uint8_t>(i >> 8);
+            auto low = static_cast<std::uint8_t>(i);
+            traffic::Endpoint source{fromSextets({0xaa, 0xbb, 0xbb, 0x1, high, low}), fromQuartets({10, 4, high, low}),
+                                     static_cast<Port>(cFirstSourcePort + i)};
+            traffic::Endpoint target{config.mTarget};
+            target.mPort = static_cast<Port>(cFirstTargetPort + i);
+
+            Flow flow{};
+            flow.mTemplates[std::to_underlying(TrafficKind::Icmp)] = traffic::makeEchoRequest(source, target, mPayloadSize);
+            flow.mTemplates[std::to_underlying(TrafficKind::Arp)] = traffic::makeArpRequest(source, target);
+            flow.mTemplates[std::to_underlying(TrafficKind::TcpSyn)] = traffic::makeTcpSegment(
+                source, target, TcpFlags{std::to_underlying(TcpFlag::Syn)}, cInitialSequence, 0);
+            flow.mTemplates[std::to_underlying(TrafficKind::TcpData)] = traffic::makeTcpSegment(
+                source, target, TcpFlags{std::to_underlying(TcpFlag::Ack)} | TcpFlag::Push, cInitialSequence + 1, mPayloadSize);
+            flow.mNextSequence = cInitialSequence + 1;
+            mFlows.push_back(std::move(flow));
+        }
+    }
+
+    // Writes the next frame into buffer, which must be large enough for any of them
+    GeneratedFrame next(std::span<char> buffer)
+    {
+        auto kind = mKinds[mKindIndex];
+        auto& flow = mFlows[mFlowIndex];
+        const auto& frameTemplate = flow.mTemplates[std::to_underlying(kind)];
+        std::memcpy(buffer.data(), frameTemplate.data(), frameTemplate.size());
+
+        GeneratedFrame generated{frameTemplate.size(), kind, 0};
+        if (kind == TrafficKind::Icmp)
+        {
+            static constexpr auto cIcmpOffset{sizeof(EthernetHeader) + sizeof(IpV4Header)};
+            generated.mProbe = mNextProbe++;
+            traffic::patchWord(buffer.data(), cIcmpOffset + sizeof(IcmpV4Header) + offsetof(IcmpV4Echo, mSeq), generated.mProbe,
+                               cIcmpOffset + offsetof(IcmpV4Header, mCheckSum));
+        }
+        else if (kind == TrafficKind::TcpData)
+        {
+            // Each segment carries new data, so the stack acknowledges every one
+            static constexpr auto cTcpOffset{sizeof(EthernetHeader) + sizeof(IpV4Header)};
+            static constexpr auto cSequenceOffset{cTcpOffset + offsetof(TcpHeader, mSequenceNumber)};
+            static constexpr auto cChecksumOffset{cTcpOffset + offsetof(TcpHeader, mCheckSum)};
+            traffic::patchWord(buffer.data(), cSequenceOffset, static_cast<std::uint16_t>(flow.mNextSequence >> 16), cChecksumOffset);
+            traffic::patchWord(buffer.data(), cSequenceOffset + 2, static_cast<std::uint16_t>(flow.mNextSequence), cChecksumOffset);
+            flow.mNextSequence += mPayloadSize;
+        }
+
+        if (++mKindIndex == mKinds.size())
+        {
+            mKindIndex = 0;
+            if (++mFlowIndex == mFlows.size())
+            {
+                mFlowIndex = 0;
+            }
+        }
+        return generated;
+    }
+
+    std::size_t flowCount() const
+    {
+        return mFlows.size();
+    }
+
+private:
+    static constexpr SequenceNumber cInitialSequence{1000};
+
+    struct Flow
+    {
+        std::array<std::vector<char>, std::to_underlying(TrafficKind::Count)> mTemplates{};
+        SequenceNumber mNextSequence{};
+    };
+
+    std::vector<TrafficKind> mKinds;
+    std::size_t mPayloadSize;
+    std::vector<Flow> mFlows{};
+    std::size_t mKindIndex{};
+    std::size_t mFlowIndex{};
+    std::uint16_t mNextProbe{};
+};
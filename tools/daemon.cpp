@@ -0,0 +1,109 @@
+#include <tap.hpp>
+#include <Log.hpp>
+#include <Pipeline.hpp>
+#include <RemoteStack.hpp>
+#include <RxArena.hpp>
+#include <Stack.hpp>
+#include <Types.hpp>
+#include <Vnet.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <print>
+#include <vector>
+
+#include <poll.h>
+
+// Runs the stack for applications in other processes, which attach with RemoteStack
+// Usage: tilapia_daemon
+// Like tilapia, it answers as 10.3.3.3 on the Tilapia tap device, and clients find it at TILAPIA_DAEMON_SOCKET,
+// /tmp/tilapia.sock unless set.
+
+int main()
+{
+    TapDevice tap{cEnableVnetHeader};
+    Stack stack{fromQuartets({10, 3, 3, 3}), fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+
+    // Frames are read straight into the arena, so streams can lend what they receive to be copied to clients
+    static constexpr std::size_t cArenaBuffers{4096};
+    RxBufferArena arena{cArenaBuffers};
+    stack.context().mTcpSockets.attachArena(arena);
+    AttachedClients clients{stack};
+    std::println("Serving clients at {} on tap device {}", daemonSocketPath(), tap.name());
+
+    LogDrainer logDrainer{};
+    tap.setNonBlocking();
+    auto framePool = std::make_unique<FramePool>(arena);
+    auto txPool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    FrameBatch txBatch{};
+    std::vector<pollfd> descriptors{};
+
+    auto writeFrames = [&](const FrameBatch& frames) {
+        for (const auto* frame : frames)
+        {
+            if (frame->mTx.empty())
+            {
+                continue;
+            }
+
+            stack.forEachFragment(frame->mTx, [&](LayerBytes tx) {
+                if (write(tap.descriptor(), tx.data(), tx.size()) != static_cast<ssize_t>(tx.size()))
+                {
+                    logError("Write failure: {}", strerror(errno));
+                }
+            });
+        }
+    };
+
+    // Timers want waking for even when nothing arrives, and we do not sleep at all while a client is waiting on us
+    static constexpr int cPollTimeoutMillis{10};
+    for (;;)
+    {
+        descriptors.clear();
+        descriptors.push_back(pollfd{tap.descriptor(), POLLIN, 0});
+        clients.descriptors(descriptors);
+        if (poll(descriptors.data(), descriptors.size(), clients.sleep() ? cPollTimeoutMillis : 0) < 0 && errno != EINTR)
+        {
+            logError("Failed to poll: {}", strerror(errno));
+        }
+        clients.wake();
+
+        batch.clear();
+        while (!batch.full())
+        {
+            auto rxBuffer = framePool->rxBuffer(batch.size());
+            auto bytesRead = read(tap.descriptor(), rxBuffer.data(), rxBuffer.size());
+            if (bytesRead <= 0)
+            {
+                break;
+            }
+
+            auto bytes = rxBuffer.first(static_cast<std::size_t>(bytesRead));
+            if constexpr (cEnableVnetHeader)
+            {
+                if (bytes.size() < sizeof(VnetHeader))
+                {
+                    continue;
+                }
+                bytes = bytes.subspan(sizeof(VnetHeader));
+            }
+
+            auto& frame = framePool->frame(batch.size());
+            frame.reset(bytes);
+            frame.mReceivedAt = nowNanos();
+            batch.push(&frame);
+        }
+
+        stack.process(batch);
+        writeFrames(batch);
+
+        clients.service();
+
+        txBatch.clear();
+        stack.transmit(*txPool, txBatch);
+        writeFrames(txBatch);
+    }
+}
@@ -0,0 +1,136 @@
+#include <tap.hpp>
+#include <Async.hpp>
+#include <Log.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <TcpSocket.hpp>
+#include <Types.hpp>
+#include <Vnet.hpp>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <print>
+#include <span>
+
+#include <poll.h>
+
+// An echo server written as coroutines, as an example of running an application inside the packet loop
+// Usage: tilapia_echo [port]
+// Like tilapia, it answers as 10.3.3.3 on the Tilapia tap device, here on port 7 unless told otherwise.
+
+namespace
+{
+
+Task echo(Scheduler& scheduler, ConnectionKey key)
+{
+    std::array<char, 512> buffer{};
+    while (auto received = co_await scheduler.read(key, buffer))
+    {
+        if (co_await scheduler.write(key, std::span{buffer}.first(received)) != received)
+        {
+            break;
+        }
+    }
+    scheduler.close(key);
+}
+
+Task serve(Scheduler& scheduler, Port port)
+{
+    for (;;)
+    {
+        auto key = co_await scheduler.accept(port);
+        if (!echo(scheduler, key).started())
+        {
+            logWarning("Too many connections, closing {}", key.mRemotePort);
+            scheduler.close(key);
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Port port = argc > 1 ? static_cast<Port>(std::strtoul(argv[1], nullptr, 10)) : 7;
+
+    TapDevice tap{cEnableVnetHeader};
+    Stack stack{fromQuartets({10, 3, 3, 3}), fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+    stack.listen(port);
+    Scheduler scheduler{stack};
+    serve(scheduler, port);
+    std::println("Echoing port {} on tap device {}", port, tap.name());
+
+    LogDrainer logDrainer{};
+    tap.setNonBlocking();
+    pollfd tapPoll{tap.descriptor(), POLLIN, 0};
+    auto framePool = std::make_unique<FramePool>();
+    auto txPool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    FrameBatch txBatch{};
+
+    auto writeFrames = [&](const FrameBatch& frames) {
+        for (const auto* frame : frames)
+        {
+            if (frame->mTx.empty())
+            {
+                continue;
+            }
+
+            stack.forEachFragment(frame->mTx, [&](LayerBytes tx) {
+                if (write(tap.descriptor(), tx.data(), tx.size()) != static_cast<ssize_t>(tx.size()))
+                {
+                    logError("Write failure: {}", strerror(errno));
+                }
+            });
+        }
+    };
+
+    // Timers want waking for even when nothing arrives
+    static constexpr int cPollTimeoutMillis{10};
+    for (;;)
+    {
+        if (poll(&tapPoll, 1, cPollTimeoutMillis) < 0 && errno != EINTR)
+        {
+            logError("Failed to poll Tap Device: {}", strerror(errno));
+        }
+
+        batch.clear();
+        while (!batch.full())
+        {
+            auto rxBuffer = framePool->rxBuffer(batch.size());
+            auto bytesRead = read(tap.descriptor(), rxBuffer.data(), rxBuffer.size());
+            if (bytesRead <= 0)
+            {
+                break;
+            }
+
+            auto bytes = rxBuffer.first(static_cast<std::size_t>(bytesRead));
+            if constexpr (cEnableVnetHeader)
+            {
+                if (bytes.size() < sizeof(VnetHeader))
+                {
+                    continue;
+                }
+                bytes = bytes.subspan(sizeof(VnetHeader));
+            }
+
+            auto& frame = framePool->frame(batch.size());
+            frame.reset(bytes);
+            frame.mReceivedAt = nowNanos();
+            batch.push(&frame);
+        }
+
+        stack.process(batch);
+        writeFrames(batch);
+
+        // The coroutines run here, and what they write goes out with the transmit after
+        scheduler.poll();
+        txBatch.clear();
+        stack.transmit(*txPool, txBatch);
+        writeFrames(txBatch);
+    }
+}
@@ -0,0 +1,128 @@
+#include <tap.hpp>
+#include <Log.hpp>
+#include <MappedFile.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <TcpSocket.hpp>
+#include <Types.hpp>
+#include <Vnet.hpp>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <print>
+#include <span>
+#include <string>
+
+#include <poll.h>
+
+// Sends a file to everything which connects, straight from its mapping, then closes the connection
+// Usage: tilapia_files <path> [port]
+// Like tilapia, it answers as 10.3.3.3 on the Tilapia tap device, here on port 80 unless told otherwise,
+// so `nc 10.3.3.3 80 > copy` fetches the file.
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::println("Usage: {} <path> [port]", argv[0]);
+        return 1;
+    }
+    MappedFile file{argv[1]};
+    Port port = argc > 2 ? static_cast<Port>(std::strtoul(argv[2], nullptr, 10)) : 80;
+
+    TapDevice tap{cEnableVnetHeader};
+    Stack stack{fromQuartets({10, 3, 3, 3}), fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+    stack.listen(port);
+    std::println("Serving {}, {} bytes, on port {} on tap device {}", argv[1], file.bytes().size(), port, tap.name());
+
+    LogDrainer logDrainer{};
+    tap.setNonBlocking();
+    pollfd tapPoll{tap.descriptor(), POLLIN, 0};
+    auto framePool = std::make_unique<FramePool>();
+    auto txPool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    FrameBatch txBatch{};
+    std::array<Readiness, FrameBatch::cMaxFrames> ready{};
+
+    auto writeFrames = [&](const FrameBatch& frames) {
+        for (const auto* frame : frames)
+        {
+            if (frame->mTx.empty())
+            {
+                continue;
+            }
+
+            stack.forEachFragment(frame->mTx, [&](LayerBytes tx) {
+                if (write(tap.descriptor(), tx.data(), tx.size()) != static_cast<ssize_t>(tx.size()))
+                {
+                    logError("Write failure: {}", strerror(errno));
+                }
+            });
+        }
+    };
+
+    // Timers want waking for even when nothing arrives
+    static constexpr int cPollTimeoutMillis{10};
+    for (;;)
+    {
+        if (poll(&tapPoll, 1, cPollTimeoutMillis) < 0 && errno != EINTR)
+        {
+            logError("Failed to poll Tap Device: {}", strerror(errno));
+        }
+
+        batch.clear();
+        while (!batch.full())
+        {
+            auto rxBuffer = framePool->rxBuffer(batch.size());
+            auto bytesRead = read(tap.descriptor(), rxBuffer.data(), rxBuffer.size());
+            if (bytesRead <= 0)
+            {
+                break;
+            }
+
+            auto bytes = rxBuffer.first(static_cast<std::size_t>(bytesRead));
+            if constexpr (cEnableVnetHeader)
+            {
+                if (bytes.size() < sizeof(VnetHeader))
+                {
+                    continue;
+                }
+                bytes = bytes.subspan(sizeof(VnetHeader));
+            }
+
+            auto& frame = framePool->frame(batch.size());
+            frame.reset(bytes);
+            frame.mReceivedAt = nowNanos();
+            batch.push(&frame);
+        }
+
+        stack.process(batch);
+        writeFrames(batch);
+
+        // The whole file is queued at once, as it takes no room, and the Fin goes out after it
+        while (auto count = stack.readiness(ready))
+        {
+            for (const auto& [key, events] : std::span{ready}.first(count))
+            {
+                if (!events.set(SocketEvent::Acceptable))
+                {
+                    continue;
+                }
+
+                while (auto accepted = stack.accept(port))
+                {
+                    stack.sendRegion(*accepted, file.bytes());
+                    stack.close(*accepted);
+                }
+            }
+        }
+
+        txBatch.clear();
+        stack.transmit(*txPool, txBatch);
+        writeFrames(txBatch);
+    }
+}
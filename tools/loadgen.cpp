@@ -0,0 +1,373 @@
+#include <Icmp.hpp>
+#include <Metrics.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <Traffic.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef linux
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#endif
+
+// Drives the stack with synthetic traffic, and reports how it kept up
+// Usage: tilapia_loadgen [--device ifname] [--mix icmp,arp,syn,data] [--flows N] [--size bytes]
+//                        [--rate pps] [--count N] [--ip a.b.c.d]
+// Without --device the stack runs in this process, and latency is how long each batch took.
+// With --device frames go out of an interface, usually the tap a running tilapia reads from,
+// and latency is measured from echo requests to their replies.
+
+namespace
+{
+
+struct Options
+{
+    std::optional<std::string> mDevice{};
+    TrafficConfig mTraffic{};
+    std::uint64_t mRate{0}; // Frames per second, or as fast as possible
+    std::uint64_t mCount{1'000'000};
+};
+
+Options parseOptions(int argc, char** argv)
+{
+    Options options{};
+    options.mTraffic.mTarget = {fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd}), fromQuartets({10, 3, 3, 3}), 0};
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view argument{argv[i]};
+        bool hasValue = i + 1 < argc;
+        if (argument == "--device" && hasValue)
+        {
+            options.mDevice = argv[++i];
+        }
+        else if (argument == "--mix" && hasValue)
+        {
+            options.mTraffic.mKinds.clear();
+            std::string_view mix{argv[++i]};
+            while (!mix.empty())
+            {
+                auto name = mix.substr(0, mix.find(','));
+                mix.remove_prefix(std::min(mix.size(), name.size() + 1));
+                auto kind = traffic::parseKind(name);
+                if (!kind.has_value())
+                {
+                    std::println("Unknown traffic kind {}, expected icmp, arp, syn or data", name);
+                    exit(1);
+                }
+                options.mTraffic.mKinds.push_back(*kind);
+            }
+        }
+        else if (argument == "--flows" && hasValue)
+        {
+            options.mTraffic.mFlows = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--size" && hasValue)
+        {
+            options.mTraffic.mPayloadSize = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--rate" && hasValue)
+        {
+            options.mRate = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--count" && hasValue)
+        {
+            options.mCount = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--ip" && hasValue)
+        {
+            std::array<int, sizeof(IpAddress)> quartets{};
+            if (std::sscanf(argv[++i], "%d.%d.%d.%d", &quartets[0], &quartets[1], &quartets[2], &quartets[3]) != 4)
+            {
+                std::println("Bad IP address {}", argv[i]);
+                exit(1);
+            }
+            options.mTraffic.mTarget.mIp = fromQuartets(quartets);
+        }
+        else
+        {
+            std::println("Usage: tilapia_loadgen [--device ifname] [--mix icmp,arp,syn,data] [--flows N] [--size bytes] "
+                         "[--rate pps] [--count N] [--ip a.b.c.d]");
+            exit(1);
+        }
+    }
+
+    static constexpr std::size_t cMaxPayloadSize{FramePool::cBufferSize - 128};
+    if (options.mTraffic.mKinds.empty() || options.mTraffic.mFlows == 0 || options.mTraffic.mPayloadSize > cMaxPayloadSize)
+    {
+        std::println("Need at least one kind of traffic, one flow, and a payload under {} bytes", cMaxPayloadSize);
+        exit(1);
+    }
+
+    return options;
+}
+
+struct Results
+{
+    std::uint64_t mSent{};
+    std::uint64_t mReplies{};
+    std::array<std::uint64_t, std::to_underlying(TrafficKind::Count)> mSentByKind{};
+    LatencyHistogram::Counts mLatency{};
+    std::uint64_t mElapsed{};
+
+    void recordLatency(std::uint64_t nanos)
+    {
+        mLatency[LatencyHistogram::bucketIndex(nanos)] += 1;
+    }
+};
+
+// Frames are sent a batch at a time, each batch waiting for its turn when a rate is set
+class Pacer
+{
+public:
+    explicit Pacer(std::uint64_t rate) : mRate{rate}, mStart{nowNanos()} { }
+
+    void wait(std::uint64_t sent) const
+    {
+        static constexpr std::uint64_t cNanosPerSecond{1'000'000'000};
+        if (mRate != 0)
+        {
+            waitUntil(mStart + static_cast<std::uint64_t>(static_cast<double>(sent) * cNanosPerSecond / mRate));
+        }
+    }
+
+private:
+    std::uint64_t mRate;
+    std::uint64_t mStart;
+};
+
+Results runInProcess(const Options& options, TrafficGenerator& generator)
+{
+    const auto& target = options.mTraffic.mTarget;
+    Stack stack{target.mIp, target.mMac};
+    stack.context().mArpNode.configure(ArpConfig::unlimited());
+    auto framePool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    Results results{};
+
+    Pacer pacer{options.mRate};
+    auto start = nowNanos();
+    while (results.mSent < options.mCount)
+    {
+        pacer.wait(results.mSent);
+        batch.clear();
+        auto batchStart = nowNanos();
+        while (!batch.full() && results.mSent < options.mCount)
+        {
+            auto buffer = framePool->rxBuffer(batch.size());
+            auto generated = generator.next(buffer);
+            auto& frame = framePool->frame(batch.size());
+            frame.reset(buffer.first(generated.mSize));
+            batch.push(&frame);
+            results.mSent += 1;
+            results.mSentByKind[std::to_underlying(generated.mKind)] += 1;
+        }
+
+        stack.process(batch);
+        auto batchLatency = nowNanos() - batchStart;
+        for (const auto* frame : batch)
+        {
+            if (!frame->mTx.empty())
+            {
+                results.mReplies += 1;
+                results.recordLatency(batchLatency);
+            }
+        }
+    }
+    results.mElapsed = nowNanos() - start;
+
+    std::println("{}", stack.context().mDropCounters);
+    return results;
+}
+
+#ifdef linux
+// Sends frames out of an interface, and picks up the stack's replies as they come back in
+class PacketSocket
+{
+public:
+    explicit PacketSocket(const std::string& device)
+    {
+        mFileDescriptor = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+        if (mFileDescriptor < 0)
+        {
+            std::println("Failed to open packet socket: {}", strerror(errno));
+            exit(1);
+        }
+
+        sockaddr_ll address{};
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_ALL);
+        address.sll_ifindex = static_cast<int>(if_nametoindex(device.c_str()));
+        if (address.sll_ifindex == 0 || bind(mFileDescriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+        {
+            std::println("Failed to bind packet socket to {}: {}", device, strerror(errno));
+            exit(1);
+        }
+    }
+
+    ~PacketSocket()
+    {
+        close(mFileDescriptor);
+    }
+
+    PacketSocket(const PacketSocket&) = delete;
+    PacketSocket& operator=(const PacketSocket&) = delete;
+
+    // Sends the whole batch with one system call, returning how many went
+    std::size_t send(std::span<const std::span<const char>> frames)
+    {
+        std::array<iovec, FrameBatch::cMaxFrames> vectors{};
+        std::array<mmsghdr, FrameBatch::cMaxFrames> messages{};
+        for (std::size_t i = 0; i < frames.size(); i++)
+        {
+            vectors[i] = {const_cast<char*>(frames[i].data()), frames[i].size()};
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(mFileDescriptor, messages.data(), static_cast<unsigned>(frames.size()), 0);
+        return sent < 0 ? 0 : static_cast<std::size_t>(sent);
+    }
+
+    // Calls onFrame for every frame that has arrived, skipping the ones we sent ourselves
+    template <typename OnFrameT>
+    void receive(OnFrameT&& onFrame)
+    {
+        std::array<char, FramePool::cBufferSize> buffer{};
+        while (true)
+        {
+            sockaddr_ll from{};
+            socklen_t fromLength{sizeof(from)};
+            auto received = recvfrom(mFileDescriptor, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+            if (received < 0)
+            {
+                return;
+            }
+
+            if (from.sll_pkttype != PACKET_OUTGOING)
+            {
+                onFrame(LayerBytes{buffer.data(), static_cast<std::size_t>(received)});
+            }
+        }
+    }
+
+private:
+    int mFileDescriptor{-1};
+};
+
+Results runOnDevice(const Options& options, TrafficGenerator& generator)
+{
+    PacketSocket packetSocket{*options.mDevice};
+    const auto& target = options.mTraffic.mTarget;
+    auto framePool = std::make_unique<FramePool>();
+    std::array<std::uint64_t, 1 << 16> probeSentAt{};
+    Results results{};
+
+    auto onFrame = [&](LayerBytes bytes) {
+        static constexpr auto cIcmpOffset{sizeof(EthernetHeader) + sizeof(IpV4Header)};
+        if (bytes.size() < sizeof(EthernetHeader) || fromWire<EthernetHeader>(bytes.data()).mSourceMacAddress != target.mMac)
+        {
+            return;
+        }
+
+        results.mReplies += 1;
+        if (bytes.size() >= cIcmpOffset + sizeof(IcmpV4Header) + sizeof(IcmpV4Echo)
+            && static_cast<IPProtocol>(bytes[sizeof(EthernetHeader) + offsetof(IpV4Header, mProto)]) == IPProtocol::ICMP)
+        {
+            auto echo = fromWire<IcmpV4Echo>(bytes.data() + cIcmpOffset + sizeof(IcmpV4Header));
+            if (echo.mId == traffic::cProbeId && probeSentAt[echo.mSeq] != 0)
+            {
+                results.recordLatency(nowNanos() - probeSentAt[echo.mSeq]);
+                probeSentAt[echo.mSeq] = 0;
+            }
+        }
+    };
+
+    Pacer pacer{options.mRate};
+    auto start = nowNanos();
+    std::array<std::span<const char>, FrameBatch::cMaxFrames> frames{};
+    while (results.mSent < options.mCount)
+    {
+        pacer.wait(results.mSent);
+        std::size_t count{0};
+        while (count < frames.size() && results.mSent + count < options.mCount)
+        {
+            auto buffer = framePool->rxBuffer(count);
+            auto generated = generator.next(buffer);
+            frames[count++] = buffer.first(generated.mSize);
+            results.mSentByKind[std::to_underlying(generated.mKind)] += 1;
+            if (generated.mKind == TrafficKind::Icmp)
+            {
+                probeSentAt[generated.mProbe] = nowNanos();
+            }
+        }
+
+        results.mSent += packetSocket.send(std::span{frames}.first(count));
+        packetSocket.receive(onFrame);
+    }
+
+    // Give the last replies a moment to come back
+    static constexpr std::uint64_t cGraceNanos{100'000'000};
+    auto deadline = nowNanos() + cGraceNanos;
+    while (nowNanos() < deadline)
+    {
+        packetSocket.receive(onFrame);
+    }
+    results.mElapsed = nowNanos() - start;
+    return results;
+}
+#else
+Results runOnDevice(const Options&, TrafficGenerator&)
+{
+    std::println("Sending to a device needs Linux packet sockets");
+    exit(1);
+}
+#endif
+
+}
+
+int main(int argc, char** argv)
+{
+    auto options = parseOptions(argc, argv);
+    TrafficGenerator generator{options.mTraffic};
+    auto results = options.mDevice.has_value() ? runOnDevice(options, generator) : runInProcess(options, generator);
+
+    // Every frame we generate should be answered, so anything unanswered was lost
+    static constexpr double cNanosPerSecond{1e9};
+    auto lost = results.mSent > results.mReplies ? results.mSent - results.mReplies : 0;
+    std::println("Sent {} frames over {} flows in {:.3f} s: {:.0f} packets/s, {:.1f} ns/packet", results.mSent, generator.flowCount(),
+        results.mElapsed / cNanosPerSecond, results.mSent * cNanosPerSecond / results.mElapsed,
+        static_cast<double>(results.mElapsed) / results.mSent);
+    for (std::uint8_t i = 0; i < std::to_underlying(TrafficKind::Count); i++)
+    {
+        if (results.mSentByKind[i] != 0)
+        {
+            std::println("{:<8} {:>12}", static_cast<TrafficKind>(i), results.mSentByKind[i]);
+        }
+    }
+    std::println("Replies {}, lost {} ({:.3f}%)", results.mReplies, lost, results.mSent ? 100.0 * lost / results.mSent : 0.0);
+
+    std::println("Latency ns: p50 {} p90 {} p99 {} p99.9 {} max {}", LatencyHistogram::percentile(results.mLatency, 0.5),
+        LatencyHistogram::percentile(results.mLatency, 0.9), LatencyHistogram::percentile(results.mLatency, 0.99),
+        LatencyHistogram::percentile(results.mLatency, 0.999), LatencyHistogram::percentile(results.mLatency, 1.0));
+}
@@ -0,0 +1,101 @@
+#include <Metrics.hpp>
+#include <Parse.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <print>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Adds up every shard of a running tilapia's metrics file and prints the totals
+// Usage: tilapia_metrics [path] [seconds between refreshes]
+// Only ever reads the file, so it has no effect on the packet loop
+
+namespace
+{
+
+struct Totals
+{
+    std::size_t mActiveShards{};
+    std::array<std::uint64_t, MetricsShard::cCounterCount> mCounters{};
+    DropCounters mDrops{};
+    LatencyHistogram::Counts mLatency{};
+};
+
+Totals aggregate(const MetricsFile& file)
+{
+    Totals totals{};
+    for (std::size_t i = 0; i < file.shardCount(); i++)
+    {
+        const auto& shard = file.shard(i);
+        if (shard.mOwner.load(std::memory_order_relaxed) != 0)
+        {
+            totals.mActiveShards += 1;
+        }
+
+        for (std::size_t j = 0; j < totals.mCounters.size(); j++)
+        {
+            totals.mCounters[j] += shard.mCounters[j].load(std::memory_order_relaxed);
+        }
+
+        for (std::size_t j = 0; j < DropCounters::cReasonCount; j++)
+        {
+            totals.mDrops.record(static_cast<DropReason>(j), shard.mDrops[j].load(std::memory_order_relaxed));
+        }
+
+        for (std::size_t j = 0; j < LatencyHistogram::cBucketCount; j++)
+        {
+            totals.mLatency[j] += shard.mLatency[j].load(std::memory_order_relaxed);
+        }
+    }
+
+    return totals;
+}
+
+void print(const Totals& totals, std::size_t shardCount)
+{
+    std::println("Shards: {} active out of {}", totals.mActiveShards, shardCount);
+    for (std::size_t i = 0; i < totals.mCounters.size(); i++)
+    {
+        std::println("{:<24} {:>16}", static_cast<Counter>(i), totals.mCounters[i]);
+    }
+    std::println("{}", totals.mDrops);
+
+    std::uint64_t replies{0};
+    for (auto count : totals.mLatency)
+    {
+        replies += count;
+    }
+
+    std::println("Receive to transmit latency over {} replies, in nanoseconds:", replies);
+    static constexpr std::array cPercentiles{0.5, 0.9, 0.99, 0.999, 1.0};
+    for (auto percentile : cPercentiles)
+    {
+        std::println("  p{:<8} {:>12}", percentile * 100, LatencyHistogram::percentile(totals.mLatency, percentile));
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = argc > 1 ? argv[1] : metricsPath();
+    int interval = argc > 2 ? std::atoi(argv[2]) : 0;
+
+    MetricsFile file{path};
+    while (true)
+    {
+        print(aggregate(file), file.shardCount());
+        if (interval <= 0)
+        {
+            return 0;
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds{interval});
+        std::println("");
+    }
+}
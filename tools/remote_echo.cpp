@@ -0,0 +1,77 @@
+#include <RemoteStack.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <print>
+#include <span>
+
+// An echo server in its own process, as an example of using tilapia_daemon's stack through RemoteStack
+// Usage: tilapia_remote_echo [port]
+// With tilapia_daemon running, `nc 10.3.3.3 7` echoes whatever it sends.
+
+int main(int argc, char** argv)
+{
+    Port port = argc > 1 ? static_cast<Port>(std::strtoul(argv[1], nullptr, 10)) : 7;
+
+    RemoteStack remote{};
+    remote.listen(port);
+
+    // Received buffers are only released once echoed, so a slow peer shuts its own window, not everyone's
+    struct Echo
+    {
+        Completion mReceived;
+        std::size_t mSent;
+    };
+    std::deque<Echo> waiting{};
+    std::array<Completion, 64> completions{};
+
+    static constexpr int cWaitTimeoutMillis{100};
+    for (;;)
+    {
+        auto count = remote.poll(completions);
+        for (const auto& completion : std::span{completions}.first(count))
+        {
+            switch (completion.mType)
+            {
+                case CompletionType::Listening:
+                    if (!completion.mSucceeded)
+                    {
+                        std::println("Failed to listen on port {}", port);
+                        return 1;
+                    }
+                    std::println("Echoing on port {}", port);
+                    break;
+                case CompletionType::Received:
+                    waiting.push_back(Echo{completion, 0});
+                    break;
+                case CompletionType::Closed:
+                    remote.close(completion.mKey);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        while (!waiting.empty())
+        {
+            auto& echo = waiting.front();
+            auto bytes = remote.received(echo.mReceived).subspan(echo.mSent);
+            echo.mSent += remote.send(echo.mReceived.mKey, bytes);
+            if (echo.mSent != echo.mReceived.mSize)
+            {
+                break;
+            }
+            remote.release(echo.mReceived);
+            waiting.pop_front();
+        }
+
+        // Sent buffers coming back wake us too, so an echo waiting for them carries on
+        if (count == 0)
+        {
+            remote.wait(cWaitTimeoutMillis);
+        }
+    }
+}
@@ -0,0 +1,176 @@
+#include <Log.hpp>
+#include <Metrics.hpp>
+#include <Pcap.hpp>
+#include <Pipeline.hpp>
+#include <Stack.hpp>
+#include <Types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Pushes a recorded capture through the stack, without a tap device or root
+// Usage: tilapia_replay <capture> [--paced] [--loops N] [--output replies.pcap] [--ip a.b.c.d]
+// As fast as possible by default, or at the pace it was recorded with --paced.
+// Replies are thrown away, or written to a capture with --output.
+
+namespace
+{
+
+struct Options
+{
+    std::string mCapturePath{};
+    bool mPaced{false};
+    std::size_t mLoops{1};
+    std::optional<std::string> mOutputPath{};
+    IpAddress mIp{fromQuartets({10, 3, 3, 3})};
+};
+
+Options parseOptions(int argc, char** argv)
+{
+    Options options{};
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view argument{argv[i]};
+        bool hasValue = i + 1 < argc;
+        if (argument == "--paced")
+        {
+            options.mPaced = true;
+        }
+        else if (argument == "--loops" && hasValue)
+        {
+            options.mLoops = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--output" && hasValue)
+        {
+            options.mOutputPath = argv[++i];
+        }
+        else if (argument == "--ip" && hasValue)
+        {
+            std::array<int, sizeof(IpAddress)> quartets{};
+            if (std::sscanf(argv[++i], "%d.%d.%d.%d", &quartets[0], &quartets[1], &quartets[2], &quartets[3]) != 4)
+            {
+                std::println("Bad IP address {}", argv[i]);
+                exit(1);
+            }
+            options.mIp = fromQuartets(quartets);
+        }
+        else if (options.mCapturePath.empty())
+        {
+            options.mCapturePath = argument;
+        }
+        else
+        {
+            std::println("Unexpected argument {}", argument);
+            exit(1);
+        }
+    }
+
+    if (options.mCapturePath.empty())
+    {
+        std::println("Usage: tilapia_replay <capture> [--paced] [--loops N] [--output replies.pcap] [--ip a.b.c.d]");
+        exit(1);
+    }
+
+    return options;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto options = parseOptions(argc, argv);
+    PcapFile capture{options.mCapturePath};
+    const auto& records = capture.records();
+    if (records.empty())
+    {
+        std::println("No Ethernet frames in {}", options.mCapturePath);
+        return 1;
+    }
+
+    std::optional<PcapWriter> output{};
+    if (options.mOutputPath.has_value())
+    {
+        output.emplace(*options.mOutputPath);
+    }
+
+    MacAddress mac{fromSextets({0xaa, 0xbb, 0xbb, 0x0, 0x0, 0xdd})};
+    Stack stack{options.mIp, mac};
+    auto framePool = std::make_unique<FramePool>();
+    FrameBatch batch{};
+    std::uint64_t replies{0};
+    std::uint64_t replyBytes{0};
+
+    auto flush = [&]() {
+        stack.process(batch);
+        for (const auto* frame : batch)
+        {
+            if (frame->mTx.empty())
+            {
+                continue;
+            }
+
+            replies += 1;
+            replyBytes += frame->mTx.size();
+            if (output.has_value())
+            {
+                output->write(captureTimestamp(), frame->mTx);
+            }
+        }
+        batch.clear();
+    };
+
+    auto firstTimestamp = records.front().mTimestampNanos;
+    auto lastTimestamp = records.back().mTimestampNanos;
+    auto start = nowNanos();
+    for (std::size_t loop = 0; loop < options.mLoops; loop++)
+    {
+        auto loopStart = nowNanos();
+        for (const auto& record : records)
+        {
+            if (options.mPaced && record.mTimestampNanos >= firstTimestamp && record.mTimestampNanos <= lastTimestamp)
+            {
+                // We hand over what we have before waiting, as a device would
+                if (!batch.empty())
+                {
+                    flush();
+                }
+                waitUntil(loopStart + (record.mTimestampNanos - firstTimestamp));
+            }
+
+            batch.push(&framePool->load(batch.size(), record.mBytes));
+            if (batch.full())
+            {
+                flush();
+            }
+        }
+    }
+
+    if (!batch.empty())
+    {
+        flush();
+    }
+    auto elapsed = nowNanos() - start;
+
+    static constexpr double cNanosPerSecond{1e9};
+    auto frames = records.size() * options.mLoops;
+    std::println("Replayed {} frames in {:.3f} s: {:.0f} packets/s, {:.1f} ns/packet", frames, elapsed / cNanosPerSecond,
+        frames * cNanosPerSecond / elapsed, static_cast<double>(elapsed) / frames);
+    std::println("Sent {} replies, {} bytes{}", replies, replyBytes, output.has_value() ? " to " + *options.mOutputPath : "");
+
+    const auto& metrics = stack.context().metrics();
+    for (auto counter : {Counter::EthernetFrames, Counter::Ipv4Packets, Counter::IcmpEchoes, Counter::TcpSegments,
+                         Counter::TcpRetransmits, Counter::ArpMessages, Counter::ArpHits, Counter::ArpMisses})
+    {
+        std::println("{:<24} {:>12}", counter, metrics.count(counter));
+    }
+    std::println("{}", stack.context().mDropCounters);
+}
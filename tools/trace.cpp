@@ -0,0 +1,161 @@
+#include <Trace.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <print>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reads the trace written by a tilapia built with TILAPIA_TRACE,
+// prints percentiles for each stage, and optionally writes a Chrome trace
+// which can be opened in chrome://tracing or ui.perfetto.dev
+// Usage: tilapia_trace [trace file] [chrome trace json]
+
+namespace
+{
+
+struct ThreadEvents
+{
+    std::uint64_t mThreadId{};
+    std::vector<TraceEvent> mEvents{};
+};
+
+struct Trace
+{
+    double mTicksPerNano{};
+    std::vector<ThreadEvents> mThreads{};
+};
+
+bool readTrace(const std::string& path, Trace& trace)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    tracing::TraceFileHeader header{};
+    bool read = std::fread(&header, sizeof(header), 1, file) == 1 && header.mMagic == tracing::TraceFileHeader::cMagic;
+    trace.mTicksPerNano = header.mTicksPerNano;
+    for (std::uint64_t i = 0; read && i < header.mThreadCount; i++)
+    {
+        tracing::TraceThreadHeader threadHeader{};
+        read = std::fread(&threadHeader, sizeof(threadHeader), 1, file) == 1 && threadHeader.mEventCount <= TraceRing::cCapacity;
+        if (read)
+        {
+            auto& thread = trace.mThreads.emplace_back(ThreadEvents{threadHeader.mThreadId, {}});
+            thread.mEvents.resize(threadHeader.mEventCount);
+            read = std::fread(thread.mEvents.data(), sizeof(TraceEvent), thread.mEvents.size(), file) == thread.mEvents.size();
+        }
+    }
+
+    std::fclose(file);
+    return read;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction)
+{
+    auto index = static_cast<std::size_t>(fraction * (sorted.size() - 1));
+    return sorted[index];
+}
+
+// Each stage's durations in nanoseconds, both per event and per frame,
+// as the Ethernet and IP stages record one event for a whole batch
+void printPercentiles(const Trace& trace)
+{
+    static constexpr auto cStageCount{std::to_underlying(TraceStage::Count)};
+    std::array<std::vector<double>, cStageCount> durations{};
+    std::array<std::vector<double>, cStageCount> perFrame{};
+    for (const auto& thread : trace.mThreads)
+    {
+        for (const auto& event : thread.mEvents)
+        {
+            auto stage = std::to_underlying(event.mStage);
+            if (stage >= cStageCount)
+            {
+                continue;
+            }
+
+            double nanos = (event.mEnd - event.mStart) / trace.mTicksPerNano;
+            durations[stage].push_back(nanos);
+            perFrame[stage].push_back(nanos / std::max<std::uint32_t>(event.mFrames, 1));
+        }
+    }
+
+    std::println("{:<16} {:>10} {:>10} {:>10} {:>10} {:>10} {:>14}", "stage (ns)", "events", "p50", "p90", "p99", "max", "p50 per frame");
+    for (std::size_t stage = 0; stage < cStageCount; stage++)
+    {
+        auto& stageDurations = durations[stage];
+        if (stageDurations.empty())
+        {
+            continue;
+        }
+
+        std::sort(stageDurations.begin(), stageDurations.end());
+        std::sort(perFrame[stage].begin(), perFrame[stage].end());
+        std::println("{:<16} {:>10} {:>10.0f} {:>10.0f} {:>10.0f} {:>10.0f} {:>14.0f}", static_cast<TraceStage>(stage), stageDurations.size(),
+            percentile(stageDurations, 0.5), percentile(stageDurations, 0.9), percentile(stageDurations, 0.99),
+            stageDurations.back(), percentile(perFrame[stage], 0.5));
+    }
+}
+
+// The Trace Event Format, with one complete event per stage, timed in microseconds
+bool writeChromeTrace(const Trace& trace, const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::uint64_t origin{~std::uint64_t{0}};
+    for (const auto& thread : trace.mThreads)
+    {
+        for (const auto& event : thread.mEvents)
+        {
+            origin = std::min(origin, event.mStart);
+        }
+    }
+
+    static constexpr double cNanosPerMicro{1000.0};
+    auto micros = [&](std::uint64_t ticks) { return ticks / trace.mTicksPerNano / cNanosPerMicro; };
+
+    std::print(file, "{{\"traceEvents\":[");
+    bool first{true};
+    for (const auto& thread : trace.mThreads)
+    {
+        for (const auto& event : thread.mEvents)
+        {
+            std::print(file, "{}\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frames\":{}}}}}",
+                first ? "" : ",", event.mStage, thread.mThreadId, micros(event.mStart - origin), micros(event.mEnd - event.mStart), event.mFrames);
+            first = false;
+        }
+    }
+    std::print(file, "\n],\"displayTimeUnit\":\"ns\"}}\n");
+    return std::fclose(file) == 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "tilapia.trace";
+    Trace trace{};
+    if (!readTrace(path, trace))
+    {
+        std::println("Failed to read trace file {}", path);
+        return 1;
+    }
+
+    printPercentiles(trace);
+
+    if (argc > 2 && !writeChromeTrace(trace, argv[2]))
+    {
+        std::println("Failed to write Chrome trace {}", argv[2]);
+        return 1;
+    }
+}